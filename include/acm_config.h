@@ -0,0 +1,138 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _ACM_CONFIG_H_
+#define _ACM_CONFIG_H_
+#include "audio_capture_manager.h"
+#include "acm_thread.h"
+#include <limits.h>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <functional>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+#define ACM_CONFIG_FILE "/opt/audiocapturemgr.conf"
+#define ACM_MAX_SOURCE_CPUS 8
+
+typedef enum
+{
+	DELIVERY_CLIENT_MUSIC_ID = 0,
+	DELIVERY_CLIENT_IP_OUT,
+	DELIVERY_CLIENT_SHM_OUT,
+	DELIVERY_CLIENT_MAX
+}delivery_client_t;
+
+typedef struct
+{
+	bool configured; //Otherwise the client keeps the policy and depth it was built with.
+	audio_capture_client::overflow_policy_t policy;
+	unsigned int max_queue_depth;
+}delivery_settings_t;
+
+typedef struct
+{
+	bool output_conversion; //Convert music id clips. RFC AcmEnableOpConv, unless the file says otherwise.
+	audiocapturemgr::ingest_mode_t ingest_mode;
+	int latency_budget_ms; //Of socket output. Negative to leave the default alone.
+	audiocapturemgr::thread_settings_t threads[audiocapturemgr::THREAD_ROLE_MAX];
+	int source_cpus[ACM_MAX_SOURCE_CPUS]; //Source n runs on source_cpus[n % num_source_cpus] while more than one is open.
+	unsigned int num_source_cpus; //0 to leave sources unpinned.
+	delivery_settings_t delivery[DELIVERY_CLIENT_MAX]; //Of sessions opened afterwards.
+	char capture_backend[PATH_MAX]; //See create_capture_backend(). Empty for the device.
+	bool silence_detection; //Of music id clips. See music_id_client::set_silence_detection().
+	float silence_threshold_db;
+	bool trim_silence;
+	bool fingerprint_output; //Of new music id sessions. See music_id_client::enable_fingerprint_output().
+	bool precapture_compression; //Of music id. See music_id_client::enable_precapture_compression().
+} acm_config_t;
+
+/**
+ *  @brief Settings and feature flags of the daemon, loaded once and cached.
+ *
+ *  RFC flags are read by the first load, at startup, which is the only time a shell is run. The optional file at
+ *  ACM_CONFIG_FILE holds one "key = value" per line, and overrides the RFC:
+ *
+ *      output_conversion = true | false
+ *      ingest_mode = pool | ring
+ *      latency_budget_ms = <milliseconds>
+ *      silence_threshold_db = <dB> | off
+ *      trim_silence = true | false
+ *      fingerprint_output = true | false
+ *      precapture_compression = true | false
+ *      delivery.<music_id | ip_out | shm_out> = drop_oldest | drop_newest | disconnect <max queue depth>
+ *      thread.<role> = other | fifo | rr <priority> [cpu]
+ *      source_cpus = <cpu>[,<cpu>...]
+ *
+ *  Music id clips are only checked for silence once silence_threshold_db is set. A CPU given for a thread role takes
+ *  precedence over source_cpus. Lines starting with # are ignored.
+ *  The file is loaded again whenever it is written, or on request.
+ */
+class acm_config
+{
+	private:
+	std::string m_path;
+	acm_config_t m_config; //needs m_mutex
+	std::mutex m_mutex;
+	std::mutex m_load_mutex; //Keeps reloads in order, so that the listener always ends up with the latest configuration.
+	bool m_rfc_read; //needs m_load_mutex, as does the flag below.
+	bool m_rfc_output_conversion;
+	std::function <void (const acm_config_t &)> m_listener;
+	int m_inotify_fd;
+	int m_event_fd; //Wakes up the watch thread to exit.
+	std::thread m_watch_thread;
+
+	int parse_file(acm_config_t &config);
+	void watch_thread();
+
+	public:
+	acm_config(const std::string &path);
+	~acm_config();
+
+	/**
+	 *  @brief Reads the configuration file, and the RFC the first time, and tells the listener if anything has changed.
+	 *
+	 *  @return 0 on success, -1 if the file exists but could not be read. Defaults are used in that case.
+	 */
+	int load();
+
+	/**
+	 *  @brief Returns a copy of the current configuration. Cheap enough for any code path.
+	 */
+	void get(acm_config_t &config);
+
+	/**
+	 *  @brief Registers a function to be called with the new configuration after each change. Set it before start_watching().
+	 */
+	void set_listener(std::function <void (const acm_config_t &)> listener);
+
+	/**
+	 *  @brief Reloads the configuration whenever the file is written, renamed into place or removed.
+	 */
+	int start_watching();
+	void stop_watching();
+};
+
+/**
+ * @}
+ */
+#endif //_ACM_CONFIG_H_
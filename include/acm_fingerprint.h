@@ -0,0 +1,75 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _ACM_FINGERPRINT_H_
+#define _ACM_FINGERPRINT_H_
+#include <stdint.h>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+/*
+ * Music id clips delivered as fingerprints rather than audio, for sessions that have fingerprint output enabled.
+ *
+ * A fingerprint is an acm_fingerprint_header_t followed by hash_count acm_fingerprint_hash_t records, all little-endian,
+ * in place of the WAV file or PCM that would otherwise be written to the file or the socket.
+ *
+ * The audio is analysed as 16-bit mono at sampling_rate, in frames of fft_size samples that start hop_size samples
+ * apart. Each hash pairs a spectral peak (the anchor) with a later one close to it in time and frequency:
+ *
+ *   bits 31-22  FFT bin of the anchor
+ *   bits 21-12  FFT bin of the other peak
+ *   bits 11-0   frames between the two
+ *
+ * Bin b is at b * sampling_rate / fft_size Hz. Hashes are in order of the anchor's frame, which is counted from the
+ * first frame of the clip, so two fingerprints of the same audio line up at a constant frame offset.
+ */
+
+#define ACM_FINGERPRINT_MAGIC 0x50464341 /* "ACFP" */
+#define ACM_FINGERPRINT_VERSION 1
+
+#define ACM_FINGERPRINT_HASH(anchor_bin, bin, delta) ((((uint32_t)(anchor_bin) & 0x3ff) << 22) | (((uint32_t)(bin) & 0x3ff) << 12) | ((uint32_t)(delta) & 0xfff))
+#define ACM_FINGERPRINT_ANCHOR_BIN(hash) (((hash) >> 22) & 0x3ff)
+#define ACM_FINGERPRINT_BIN(hash) (((hash) >> 12) & 0x3ff)
+#define ACM_FINGERPRINT_DELTA(hash) ((hash) & 0xfff)
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size; /* Hashes start this many bytes in. Later versions may add fields.*/
+	uint64_t timestamp_us; /* CLOCK_MONOTONIC capture time of the first frame of the clip. 0 if unknown.*/
+	uint32_t sampling_rate; /* Hz, of the analysis. Not that of the source.*/
+	uint16_t fft_size;
+	uint16_t hop_size;
+	uint32_t frames; /* Frames the clip spans.*/
+	uint32_t hash_count;
+} acm_fingerprint_header_t;
+
+typedef struct
+{
+	uint32_t hash;
+	uint32_t frame; /* Of the anchor, from the start of the clip.*/
+} acm_fingerprint_hash_t;
+
+/**
+ * @}
+ */
+#endif //_ACM_FINGERPRINT_H_
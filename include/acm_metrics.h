@@ -0,0 +1,126 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _ACM_METRICS_H_
+#define _ACM_METRICS_H_
+#include <atomic>
+#include <ostream>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+class acm_histogram_snapshot;
+
+/**
+ *  @brief Histogram of non-negative values in logarithmic buckets, cheap enough to update once per buffer.
+ *
+ *  Values below 8 get a bucket each. Above that, every power of 2 is split into 8 buckets, so a bucket is never more than
+ *  12.5% wide. Values from 2^32 up are counted in the last bucket.
+ *
+ *  There must be only one writer. Updates are plain relaxed loads and stores, with no locked instructions, and can be
+ *  read from any thread with snapshot(). A snapshot taken during an update may be off by that one update.
+ */
+class acm_histogram
+{
+	public:
+	static const unsigned int SUB_BUCKET_BITS = 3;
+	static const unsigned int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+	static const unsigned int NUM_BUCKETS = (32 - SUB_BUCKET_BITS + 1) * SUB_BUCKETS;
+
+	private:
+	std::atomic <unsigned long long> m_buckets[NUM_BUCKETS];
+	std::atomic <unsigned long long> m_count;
+	std::atomic <unsigned long long> m_sum;
+	std::atomic <unsigned long long> m_max;
+
+	public:
+	acm_histogram();
+
+	static inline unsigned int get_bucket(unsigned long long value)
+	{
+		if(SUB_BUCKETS > value)
+		{
+			return (unsigned int)value;
+		}
+		if(0xFFFFFFFFULL < value)
+		{
+			return NUM_BUCKETS - 1;
+		}
+		unsigned int msb = 63 - __builtin_clzll(value);
+		return ((msb - SUB_BUCKET_BITS + 1) << SUB_BUCKET_BITS) + (unsigned int)((value >> (msb - SUB_BUCKET_BITS)) & (SUB_BUCKETS - 1));
+	}
+
+	/* Smallest and largest values counted in a bucket.*/
+	static unsigned long long get_bucket_floor(unsigned int bucket);
+	static unsigned long long get_bucket_ceiling(unsigned int bucket);
+
+	inline void record(unsigned long long value) //Single writer only.
+	{
+		std::atomic <unsigned long long> &bucket = m_buckets[get_bucket(value)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		m_count.store(m_count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		m_sum.store(m_sum.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+		if(m_max.load(std::memory_order_relaxed) < value)
+		{
+			m_max.store(value, std::memory_order_relaxed);
+		}
+	}
+
+	void snapshot(acm_histogram_snapshot &out) const;
+};
+
+/**
+ *  @brief Copy of an acm_histogram at one point in time, for reporting.
+ */
+class acm_histogram_snapshot
+{
+	public:
+	unsigned long long buckets[acm_histogram::NUM_BUCKETS];
+	unsigned long long count;
+	unsigned long long sum;
+	unsigned long long max;
+
+	acm_histogram_snapshot();
+
+	/**
+	 *  @brief Returns the value that fraction of the samples are at or below, to within a bucket. 0 if there are none.
+	 *
+	 *  @param[in] fraction  0.5 for the median, 0.99 for the 99th percentile and so on.
+	 */
+	unsigned long long get_percentile(double fraction) const;
+	unsigned long long get_mean() const;
+
+	/**
+	 *  @brief Turns this snapshot into what was recorded since earlier, an older snapshot of the same histogram.
+	 *
+	 *  max is left alone, as the histogram doesn't keep it per interval.
+	 */
+	void subtract(const acm_histogram_snapshot &earlier);
+
+	/**
+	 *  @brief Writes count, mean, max and the main percentiles as a JSON object.
+	 */
+	void write_json(std::ostream &os) const;
+};
+
+/**
+ * @}
+ */
+#endif //_ACM_METRICS_H_
@@ -19,7 +19,9 @@
 #include "audio_capture_manager.h"
 #include "music_id.h"
 #include "ip_out.h"
+#include "shm_out.h"
 #include "audiocapturemgr_iarm.h"
+#include "acm_config.h"
 #include <vector>
 #include <list>
 
@@ -44,6 +46,7 @@ class acm_session_mgr
 	std::vector <q_mgr *> m_sources;
 	pthread_mutex_t m_mutex;
 	int m_session_counter;
+	acm_config m_config;
 
 	public:
 	acm_session_mgr();
@@ -181,6 +184,34 @@ class acm_session_mgr
      */
 	int stop_handler(void * arg);
 
+    /**
+     *  @brief This API writes ingest and delivery metrics of all sources and sessions to a JSON file.
+     *
+     *  Covers ingest rate, queue depth, buffer allocator usage, per-session drops, and histograms of delivery latency,
+     *  callback duration and conversion cost.
+     *
+     *  @param[out] arg IARM bus arguments. The path of the file is returned in the output properties.
+     *
+     *  @return Returns 0 on success, appropriate error code otherwise.
+     */
+	int get_metrics_handler(void * arg);
+
+    /**
+     *  @brief Writes the same report as get_metrics_handler() to the log.
+     */
+	void dump_metrics();
+
+    /**
+     *  @brief This API reloads settings from the configuration file. RFC flags are only read at startup.
+     *
+     *  Changes to ingest mode and latency budget apply right away. Output conversion applies to music id sessions opened afterwards.
+     *
+     *  @param[in] arg IARM bus arguments.
+     *
+     *  @return Returns 0 on success, appropriate error code otherwise.
+     */
+	int reload_config_handler(void * arg);
+
     /**
      *  @brief Function to add prefix to the audio filename.
      *
@@ -190,6 +221,9 @@ class acm_session_mgr
 
 	private:
 	q_mgr * get_source(int source);
+	void write_metrics(std::ostream &os);
+	void apply_config(const acm_config_t &config);
+	void update_source_cpus(const acm_config_t &config); //needs lock
 	void lock();
 	void unlock();
 	acm_session_t * get_session(int session_id);
@@ -0,0 +1,176 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _ACM_SHM_RING_H_
+#define _ACM_SHM_RING_H_
+#include <stdint.h>
+#include <string.h>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+/*
+ * Layout of the shared-memory ring used by REALTIME_SHARED_MEMORY sessions.
+ *
+ * Consumers connect to the UNIX socket returned by getOutputProperties and receive one acm_shm_handshake_t, with two
+ * file descriptors attached as SCM_RIGHTS: the memfd holding the ring, and an eventfd of their own. They map map_size
+ * bytes of the memfd read-only, and poll the eventfd, which is signalled each time audio is published. Closing the socket
+ * ends the session.
+ *
+ * The ring has one writer and any number of readers. The writer never waits for readers: a reader that falls more than
+ * capacity bytes behind loses data, and acm_shm_ring_read() tells it so.
+ */
+
+#define ACM_SHM_RING_MAGIC 0x524d4341 /* "ACMR" */
+#define ACM_SHM_RING_VERSION 1
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t data_offset; /* Of the audio data, from the start of the mapping.*/
+	uint32_t capacity; /* Bytes of audio data. A power of 2.*/
+
+	/* Format of the audio from format_position on. Updated under format_sequence, which is odd while an update is in
+	 * progress. Use acm_shm_ring_get_format().*/
+	uint64_t format_sequence;
+	uint64_t format_position;
+	uint32_t sampling_rate; /* Hz*/
+	uint16_t channels;
+	uint16_t bits_per_sample;
+
+	/* Positions count bytes published since the ring was created, so they double as sequence numbers. Audio at
+	 * position p is at data_offset + (p % capacity). The writer moves reserve_position ahead before it overwrites
+	 * anything, and write_position once the new audio is in place.*/
+	uint64_t reserve_position;
+	uint64_t write_position;
+	uint64_t chunks_written;
+
+	/* When the audio at timing_position was captured (CLOCK_MONOTONIC) and its sample index, counted from when capture
+	 * began. Moved to the start of each chunk as it is published, under timing_sequence. Use acm_shm_ring_get_timing().*/
+	uint64_t timing_sequence;
+	uint64_t timing_position;
+	uint64_t timestamp_us;
+	uint64_t sample_index;
+} acm_shm_ring_header_t;
+
+typedef struct
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t map_size; /* Bytes to map from the memfd.*/
+} acm_shm_handshake_t;
+
+/**
+ *  @brief Returns the position of the newest audio in the ring. A reader that wants live audio starts from here.
+ */
+static inline uint64_t acm_shm_ring_get_write_position(const acm_shm_ring_header_t * header)
+{
+	return __atomic_load_n(&header->write_position, __ATOMIC_ACQUIRE);
+}
+
+/**
+ *  @brief Reads the current audio format.
+ *
+ *  @param[out] position  Ring position from which this format applies.
+ */
+static inline void acm_shm_ring_get_format(const acm_shm_ring_header_t * header, uint32_t * sampling_rate, uint16_t * channels,
+		uint16_t * bits_per_sample, uint64_t * position)
+{
+	uint64_t sequence;
+	do
+	{
+		sequence = __atomic_load_n(&header->format_sequence, __ATOMIC_ACQUIRE);
+		*sampling_rate = header->sampling_rate;
+		*channels = header->channels;
+		*bits_per_sample = header->bits_per_sample;
+		*position = header->format_position;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while((0 != (sequence & 1)) || (sequence != __atomic_load_n(&header->format_sequence, __ATOMIC_RELAXED)));
+}
+
+/**
+ *  @brief Reads the capture time and sample index of the audio at *position.
+ *
+ *  Both are taken from the newest chunk and extrapolated at the current data rate, so they are exact for audio published
+ *  since the last discontinuity or format change.
+ */
+static inline void acm_shm_ring_get_timing(const acm_shm_ring_header_t * header, uint64_t position, uint64_t * timestamp_us,
+		uint64_t * sample_index)
+{
+	uint64_t sequence, anchor_position, anchor_timestamp_us, anchor_sample_index;
+	do
+	{
+		sequence = __atomic_load_n(&header->timing_sequence, __ATOMIC_ACQUIRE);
+		anchor_position = header->timing_position;
+		anchor_timestamp_us = header->timestamp_us;
+		anchor_sample_index = header->sample_index;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while((0 != (sequence & 1)) || (sequence != __atomic_load_n(&header->timing_sequence, __ATOMIC_RELAXED)));
+
+	uint32_t sampling_rate;
+	uint16_t channels, bits_per_sample;
+	uint64_t format_position;
+	acm_shm_ring_get_format(header, &sampling_rate, &channels, &bits_per_sample, &format_position);
+	uint32_t frame_size = channels * bits_per_sample / 8;
+	int64_t frames = (0 == frame_size ? 0 : ((int64_t)position - (int64_t)anchor_position) / frame_size);
+	*sample_index = anchor_sample_index + frames;
+	*timestamp_us = anchor_timestamp_us + (0 == sampling_rate ? 0 : frames * 1000000 / (int64_t)sampling_rate);
+}
+
+/**
+ *  @brief Copies up to size bytes of audio from *position on, and advances *position past them.
+ *
+ *  @return Bytes copied, 0 if there is nothing new, or -1 if the audio at *position has already been overwritten. In
+ *  that case nothing is copied, and *position is moved to the newest audio so that the reader can carry on from there.
+ */
+static inline int64_t acm_shm_ring_read(const acm_shm_ring_header_t * header, uint64_t * position, void * dst, uint32_t size)
+{
+	const uint8_t * data = (const uint8_t *)header + header->data_offset;
+	uint32_t capacity = header->capacity;
+	uint64_t write_position = __atomic_load_n(&header->write_position, __ATOMIC_ACQUIRE);
+	if(capacity < (write_position - *position))
+	{
+		*position = write_position;
+		return -1;
+	}
+
+	uint64_t available = write_position - *position;
+	uint32_t count = (available < size ? (uint32_t)available : size);
+	uint32_t offset = (uint32_t)(*position & (capacity - 1));
+	uint32_t first = ((capacity - offset) < count ? (capacity - offset) : count);
+	memcpy(dst, data + offset, first);
+	memcpy((uint8_t *)dst + first, data, count - first);
+
+	/* If the writer started overwriting what was just copied, the copy can't be trusted.*/
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if(capacity < (__atomic_load_n(&header->reserve_position, __ATOMIC_RELAXED) - *position))
+	{
+		*position = __atomic_load_n(&header->write_position, __ATOMIC_ACQUIRE);
+		return -1;
+	}
+	*position += count;
+	return count;
+}
+
+/**
+ * @}
+ */
+#endif //_ACM_SHM_RING_H_
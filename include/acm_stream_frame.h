@@ -0,0 +1,64 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _ACM_STREAM_FRAME_H_
+#define _ACM_STREAM_FRAME_H_
+#include <stdint.h>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+/*
+ * Framing of REALTIME_SOCKET sessions that have ACM_STREAM_FLAG_FRAMED set.
+ *
+ * The socket is then a SOCK_SEQPACKET socket, and each message is one frame: an acm_stream_frame_header_t followed by
+ * payload_size bytes of audio in the format given by the header. A frame always holds whole sample frames.
+ *
+ * Sequence numbers count the buffers captured from the source, including the ones that were dropped before they got
+ * here, so a gap in them is a gap in the audio. ACM_STREAM_FRAME_FLAG_DISCONTINUITY is set on the first frame a reader
+ * gets, and on any frame that doesn't follow on from the previous one, be it because audio was lost on the way or
+ * because the format changed.
+ */
+
+#define ACM_STREAM_FRAME_MAGIC 0x464d4341 /* "ACMF" */
+#define ACM_STREAM_FRAME_VERSION 1
+
+#define ACM_STREAM_FRAME_FLAG_DISCONTINUITY 0x1
+
+typedef struct
+{
+	uint32_t magic;
+	uint16_t version;
+	uint16_t header_size; /* Payload starts this many bytes into the message. Later versions may add fields.*/
+	uint64_t sequence;
+	uint64_t timestamp_us; /* CLOCK_MONOTONIC time at which the captured buffer that this frame was made from began.
+				* Allows for the delay that output conversion adds.*/
+	uint64_t sample_index; /* Of the first sample frame of the payload, counted from when capture began, at the payload's rate.*/
+	uint32_t sampling_rate; /* Hz*/
+	uint16_t channels;
+	uint16_t bits_per_sample;
+	uint32_t flags;
+	uint32_t payload_size;
+} acm_stream_frame_header_t;
+
+/**
+ * @}
+ */
+#endif //_ACM_STREAM_FRAME_H_
@@ -0,0 +1,121 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _ACM_THREAD_H_
+#define _ACM_THREAD_H_
+#include <pthread.h>
+#include <sched.h>
+#include <sys/types.h>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+namespace audiocapturemgr
+{
+	typedef enum
+	{
+		THREAD_ROLE_PROCESSING = 0, //q_mgr: takes buffers from the driver callback and hands them to clients.
+		THREAD_ROLE_DELIVERY,       //One per client: runs data_callback.
+		THREAD_ROLE_MONITOR,        //q_mgr: ingest statistics.
+		THREAD_ROLE_IP_OUT,         //Socket output.
+		THREAD_ROLE_SHM_OUT,        //Shared memory output.
+		THREAD_ROLE_MUSIC_ID,       //Music id request handling.
+		THREAD_ROLE_CLIP,           //Music id clip conversion and writes.
+		THREAD_ROLE_SOCKET_ADAPTOR, //Socket adaptor.
+		THREAD_ROLE_CAPTURE,        //Synthetic capture. The RMF HAL runs its own threads.
+		THREAD_ROLE_MAX
+	}thread_role_t;
+
+	typedef struct
+	{
+		int policy;   //SCHED_OTHER, SCHED_FIFO or SCHED_RR.
+		int priority; //1-99 for SCHED_FIFO and SCHED_RR. Nice value (-20 to 19) for SCHED_OTHER.
+		int cpu;      //Negative to leave affinity alone.
+	}thread_settings_t;
+
+	/**
+	 *  @brief Threads that share a CPU, such as the processing and delivery threads of one source.
+	 *
+	 *  Where a thread runs is decided in one place: the CPU configured for its role if there is one, otherwise the CPU of
+	 *  its group, otherwise anywhere.
+	 */
+	typedef struct
+	{
+		int cpu; //Negative for none. Only change it through set_thread_group_cpu().
+	}thread_group_t;
+
+	const char * get_thread_role_name(thread_role_t role); //As used in the configuration file.
+	thread_role_t get_thread_role(const char * name); //THREAD_ROLE_MAX if there is no such role.
+	const char * get_sched_policy_name(int policy);
+	int get_sched_policy(const char * name); //"other", "fifo" or "rr". -1 if unknown.
+	void get_default_thread_settings(thread_settings_t &settings);
+
+	/**
+	 *  @brief Changes the settings of a role. Threads already running in that role are updated too.
+	 */
+	void set_thread_settings(thread_role_t role, const thread_settings_t &settings);
+	void get_thread_settings(thread_role_t role, thread_settings_t &settings);
+
+	/**
+	 *  @brief Moves the threads of a group to cpu, or lets them run anywhere if cpu is negative. Threads whose role has a
+	 *  CPU configured stay where they are.
+	 *
+	 *  @return true if the CPU of the group changed.
+	 */
+	bool set_thread_group_cpu(thread_group_t &group, int cpu);
+
+	/**
+	 *  @brief Tries the settings of every role that isn't at the default, and logs which ones the process is allowed.
+	 *
+	 *  Real-time policies and negative nice values need CAP_SYS_NICE or a suitable RLIMIT_RTPRIO / RLIMIT_NICE, which a
+	 *  process that has dropped root privileges may not have. Settings that are refused don't stop anything from working;
+	 *  threads just run as they would by default.
+	 *
+	 *  @return Number of roles whose settings were refused.
+	 */
+	int check_thread_settings();
+
+	/**
+	 *  @brief Declared at the top of a thread function. Names the thread and applies the settings of its role, and the CPU
+	 *  of its group if it has one, for as long as the object lives.
+	 */
+	class thread_role_scope
+	{
+		private:
+		thread_role_t m_role;
+		pthread_t m_thread;
+		pid_t m_tid;
+		const thread_group_t * m_group;
+		thread_role_scope * m_next; //List of live threads, for set_thread_settings().
+
+		int get_cpu() const;
+
+		public:
+		thread_role_scope(thread_role_t role, const thread_group_t * group = NULL);
+		~thread_role_scope();
+		friend void set_thread_settings(thread_role_t role, const thread_settings_t &settings);
+		friend bool set_thread_group_cpu(thread_group_t &group, int cpu);
+	};
+}
+
+/**
+ * @}
+ */
+#endif //_ACM_THREAD_H_
@@ -17,29 +17,168 @@
  * limitations under the License.
 */
 
+#ifndef _AUDIO_BUFFER_H_
+#define _AUDIO_BUFFER_H_
+#include <pthread.h>
+#include <vector>
+#include <atomic>
+
 /**
  * @addtogroup AUDIO_CAPTURE_MANAGER_API
  * @{
  */
 
+class audio_buffer_allocator;
 class audio_buffer
 {
 	public:
 		unsigned char * m_start_ptr;
 		unsigned int m_size;
 		unsigned int m_clip_length;
-		unsigned int m_refcount;
+		std::atomic <unsigned int> m_refcount;
+		audio_buffer_allocator * m_allocator; //Allocator that owns the storage. NULL for buffers allocated from the heap.
+		unsigned long long m_sequence; //Ingest order, stamped by q_mgr. Buffers dropped on the way in leave gaps.
+		unsigned long long m_timestamp_us; //CLOCK_MONOTONIC capture time of the first byte. 0 if unknown.
+		unsigned long long m_sample_index; //Frames captured from the source before this buffer.
 
 		audio_buffer(const unsigned char *in_ptr, unsigned int in_size, unsigned int clip_length, unsigned int refcount);
+		audio_buffer(audio_buffer_allocator *allocator, unsigned char *storage);
 		~audio_buffer();
 };
 
+typedef struct
+{
+	unsigned long long hits;
+	unsigned long long misses;
+	unsigned int in_use;
+	unsigned int high_water_mark;
+	unsigned int num_slots;
+	unsigned int slot_size; //0 for allocators that hand out variable-sized buffers.
+	unsigned int capacity_bytes;
+	unsigned int high_water_mark_bytes;
+}audio_buffer_pool_stats_t;
+
+/**
+ *  @brief Base class of the allocators q_mgr takes its audio buffers from.
+ *
+ *  Takes care of locking, statistics, heap fallback and retirement. Derived classes only manage their storage.
+ */
+class audio_buffer_allocator
+{
+	protected:
+		pthread_mutex_t m_mutex;
+		unsigned int m_in_use;
+		unsigned int m_high_water_mark;
+		unsigned long long m_hits;
+		unsigned long long m_misses;
+		bool m_retired;
+
+		audio_buffer_allocator();
+		virtual ~audio_buffer_allocator(); //Use retire() instead.
+
+		/* Called with m_mutex held. take_slot() returns NULL if the request can't be served.*/
+		virtual audio_buffer * take_slot(unsigned int size) = 0;
+		virtual void return_slot(audio_buffer *ptr) = 0;
+		virtual void fill_stats(audio_buffer_pool_stats_t &stats) = 0;
+
+	public:
+		/**
+		 *  @brief Creates a new audio buffer, preferably from storage owned by this allocator.
+		 *
+		 *  Falls back to create_new_audio_buffer() if the allocator is exhausted or the data does not fit.
+		 *
+		 *  @param[in] in_ptr       start_ptr
+		 *  @param[in] in_size      input size
+		 *  @param[in] clip_length  Duration of the audio data
+		 *  @param[in] refcount     reference count of the buffer.
+		 */
+		audio_buffer * allocate(const unsigned char *in_ptr, unsigned int in_size, unsigned int clip_length, unsigned int refcount);
+
+		/**
+		 *  @brief Returns a buffer to the allocator. Only meant to be called by free_audio_buffer() and unref_audio_buffer().
+		 *
+		 *  @param[in] ptr  Buffer allocated from this allocator.
+		 */
+		void release(audio_buffer *ptr);
+
+		/**
+		 *  @brief Stops using the allocator. It is destroyed immediately if no buffers are in use, otherwise when the last one is released.
+		 */
+		void retire();
+
+		/**
+		 *  @brief Returns usage statistics of the allocator.
+		 *
+		 *  @param[out] stats  hits, misses, buffers in use and high-water mark.
+		 */
+		void get_stats(audio_buffer_pool_stats_t &stats);
+};
+
+/**
+ *  @brief Fixed-size slab allocator for audio buffers.
+ *
+ *  All slots (the audio_buffer object along with its payload storage) are carved out of one allocation made
+ *  up front, so the ingest path does not touch the heap as long as a free slot of sufficient size is available.
+ *  Requests that cannot be served from the pool fall back to the heap and are counted as misses.
+ */
+class audio_buffer_pool : public audio_buffer_allocator
+{
+	private:
+		unsigned char * m_slab;
+		std::vector <audio_buffer *> m_slots;
+		std::vector <audio_buffer *> m_free_list;
+		unsigned int m_slot_size;
+		unsigned int m_num_slots;
+
+		virtual ~audio_buffer_pool();
+		virtual audio_buffer * take_slot(unsigned int size);
+		virtual void return_slot(audio_buffer *ptr);
+		virtual void fill_stats(audio_buffer_pool_stats_t &stats);
+
+	public:
+		audio_buffer_pool(unsigned int slot_size, unsigned int num_slots);
+};
+
+/**
+ *  @brief Contiguous ring of audio data that buffers are handed out as views (offset + length) into.
+ *
+ *  Each driver callback is copied exactly once, into the next free stretch of the ring. Space is reclaimed in
+ *  allocation order: a released buffer only gives its space back once every buffer allocated before it has been released
+ *  too, so a client that holds on to buffers for a long time will eventually push the ring onto the heap fallback.
+ */
+class audio_buffer_ring : public audio_buffer_allocator
+{
+	private:
+		unsigned char * m_storage;
+		unsigned int m_capacity;
+		unsigned char * m_descriptor_storage;
+		unsigned int m_num_descriptors;
+		std::vector <unsigned int> m_offsets;
+		std::vector <unsigned int> m_footprints; //Size, plus any bytes skipped at the end of the ring to keep the buffer contiguous.
+		std::vector <bool> m_released;
+		unsigned int m_desc_head; //Next descriptor to be handed out.
+		unsigned int m_desc_tail; //Oldest descriptor still in use.
+		unsigned int m_desc_count; //Descriptors in use, including released ones whose space is still pinned.
+		unsigned int m_write_offset;
+		unsigned int m_bytes_in_use;
+		unsigned int m_bytes_high_water_mark;
+
+		audio_buffer * get_descriptor(unsigned int index);
+		virtual ~audio_buffer_ring();
+		virtual audio_buffer * take_slot(unsigned int size);
+		virtual void return_slot(audio_buffer *ptr);
+		virtual void fill_stats(audio_buffer_pool_stats_t &stats);
+
+	public:
+		audio_buffer_ring(unsigned int capacity, unsigned int max_buffers);
+};
+
 /**
  *  @brief This API creates new audio buffer.
  *
  *  It is used by the Data processor thread.
  *
- *  @param[in] in_ptr       start_ptr
+ *  @param[in] in_ptr       start_ptr. If NULL, the payload is allocated but left uninitialized for the caller to fill in.
  *  @param[in] in_size      input size
  *  @parampin] clip_length  Duration of the audio data
  *  @param[in] refcount     reference count of the buffer.
@@ -49,6 +188,9 @@ audio_buffer * create_new_audio_buffer(const unsigned char *in_ptr, unsigned int
 /**
  *  @brief This API is to release the audio buffer.
  *
+ *  Drops one reference. The client that drops the last one frees the buffer or returns it to its pool.
+ *  Safe to call concurrently from any number of clients.
+ *
  *  @param[in] ptr Indicates the starting address of buffer
  */
 void unref_audio_buffer(audio_buffer *ptr);
@@ -56,23 +198,15 @@ void unref_audio_buffer(audio_buffer *ptr);
 /**
  *  @brief This API is used to update the buffer references.
  *
+ *  Must be called before the buffer is handed to any client.
+ *
  *  @param[in] ptr       Buffer pointer.
  *  @param[in] refcount  Number of clients connected.
  */
-inline void set_ref_audio_buffer(audio_buffer *ptr, unsigned int refcount){ ptr->m_refcount = refcount; } //needs global lock
-
-/**
- *  @brief Function to acquire lock.
- */
-void audio_buffer_get_global_lock();
-
-/**
- *  @brief Function to release lock.
- */
-void audio_buffer_release_global_lock();
+inline void set_ref_audio_buffer(audio_buffer *ptr, unsigned int refcount){ ptr->m_refcount.store(refcount, std::memory_order_release); }
 
 /**
- *  @brief Deletes the audio buffer.
+ *  @brief Deletes the audio buffer, or returns it to its pool if it has one.
  *
  *  @param[in]  ptr Indicates the starting address of buffer to be deleted.
  */
@@ -81,3 +215,4 @@ void free_audio_buffer(audio_buffer *ptr);
 /**
  * @}
  */
+#endif //_AUDIO_BUFFER_H_
@@ -20,13 +20,16 @@
 #define _AUDIO_CAPTURE_MANAGER_H_
 #include <pthread.h>
 #include <vector>
-#include <semaphore.h>
+#include <deque>
 #include <string>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
 #include "audio_buffer.h"
+#include "acm_metrics.h"
+#include "spsc_ring.h"
 #include "basic_types.h"
+#include "acm_thread.h"
 #include "rmf_error.h"
 #include "media-utils/audioCapture/rmfAudioCapture.h"
 
@@ -61,52 +64,131 @@ namespace audiocapturemgr
 		size_t threshold;
 		unsigned int delay_compensation_ms;
 	}audio_properties_t;
+
+	typedef struct
+	{
+		unsigned int occupancy;
+		unsigned int high_water_mark;
+		unsigned int capacity;
+		unsigned long long dropped_buffers;
+	}queue_stats_t;
+
+	typedef struct
+	{
+		unsigned long long timestamp_us; //End of the interval, CLOCK_MONOTONIC.
+		unsigned int bytes_per_second;
+		unsigned int buffers;
+		unsigned int dropped_buffers;
+		unsigned int mean_queue_depth;
+		unsigned int peak_queue_depth; //To within a histogram bucket.
+	}ingest_interval_t;
+
+	typedef struct
+	{
+		unsigned long long bytes; //Since the instance was created, dropped or not.
+		unsigned long long buffers;
+		acm_histogram_snapshot queue_depth; //Sampled as each buffer arrives.
+		std::vector <ingest_interval_t> history; //Oldest first. Only covers time spent capturing.
+	}ingest_metrics_t;
+
+	typedef enum
+	{
+		INGEST_POOL = 0, //Each driver callback is copied into a fixed-size slot of a slab pool.
+		INGEST_RING      //Each driver callback is copied into a large contiguous ring; clients get views into it.
+	}ingest_mode_t;
+
 	void get_individual_audio_parameters(const audio_properties_t &audio_props, unsigned int &sampling_rate, unsigned int &bits_per_sample, unsigned int &num_channels);
 	unsigned int calculate_data_rate(const audio_properties_t &audio_props);
+	unsigned int get_frame_size(const audio_properties_t &audio_props); //Bytes per sample frame, all channels included.
 	std::string get_suffix(unsigned int ticker);
+	unsigned long long get_monotonic_time_us(); //CLOCK_MONOTONIC, the clock capture timestamps are taken from.
+	int set_thread_cpu(pthread_t thread, int cpu); //Pins thread to cpu, or lets it run anywhere if cpu is negative.
 }
 
 class audio_capture_client;
+class capture_backend;
 class q_mgr
 {
 	private:
-		std::vector <audio_buffer *> *m_current_incoming_q;
-		std::vector <audio_buffer *> *m_current_outgoing_q;
+		spsc_ring <audio_buffer *> m_queue; //Driver callback thread is the only producer, data_processor_thread the only consumer.
+		std::vector <audio_buffer *> m_outgoing_batch; //Used by data_processor_thread only.
 		std::vector <audio_capture_client *> m_clients;
 		audiocapturemgr::audio_properties_t m_audio_properties;
 		unsigned int m_bytes_per_second;
-		unsigned int m_inflow_byte_counter; // It's okay if this rolls over.
+		unsigned int m_bytes_per_frame;
+		std::atomic <unsigned long long> m_inflow_byte_counter; //Written by the driver callback thread only.
+		std::atomic <unsigned long long> m_inflow_buffer_counter; //Written by the driver callback thread only.
+		acm_histogram m_queue_depth; //Written by the driver callback thread only.
+		unsigned long long m_ingest_sequence; //Used by the driver callback thread only.
+		unsigned long long m_ingest_sample_index; //Frames captured so far, dropped or not. Used by the driver callback thread only.
 		unsigned int m_num_clients;
-		pthread_mutex_t m_q_mutex;
+		pthread_mutex_t m_q_mutex; //Guards queue limits and the buffer pool against property changes. Never taken by the processing thread.
 		pthread_mutex_t m_client_mutex;
-		sem_t m_sem;
+		int m_event_fd;
+		std::atomic <bool> m_consumer_waiting;
+		std::atomic <unsigned int> m_queue_high_water_mark;
+		std::atomic <unsigned long long> m_dropped_buffers;
+		std::mutex m_drain_mutex;
+		std::condition_variable m_drain_cv;
+		bool m_consumer_idle;
 		pthread_t m_thread;
-		bool m_processing_thread_alive;
-		bool m_notify_new_data;
+		std::atomic <bool> m_processing_thread_alive;
 		bool m_started;
-		RMF_AudioCaptureHandle m_device_handle;
+		capture_backend * m_backend;
 		unsigned int m_max_queue_size;
+		audio_buffer_allocator * m_allocator;
+		audiocapturemgr::ingest_mode_t m_ingest_mode;
+		std::string m_device_type;
+		audiocapturemgr::thread_group_t m_thread_group; //Processing thread, and the delivery threads of all clients.
 
 		std::thread m_data_monitor_thread;
 		std::mutex m_data_monitor_mutex;
 		std::condition_variable m_data_monitor_cv;
 		bool m_stop_data_monitor;
+		std::deque <audiocapturemgr::ingest_interval_t> m_ingest_history; //needs m_data_monitor_mutex
 
 	private:
 		inline void lock(pthread_mutex_t &mutex);
 		inline void unlock(pthread_mutex_t &mutex);
 		inline void notify_data_ready();
-		void swap_queues(); //caller must lock before invoking this.
+		void wait_for_data();
 		void flush_queue(std::vector <audio_buffer *> *q);
 		void flush_system();
 		void process_data();
 		void update_buffer_references();
 		void data_monitor();
+		void rebuild_allocator();
 
 	public:
-		q_mgr();
+		/**
+		 *  @brief Opens a capture device.
+		 *
+		 *  @param[in]  device_type  RMF audio capture type to open, such as RMF_AC_TYPE_AUXILIARY. NULL for the primary device.
+		 */
+		q_mgr(const char * device_type = NULL);
+
+		/**
+		 *  @brief Captures from backend instead, such as a synthetic_capture_backend. Takes ownership of it.
+		 */
+		q_mgr(capture_backend * backend);
 		~q_mgr();
 
+		/**
+		 *  @brief Returns false if the capture device could not be opened.
+		 */
+		bool is_available();
+
+		/**
+		 *  @brief Runs the processing thread, and the delivery threads of all clients, on one CPU.
+		 *
+		 *  Keeps sources apart, so that a busy one can't hold up the others. Clients registered later are placed on the
+		 *  same CPU. A CPU configured for the processing or delivery role takes precedence. See thread_group_t.
+		 *
+		 *  @param[in]  cpu  CPU to run on. Negative to let the scheduler choose.
+		 */
+		void set_cpu_affinity(int cpu);
+		const audiocapturemgr::thread_group_t * get_thread_group();
+
 		/**
 		 *  @brief This API is used to set the audio properties to the client device.
 		 *
@@ -150,6 +232,43 @@ class q_mgr
 		 */
 		unsigned int get_data_rate();
 
+		/**
+		 * @brief Returns statistics of the pool or ring that audio buffers are allocated from.
+		 *
+		 * The allocator is sized from the threshold and FIFO size of the current audio properties and is rebuilt whenever they change.
+		 *
+		 * @param[out] stats  Pool hits, misses and high-water mark.
+		 */
+		void get_buffer_pool_stats(audio_buffer_pool_stats_t &stats);
+
+		/**
+		 * @brief Returns occupancy statistics of the queue between the driver callback and the processing thread.
+		 *
+		 * @param[out] stats  Current occupancy, high-water mark, capacity and number of buffers dropped because the queue was full.
+		 */
+		void get_queue_stats(audiocapturemgr::queue_stats_t &stats);
+
+		/**
+		 * @brief Returns ingest totals, the distribution of queue depth, and ingest rate and queue depth over recent intervals.
+		 *
+		 * @param[out] metrics  Ingest metrics.
+		 */
+		void get_ingest_metrics(audiocapturemgr::ingest_metrics_t &metrics);
+
+		/**
+		 * @brief Selects how driver data is stored before it is fanned out to clients.
+		 *
+		 * In ring mode, the driver payload is copied once into a large pre-allocated ring and clients receive audio_buffers
+		 * that are views into it. Ring space is reclaimed as the clients release their buffers. Buffers in both modes are used
+		 * the same way by clients.
+		 *
+		 * @param[in]  mode  INGEST_POOL or INGEST_RING.
+		 *
+		 * @return 0 on success, appropiate errorcode otherwise.
+		 */
+		int set_ingest_mode(audiocapturemgr::ingest_mode_t mode);
+		audiocapturemgr::ingest_mode_t get_ingest_mode();
+
 		/**
 		 * @brief This API creates new audio buffer and pushes the data to the queue.
 		 *
@@ -218,13 +337,52 @@ class q_mgr
 
 class audio_capture_client
 {
+	public:
+		typedef enum
+		{
+			DROP_OLDEST = 0, //Make room by discarding the oldest queued buffer.
+			DROP_NEWEST,     //Discard the incoming buffer.
+			DISCONNECT       //Discard everything queued and raise AUDIO_DELIVERY_OVERFLOW_EVENT.
+		} overflow_policy_t;
+
+		typedef struct
+		{
+			unsigned long long delivered;
+			unsigned long long dropped;
+			unsigned long long disconnects;
+			unsigned int queue_depth;
+			unsigned int high_water_mark;
+		} delivery_stats_t;
+
+		typedef struct
+		{
+			acm_histogram_snapshot latency_us; //From capture to the start of data_callback().
+			acm_histogram_snapshot callback_us; //Time spent in data_callback().
+			acm_histogram_snapshot conversion_us; //Empty unless the client converts audio.
+		} delivery_metrics_t;
 
 	private:
 		unsigned int m_priority;
 		pthread_mutex_t m_mutex;
 
+		std::deque <audio_buffer *> m_delivery_queue;
+		std::mutex m_delivery_mutex;
+		std::condition_variable m_delivery_cv;
+		std::thread m_delivery_thread;
+		bool m_delivery_thread_alive;
+		bool m_overflow_pending;
+		overflow_policy_t m_overflow_policy;
+		unsigned int m_max_queue_depth;
+		delivery_stats_t m_delivery_stats;
+		acm_histogram m_delivery_latency; //Written by the delivery thread only.
+		acm_histogram m_callback_duration; //Written by the delivery thread only.
+
+		void delivery_thread();
+		void flush_delivery_queue(); //caller must hold m_delivery_mutex.
+
 	protected:
 		q_mgr * m_manager;
+		acm_histogram m_conversion_cost; //Microseconds per buffer. To be written from data_callback() only.
 		void release_buffer(audio_buffer *ptr);
 		void lock();
 		void unlock();
@@ -241,6 +399,50 @@ class audio_capture_client
 		virtual void notify_event(audio_capture_events_t event){}
 		virtual int start();
 		virtual int stop();
+
+		/**
+		 * @brief Queues a buffer for delivery to data_callback() on this client's own delivery thread.
+		 *
+		 * Called by q_mgr's processing thread. Never blocks on the client, so a slow client can't hold up the others.
+		 * Takes over the caller's reference to the buffer.
+		 *
+		 * @param[in]  buf  Buffer to be delivered.
+		 */
+		void enqueue_buffer(audio_buffer *buf);
+
+		/**
+		 * @brief Launches the delivery thread. Invoked by q_mgr when the client is registered.
+		 */
+		void start_delivery(); //needs m_manager's m_client_mutex
+
+		/**
+		 * @brief Stops the delivery thread and releases any buffers still queued. Invoked by q_mgr when the client is unregistered.
+		 *
+		 * Must not be called from within data_callback().
+		 */
+		void stop_delivery();
+
+		/**
+		 * @brief Configures the delivery queue of this client.
+		 *
+		 * @param[in]  policy           What to do when a buffer arrives and the queue is full.
+		 * @param[in]  max_queue_depth  Maximum number of buffers waiting for delivery.
+		 */
+		void set_delivery_policy(overflow_policy_t policy, unsigned int max_queue_depth);
+
+		/**
+		 * @brief Returns delivery and drop counters of this client.
+		 *
+		 * @param[out]  stats  Delivery statistics.
+		 */
+		void get_delivery_stats(delivery_stats_t &stats);
+
+		/**
+		 * @brief Returns histograms of delivery latency, and of the time this client takes to handle each buffer.
+		 *
+		 * @param[out]  metrics  Delivery metrics.
+		 */
+		void get_delivery_metrics(delivery_metrics_t &metrics);
 };
 
 /**
@@ -21,12 +21,26 @@
 
 #include <fstream>
 #include <list>
+#include <vector>
 #include "audio_capture_manager.h"
+#include "audio_kernels.h"
+
+class polyphase_resampler;
 
 class audio_converter_sink
 {
+	private:
+	std::vector <char> m_staging;
+
 	public:
+	virtual ~audio_converter_sink() {}
 	virtual int write_data(const char * ptr, unsigned int size) = 0;
+
+	/* Span interface for converters to write directly into the sink: get_write_span() returns room for size bytes,
+	 * and commit() hands over however many of them were filled. Sinks that can't expose their storage get a
+	 * staging buffer that is passed to write_data() on commit.*/
+	virtual char * get_write_span(unsigned int size);
+	virtual int commit(unsigned int size);
 };
 
 
@@ -39,6 +53,7 @@ class audio_converter
 			DOWNMIX,
 			DOWNSAMPLE,
 			DOWNMIX_AND_DOWNSAMPLE,
+			CHANGE_SAMPLE_SIZE,
 			UNSUPPORTED_CONVERSION,
 		} conversion_ops_t;
 
@@ -47,11 +62,28 @@ class audio_converter
 	const audiocapturemgr::audio_properties_t &m_out_props;
 	bool m_downmix;
 	bool m_downsample;
+	bool m_narrow; //24-bit to 16-bit samples.
 	audio_converter_sink &m_sink;
+	const audio_kernels_t * m_kernels;
+	unsigned int m_in_channels;
+	unsigned int m_out_channels;
+	unsigned int m_in_frame_size;
+	unsigned int m_out_frame_size;
+	unsigned int m_in_rate;
+	unsigned int m_out_rate;
+	unsigned long long m_input_frames; //Whole frames converted since the last reset().
+	unsigned long long m_output_frames; //Frames written since the last reset().
+	polyphase_resampler * m_resampler; //NULL unless the sampling rate changes.
+	std::vector <int16_t> m_scratch;
+	std::vector <int16_t> m_stage; //Format-converted audio waiting to be resampled.
+	unsigned char m_carry[32]; //Start of a frame split across two buffers. Larger than any frame.
+	unsigned int m_carry_size;
+	std::vector <unsigned char> m_bounce;
 
-	//virtual	int write_data(const char * ptr, unsigned int size){}
 	int process_conversion_params();
-	int downsample_and_downmix(const std::list<audio_buffer *> &queue, int size);
+	void convert_format(const unsigned char * src, unsigned int frames, int16_t * dst);
+	int transform(const unsigned char * ptr, unsigned int size);
+	int feed(const unsigned char * ptr, unsigned int size);
 	int passthrough(const std::list<audio_buffer *> &queue, int size);
 
 	protected:
@@ -59,10 +91,36 @@ class audio_converter
 
 	public:
 	audio_converter(const audiocapturemgr::audio_properties_t &in_props,const audiocapturemgr::audio_properties_t &out_props, audio_converter_sink &sink);
-	virtual ~audio_converter() {}
+	virtual ~audio_converter();
 	virtual int convert(const std::list<audio_buffer *> &queue, unsigned int size);
-	void convert(const audio_buffer * buffer) {} //TODO
-	int downmix(const std::list<audio_buffer *> &queue, int size); //public because of the friend declaration 
+
+	/**
+	 *  @brief Converts one buffer of a continuous stream.
+	 *
+	 *  Resampler history and any partial frame at the end of the buffer are carried over to the next call, so feeding
+	 *  a stream buffer by buffer gives the same output as converting it in one go. Call reset() at a discontinuity.
+	 *
+	 *  @param[in] buffer  Next buffer of the stream.
+	 *
+	 *  @return 0 on success, negative if the conversion is unsupported or the sink failed.
+	 */
+	int convert(const audio_buffer * buffer);
+
+	/**
+	 *  @brief Drops all state carried over from earlier calls to convert(buffer).
+	 */
+	void reset();
+
+	/**
+	 *  @brief Returns when the first frame that convert(buffer) is about to write was captured, and its sample index.
+	 *
+	 *  Based on the timestamp and sample index of buffer, which must be the next buffer of the stream. Allows for audio
+	 *  still held back from earlier buffers, and for the delay of the resampling filter. The sample index is counted at
+	 *  the output rate.
+	 */
+	void get_output_position(const audio_buffer * buffer, unsigned long long &timestamp_us, unsigned long long &sample_index) const;
+
+	inline bool is_supported() const { return (UNSUPPORTED_CONVERSION != m_op); }
 };
 
 class audio_converter_file_sink : public audio_converter_sink 
@@ -83,17 +141,16 @@ class audio_converter_memory_sink : public audio_converter_sink
 	private:
 	char * m_buffer;
 	unsigned int m_write_offset;
+	unsigned int m_max_size;
 
 	public:
 	audio_converter_memory_sink(unsigned int max_size);
 	virtual ~audio_converter_memory_sink();
 	virtual int write_data(const char * ptr, unsigned int size) override;
+	virtual char * get_write_span(unsigned int size) override;
+	virtual int commit(unsigned int size) override;
 	inline char * get_buffer() { return m_buffer; }
 	inline unsigned int get_size() { return m_write_offset; }
-	
-	/* Direct access provided to downmix method in order to make optimizations
-	 * that bypass the write method possible. */
-	friend int audio_converter::downmix(const std::list<audio_buffer *> &queue, int size); 
 };
 
 #endif //_AUDIO_CONVERTER_H_
@@ -0,0 +1,87 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _AUDIO_KERNELS_H_
+#define _AUDIO_KERNELS_H_
+#include <stdint.h>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+typedef enum
+{
+	KERNEL_ISA_SCALAR = 0,
+	KERNEL_ISA_SSE2,
+	KERNEL_ISA_AVX2,
+	KERNEL_ISA_NEON,
+	KERNEL_ISA_MAX
+} kernel_isa_t;
+
+/**
+ *  @brief Sample format conversion kernels used by audio_converter, level measurement used by loudness_analyzer and
+ *  spectral analysis used by fingerprinter.
+ *
+ *  All kernels work on little-endian PCM, write exactly the number of output samples asked for and
+ *  may not be used in place. Downmixing keeps the first (left) channel, which is what the converter has always done.
+ */
+typedef struct
+{
+	kernel_isa_t isa;
+	const char * name;
+
+	/* dst[i] = src[2 * i]: 16-bit stereo to 16-bit mono.*/
+	void (*stereo_to_mono_s16)(const int16_t * src, int16_t * dst, unsigned int frames);
+
+	/* Packed 24-bit samples to 16-bit, keeping the 16 most significant bits.*/
+	void (*s24_to_s16)(const uint8_t * src, int16_t * dst, unsigned int samples);
+
+	/* Keeps every ratio-th frame of 16-bit audio with the given channel count. If first_channel_only is set, only
+	 * the first channel of each kept frame is written.*/
+	void (*decimate_s16)(const int16_t * src, int16_t * dst, unsigned int out_frames, unsigned int channels, bool first_channel_only, unsigned int ratio);
+
+	/* Adds the squares of 16-bit samples to sum_squares, and raises peak to the largest magnitude among them.*/
+	void (*energy_s16)(const int16_t * src, unsigned int samples, uint64_t * sum_squares, unsigned int * peak);
+
+	/* dst[i] = src[i] * window[i], as float.*/
+	void (*window_s16)(const int16_t * src, const float * window, float * dst, unsigned int samples);
+
+	/* count radix-2 butterflies on split complex data: t = b * w, then b = a - t and a = a + t.*/
+	void (*butterfly_f32)(float * a_re, float * a_im, float * b_re, float * b_im, const float * w_re, const float * w_im, unsigned int count);
+
+	/* dst[i] = re[i] * re[i] + im[i] * im[i].*/
+	void (*power_f32)(const float * re, const float * im, float * dst, unsigned int count);
+} audio_kernels_t;
+
+/**
+ *  @brief Returns the fastest set of kernels that this CPU supports. Chosen once, on first use.
+ */
+const audio_kernels_t * get_audio_kernels();
+
+/**
+ *  @brief Returns the kernels for a specific instruction set, or NULL if this build or this CPU doesn't support it.
+ *
+ *  Meant for benchmarking and testing one implementation against another.
+ */
+const audio_kernels_t * get_audio_kernels(kernel_isa_t isa);
+
+/**
+ * @}
+ */
+#endif //_AUDIO_KERNELS_H_
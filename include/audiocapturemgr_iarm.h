@@ -40,6 +40,8 @@
 #define IARMBUS_AUDIOCAPTUREMGR_GET_OUTPUT_PROPS "getOutputProperties"
 #define IARMBUS_AUDIOCAPTUREMGR_SET_AUDIO_PROPERTIES "setAudioProperties"
 #define IARMBUS_AUDIOCAPTUREMGR_SET_OUTPUT_PROPERTIES "setOutputProperties"
+#define IARMBUS_AUDIOCAPTUREMGR_RELOAD_CONFIG "reloadConfig" //!< Reloads /opt/audiocapturemgr.conf. RFC flags are read once, at startup. No session needed.
+#define IARMBUS_AUDIOCAPTUREMGR_GET_METRICS "getMetrics" //!< Writes a JSON report of ingest and delivery metrics, and returns its path in arg_output_props.output.file_path. No session needed.
 
 /*End API list*/
 
@@ -55,6 +57,7 @@ namespace audiocapturemgr
 	{
 		BUFFERED_FILE_OUTPUT = 0,
 		REALTIME_SOCKET,
+		REALTIME_SHARED_MEMORY, //!< Audio in a shared-memory ring. See acm_shm_ring.h.
 		MAX_SUPPORTED_OUTPUT_TYPES
 	}iarmbus_output_type_t;
 
@@ -62,6 +65,7 @@ namespace audiocapturemgr
 	typedef enum
 	{
 		DATA_CAPTURE_IARM_EVENT_AUDIO_CLIP_READY = 0,
+		DATA_CAPTURE_IARM_EVENT_AUDIO_CLIP_FAILED, //!< A fresh sample request ended without a clip. Carries iarmbus_clip_failed_payload_t.
 		IARMBUS_MAX_ACM_EVENT
 	}iarmbus_events_t;
 
@@ -74,6 +78,7 @@ namespace audiocapturemgr
 		ACM_RESULT_BAD_SESSION_ID,
 		ACM_RESULT_INVALID_ARGUMENTS,
 		ACM_RESULT_GENERAL_FAILURE,
+		ACM_RESULT_CLIP_SILENT, //!< The requested audio was silent, so no clip was made.
 		ACM_RESULT_PRECAPTURE_DURATION_TOO_LONG = 254,
 		ACM_RESULT_PRECAPTURE_NOT_SUPPORTED = 255
 	}iarmbus_audiocapturemgr_result_t;
@@ -132,20 +137,35 @@ namespace audiocapturemgr
 		char dataLocator[64];
 	}iarmbus_notification_payload_t;
 
+	typedef struct
+	{
+		char dataLocator[64]; //!< Where the clip would have been delivered.
+		unsigned int result; //!< ACM_RESULT_CLIP_SILENT, or ACM_RESULT_GENERAL_FAILURE.
+	}iarmbus_clip_failed_payload_t;
+
 	#define MAX_OUTPUT_PATH_LEN 256
+	#define ACM_STREAM_FLAG_FRAMED 0x1 //!< One frame per buffer over SOCK_SEQPACKET, as in acm_stream_frame.h. Changes the socket path.
+	#define ACM_STREAM_FLAG_SET_FORMAT 0x2 //!< Apply format and sampling_frequency. Without it, both are ignored.
+	#define ACM_STREAM_FLAG_SET_FRAMING 0x4 //!< Apply ACM_STREAM_FLAG_FRAMED. Without it, framing is left as it is.
 	typedef struct
 	{
 		union
 		{
-			char file_path[MAX_OUTPUT_PATH_LEN]; //!< get unix domain socket name (ip out) 
+			char file_path[MAX_OUTPUT_PATH_LEN]; //!< get unix domain socket name (ip out, shared memory) 
 			unsigned int buffer_duration; //!< set precapture duration (music id)
 			unsigned int max_buffer_duration; //!< get max supported buffer duration (music id)
+			struct
+			{
+				iarmbus_acm_format format; //!< acmFormateMax sends the captured format unconverted. Needs ACM_STREAM_FLAG_SET_FORMAT.
+				iarmbus_acm_freq sampling_frequency;
+				unsigned int flags; //!< ACM_STREAM_FLAG_* values.
+			}stream_format; //!< set format, sampling rate and framing of the socket stream (ip out)
 		}output;
 	}iarmbus_delivery_props_t;
 
 	typedef struct
 	{
-		int source;//!< 0 for primary, increasing by 1 for each new source.
+		int source;//!< 0 for primary, increasing by 1 for each new source. 1 is auxiliary audio, where the platform supports it.
 		iarmbus_output_type_t output_type;
 	}iarmbus_open_args;
 
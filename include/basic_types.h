@@ -45,7 +45,8 @@
 
 typedef enum
 {
-	AUDIO_SETTINGS_CHANGE_EVENT = 0
+	AUDIO_SETTINGS_CHANGE_EVENT = 0,
+	AUDIO_DELIVERY_OVERFLOW_EVENT //Client's delivery queue overflowed under the DISCONNECT policy.
 }audio_capture_events_t;
 
 #endif // __BASIC_TYPES_H__
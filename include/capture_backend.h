@@ -0,0 +1,173 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _CAPTURE_BACKEND_H_
+#define _CAPTURE_BACKEND_H_
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <stdint.h>
+#include "audio_capture_manager.h"
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+/**
+ *  @brief Where q_mgr gets its audio from.
+ *
+ *  Once started, a backend calls the data callback from a thread of its own with about threshold bytes of audio at a
+ *  time, in the format asked for, until it is stopped. The callback must not block for long.
+ */
+class capture_backend
+{
+	public:
+	typedef rmf_Error (*data_callback_t)(void *context, void *buf, unsigned int size);
+
+	virtual ~capture_backend() {}
+	virtual const char * get_name() = 0; //For logs, such as "primary" or "tone".
+	virtual bool is_open() = 0;
+	virtual void get_default_properties(audiocapturemgr::audio_properties_t &properties) = 0;
+	virtual int start(const audiocapturemgr::audio_properties_t &properties, data_callback_t callback, void * context) = 0;
+	virtual int stop() = 0;
+};
+
+/**
+ *  @brief Capture from the device through the RMF audio capture HAL. Only built with --enable-rmfcapture, the default.
+ */
+class rmf_capture_backend : public capture_backend
+{
+	private:
+	RMF_AudioCaptureHandle m_device_handle;
+	std::string m_name;
+
+	public:
+	/**
+	 *  @param[in]  device_type  RMF audio capture type to open, such as RMF_AC_TYPE_AUXILIARY. NULL for the primary device.
+	 */
+	rmf_capture_backend(const char * device_type);
+	virtual ~rmf_capture_backend();
+	virtual const char * get_name() {return m_name.c_str();}
+	virtual bool is_open() {return (NULL != m_device_handle);}
+	virtual void get_default_properties(audiocapturemgr::audio_properties_t &properties);
+	virtual int start(const audiocapturemgr::audio_properties_t &properties, data_callback_t callback, void * context);
+	virtual int stop();
+};
+
+typedef enum
+{
+	SYNTHETIC_SILENCE = 0,
+	SYNTHETIC_TONE,
+	SYNTHETIC_NOISE,
+	SYNTHETIC_WAV  //Loops a PCM WAV file.
+}synthetic_signal_t;
+
+typedef struct
+{
+	synthetic_signal_t signal;
+	double frequency_hz; //Tone only.
+	double level;        //Peak of tone and noise, as a fraction of full scale.
+	std::string wav_path;
+	bool realtime;       //Paced like a device. Otherwise each callback follows the last as soon as it returns.
+	unsigned long long max_frames; //Stops delivering after this many frames. 0 for no limit.
+}synthetic_capture_config_t;
+
+typedef struct
+{
+	unsigned long long callbacks;
+	unsigned long long frames;
+	unsigned long long dropped_frames; //Realtime only: frames that would have overflowed the FIFO while the callback was late.
+	bool finished; //max_frames have been delivered.
+}synthetic_capture_stats_t;
+
+/**
+ *  @brief Capture without hardware: a tone, noise, silence or a WAV file, for tests and benchmarks off the box.
+ *
+ *  A loop of the signal is rendered in the requested format when capture starts, so producing audio costs no more than
+ *  a copy. A WAV file is resampled and remapped to the requested rate and channels. Tones are rounded to a whole number
+ *  of cycles per second so that the loop is seamless.
+ *
+ *  Callbacks carry threshold bytes each. In realtime mode they are paced by CLOCK_MONOTONIC. If the callback falls
+ *  further behind than fifo_size bytes, the audio that a device FIFO would have lost is skipped and counted.
+ */
+class synthetic_capture_backend : public capture_backend
+{
+	private:
+	synthetic_capture_config_t m_config;
+	std::string m_name;
+	std::vector <int32_t> m_wav_samples; //Interleaved, scaled to 24 bits.
+	unsigned int m_wav_rate;
+	unsigned int m_wav_channels;
+	bool m_open;
+
+	std::vector <uint8_t> m_loop; //One loop of the signal in the output format.
+	std::vector <uint8_t> m_chunk;
+	data_callback_t m_callback;
+	void * m_callback_context;
+	audiocapturemgr::audio_properties_t m_properties;
+
+	std::thread m_thread;
+	std::mutex m_mutex;
+	std::condition_variable m_cv;
+	bool m_stop; //needs m_mutex
+	std::atomic <unsigned long long> m_callbacks;
+	std::atomic <unsigned long long> m_frames;
+	std::atomic <unsigned long long> m_dropped_frames;
+	std::atomic <bool> m_finished;
+
+	int load_wav();
+	void render_loop(unsigned int sampling_rate, unsigned int bits_per_sample, unsigned int num_channels);
+	void worker_thread();
+
+	public:
+	synthetic_capture_backend(const synthetic_capture_config_t &config);
+	virtual ~synthetic_capture_backend();
+	virtual const char * get_name() {return m_name.c_str();}
+	virtual bool is_open() {return m_open;}
+	virtual void get_default_properties(audiocapturemgr::audio_properties_t &properties);
+	virtual int start(const audiocapturemgr::audio_properties_t &properties, data_callback_t callback, void * context);
+	virtual int stop();
+	void get_stats(synthetic_capture_stats_t &stats);
+};
+
+/**
+ *  @brief Creates a backend from a description, as found in the configuration file.
+ *
+ *      rmf                       The capture device. Default.
+ *      tone[:<Hz>[:<level>]]     A sine wave. 1000Hz at half of full scale by default.
+ *      noise[:<level>]           White noise.
+ *      silence
+ *      wav:<path>                A PCM WAV file, looped.
+ *
+ *  Anything but rmf may end in ",fast" to deliver audio as fast as it is taken instead of in real time.
+ *
+ *  @param[in]  spec         Description of the backend. NULL or empty for rmf.
+ *  @param[in]  device_type  RMF audio capture type, for rmf. NULL for the primary device.
+ *
+ *  @return The backend, or NULL if spec can't be parsed or names something this build doesn't have.
+ */
+capture_backend * create_capture_backend(const char * spec, const char * device_type);
+
+/**
+ * @}
+ */
+#endif //_CAPTURE_BACKEND_H_
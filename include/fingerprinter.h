@@ -0,0 +1,138 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _FINGERPRINTER_H_
+#define _FINGERPRINTER_H_
+#include <vector>
+#include <deque>
+#include <stdint.h>
+#include "audio_capture_manager.h"
+#include "audio_converter.h"
+#include "audio_kernels.h"
+#include "acm_fingerprint.h"
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+/**
+ *  @brief Picks spectral peaks out of a stream as it goes by, so that a stretch of it can be handed out as a fingerprint
+ *  (see acm_fingerprint.h) instead of as audio.
+ *
+ *  Audio is converted to 16kHz mono and cut into Hann-windowed frames of FINGERPRINT_FFT_SIZE samples, every
+ *  FINGERPRINT_HOP_SIZE samples. In each frame, the strongest bin of each of a few bands between 250Hz and 6kHz is a
+ *  peak if it stands out from the rest of the spectrum, and from the same band in the frames around it. Only peaks are
+ *  kept. Pairing them into hashes is left until a fingerprint is asked for, which costs little next to the transforms.
+ *
+ *  Positions are whatever the caller counts bytes of the stream in, as with loudness_analyzer. Audio handed in out of
+ *  sequence starts the analysis over. Not thread-safe; the owner locks around it.
+ */
+class fingerprinter : private audio_converter_sink
+{
+	public:
+	static const unsigned int FINGERPRINT_SAMPLING_RATE = 16000;
+	static const unsigned int FINGERPRINT_FFT_SIZE = 1024;
+	static const unsigned int FINGERPRINT_HOP_SIZE = 512;
+	static const unsigned int FINGERPRINT_BANDS = 6;
+
+	private:
+	typedef struct
+	{
+		unsigned long long frame;
+		unsigned int bin;
+	} peak_t;
+
+	typedef struct
+	{
+		float power[FINGERPRINT_BANDS]; //Of the strongest bin of each band.
+		unsigned int bin[FINGERPRINT_BANDS];
+		bool candidate[FINGERPRINT_BANDS]; //Stands out from the rest of its frame.
+	} frame_bands_t;
+
+	audiocapturemgr::audio_properties_t m_in_props; //The converter keeps references to these two.
+	audiocapturemgr::audio_properties_t m_analysis_props;
+	audio_converter * m_converter; //NULL if the input format can't be analysed.
+	const audio_kernels_t * m_kernels;
+	unsigned int m_in_frame_size;
+	unsigned int m_in_rate;
+	unsigned int m_history_frames;
+	float m_min_peak_power; //Peaks quieter than this are ignored.
+
+	unsigned long long m_base_position; //Stream position of the first sample analysed.
+	unsigned long long m_next_position; //Expected position of the next add().
+	unsigned long long m_frames; //Frames analysed.
+	std::vector <int16_t> m_pending; //Converted samples not yet analysed. Fewer than a frame, plus what the converter just wrote.
+
+	std::vector <float> m_window;
+	std::vector <unsigned short> m_bit_reverse;
+	std::vector <float> m_twiddle_re; //Of every FFT stage, one after the other.
+	std::vector <float> m_twiddle_im;
+	std::vector <float> m_windowed;
+	std::vector <float> m_re;
+	std::vector <float> m_im;
+	std::vector <float> m_power;
+
+	std::vector <frame_bands_t> m_recent; //Ring of the last few frames, for the comparison in time.
+	std::deque <peak_t> m_peaks; //Oldest first.
+
+	virtual int write_data(const char * ptr, unsigned int size) override;
+	void analyse_frame(const int16_t * samples);
+	void pick_peaks(unsigned long long frame);
+	unsigned long long position_to_sample(unsigned long long position) const;
+	unsigned long long sample_to_position(unsigned long long sample) const;
+
+	public:
+	fingerprinter();
+	virtual ~fingerprinter();
+
+	/**
+	 *  @brief Sets the format of the audio to come and how many seconds of peaks to keep. Forgets all peaks.
+	 *
+	 *  @return false if audio in this format can't be converted for analysis. add() then does nothing.
+	 */
+	bool configure(const audiocapturemgr::audio_properties_t &properties, unsigned int history_seconds);
+	void reset();
+
+	/**
+	 *  @brief Analyses a buffer of audio that starts at the given stream position.
+	 */
+	void add(const audio_buffer * buffer, unsigned long long position);
+
+	/**
+	 *  @brief Pairs up the peaks found between two stream positions into a fingerprint.
+	 *
+	 *  Only frames that lie wholly within the stretch count, and of those, only the ones that are still kept and whose
+	 *  peaks are settled, which takes a few frames. A peak is paired with up to a few of the peaks that follow it within
+	 *  about a second, so the same audio gives the same hashes, bar those of peaks paired past the end of the stretch.
+	 *
+	 *  @param[in]  start, end      Stream positions.
+	 *  @param[out] header          Filled in, except for timestamp_us.
+	 *  @param[out] hashes          In order of the anchor's frame.
+	 *  @param[out] first_position  Stream position of the first frame.
+	 *
+	 *  @return false if none of the stretch has been analysed, which is the case before configure() or when it is too old.
+	 */
+	bool get_fingerprint(unsigned long long start, unsigned long long end, acm_fingerprint_header_t &header,
+			std::vector <acm_fingerprint_hash_t> &hashes, unsigned long long &first_position) const;
+};
+
+/**
+ * @}
+ */
+#endif //_FINGERPRINTER_H_
@@ -19,11 +19,55 @@
 #ifndef _IP_OUT_H_
 #define _IP_OUT_H_
 #include "audio_capture_manager.h"
+#include "audio_converter.h"
+#include "acm_stream_frame.h"
 #include <iostream>
 #include <list>
 #include <map>
 #include <fstream>
 #include <string>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+typedef struct
+{
+	unsigned int id;
+	unsigned long long bytes_sent;
+	unsigned long long bytes_dropped; //Discarded because the reader was too far behind.
+	unsigned long long chunks_dropped;
+	unsigned long long writes; //System calls that sent data. Lower than chunks sent when batching is effective.
+	unsigned int queued_bytes;
+	unsigned int queue_high_water_mark;
+	unsigned int latency_us; //From capture to the socket, of the latest chunk.
+	unsigned int max_latency_us;
+} ip_out_connection_stats_t;
+
+typedef struct
+{
+	unsigned int active_connections;
+	unsigned long long accepted;
+	unsigned long long rejected; //Turned away because MAX_CONNECTIONS readers were already connected.
+	unsigned long long stalled; //Disconnected because they stopped reading altogether.
+} ip_out_stats_t;
+
+class ip_out_client;
+
+/* Hands converter output to every connected reader, or collects it into a frame.*/
+class ip_out_fanout_sink : public audio_converter_sink
+{
+	private:
+	ip_out_client &m_client;
+	std::vector <char> * m_collector;
+	unsigned long long m_fan_out_us; //Spent handing output to the readers, which isn't part of the cost of conversion.
+
+	public:
+	ip_out_fanout_sink(ip_out_client &client) : m_client(client), m_collector(NULL), m_fan_out_us(0) {}
+	virtual ~ip_out_fanout_sink() {}
+	virtual int write_data(const char * ptr, unsigned int size) override;
+	void collect(std::vector <char> * frame) {m_collector = frame;} //NULL goes back to sending.
+	unsigned long long take_fan_out_time() {unsigned long long elapsed = m_fan_out_us; m_fan_out_us = 0; return elapsed;}
+};
 
 class ip_out_client : public audio_capture_client
 {
@@ -35,23 +79,112 @@ class ip_out_client : public audio_capture_client
 	} control_code_t;
 
 	private:
+	typedef struct
+	{
+		int fd;
+		std::vector <char> queue; //Circular send queue, holding what the socket wouldn't take yet.
+		unsigned int queue_head;
+		unsigned int queue_fill;
+		bool waiting_for_output; //EPOLLOUT is armed.
+		bool discontinuity; //The next frame doesn't follow on from the last one this reader got.
+		unsigned long long dequeued; //Bytes taken off the queue so far.
+		std::deque <std::pair <unsigned long long, unsigned long long> > queued_chunks; //Queue position and capture time of each chunk still queued.
+		std::chrono::steady_clock::time_point last_progress;
+		ip_out_connection_stats_t stats;
+	} connection_t;
+
 	std::string m_data_path;
 	int m_listen_fd;
-	int m_write_fd;
+	int m_epoll_fd;
+	int m_timer_fd;
 	int m_control_pipe[2];
-	unsigned int m_num_connections;
+	std::map <int, connection_t *> m_connections;
+	unsigned int m_connection_counter;
+	ip_out_stats_t m_stats;
+	unsigned int m_latency_budget_ms;
+	bool m_batch_pending; //Data has been queued since the last flush.
+	std::chrono::steady_clock::time_point m_batch_start;
+	unsigned int m_stream_data_rate; //Bytes per second sent to each reader.
+	bool m_framed;
+	acm_stream_frame_header_t m_frame_header; //Describes the buffer being delivered. Copied into each frame.
+	std::vector <char> m_frame_payload; //Converter output for the buffer being delivered, in framed mode.
+	unsigned int m_largest_frame;
 	pthread_t m_thread;
+	bool m_convert_output;
+	audiocapturemgr::audio_properties_t m_input_properties; //What m_converter was built for.
+	audiocapturemgr::audio_properties_t m_output_properties;
+	ip_out_fanout_sink m_sink;
+	audio_converter * m_converter;
 
-	void process_new_connection();
+	void process_new_connections();
+	void process_connection_event(int fd, unsigned int events);
+	void close_connection(connection_t * connection);
+	int flush(connection_t * connection);
+	int flush_frames(connection_t * connection);
+	void set_waiting_for_output(connection_t * connection, bool waiting);
+	void enqueue(connection_t * connection, const char * ptr, unsigned int size);
+	void dequeue(connection_t * connection, unsigned int size);
+	void record_latency(connection_t * connection, unsigned long long timestamp_us);
+	void flush_all();
+	void arm_batch_timer(unsigned int delay_ms);
+	void size_socket_buffer(int fd);
+	void update_stream_data_rate();
+	void rebuild_converter();
 
 	public:
 	ip_out_client(q_mgr * manager);
 	~ip_out_client();
 	virtual int data_callback(audio_buffer *buf);
+	virtual void notify_event(audio_capture_events_t event);
 	virtual std::string get_data_path();
 	virtual std::string open_output();
 	virtual void close_output();
 	void worker_thread();
+
+	/**
+	 *  @brief Sends data to every connected reader without blocking. Must be called with the client lock held.
+	 *
+	 *  A reader that can't take the data right away lags behind by up to its send queue. Beyond that it loses whole
+	 *  chunks, and if it stops reading altogether it is disconnected. Other readers are not affected either way.
+	 *
+	 *  In framed mode, each call goes out as one frame, stamped with the sequence number and capture time of the buffer
+	 *  being delivered.
+	 */
+	int fan_out(const char * ptr, unsigned int size);
+
+	/**
+	 *  @brief Switches between a plain byte stream and one frame per buffer, as described in acm_stream_frame.h.
+	 *
+	 *  The two use different socket types, so switching disconnects all readers and moves the socket to a new path.
+	 */
+	void set_framed_output(bool isEnabled);
+
+	/**
+	 *  @brief Sets how long audio may wait to be batched with later audio before it is sent.
+	 *
+	 *  Audio that arrives within the budget goes out in one writev() per reader. 0 sends each buffer as it arrives.
+	 */
+	void set_latency_budget(unsigned int budget_ms);
+
+	/**
+	 *  @brief Returns session totals and counters of each connected reader.
+	 */
+	void get_stats(ip_out_stats_t &totals, std::vector <ip_out_connection_stats_t> &connections);
+	/**
+	 *  @brief Sets the format and sampling rate that the socket carries when output conversion is enabled.
+	 *
+	 *  @param[in] properties  Only format and sampling_frequency are used.
+	 *
+	 *  @return 0 on success, -1 if the current input can't be converted to it.
+	 */
+	int set_output_properties(const audiocapturemgr::audio_properties_t &properties);
+
+	/**
+	 *  @brief Converts each buffer to the output properties as it is delivered, instead of sending the input as is.
+	 *
+	 *  Conversion is streaming and shared by all readers. A reader that connects later joins the stream where it is.
+	 */
+	void enable_output_conversion(bool isEnabled);
 };
 
 #endif //_IP_OUT_H_
@@ -0,0 +1,121 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _LOUDNESS_ANALYZER_H_
+#define _LOUDNESS_ANALYZER_H_
+#include <vector>
+#include <stdint.h>
+#include "audio_capture_manager.h"
+#include "audio_kernels.h"
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+#define LOUDNESS_FLOOR_DB (-120.0f) //Reported for digital silence.
+
+typedef struct
+{
+	unsigned long long position; //Stream position, in bytes, of the first frame covered.
+	unsigned int size;           //Bytes covered. One second of audio, except for the one still being measured.
+	unsigned long long timestamp_us; //Capture time of the first frame. 0 if unknown.
+	float level_db;              //Mean square of all samples, relative to a full-scale square wave.
+	float peak_db;               //Largest sample magnitude, relative to full scale.
+} loudness_summary_t;
+
+typedef struct
+{
+	float level_db;     //Over the whole window.
+	float max_level_db; //Of the loudest second.
+	float peak_db;
+	unsigned long long loud_start; //Stream positions of the first and last seconds at or above the threshold passed in.
+	unsigned long long loud_end;   //Equal to loud_start if there are none.
+} loudness_window_t;
+
+/**
+ *  @brief Keeps per-second loudness of a stream as it goes by, so that a stretch of it can be judged without looking
+ *  at the audio again.
+ *
+ *  Each buffer costs one pass of energy_s16 over its samples, plus constant bookkeeping. 24-bit audio is narrowed to
+ *  16 bits first, which is plenty for a level meter. The level is unweighted: there is no K-weighting filter as in
+ *  ITU-R BS.1770, so it reads like LUFS only for broadband content, but it is fine for telling silence from programme.
+ *
+ *  Positions are whatever the caller counts bytes of the stream in, such as a ring write position. Audio handed in
+ *  out of sequence closes the second being measured early. Not thread-safe; the owner locks around it.
+ */
+class loudness_analyzer
+{
+	private:
+	std::vector <loudness_summary_t> m_history; //Ring of completed seconds.
+	unsigned int m_history_start; //Index of the oldest.
+	unsigned int m_history_count;
+	unsigned int m_frame_size;
+	unsigned int m_interval_size; //Bytes in a second.
+	bool m_narrow; //24-bit input.
+	const audio_kernels_t * m_kernels;
+
+	/* The second being measured.*/
+	unsigned long long m_position;
+	unsigned int m_size;
+	unsigned long long m_timestamp_us;
+	uint64_t m_sum_squares;
+	unsigned long long m_samples;
+	unsigned int m_peak;
+
+	void measure(const unsigned char * ptr, unsigned int size);
+	void close_interval();
+	void fill_summary(loudness_summary_t &summary, uint64_t sum_squares, unsigned long long samples, unsigned int peak) const;
+
+	public:
+	loudness_analyzer();
+
+	/**
+	 *  @brief Sets the format of the audio to come and how many seconds of history to keep. Forgets all history.
+	 */
+	void configure(const audiocapturemgr::audio_properties_t &properties, unsigned int history_seconds);
+	void reset();
+
+	/**
+	 *  @brief Measures audio that starts at the given stream position.
+	 *
+	 *  @param[in] timestamp_us  Capture time of the first frame, or 0.
+	 */
+	void add(const unsigned char * ptr, unsigned int size, unsigned long long position, unsigned long long timestamp_us);
+
+	/**
+	 *  @brief Sums up the seconds that overlap a stretch of the stream, the one still being measured included.
+	 *
+	 *  @param[in]  start, end      Stream positions.
+	 *  @param[in]  threshold_db    Level that counts as loud, for loud_start and loud_end.
+	 *  @param[out] window          Levels of the stretch.
+	 *
+	 *  @return false if none of it was measured, which is the case right after configure() or when it is too old.
+	 */
+	bool get_window(unsigned long long start, unsigned long long end, float threshold_db, loudness_window_t &window) const;
+
+	/**
+	 *  @brief Returns the summaries of the seconds kept, oldest first, followed by the one still being measured.
+	 */
+	void get_history(std::vector <loudness_summary_t> &history) const;
+};
+
+/**
+ * @}
+ */
+#endif //_LOUDNESS_ANALYZER_H_
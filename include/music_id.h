@@ -21,12 +21,22 @@
 #include "audio_capture_manager.h"
 #include "audio_converter.h"
 #include "socket_adaptor.h"
+#include "loudness_analyzer.h"
+#include "fingerprinter.h"
+#include "pcm_codec.h"
 #include <iostream>
 #include <list>
+#include <deque>
 #include <map>
 #include <fstream>
 #include <string>
 #include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <chrono>
 
 /**
  * @addtogroup AUDIO_CAPTURE_MANAGER_API
@@ -43,41 +53,157 @@ class music_id_client : public audio_capture_client
 		SOCKET_OUTPUT
 	} preferred_delivery_method_t;
 
+	static const int CLIP_SILENT = 1; //Returned, or passed to the request callback, instead of a clip that is silent throughout.
+
+	typedef struct
+	{
+		unsigned long long clips; //Clips converted and written, successfully or otherwise.
+		unsigned long long lock_hold_us_total; //Time spent holding the client lock to take snapshots.
+		unsigned long long lock_hold_us_max;
+		unsigned long long conversion_us_total; //Time spent copying, converting and writing, without the client lock.
+		unsigned long long conversion_us_max;
+		unsigned long long silent_clips; //Not delivered, as they were silent.
+		unsigned long long trimmed_bytes; //Silence cut from the ends of clips.
+	} clip_stats_t;
+
 	private:
 	typedef int request_id_t;
+	typedef struct
+	{
+		unsigned long long position; //Ring position of the first frame.
+		unsigned int size; //Bytes of audio it decodes to.
+		std::vector <unsigned char> data;
+	}compressed_block_t;
+
+	typedef struct
+	{
+		unsigned long long position; //Ring position of the first frame.
+		std::vector <unsigned char> pcm; //A whole block of audio, waiting to be compressed outside the lock.
+	}sealed_block_t;
+
 	typedef struct
 	{	
 		request_id_t id;
 		std::string filename;
-		unsigned int length;
-        unsigned int time_remaining;
+		float length;
+		unsigned int length_bytes;
+		unsigned long long target_position; //Ring write position at which the clip is complete.
+		std::chrono::steady_clock::time_point deadline; //Deliver whatever is available if audio stops flowing.
 		request_complete_callback_t callback;
 		void * callback_data;
 	}request_t;
 
-	std::list <audio_buffer *> m_queue;
-	std::list <request_t*> m_requests;
+	typedef struct
+	{
+		audio_buffer * snapshot; //Owned by the job. Allocated under the lock and filled in off it. NULL if there was nothing to snapshot.
+		unsigned long long snapshot_position; //Ring position of the start of the snapshot.
+		unsigned long long copy_position; //Ring position up to which the snapshot has been copied out of the ring. Protected by m_pin_mutex.
+		unsigned int compressed_size; //Bytes at the start of the snapshot still to be decoded from the blocks below.
+		std::vector <std::shared_ptr <const compressed_block_t> > compressed;
+		audiocapturemgr::audio_properties_t properties; //Format of the snapshot.
+		bool convert_output; //Output settings as they were when the job was created.
+		audiocapturemgr::audio_properties_t output_properties;
+		bool wav_header;
+		std::string filename;
+		request_complete_callback_t callback;
+		void * callback_data;
+		unsigned long long lock_hold_us;
+		bool silent; //No snapshot was taken, as the audio was silent.
+		unsigned int trimmed_bytes; //Silence left out of the snapshot.
+		bool fingerprinted; //Deliver the fingerprint below instead of a snapshot.
+		acm_fingerprint_header_t fingerprint_header;
+		std::vector <acm_fingerprint_hash_t> fingerprint;
+		bool detached; //Detached jobs are deleted by the clip thread. Otherwise, the submitter waits for done and deletes it.
+		bool done;
+		int result;
+	}clip_job_t;
+
+	typedef struct
+	{
+		unsigned long long position; //Ring position where a buffer starts.
+		unsigned long long timestamp_us; //When it was captured.
+		unsigned long long sample_index;
+	}ring_anchor_t;
+
+	unsigned char * m_precapture_ring; //Contiguous ring holding the most recent audio.
+	unsigned int m_ring_capacity; //Bytes. Always a whole number of frames.
+	unsigned int m_ring_fill; //Bytes of valid data, ending at m_ring_write_position.
+	std::atomic <unsigned long long> m_ring_write_position; //Byte position of the next write, counted from the start of capture. Written under lock.
+	std::deque <ring_anchor_t> m_ring_anchors; //One per buffer in the ring, oldest first.
+	std::list <clip_job_t *> m_pinned_jobs; //Jobs whose audio is still to be copied out of the ring. Protected by m_pin_mutex.
+	std::mutex m_pin_mutex; //Lock order: client lock first, then m_pin_mutex. Held while copying out of the ring without the client lock.
+	std::atomic <unsigned long long> m_oldest_pinned_position; //Oldest copy_position still needed by m_pinned_jobs, or ULLONG_MAX. Written under m_pin_mutex.
+	loudness_analyzer m_loudness; //Covers the ring, by ring position. Needs lock.
+	bool m_silence_detection; //Needs lock, as do the two below.
+	float m_silence_threshold_db;
+	bool m_trim_silence;
+	fingerprinter m_fingerprinter; //Covers the ring, by ring position. Only fed while fingerprint output is on. Needs lock.
+	bool m_fingerprint_output; //Needs lock.
+	bool m_compress_precapture; //Needs lock, as do the members below.
+	pcm_codec m_codec; //Not configured if the format can't be compressed.
+	unsigned int m_block_size; //Bytes of audio per compressed block.
+	std::deque <std::shared_ptr <const compressed_block_t> > m_compressed_blocks; //Oldest first, one after the other, up to m_staging_position.
+	unsigned long long m_compressed_size; //Bytes held by m_compressed_blocks.
+	std::vector <unsigned char> m_block_staging; //Audio waiting for enough of it to make a block.
+	unsigned long long m_staging_position; //Ring position of the start of m_block_staging.
+	std::vector <sealed_block_t> m_sealed_blocks; //Full blocks for data_callback() to compress.
+	unsigned int m_compression_generation; //Bumped whenever compressed blocks are thrown away, so that blocks compressed from before aren't added.
+	bool m_compressing_backlog; //enable_precapture_compression() is compressing what the ring held. The ring isn't cut down meanwhile.
+	pcm_codec m_encoder; //Copy of m_codec, used by data_callback() outside the lock.
+	unsigned int m_encoder_generation; //Of m_encoder. Only used by data_callback().
+	unsigned int m_history_size; //Bytes back from the write position that clips may need.
+	std::vector <request_t*> m_requests; //Min-heap on target_position. Protected by m_request_mutex.
+	std::mutex m_request_mutex; //Lock order: client lock first, then m_request_mutex.
+	std::condition_variable m_request_cv;
+	std::atomic <unsigned long long> m_next_target_position; //target_position of the earliest pending request.
 	std::list <audio_converter_memory_sink *> m_outbox;
 	std::thread m_worker_thread;
 	bool m_worker_thread_alive;
-	unsigned int m_total_size;
+	std::list <clip_job_t *> m_clip_jobs;
+	std::mutex m_clip_mutex;
+	std::condition_variable m_clip_cv;
+	std::condition_variable m_clip_done_cv;
+	std::thread m_clip_thread;
+	bool m_clip_thread_alive;
+	clip_stats_t m_clip_stats;
 	unsigned int m_precapture_duration_seconds;
 	unsigned int m_precapture_size_bytes;
 	unsigned int m_queue_upper_limit_bytes;
 	unsigned int m_request_counter;
-	bool m_enable_wav_header_output;
+	bool m_enable_wav_header_output; //Needs lock, as do the two below.
 	audiocapturemgr::audio_properties_t m_output_properties;
 	bool m_convert_output;
 	preferred_delivery_method_t m_delivery_method;
 	socket_adaptor * m_sock_adaptor;
 	const std::string m_sock_path;
 
-	void trim_queue();
-	int write_default_file_header(std::ofstream &file);
+	void resize_precapture_ring(unsigned int capacity);
+	void reset_precapture_ring();
+	void write_to_precapture_ring(const audio_buffer * buf);
+	bool is_compressing();
+	void configure_compression(const audiocapturemgr::audio_properties_t &properties);
+	void compress_precapture(const unsigned char * ptr, unsigned int size);
+	void add_compressed_blocks(std::vector <sealed_block_t> &sealed, pcm_codec &codec, unsigned int generation);
+	unsigned long long get_oldest_position();
+	void snapshot_precapture_ring(unsigned long long end_position, unsigned int size, clip_job_t * job);
+	void update_oldest_pinned_position();
+	void release_pinned_audio(unsigned long long limit_position);
+	void copy_pinned_audio(clip_job_t * job);
+	int decompress_snapshot(clip_job_t * job);
+	unsigned long long time_to_ring_position(unsigned long long timestamp_us);
+	void get_ring_position_time(unsigned long long position, unsigned long long &timestamp_us, unsigned long long &sample_index);
+	unsigned int duration_to_bytes(float seconds);
+	int write_default_file_header(std::ofstream &file, const clip_job_t * job);
 	int update_file_header_size(std::ofstream &file, unsigned int data_size);
-	int grab_last_n_seconds(const std::string &filename, unsigned int seconds);
-	int grab_last_n_seconds(unsigned int seconds); //For socket mode output
+	clip_job_t * create_clip_job(unsigned long long end_position, unsigned int size, const std::string &filename); //needs lock
+	void submit_clip_job(clip_job_t * job);
+	int wait_for_clip_job(clip_job_t * job);
+	int write_clip(const clip_job_t * job, const std::string &filename);
+	int write_clip(const clip_job_t * job); //For socket mode output
+	int write_fingerprint(const clip_job_t * job);
+	void clip_thread();
 	void compute_queue_size();
+	static bool later_target(const request_t * a, const request_t * b);
 
 	public:
 	music_id_client(q_mgr * manager, preferred_delivery_method_t mode);
@@ -88,23 +214,43 @@ class music_id_client : public audio_capture_client
      *  @brief This API writes the precaptured sample to a file for file mode and in socket mode, sample is written to the unix 
      *  socket connection established to the client.
      *
+     *  Only the bounds of the audio are taken under the client lock. The clip thread copies it out of the ring and
+     *  converts it, and this call returns once it is done.
+     *
      *  @param[in] filename     File name, where precaptured output is written to in the case of file mode.
      *
      *  @return Return 0 on success, appropiate error code otherwise.
      */
 	int grab_precaptured_sample(const std::string &filename = nullptr);
 
+    /**
+     *  @brief Writes the precaptured audio captured between two points in time, like grab_precaptured_sample().
+     *
+     *  Times are CLOCK_MONOTONIC, as in audio_buffer timestamps and ip_out frame headers. Whatever part of the range is
+     *  no longer, or not yet, in the precapture ring is left out.
+     *
+     *  @param[in] start_us  Capture time of the first sample wanted.
+     *  @param[in] end_us    Capture time just past the last sample wanted.
+     *  @param[in] filename  Output file name, for file mode.
+     *
+     *  @return Return 0 on success, appropiate error code otherwise.
+     */
+	int grab_clip(unsigned long long start_us, unsigned long long end_us, const std::string &filename = nullptr);
+
     /**
      *  @brief This API requests for new sample.
      *
-     *  @param[in] seconds   length of the sample.
+     *  The request completes as soon as the requested amount of audio has arrived, or shortly after it should have
+     *  if audio stops flowing, in which case whatever is available is delivered.
+     *
+     *  @param[in] seconds   length of the sample. Fractions of a second are supported.
      *  @param[in] filename  Output file name.
      *  @param[in] cb        Callback function.
      *  @param[in] cb_data   Callback data.
      *
      *  @return Return 0 on success, appropiate error code otherwise.
      */
-	request_id_t grab_fresh_sample(unsigned int seconds, const std::string &filename = nullptr, request_complete_callback_t cb = nullptr, void * cb_data = nullptr);
+	request_id_t grab_fresh_sample(float seconds, const std::string &filename = nullptr, request_complete_callback_t cb = nullptr, void * cb_data = nullptr);
 
     /**
      *  @brief Invokes an API  for setting the audio specific properties of the audio capture client.
@@ -135,12 +281,65 @@ class music_id_client : public audio_capture_client
 
     /**
      *  @brief This function manages a queue of requests for music id samples.
+     *
+     *  Sleeps until the earliest request has enough audio, or until the earliest deadline passes.
      */
 	void worker_thread();
 
+    /**
+     *  @brief Returns how long clip extraction has held the client lock, and how long conversion has taken.
+     *
+     *  @param[out] stats  Totals and maxima in microseconds.
+     */
+	void get_clip_stats(clip_stats_t &stats);
+
+    /**
+     *  @brief Sets how clips that are silent, or start or end with silence, are handled.
+     *
+     *  A clip whose every second is quieter than threshold_db is not delivered: the request fails with CLIP_SILENT,
+     *  before any audio is copied or converted. With trimming, whole seconds of silence are also cut from either end
+     *  of clips that are delivered.
+     *
+     *  @param[in] enable        Off to deliver every clip as is.
+     *  @param[in] threshold_db  Level below which a second counts as silent. See loudness_analyzer.
+     *  @param[in] trim          Cut silent seconds from the ends of clips.
+     */
+	void set_silence_detection(bool enable, float threshold_db, bool trim);
+
+    /**
+     *  @brief Returns the loudness of each second of audio in the precapture ring, oldest first. The last entry is the
+     *  second still being measured.
+     *
+     *  @param[out] history  Per-second summaries. Positions are bytes since capture started.
+     */
+	void get_loudness_history(std::vector <loudness_summary_t> &history);
+
+    /**
+     *  @brief Keeps audio older than the last few seconds losslessly compressed (see pcm_codec), which allows for
+     *  longer precapture durations in the same memory.
+     *
+     *  Audio is compressed as it comes in, and clips that reach back past the uncompressed part are decoded on the
+     *  clip thread. Audio already in the ring is compressed when this is enabled. When it is disabled, only the
+     *  uncompressed part is kept, and the precapture duration is cut back to what is supported without compression.
+     *
+     *  @param[in] isEnabled  Boolean value indicates enabled/disabled.
+     */
+	void enable_precapture_compression(bool isEnabled);
+
+    /**
+     *  @brief Returns how much memory precaptured audio takes up.
+     *
+     *  @param[out] pcm_bytes         Size of the ring of uncompressed audio.
+     *  @param[out] compressed_bytes  Size of the compressed blocks.
+     *  @param[out] compressed_audio  Bytes of audio that the compressed blocks decode to.
+     */
+	void get_precapture_usage(unsigned int &pcm_bytes, unsigned long long &compressed_bytes, unsigned long long &compressed_audio);
+
     /**
      *  @brief This API returns maximum precaptured length.
      *
+     *  It is longer while precapture compression is on.
+     *
      *  @return Returns maximum precaptured length in seconds.
      */
 	unsigned int get_max_supported_duration();
@@ -155,11 +354,22 @@ class music_id_client : public audio_capture_client
 	unsigned int enable_wav_header(bool isEnabled);
 
     /**
-     *  @brief This API enables audio downsampling without anti-aliasing.
+     *  @brief This API enables conversion of clips to the output format, with anti-aliased resampling if the sampling rate differs.
+     *
+     *  @param[in] isEnabled  Boolean value indicates enabled/disabled.
+     */
+	void enable_output_conversion(bool isEnabled);
+
+    /**
+     *  @brief Delivers clips as fingerprints (see acm_fingerprint.h) rather than audio, in the same way and with the
+     *  same file names.
+     *
+     *  The audio is analysed as it is captured, from when this is enabled, so a clip only gets hashes for audio that
+     *  came in since. Output conversion and WAV headers don't apply, but silence detection does.
      *
      *  @param[in] isEnabled  Boolean value indicates enabled/disabled.
      */
-	void enable_output_conversion(bool isEnabled) { m_convert_output = isEnabled; }
+	void enable_fingerprint_output(bool isEnabled);
 
     /**
      *  @brief This API writes the captured clip data to the socket.
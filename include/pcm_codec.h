@@ -0,0 +1,82 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _PCM_CODEC_H_
+#define _PCM_CODEC_H_
+#include <stdint.h>
+#include <vector>
+#include "audio_capture_manager.h"
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+/**
+ *  @brief Lossless coder for blocks of interleaved 16 or 24-bit PCM, along the lines of FLAC's fixed predictors.
+ *
+ *  Each channel of a block is predicted with whichever polynomial of order 0 to 3 fits it best, and the residual is
+ *  Rice coded, with a parameter per partition of PARTITION_SIZE samples. Partitions that Rice coding would blow up,
+ *  such as a click after silence, are stored verbatim instead. Stereo blocks may be coded as left and side.
+ *  Programme material typically comes out at half its size or less, and silence at next to nothing.
+ *
+ *  Encoded blocks carry no format or length of their own; the caller keeps track of both. The coder has no state
+ *  besides the format, so one configured the same way decodes what another encoded.
+ */
+class pcm_codec
+{
+	public:
+	static const unsigned int PARTITION_SIZE = 256;
+	static const unsigned int MAX_CHANNELS = 6;
+
+	private:
+	unsigned int m_channels;
+	unsigned int m_bytes_per_sample;
+	std::vector <int32_t> m_samples; //One channel of the block being coded.
+	std::vector <int32_t> m_side;
+	std::vector <int32_t> m_residual;
+
+	void deinterleave(const unsigned char * pcm, unsigned int frames, unsigned int channel, int32_t * dst) const;
+	void interleave(const int32_t * src, unsigned int frames, unsigned int channel, unsigned char * pcm) const;
+
+	public:
+	pcm_codec();
+
+	/**
+	 *  @return false if the format isn't one that can be coded.
+	 */
+	bool configure(const audiocapturemgr::audio_properties_t &properties);
+	inline bool is_configured() const { return (0 != m_channels); }
+
+	/**
+	 *  @brief Encodes frames whole frames of audio, replacing the contents of out.
+	 */
+	void encode(const unsigned char * pcm, unsigned int frames, std::vector <unsigned char> &out);
+
+	/**
+	 *  @brief Decodes a block that encode() made of frames frames.
+	 *
+	 *  @return false if the block is corrupt, in which case pcm holds silence.
+	 */
+	bool decode(const unsigned char * data, unsigned int size, unsigned int frames, unsigned char * pcm);
+};
+
+/**
+ * @}
+ */
+#endif //_PCM_CODEC_H_
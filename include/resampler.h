@@ -0,0 +1,99 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _RESAMPLER_H_
+#define _RESAMPLER_H_
+#include <stdint.h>
+#include <vector>
+#include <memory>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+/**
+ *  @brief Windowed-sinc filter split into L phases, for resampling by L/M.
+ *
+ *  Banks are expensive to design, so they are built once per reduced (L, M) pair and shared.
+ */
+typedef struct
+{
+	unsigned int up; //L
+	unsigned int down; //M
+	unsigned int taps; //Taps per phase.
+	std::vector <float> coefficients; //Phase p occupies [p * taps, (p + 1) * taps), oldest input first.
+} polyphase_filter_bank_t;
+
+/**
+ *  @brief Anti-aliased rational-ratio resampler for interleaved 16-bit audio.
+ *
+ *  Keeps enough input history to carry the filter across calls, so audio can be fed in pieces of any size and the
+ *  result is the same as if it had been fed in one go.
+ */
+class polyphase_resampler
+{
+	private:
+		std::shared_ptr <const polyphase_filter_bank_t> m_bank;
+		unsigned int m_channels;
+		std::vector <float> m_history; //Interleaved input frames, starting with taps - 1 frames of history.
+		unsigned int m_history_frames;
+		unsigned int m_index; //Frame in m_history that the next output is aligned to.
+		unsigned int m_phase; //Filter phase of the next output, in [0, up).
+
+	public:
+		polyphase_resampler(unsigned int in_rate, unsigned int out_rate, unsigned int channels);
+
+		/**
+		 *  @brief Returns exactly how many frames the next call to process() will write for in_frames frames of input.
+		 */
+		unsigned int get_output_frames(unsigned int in_frames) const;
+
+		/**
+		 *  @brief Returns how far, in input frames, each output frame lags the input it lines up with.
+		 *
+		 *  Output frame n corresponds to input frame n * down / up - get_delay_frames(), counted from the last reset().
+		 */
+		double get_delay_frames() const;
+
+		/**
+		 *  @brief Resamples in_frames frames from src into dst.
+		 *
+		 *  @param[in]  src        Interleaved input.
+		 *  @param[in]  in_frames  Input frames.
+		 *  @param[out] dst        Room for get_output_frames(in_frames) frames.
+		 *
+		 *  @return Number of frames written.
+		 */
+		unsigned int process(const int16_t * src, unsigned int in_frames, int16_t * dst);
+
+		/**
+		 *  @brief Forgets all history, for when the next input isn't a continuation of the last.
+		 */
+		void reset();
+};
+
+/**
+ *  @brief Returns the shared filter bank for resampling from in_rate to out_rate, designing it on first use.
+ */
+std::shared_ptr <const polyphase_filter_bank_t> get_polyphase_filter_bank(unsigned int in_rate, unsigned int out_rate);
+
+/**
+ * @}
+ */
+#endif //_RESAMPLER_H_
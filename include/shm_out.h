@@ -0,0 +1,81 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _SHM_OUT_H_
+#define _SHM_OUT_H_
+#include "audio_capture_manager.h"
+#include "acm_shm_ring.h"
+#include <map>
+#include <string>
+
+typedef struct
+{
+	unsigned int active_readers;
+	unsigned long long accepted;
+	unsigned long long rejected;
+	unsigned long long bytes_published;
+	unsigned int latency_us; //From capture to publication, of the latest chunk.
+	unsigned int max_latency_us;
+} shm_out_stats_t;
+
+/**
+ *  @brief Publishes captured audio into a shared-memory ring that consumers map directly.
+ *
+ *  The ring is a memfd laid out as described in acm_shm_ring.h. It is handed to consumers, together with an eventfd
+ *  of their own, over a UNIX socket. After that, the only system call per buffer is one eventfd write per reader on
+ *  this side, and whatever the consumer needs to wait on its eventfd.
+ */
+class shm_out_client : public audio_capture_client
+{
+	private:
+	std::string m_data_path;
+	int m_listen_fd;
+	int m_epoll_fd;
+	int m_control_pipe[2];
+	int m_memfd;
+	unsigned int m_map_size;
+	acm_shm_ring_header_t * m_header;
+	unsigned char * m_data;
+	std::map <int, int> m_readers; //Socket to eventfd.
+	shm_out_stats_t m_stats;
+	pthread_t m_thread;
+	audiocapturemgr::audio_properties_t m_published_properties;
+
+	int create_ring();
+	void destroy_ring();
+	void publish_format(const audiocapturemgr::audio_properties_t &properties);
+	void publish(const audio_buffer * buf);
+	void process_new_connections();
+	void close_reader(int fd);
+
+	public:
+	shm_out_client(q_mgr * manager);
+	~shm_out_client();
+	virtual int data_callback(audio_buffer *buf);
+	std::string get_data_path();
+	std::string open_output();
+	void close_output();
+	void worker_thread();
+
+	/**
+	 *  @brief Returns reader counts and how much audio has been published.
+	 */
+	void get_stats(shm_out_stats_t &stats);
+};
+
+#endif //_SHM_OUT_H_
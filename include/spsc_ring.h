@@ -0,0 +1,123 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#ifndef _SPSC_RING_H_
+#define _SPSC_RING_H_
+#include <atomic>
+
+/**
+ * @addtogroup AUDIO_CAPTURE_MANAGER_API
+ * @{
+ */
+
+/**
+ *  @brief Lock-free ring for exactly one producer thread and one consumer thread.
+ *
+ *  Capacity is rounded up to a power of 2. Head and tail are free-running counters, so occupancy is simply their difference.
+ *  size() may be called from any thread, but is only exact when called from the producer or the consumer.
+ */
+template <typename T>
+class spsc_ring
+{
+	private:
+		static const unsigned int CACHE_LINE_SIZE = 64;
+
+		T * m_slots;
+		unsigned int m_mask;
+		char m_pad0[CACHE_LINE_SIZE];
+		std::atomic <unsigned int> m_head; //Written by producer only.
+		char m_pad1[CACHE_LINE_SIZE];
+		std::atomic <unsigned int> m_tail; //Written by consumer only.
+		char m_pad2[CACHE_LINE_SIZE];
+
+		spsc_ring(const spsc_ring &);
+		spsc_ring & operator=(const spsc_ring &);
+
+	public:
+		spsc_ring(unsigned int min_capacity) : m_head(0), m_tail(0)
+		{
+			unsigned int capacity = 2;
+			while(capacity < min_capacity)
+			{
+				capacity <<= 1;
+			}
+			m_slots = new T[capacity];
+			m_mask = capacity - 1;
+		}
+
+		~spsc_ring()
+		{
+			delete [] m_slots;
+		}
+
+		/**
+		 *  @brief Appends an item. Producer only.
+		 *
+		 *  @return false if the ring is full.
+		 */
+		bool push(const T &item)
+		{
+			unsigned int head = m_head.load(std::memory_order_relaxed);
+			if((head - m_tail.load(std::memory_order_acquire)) > m_mask)
+			{
+				return false;
+			}
+			m_slots[head & m_mask] = item;
+			m_head.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		/**
+		 *  @brief Removes the oldest item. Consumer only.
+		 *
+		 *  @return false if the ring is empty.
+		 */
+		bool pop(T &item)
+		{
+			unsigned int tail = m_tail.load(std::memory_order_relaxed);
+			if(tail == m_head.load(std::memory_order_acquire))
+			{
+				return false;
+			}
+			item = m_slots[tail & m_mask];
+			m_tail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		unsigned int size() const
+		{
+			unsigned int tail = m_tail.load(std::memory_order_acquire); //Tail first, so that it can never overtake the head we read.
+			return m_head.load(std::memory_order_acquire) - tail;
+		}
+
+		bool empty() const
+		{
+			return (0 == size());
+		}
+
+		unsigned int capacity() const
+		{
+			return m_mask + 1;
+		}
+};
+
+/**
+ * @}
+ */
+
+#endif //_SPSC_RING_H_
@@ -0,0 +1,427 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "acm_config.h"
+#include <fstream>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <limits.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <sys/wait.h>
+
+using namespace audiocapturemgr;
+
+static bool get_rfc_flag(const char * name)
+{
+	std::string command = ". /lib/rdk/isFeatureEnabled.sh ";
+	command += name;
+	int ret = system(command.c_str());
+	return ((true == WEXITSTATUS(ret)) && (true == WIFEXITED(ret)));
+}
+
+static std::string trim(const std::string &text)
+{
+	const char * whitespace = " \t\r\n";
+	size_t start = text.find_first_not_of(whitespace);
+	if(std::string::npos == start)
+	{
+		return std::string();
+	}
+	return text.substr(start, text.find_last_not_of(whitespace) - start + 1);
+}
+
+static void set_defaults(acm_config_t &config)
+{
+	memset(&config, 0, sizeof(config)); //Compared with memcmp, so padding has to be zero too.
+	config.output_conversion = false;
+	config.ingest_mode = INGEST_POOL;
+	config.latency_budget_ms = -1;
+	config.silence_detection = false; //Opt in by setting silence_threshold_db.
+	config.silence_threshold_db = -70.0f; //Same as music_id_client's default.
+	config.trim_silence = false;
+	config.fingerprint_output = false;
+	config.precapture_compression = false;
+	for(int i = 0; i < THREAD_ROLE_MAX; i++)
+	{
+		get_default_thread_settings(config.threads[i]);
+	}
+}
+
+static const char * DELIVERY_CLIENT_NAMES[DELIVERY_CLIENT_MAX] = {"music_id", "ip_out", "shm_out"};
+static const char * OVERFLOW_POLICY_NAMES[] = {"drop_oldest", "drop_newest", "disconnect"}; //In overflow_policy_t order.
+static const unsigned int OVERFLOW_POLICY_COUNT = sizeof(OVERFLOW_POLICY_NAMES) / sizeof(OVERFLOW_POLICY_NAMES[0]);
+
+/* Parses "<cpu>[,<cpu>...]". Returns false and leaves config alone if the value is malformed.*/
+static bool parse_source_cpus(const std::string &value, acm_config_t &config)
+{
+	int cpus[ACM_MAX_SOURCE_CPUS];
+	unsigned int count = 0;
+	std::istringstream stream(value);
+	std::string item;
+	while(std::getline(stream, item, ','))
+	{
+		item = trim(item);
+		char * end = NULL;
+		long cpu = strtol(item.c_str(), &end, 10);
+		if(item.empty() || ('\0' != *end) || (0 > cpu) || (CPU_SETSIZE <= cpu) || (ACM_MAX_SOURCE_CPUS <= count))
+		{
+			return false;
+		}
+		cpus[count++] = (int) cpu;
+	}
+	memcpy(config.source_cpus, cpus, count * sizeof(cpus[0]));
+	config.num_source_cpus = count;
+	return true;
+}
+
+/* Parses "<overflow policy> <max queue depth>". Returns false and leaves settings alone if the value is malformed.*/
+static bool parse_delivery_settings(const std::string &value, delivery_settings_t &settings)
+{
+	std::istringstream stream(value);
+	std::string policy_name;
+	int depth = 0;
+	if(!(stream>>policy_name>>depth) || !stream.eof() || (0 >= depth))
+	{
+		return false;
+	}
+	for(unsigned int i = 0; i < OVERFLOW_POLICY_COUNT; i++)
+	{
+		if(policy_name == OVERFLOW_POLICY_NAMES[i])
+		{
+			settings.configured = true;
+			settings.policy = (audio_capture_client::overflow_policy_t)i;
+			settings.max_queue_depth = depth;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Parses "<policy> <priority> [cpu]". Returns false and leaves settings alone if the value is malformed.*/
+static bool parse_thread_settings(const std::string &value, thread_settings_t &settings)
+{
+	std::istringstream stream(value);
+	std::string policy_name;
+	thread_settings_t parsed;
+	parsed.cpu = -1;
+	if(!(stream>>policy_name>>parsed.priority))
+	{
+		return false;
+	}
+	parsed.policy = get_sched_policy(policy_name.c_str());
+	if(!stream.eof() && !(stream>>parsed.cpu))
+	{
+		return false;
+	}
+	if((0 > parsed.policy) ||
+		((SCHED_OTHER == parsed.policy) && ((-20 > parsed.priority) || (19 < parsed.priority))) ||
+		((SCHED_OTHER != parsed.policy) && ((sched_get_priority_min(parsed.policy) > parsed.priority) || (sched_get_priority_max(parsed.policy) < parsed.priority))))
+	{
+		return false;
+	}
+	settings = parsed;
+	return true;
+}
+
+acm_config::acm_config(const std::string &path) : m_path(path), m_rfc_read(false), m_rfc_output_conversion(false), m_inotify_fd(-1), m_event_fd(-1)
+{
+	set_defaults(m_config);
+}
+
+acm_config::~acm_config()
+{
+	stop_watching();
+}
+
+int acm_config::parse_file(acm_config_t &config)
+{
+	std::ifstream file(m_path.c_str());
+	if(!file.is_open())
+	{
+		if(0 == access(m_path.c_str(), F_OK))
+		{
+			ERROR("Could not read %s.\n", m_path.c_str());
+			return -1;
+		}
+		return 0; //The file is optional.
+	}
+	std::string line;
+	unsigned int line_number = 0;
+	while(std::getline(file, line))
+	{
+		line_number++;
+		line = trim(line);
+		if(line.empty() || ('#' == line[0]))
+		{
+			continue;
+		}
+		size_t separator = line.find('=');
+		if(std::string::npos == separator)
+		{
+			WARN("%s:%u: expected key = value.\n", m_path.c_str(), line_number);
+			continue;
+		}
+		std::string key = trim(line.substr(0, separator));
+		std::string value = trim(line.substr(separator + 1));
+
+		if("output_conversion" == key)
+		{
+			config.output_conversion = (("true" == value) || ("1" == value));
+		}
+		else if("ingest_mode" == key)
+		{
+			if("ring" == value)
+			{
+				config.ingest_mode = INGEST_RING;
+			}
+			else if("pool" == value)
+			{
+				config.ingest_mode = INGEST_POOL;
+			}
+			else
+			{
+				WARN("%s:%u: unknown ingest mode %s.\n", m_path.c_str(), line_number, value.c_str());
+			}
+		}
+		else if("latency_budget_ms" == key)
+		{
+			config.latency_budget_ms = atoi(value.c_str());
+		}
+		else if("silence_threshold_db" == key)
+		{
+			char * end = NULL;
+			float threshold = strtof(value.c_str(), &end);
+			if("off" == value)
+			{
+				config.silence_detection = false;
+			}
+			else if((end == value.c_str()) || ('\0' != *end) || (0 < threshold))
+			{
+				WARN("%s:%u: expected a level in dB, at most 0, or off. Got %s.\n", m_path.c_str(), line_number, value.c_str());
+			}
+			else
+			{
+				config.silence_detection = true;
+				config.silence_threshold_db = threshold;
+			}
+		}
+		else if("trim_silence" == key)
+		{
+			config.trim_silence = (("true" == value) || ("1" == value));
+		}
+		else if("fingerprint_output" == key)
+		{
+			config.fingerprint_output = (("true" == value) || ("1" == value));
+		}
+		else if("precapture_compression" == key)
+		{
+			config.precapture_compression = (("true" == value) || ("1" == value));
+		}
+		else if("capture_backend" == key)
+		{
+			if(sizeof(config.capture_backend) <= value.size())
+			{
+				WARN("%s:%u: capture backend is too long.\n", m_path.c_str(), line_number);
+			}
+			else
+			{
+				strncpy(config.capture_backend, value.c_str(), sizeof(config.capture_backend) - 1);
+			}
+		}
+		else if("source_cpus" == key)
+		{
+			if(!parse_source_cpus(value, config))
+			{
+				WARN("%s:%u: expected up to %d CPU numbers separated by commas, got %s.\n", m_path.c_str(), line_number, ACM_MAX_SOURCE_CPUS, value.c_str());
+			}
+		}
+		else if(0 == key.compare(0, 9, "delivery."))
+		{
+			int client = 0;
+			while((DELIVERY_CLIENT_MAX > client) && (key.substr(9) != DELIVERY_CLIENT_NAMES[client]))
+			{
+				client++;
+			}
+			if(DELIVERY_CLIENT_MAX == client)
+			{
+				WARN("%s:%u: unknown client type %s.\n", m_path.c_str(), line_number, key.c_str() + 9);
+			}
+			else if(!parse_delivery_settings(value, config.delivery[client]))
+			{
+				WARN("%s:%u: expected drop_oldest | drop_newest | disconnect <max queue depth>, got %s.\n", m_path.c_str(), line_number, value.c_str());
+			}
+		}
+		else if(0 == key.compare(0, 7, "thread."))
+		{
+			thread_role_t role = get_thread_role(key.c_str() + 7);
+			if(THREAD_ROLE_MAX == role)
+			{
+				WARN("%s:%u: unknown thread role %s.\n", m_path.c_str(), line_number, key.c_str() + 7);
+			}
+			else if(!parse_thread_settings(value, config.threads[role]))
+			{
+				WARN("%s:%u: expected other | fifo | rr <priority> [cpu], got %s.\n", m_path.c_str(), line_number, value.c_str());
+			}
+		}
+		else
+		{
+			WARN("%s:%u: unknown key %s.\n", m_path.c_str(), line_number, key.c_str());
+		}
+	}
+	return 0;
+}
+
+int acm_config::load()
+{
+	std::unique_lock<std::mutex> load_lock(m_load_mutex);
+	if(!m_rfc_read)
+	{
+		/* Runs a shell, so it's kept out of reloads, which come from the watch thread and the IARM handler.*/
+		m_rfc_output_conversion = get_rfc_flag("AcmEnableOpConv");
+		m_rfc_read = true;
+	}
+	acm_config_t config;
+	set_defaults(config);
+	config.output_conversion = m_rfc_output_conversion;
+	int ret = parse_file(config);
+	INFO("Output conversion %s, %s ingest, latency budget %dms, capture from %s.\n", (config.output_conversion ? "on" : "off"),
+		(INGEST_RING == config.ingest_mode ? "ring" : "pool"), config.latency_budget_ms, ('\0' == config.capture_backend[0] ? "rmf" : config.capture_backend));
+	INFO("Silence detection %s at %.1fdB, trimming %s. Fingerprint output %s.\n", (config.silence_detection ? "on" : "off"), config.silence_threshold_db,
+		(config.trim_silence ? "on" : "off"), (config.fingerprint_output ? "on" : "off"));
+	INFO("Precapture compression %s.\n", (config.precapture_compression ? "on" : "off"));
+	for(int i = 0; i < DELIVERY_CLIENT_MAX; i++)
+	{
+		if(config.delivery[i].configured)
+		{
+			INFO("New %s sessions deliver with %s, at most %u buffers queued.\n", DELIVERY_CLIENT_NAMES[i],
+				OVERFLOW_POLICY_NAMES[config.delivery[i].policy], config.delivery[i].max_queue_depth);
+		}
+	}
+
+	std::unique_lock<std::mutex> config_lock(m_mutex);
+	bool changed = (0 != memcmp(&config, &m_config, sizeof(config)));
+	m_config = config;
+	config_lock.unlock();
+	if(changed && m_listener)
+	{
+		m_listener(config);
+	}
+	return ret;
+}
+
+void acm_config::get(acm_config_t &config)
+{
+	std::unique_lock<std::mutex> config_lock(m_mutex);
+	config = m_config;
+}
+
+void acm_config::set_listener(std::function <void (const acm_config_t &)> listener)
+{
+	m_listener = listener;
+}
+
+int acm_config::start_watching()
+{
+	if(m_watch_thread.joinable())
+	{
+		return 0;
+	}
+	/* Watch the directory rather than the file, so that the file can be created later, or replaced by a rename.*/
+	std::string directory = m_path.substr(0, m_path.find_last_of('/') + 1);
+	m_inotify_fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+	m_event_fd = eventfd(0, EFD_CLOEXEC);
+	if((0 > m_inotify_fd) || (0 > m_event_fd) ||
+		(0 > inotify_add_watch(m_inotify_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_DELETE)))
+	{
+		ERROR("Could not watch %s. errno: 0x%x\n", directory.c_str(), errno);
+		stop_watching();
+		return -1;
+	}
+	m_watch_thread = std::thread(&acm_config::watch_thread, this);
+	return 0;
+}
+
+void acm_config::stop_watching()
+{
+	if(m_watch_thread.joinable())
+	{
+		uint64_t count = 1;
+		REPORT_IF_UNEQUAL(sizeof(count), write(m_event_fd, &count, sizeof(count)));
+		m_watch_thread.join();
+	}
+	if(0 <= m_inotify_fd)
+	{
+		close(m_inotify_fd);
+		m_inotify_fd = -1;
+	}
+	if(0 <= m_event_fd)
+	{
+		close(m_event_fd);
+		m_event_fd = -1;
+	}
+}
+
+void acm_config::watch_thread()
+{
+	INFO("Watching %s.\n", m_path.c_str());
+	std::string filename = m_path.substr(m_path.find_last_of('/') + 1);
+	char buffer[sizeof(struct inotify_event) + NAME_MAX + 1] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(true)
+	{
+		struct pollfd poll_fds[2] = {{m_inotify_fd, POLLIN, 0}, {m_event_fd, POLLIN, 0}};
+		if(0 > poll(poll_fds, 2, -1))
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			ERROR("poll failed. errno: 0x%x\n", errno);
+			break;
+		}
+		if(poll_fds[1].revents)
+		{
+			break;
+		}
+
+		bool reload = false;
+		ssize_t size;
+		while(0 < (size = read(m_inotify_fd, buffer, sizeof(buffer))))
+		{
+			for(char * ptr = buffer; ptr < (buffer + size); )
+			{
+				const struct inotify_event * event = (const struct inotify_event *) ptr;
+				if((0 != event->len) && (filename == event->name))
+				{
+					reload = true;
+				}
+				ptr += sizeof(struct inotify_event) + event->len;
+			}
+		}
+		if(reload)
+		{
+			INFO("%s has changed. Reloading.\n", m_path.c_str());
+			load();
+		}
+	}
+	INFO("Exit.\n");
+}
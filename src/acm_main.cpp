@@ -17,9 +17,14 @@
  * limitations under the License.
 */
 #include <unistd.h>
+#include <string.h>
+#include <signal.h>
+#include <semaphore.h>
+#include <errno.h>
 #include "audio_capture_manager.h"
 #include "music_id.h"
 #include "acm_session_mgr.h"
+#include "acm_thread.h"
 #if defined(DROP_ROOT_PRIV)
 #include "cap.h"
 #endif
@@ -52,12 +57,46 @@ static bool drop_root()
 }
 #endif
 
+static sem_t g_metrics_request;
+
+static void metrics_signal_handler(int)
+{
+	sem_post(&g_metrics_request); //Async-signal-safe, unlike anything that could write the report from here.
+}
+
 void launcher()
 {
 	acm_session_mgr *mgr = acm_session_mgr::get_instance();
+	REPORT_IF_UNEQUAL(0, sem_init(&g_metrics_request, 0, 0));
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = metrics_signal_handler;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	REPORT_IF_UNEQUAL(0, sigaction(SIGUSR1, &action, NULL));
+
 	mgr->activate();
-	/* Hold here until application is terminated.*/
-	pause();
+	/* The configuration has been loaded by now. See whether this process may use the scheduling it asks for.*/
+	if(0 != audiocapturemgr::check_thread_settings())
+	{
+#if defined(DROP_ROOT_PRIV)
+		WARN("Root privileges have been dropped. Real-time scheduling and negative nice values need CAP_SYS_NICE, or LimitRTPRIO and LimitNICE in the service file.\n");
+#else
+		WARN("Some of the requested thread scheduling was refused.\n");
+#endif
+	}
+	/* Hold here until application is terminated. Dump metrics to the log each time SIGUSR1 arrives.*/
+	while(true)
+	{
+		if(0 == sem_wait(&g_metrics_request))
+		{
+			mgr->dump_metrics();
+		}
+		else if(EINTR != errno)
+		{
+			break;
+		}
+	}
 	mgr->deactivate();
 }
 
@@ -0,0 +1,119 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "acm_metrics.h"
+#include <string.h>
+
+acm_histogram::acm_histogram() : m_count(0), m_sum(0), m_max(0)
+{
+	for(unsigned int i = 0; i < NUM_BUCKETS; i++)
+	{
+		m_buckets[i].store(0, std::memory_order_relaxed);
+	}
+}
+
+unsigned long long acm_histogram::get_bucket_floor(unsigned int bucket)
+{
+	if(SUB_BUCKETS > bucket)
+	{
+		return bucket;
+	}
+	unsigned int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+	return (unsigned long long)(SUB_BUCKETS + (bucket & (SUB_BUCKETS - 1))) << shift;
+}
+
+unsigned long long acm_histogram::get_bucket_ceiling(unsigned int bucket)
+{
+	if(SUB_BUCKETS > bucket)
+	{
+		return bucket;
+	}
+	if((NUM_BUCKETS - 1) == bucket)
+	{
+		return ~0ULL; //Also holds everything too big for the histogram.
+	}
+	unsigned int shift = (bucket >> SUB_BUCKET_BITS) - 1;
+	return get_bucket_floor(bucket) + (1ULL << shift) - 1;
+}
+
+void acm_histogram::snapshot(acm_histogram_snapshot &out) const
+{
+	for(unsigned int i = 0; i < NUM_BUCKETS; i++)
+	{
+		out.buckets[i] = m_buckets[i].load(std::memory_order_relaxed);
+	}
+	out.count = m_count.load(std::memory_order_relaxed);
+	out.sum = m_sum.load(std::memory_order_relaxed);
+	out.max = m_max.load(std::memory_order_relaxed);
+}
+
+acm_histogram_snapshot::acm_histogram_snapshot() : count(0), sum(0), max(0)
+{
+	memset(buckets, 0, sizeof(buckets));
+}
+
+unsigned long long acm_histogram_snapshot::get_percentile(double fraction) const
+{
+	/* The bucket counts are read one by one, so go by their total rather than count, which may be a little off.*/
+	unsigned long long total = 0;
+	for(unsigned int i = 0; i < acm_histogram::NUM_BUCKETS; i++)
+	{
+		total += buckets[i];
+	}
+	if(0 == total)
+	{
+		return 0;
+	}
+	unsigned long long rank = (unsigned long long)(fraction * total + 0.5);
+	if(0 == rank)
+	{
+		rank = 1;
+	}
+	unsigned long long seen = 0;
+	for(unsigned int i = 0; i < acm_histogram::NUM_BUCKETS; i++)
+	{
+		seen += buckets[i];
+		if(seen >= rank)
+		{
+			unsigned long long ceiling = acm_histogram::get_bucket_ceiling(i);
+			return ((0 != max) && (max < ceiling) ? max : ceiling);
+		}
+	}
+	return max;
+}
+
+unsigned long long acm_histogram_snapshot::get_mean() const
+{
+	return (0 == count ? 0 : sum / count);
+}
+
+void acm_histogram_snapshot::subtract(const acm_histogram_snapshot &earlier)
+{
+	for(unsigned int i = 0; i < acm_histogram::NUM_BUCKETS; i++)
+	{
+		buckets[i] -= earlier.buckets[i];
+	}
+	count -= earlier.count;
+	sum -= earlier.sum;
+}
+
+void acm_histogram_snapshot::write_json(std::ostream &os) const
+{
+	os<<"{\"count\":"<<count<<",\"mean\":"<<get_mean()<<",\"p50\":"<<get_percentile(0.5)<<",\"p90\":"<<get_percentile(0.9)
+		<<",\"p99\":"<<get_percentile(0.99)<<",\"p999\":"<<get_percentile(0.999)<<",\"max\":"<<max<<"}";
+}
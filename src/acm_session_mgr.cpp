@@ -18,17 +18,28 @@
 */
 #include "acm_session_mgr.h"
 #include "audiocapturemgr_iarm.h"
+#include "capture_backend.h"
 #include <string>
 #include <string.h>
 #include <sstream>
+#include <fstream>
+#include <algorithm>
 #include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
 #include "libIARM.h"
 #include "libIBus.h"
 #include "safec_lib.h"
 
 using namespace audiocapturemgr;
 
-static const unsigned int MAX_SUPPORTED_SOURCES = 1; //Primary only at the moment
+/* RMF capture type of each source, by index. NULL opens the primary device the original way.*/
+#ifdef RMF_AC_TYPE_AUXILIARY
+static const char * SOURCE_TYPES[] = {NULL, RMF_AC_TYPE_AUXILIARY};
+#else
+static const char * SOURCE_TYPES[] = {NULL}; //This HAL has no way to open anything but the primary device.
+#endif
+static const unsigned int MAX_SUPPORTED_SOURCES = sizeof(SOURCE_TYPES) / sizeof(SOURCE_TYPES[0]);
 static acm_session_mgr g_singleton;
 
 static unsigned int ticker = 0;
@@ -40,7 +51,25 @@ static void request_callback(void * data, std::string &file, int result)
 	errno_t rc = -1;
 	if(0 != result)
 	{
-		ERROR("Failed to grab sample.\n");
+		iarmbus_clip_failed_payload_t payload;
+		if(music_id_client::CLIP_SILENT == result)
+		{
+			INFO("Sample is silent.\n");
+			payload.result = ACM_RESULT_CLIP_SILENT;
+		}
+		else
+		{
+			ERROR("Failed to grab sample.\n");
+			payload.result = ACM_RESULT_GENERAL_FAILURE;
+		}
+		rc = strcpy_s(payload.dataLocator, sizeof(payload.dataLocator), file.c_str());
+		if(rc != EOK)
+		{
+			ERR_CHK(rc);
+			payload.dataLocator[0] = '\0';
+		}
+		int ret = IARM_Bus_BroadcastEvent(IARMBUS_AUDIOCAPTUREMGR_NAME, DATA_CAPTURE_IARM_EVENT_AUDIO_CLIP_FAILED, &payload, sizeof(payload));
+		REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
 	}
 	else
 	{
@@ -59,6 +88,14 @@ static void request_callback(void * data, std::string &file, int result)
 	}
 }
 
+static void apply_delivery_settings(audio_capture_client * client, const delivery_settings_t &settings)
+{
+	if(settings.configured)
+	{
+		client->set_delivery_policy(settings.policy, settings.max_queue_depth);
+	}
+}
+
 static IARM_Result_t request_sample(void * arg)
 {
 	g_singleton.get_sample_handler(arg);
@@ -110,7 +147,17 @@ static IARM_Result_t set_audio_props(void * arg)
 	g_singleton.set_audio_props_handler(arg);
 	return IARM_RESULT_SUCCESS;
 }
-acm_session_mgr::acm_session_mgr() : m_session_counter(0)
+static IARM_Result_t get_metrics(void * arg)
+{
+	g_singleton.get_metrics_handler(arg);
+	return IARM_RESULT_SUCCESS;
+}
+static IARM_Result_t reload_config(void * arg)
+{
+	g_singleton.reload_config_handler(arg);
+	return IARM_RESULT_SUCCESS;
+}
+acm_session_mgr::acm_session_mgr() : m_session_counter(0), m_config(ACM_CONFIG_FILE)
 {
 	INFO("Enter\n");
 
@@ -119,9 +166,6 @@ acm_session_mgr::acm_session_mgr() : m_session_counter(0)
 		m_sources.push_back((q_mgr *)NULL);
 	}
 
-	/*Add primary audio to the list of sources*/
-	m_sources[0] = new q_mgr;
-
 	pthread_mutexattr_t mutex_attribute;
 	REPORT_IF_UNEQUAL(0, pthread_mutexattr_init(&mutex_attribute));
 	REPORT_IF_UNEQUAL(0, pthread_mutexattr_settype(&mutex_attribute, PTHREAD_MUTEX_ERRORCHECK));
@@ -154,6 +198,14 @@ int acm_session_mgr::activate()
 	int ret;
 	INFO("Enter\n");
 
+	/* Load settings before any session can be opened, so that handlers never have to wait for the RFC.*/
+	m_config.set_listener([this](const acm_config_t &config){apply_config(config);});
+	m_config.load();
+	m_config.start_watching();
+
+	/*Open primary audio now that the capture backend is known. Others are opened when a session first asks for them.*/
+	get_source(0);
+
 	//TODO: add early exit for each of the failures below
 	ret = IARM_Bus_Init(IARMBUS_AUDIOCAPTUREMGR_NAME);
 	REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
@@ -174,6 +226,8 @@ int acm_session_mgr::activate()
 	ret = IARM_Bus_RegisterCall(IARMBUS_AUDIOCAPTUREMGR_GET_OUTPUT_PROPS, get_output_props); REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
 	ret = IARM_Bus_RegisterCall(IARMBUS_AUDIOCAPTUREMGR_SET_AUDIO_PROPERTIES, set_audio_props); REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
 	ret = IARM_Bus_RegisterCall(IARMBUS_AUDIOCAPTUREMGR_SET_OUTPUT_PROPERTIES, set_output_props); REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
+	ret = IARM_Bus_RegisterCall(IARMBUS_AUDIOCAPTUREMGR_GET_METRICS, get_metrics); REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
+	ret = IARM_Bus_RegisterCall(IARMBUS_AUDIOCAPTUREMGR_RELOAD_CONFIG, reload_config); REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
 	return ret;
 }
 int acm_session_mgr::deactivate()
@@ -184,22 +238,51 @@ int acm_session_mgr::deactivate()
 	REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
 	ret = IARM_Bus_Term();
 	REPORT_IF_UNEQUAL(IARM_RESULT_SUCCESS, ret);
+	m_config.stop_watching();
 	return ret;
 }
 
-static bool get_rfc_output_conversion_config()
+void acm_session_mgr::apply_config(const acm_config_t &config)
 {
-	int ret  = system(". /lib/rdk/isFeatureEnabled.sh AcmEnableOpConv");
-	if((true == WEXITSTATUS(ret)) && (true == WIFEXITED(ret)))
+	for(int i = 0; i < THREAD_ROLE_MAX; i++)
 	{
-		INFO("RFC: enable song-id output conversion\n");
-		return true;
+		set_thread_settings((thread_role_t) i, config.threads[i]);
 	}
-	else
+
+	/* Output conversion of music id is left alone in existing sessions, as their apps may have chosen it themselves. So is
+	 * fingerprint output, as their apps expect clips in the form they have been getting them.
+	 * Silence detection and precapture compression are only ever set from here, so they apply to all of them.*/
+	lock();
+	for(unsigned int i = 0; i < m_sources.size(); i++)
 	{
-		INFO("RFC: disable song-id output conversion.\n");
-		return false;
+		if(NULL != m_sources[i])
+		{
+			m_sources[i]->set_ingest_mode(config.ingest_mode);
+		}
 	}
+	update_source_cpus(config);
+	std::list <acm_session_t *>::iterator iter;
+	for(iter = m_sessions.begin(); iter != m_sessions.end(); iter++)
+	{
+		if((REALTIME_SOCKET == (*iter)->output_type) && (0 <= config.latency_budget_ms))
+		{
+			static_cast <ip_out_client *> ((*iter)->client)->set_latency_budget(config.latency_budget_ms);
+		}
+		else if(BUFFERED_FILE_OUTPUT == (*iter)->output_type)
+		{
+			static_cast <music_id_client *> ((*iter)->client)->set_silence_detection(config.silence_detection, config.silence_threshold_db, config.trim_silence);
+			static_cast <music_id_client *> ((*iter)->client)->enable_precapture_compression(config.precapture_compression);
+		}
+	}
+	unlock();
+}
+
+int acm_session_mgr::reload_config_handler(void * arg)
+{
+	iarmbus_acm_arg_t *param = static_cast <iarmbus_acm_arg_t *> (arg);
+	INFO("Enter\n");
+	param->result = (0 == m_config.load() ? 0 : ACM_RESULT_GENERAL_FAILURE);
+	return param->result;
 }
 
 int acm_session_mgr::open_handler(void * arg)
@@ -213,18 +296,42 @@ int acm_session_mgr::open_handler(void * arg)
 		return param->result;
 	}
 
+	q_mgr * source = get_source(param->details.arg_open.source);
+	if(NULL == source)
+	{
+		param->result = ACM_RESULT_STREAM_UNAVAILABLE;
+		return param->result;
+	}
+
+	acm_config_t config;
+	m_config.get(config);
 	acm_session_t *new_session = new acm_session_t;
-	new_session->source = m_sources[param->details.arg_open.source];
+	new_session->source = source;
 	switch(param->details.arg_open.output_type)
 	{
 		case BUFFERED_FILE_OUTPUT:
 			new_session->client = new music_id_client(new_session->source, music_id_client::SOCKET_OUTPUT);
-			static_cast <music_id_client *> (new_session->client)->enable_output_conversion(get_rfc_output_conversion_config());
+			static_cast <music_id_client *> (new_session->client)->enable_output_conversion(config.output_conversion);
+			static_cast <music_id_client *> (new_session->client)->set_silence_detection(config.silence_detection, config.silence_threshold_db, config.trim_silence);
+			static_cast <music_id_client *> (new_session->client)->enable_fingerprint_output(config.fingerprint_output);
+			static_cast <music_id_client *> (new_session->client)->enable_precapture_compression(config.precapture_compression);
+			apply_delivery_settings(new_session->client, config.delivery[DELIVERY_CLIENT_MUSIC_ID]);
 			param->result = 0;
 			break;
 
 		case REALTIME_SOCKET:
 			new_session->client = new ip_out_client(new_session->source);
+			if(0 <= config.latency_budget_ms)
+			{
+				static_cast <ip_out_client *> (new_session->client)->set_latency_budget(config.latency_budget_ms);
+			}
+			apply_delivery_settings(new_session->client, config.delivery[DELIVERY_CLIENT_IP_OUT]);
+			param->result = 0;
+			break;
+
+		case REALTIME_SHARED_MEMORY:
+			new_session->client = new shm_out_client(new_session->source);
+			apply_delivery_settings(new_session->client, config.delivery[DELIVERY_CLIENT_SHM_OUT]);
 			param->result = 0;
 			break;
 
@@ -313,6 +420,51 @@ int acm_session_mgr::close_handler(void * arg)
 	return param->result;
 }
 
+q_mgr * acm_session_mgr::get_source(int source)
+{
+	lock();
+	q_mgr * ptr = m_sources[source];
+	if(NULL == ptr)
+	{
+		acm_config_t config;
+		m_config.get(config);
+		ptr = new q_mgr(create_capture_backend(config.capture_backend, SOURCE_TYPES[source]));
+		if(ptr->is_available())
+		{
+			ptr->set_ingest_mode(config.ingest_mode);
+			m_sources[source] = ptr;
+			update_source_cpus(config);
+		}
+		else
+		{
+			ERROR("Could not open source %d.\n", source);
+			delete ptr;
+			ptr = NULL;
+		}
+	}
+	unlock();
+	return ptr;
+}
+
+void acm_session_mgr::update_source_cpus(const acm_config_t &config) //needs lock
+{
+	/* With more than one source open, give each its own CPU, so that one can't add latency to another. A single source
+	 * is better off running wherever the scheduler finds room.*/
+	unsigned int num_open = 0;
+	for(unsigned int i = 0; i < m_sources.size(); i++)
+	{
+		num_open += (NULL != m_sources[i] ? 1 : 0);
+	}
+	for(unsigned int i = 0; i < m_sources.size(); i++)
+	{
+		if(NULL != m_sources[i])
+		{
+			bool pin = ((1 < num_open) && (0 < config.num_source_cpus));
+			m_sources[i]->set_cpu_affinity(pin ? config.source_cpus[i % config.num_source_cpus] : -1);
+		}
+	}
+}
+
 acm_session_t * acm_session_mgr::get_session(int session_id)
 {
 	acm_session_t * ptr = NULL;
@@ -535,10 +687,17 @@ int acm_session_mgr::get_output_props_handler(void * arg)
 	acm_session_t * ptr = get_session(param->session_id);
 	if(ptr)
 	{
-		if(REALTIME_SOCKET == ptr->output_type)
+		if((REALTIME_SOCKET == ptr->output_type) || (REALTIME_SHARED_MEMORY == ptr->output_type))
 		{
-			ip_out_client * client = static_cast <ip_out_client *> (ptr->client);
-			std::string sock_path = client->get_data_path();
+			std::string sock_path;
+			if(REALTIME_SOCKET == ptr->output_type)
+			{
+				sock_path = static_cast <ip_out_client *> (ptr->client)->get_data_path();
+			}
+			else
+			{
+				sock_path = static_cast <shm_out_client *> (ptr->client)->get_data_path();
+			}
 			if(sock_path.empty())
 			{
 				param->result = ACM_RESULT_GENERAL_FAILURE;
@@ -569,6 +728,69 @@ int acm_session_mgr::get_output_props_handler(void * arg)
 	return param->result;
 }
 
+static racFormat to_rac_format(iarmbus_acm_format format)
+{
+	racFormat result;
+	switch(format)
+	{
+		case acmFormate16BitStereo:
+			result = racFormat_e16BitStereo;
+			break;
+		case acmFormate24BitStereo:
+			result = racFormat_e24BitStereo;
+			break;
+		case acmFormate16BitMonoLeft:
+			result = racFormat_e16BitMonoLeft;
+			break;
+		case acmFormate16BitMonoRight:
+			result = racFormat_e16BitMonoRight;
+			break;
+		case acmFormate16BitMono:
+			result = racFormat_e16BitMono;
+			break;
+		case acmFormate24Bit5_1:
+			result = racFormat_e24Bit5_1;
+			break;
+		case acmFormateMax:
+			result = racFormat_eMax;
+			break;
+		default:
+			result = racFormat_e16BitStereo;
+			break;
+	}
+	return result;
+}
+
+static racFreq to_rac_freq(iarmbus_acm_freq sampling_frequency)
+{
+	racFreq result;
+	switch(sampling_frequency)
+	{
+		case acmFreqe16000:
+			result = racFreq_e16000;
+			break;
+		case acmFreqe24000:
+			result = racFreq_e24000;
+			break;
+		case acmFreqe32000:
+			result = racFreq_e32000;
+			break;
+		case acmFreqe44100:
+			result = racFreq_e44100;
+			break;
+		case acmFreqe48000:
+			result = racFreq_e48000;
+			break;
+		case acmFreqeMax:
+			result = racFreq_eMax;
+			break;
+		default:
+			result = racFreq_e48000;
+			break;
+	}
+	return result;
+}
+
 int acm_session_mgr::set_audio_props_handler(void * arg)
 {
 	iarmbus_acm_arg_t *param = static_cast <iarmbus_acm_arg_t *> (arg);
@@ -578,58 +800,8 @@ int acm_session_mgr::set_audio_props_handler(void * arg)
 	{
         audio_properties_t props;
 
-
-        switch (param->details.arg_audio_properties.format) {
-        case acmFormate16BitStereo:
-            props.format = racFormat_e16BitStereo;
-            break;
-        case acmFormate24BitStereo:
-            props.format = racFormat_e24BitStereo;
-            break;
-        case acmFormate16BitMonoLeft:
-            props.format = racFormat_e16BitMonoLeft;
-            break;
-        case acmFormate16BitMonoRight:
-            props.format = racFormat_e16BitMonoRight;
-            break;
-        case acmFormate16BitMono:
-            props.format = racFormat_e16BitMono;
-            break;
-        case acmFormate24Bit5_1:
-            props.format = racFormat_e24Bit5_1;
-            break;
-        case acmFormateMax:
-            props.format = racFormat_eMax;
-            break;
-        default:
-            props.format = racFormat_e16BitStereo;
-            break;
-        }
-
-        switch (param->details.arg_audio_properties.sampling_frequency) {
-        case acmFreqe16000:
-            props.sampling_frequency = racFreq_e16000;
-            break;
-        case acmFreqe24000:
-            props.sampling_frequency = racFreq_e24000;
-            break;
-        case acmFreqe32000:
-            props.sampling_frequency = racFreq_e32000;
-            break;
-        case acmFreqe44100:
-            props.sampling_frequency = racFreq_e44100;
-            break;
-        case acmFreqe48000:
-            props.sampling_frequency = racFreq_e48000;
-            break;
-        case acmFreqeMax:
-            props.sampling_frequency = racFreq_eMax;
-            break;
-        default:
-            props.sampling_frequency = racFreq_e48000;
-            break;
-        }
-
+        props.format = to_rac_format(param->details.arg_audio_properties.format);
+        props.sampling_frequency = to_rac_freq(param->details.arg_audio_properties.sampling_frequency);
 
         props.fifo_size               = param->details.arg_audio_properties.fifo_size;
         props.threshold               = param->details.arg_audio_properties.threshold;
@@ -667,6 +839,43 @@ int acm_session_mgr::set_output_props_handler(void * arg)
 				param->result = ACM_RESULT_DURATION_OUT_OF_BOUNDS;
 			}
 		}
+		else if(REALTIME_SOCKET == ptr->output_type)
+		{
+			ip_out_client * client = static_cast <ip_out_client *> (ptr->client);
+			unsigned int flags = param->details.arg_output_props.output.stream_format.flags;
+			param->result = 0;
+			/* Callers that predate stream_format send zeros, which must not turn anything on.*/
+			if(0 == (flags & (ACM_STREAM_FLAG_SET_FORMAT | ACM_STREAM_FLAG_SET_FRAMING)))
+			{
+				WARN("Nothing to set. Use ACM_STREAM_FLAG_SET_FORMAT or ACM_STREAM_FLAG_SET_FRAMING.\n");
+				param->result = ACM_RESULT_UNSUPPORTED_API;
+			}
+			if(0 != (flags & ACM_STREAM_FLAG_SET_FORMAT))
+			{
+				if(acmFormateMax == param->details.arg_output_props.output.stream_format.format)
+				{
+					client->enable_output_conversion(false);
+				}
+				else
+				{
+					audio_properties_t props = {racFormat_eMax, racFreq_eMax, 0, 0, 0};
+					props.format = to_rac_format(param->details.arg_output_props.output.stream_format.format);
+					props.sampling_frequency = to_rac_freq(param->details.arg_output_props.output.stream_format.sampling_frequency);
+					if(0 == client->set_output_properties(props))
+					{
+						client->enable_output_conversion(true);
+					}
+					else
+					{
+						param->result = ACM_RESULT_INVALID_ARGUMENTS;
+					}
+				}
+			}
+			if((0 == param->result) && (0 != (flags & ACM_STREAM_FLAG_SET_FRAMING)))
+			{
+				client->set_framed_output(0 != (flags & ACM_STREAM_FLAG_FRAMED));
+			}
+		}
 		else
 		{
 			WARN("Not implemented for this type of output.\n");
@@ -714,7 +923,7 @@ int acm_session_mgr::get_sample_handler(void * arg)
 				}
 				else
 				{
-					unsigned int duration = param->details.arg_sample_request.duration;	
+					float duration = param->details.arg_sample_request.duration;
 					if(duration <= client->get_max_supported_duration())
 					{
 						ret = client->grab_fresh_sample(duration, filename, &request_callback, NULL);
@@ -727,7 +936,11 @@ int acm_session_mgr::get_sample_handler(void * arg)
 				}
 				/*Note: tricky condition check. ret is also zero if it's an out-of-bounds error, 
 				 * but in that case, result is already updated.*/
-				if(0 != ret)
+				if(music_id_client::CLIP_SILENT == ret)
+				{
+					param->result = ACM_RESULT_CLIP_SILENT;
+				}
+				else if(0 != ret)
 				{
 					param->result = ACM_RESULT_GENERAL_FAILURE;
 				}
@@ -748,6 +961,151 @@ int acm_session_mgr::get_sample_handler(void * arg)
 	return param->result;
 }
 
+static const char * get_output_type_name(iarmbus_output_type_t output_type)
+{
+	switch(output_type)
+	{
+		case BUFFERED_FILE_OUTPUT:
+			return "file";
+		case REALTIME_SOCKET:
+			return "socket";
+		case REALTIME_SHARED_MEMORY:
+			return "shared_memory";
+		default:
+			return "unknown";
+	}
+}
+
+void acm_session_mgr::write_metrics(std::ostream &os)
+{
+	/* Sessions are only deleted after they leave the list, so holding the lock keeps their clients alive.*/
+	lock();
+	os<<"{\"timestamp_us\":"<<get_monotonic_time_us()<<",\"sources\":[";
+	bool first = true;
+	for(unsigned int i = 0; i < m_sources.size(); i++)
+	{
+		q_mgr * source = m_sources[i];
+		if(NULL == source)
+		{
+			continue;
+		}
+		ingest_metrics_t ingest;
+		queue_stats_t queue;
+		audio_buffer_pool_stats_t allocator;
+		source->get_ingest_metrics(ingest);
+		source->get_queue_stats(queue);
+		source->get_buffer_pool_stats(allocator);
+
+		os<<(first ? "" : ",")<<"{\"source\":"<<i<<",\"bytes\":"<<ingest.bytes<<",\"buffers\":"<<ingest.buffers
+			<<",\"queue\":{\"occupancy\":"<<queue.occupancy<<",\"high_water_mark\":"<<queue.high_water_mark<<",\"capacity\":"<<queue.capacity
+			<<",\"dropped_buffers\":"<<queue.dropped_buffers<<",\"depth\":";
+		ingest.queue_depth.write_json(os);
+		os<<"},\"allocator\":{\"mode\":\""<<(INGEST_RING == source->get_ingest_mode() ? "ring" : "pool")<<"\",\"hits\":"<<allocator.hits
+			<<",\"misses\":"<<allocator.misses<<",\"in_use\":"<<allocator.in_use<<",\"high_water_mark\":"<<allocator.high_water_mark
+			<<",\"num_slots\":"<<allocator.num_slots<<",\"capacity_bytes\":"<<allocator.capacity_bytes
+			<<",\"high_water_mark_bytes\":"<<allocator.high_water_mark_bytes<<"},\"history\":[";
+		for(unsigned int j = 0; j < ingest.history.size(); j++)
+		{
+			const ingest_interval_t &interval = ingest.history[j];
+			os<<(0 == j ? "" : ",")<<"{\"timestamp_us\":"<<interval.timestamp_us<<",\"bytes_per_second\":"<<interval.bytes_per_second
+				<<",\"buffers\":"<<interval.buffers<<",\"dropped_buffers\":"<<interval.dropped_buffers
+				<<",\"mean_queue_depth\":"<<interval.mean_queue_depth<<",\"peak_queue_depth\":"<<interval.peak_queue_depth<<"}";
+		}
+		os<<"]}";
+		first = false;
+	}
+	os<<"],\"sessions\":[";
+
+	first = true;
+	std::list <acm_session_t *>::iterator iter;
+	for(iter = m_sessions.begin(); iter != m_sessions.end(); iter++)
+	{
+		acm_session_t * session = *iter;
+		audio_capture_client::delivery_stats_t delivery;
+		audio_capture_client::delivery_metrics_t metrics;
+		session->client->get_delivery_stats(delivery);
+		session->client->get_delivery_metrics(metrics);
+		int source = std::find(m_sources.begin(), m_sources.end(), session->source) - m_sources.begin();
+
+		os<<(first ? "" : ",")<<"{\"session_id\":"<<session->session_id<<",\"source\":"<<source
+			<<",\"output_type\":\""<<get_output_type_name(session->output_type)<<"\",\"enabled\":"<<(session->enable ? "true" : "false")
+			<<",\"delivered\":"<<delivery.delivered<<",\"dropped\":"<<delivery.dropped<<",\"disconnects\":"<<delivery.disconnects
+			<<",\"queue_depth\":"<<delivery.queue_depth<<",\"queue_high_water_mark\":"<<delivery.high_water_mark<<",\"latency_us\":";
+		metrics.latency_us.write_json(os);
+		os<<",\"callback_us\":";
+		metrics.callback_us.write_json(os);
+		os<<",\"conversion_us\":";
+		metrics.conversion_us.write_json(os);
+
+		if(REALTIME_SOCKET == session->output_type)
+		{
+			ip_out_stats_t totals;
+			std::vector <ip_out_connection_stats_t> connections;
+			static_cast <ip_out_client *> (session->client)->get_stats(totals, connections);
+			os<<",\"connections\":"<<totals.active_connections<<",\"accepted\":"<<totals.accepted<<",\"rejected\":"<<totals.rejected
+				<<",\"stalled\":"<<totals.stalled<<",\"readers\":[";
+			for(unsigned int j = 0; j < connections.size(); j++)
+			{
+				const ip_out_connection_stats_t &connection = connections[j];
+				os<<(0 == j ? "" : ",")<<"{\"id\":"<<connection.id<<",\"bytes_sent\":"<<connection.bytes_sent
+					<<",\"bytes_dropped\":"<<connection.bytes_dropped<<",\"chunks_dropped\":"<<connection.chunks_dropped
+					<<",\"writes\":"<<connection.writes<<",\"queued_bytes\":"<<connection.queued_bytes
+					<<",\"latency_us\":"<<connection.latency_us<<",\"max_latency_us\":"<<connection.max_latency_us<<"}";
+			}
+			os<<"]";
+		}
+		else if(REALTIME_SHARED_MEMORY == session->output_type)
+		{
+			shm_out_stats_t stats;
+			static_cast <shm_out_client *> (session->client)->get_stats(stats);
+			os<<",\"readers\":"<<stats.active_readers<<",\"accepted\":"<<stats.accepted<<",\"rejected\":"<<stats.rejected
+				<<",\"bytes_published\":"<<stats.bytes_published<<",\"publish_latency_us\":"<<stats.latency_us
+				<<",\"max_publish_latency_us\":"<<stats.max_latency_us;
+		}
+		os<<"}";
+		first = false;
+	}
+	unlock();
+	os<<"]}";
+}
+
+int acm_session_mgr::get_metrics_handler(void * arg)
+{
+	errno_t rc = -1;
+	iarmbus_acm_arg_t *param = static_cast <iarmbus_acm_arg_t *> (arg);
+	std::string filename = audio_file_path + "acm_metrics.json";
+	std::string temp_filename = filename + ".tmp";
+
+	/* Write it out in full before it replaces the last report, so that readers never see half a file.*/
+	std::ofstream file(temp_filename.c_str());
+	write_metrics(file);
+	file.close();
+	if(file.fail() || (0 != rename(temp_filename.c_str(), filename.c_str())))
+	{
+		ERROR("Could not write metrics to %s\n", filename.c_str());
+		unlink(temp_filename.c_str());
+		param->result = ACM_RESULT_GENERAL_FAILURE;
+		return param->result;
+	}
+
+	rc = strcpy_s(param->details.arg_output_props.output.file_path, sizeof(param->details.arg_output_props.output.file_path), filename.c_str());
+	if(rc != EOK)
+	{
+		ERR_CHK(rc);
+		param->result = ACM_RESULT_GENERAL_FAILURE;
+		return param->result;
+	}
+	param->result = 0;
+	return param->result;
+}
+
+void acm_session_mgr::dump_metrics()
+{
+	std::ostringstream report;
+	write_metrics(report);
+	INFO("%s\n", report.str().c_str());
+}
+
 void acm_session_mgr::set_filename_prefix(std::string &prefix)
 {
 	audio_filename_prefix = prefix;	
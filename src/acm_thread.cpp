@@ -0,0 +1,281 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "acm_thread.h"
+#include "audio_capture_manager.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <thread>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+namespace audiocapturemgr
+{
+	typedef struct
+	{
+		const char * name;
+		const char * thread_name; //15 characters at most.
+	}thread_role_info_t;
+
+	static const thread_role_info_t ROLE_INFO[THREAD_ROLE_MAX] =
+	{
+		{"processing", "acm_processing"},
+		{"delivery", "acm_delivery"},
+		{"monitor", "acm_monitor"},
+		{"ip_out", "acm_ip_out"},
+		{"shm_out", "acm_shm_out"},
+		{"music_id", "acm_music_id"},
+		{"clip", "acm_clip"},
+		{"socket_adaptor", "acm_sockadaptor"},
+		{"capture", "acm_capture"}
+	};
+
+	/* Threads start during static initialization, so everything here must be usable before any constructor has run.*/
+	static pthread_mutex_t g_mutex = PTHREAD_MUTEX_INITIALIZER;
+	static thread_settings_t g_settings[THREAD_ROLE_MAX] = //needs g_mutex
+	{
+		{SCHED_OTHER, 0, -1}, {SCHED_OTHER, 0, -1}, {SCHED_OTHER, 0, -1}, {SCHED_OTHER, 0, -1},
+		{SCHED_OTHER, 0, -1}, {SCHED_OTHER, 0, -1}, {SCHED_OTHER, 0, -1}, {SCHED_OTHER, 0, -1},
+		{SCHED_OTHER, 0, -1}
+	};
+	static thread_role_scope * g_threads = NULL; //needs g_mutex
+
+	static bool is_default(const thread_settings_t &settings)
+	{
+		return ((SCHED_OTHER == settings.policy) && (0 == settings.priority) && (0 > settings.cpu));
+	}
+
+	/* Returns 0 or the first error. Affinity is left to thread_role_scope::get_cpu().*/
+	static int apply_settings(pthread_t thread, pid_t tid, const thread_settings_t &settings)
+	{
+		struct sched_param param;
+		param.sched_priority = (SCHED_OTHER == settings.policy ? 0 : settings.priority);
+		int ret = pthread_setschedparam(thread, settings.policy, &param);
+		if((0 == ret) && (SCHED_OTHER == settings.policy) && (0 != setpriority(PRIO_PROCESS, tid, settings.priority)))
+		{
+			ret = errno;
+		}
+		return ret;
+	}
+
+	const char * get_thread_role_name(thread_role_t role)
+	{
+		return (THREAD_ROLE_MAX > role ? ROLE_INFO[role].name : "unknown");
+	}
+
+	thread_role_t get_thread_role(const char * name)
+	{
+		for(int i = 0; i < THREAD_ROLE_MAX; i++)
+		{
+			if(0 == strcmp(name, ROLE_INFO[i].name))
+			{
+				return (thread_role_t) i;
+			}
+		}
+		return THREAD_ROLE_MAX;
+	}
+
+	const char * get_sched_policy_name(int policy)
+	{
+		switch(policy)
+		{
+			case SCHED_OTHER: return "other";
+			case SCHED_FIFO: return "fifo";
+			case SCHED_RR: return "rr";
+			default: return "unknown";
+		}
+	}
+
+	int get_sched_policy(const char * name)
+	{
+		if(0 == strcmp(name, "other"))
+		{
+			return SCHED_OTHER;
+		}
+		if(0 == strcmp(name, "fifo"))
+		{
+			return SCHED_FIFO;
+		}
+		if(0 == strcmp(name, "rr"))
+		{
+			return SCHED_RR;
+		}
+		return -1;
+	}
+
+	void get_default_thread_settings(thread_settings_t &settings)
+	{
+		settings.policy = SCHED_OTHER;
+		settings.priority = 0;
+		settings.cpu = -1;
+	}
+
+	void set_thread_settings(thread_role_t role, const thread_settings_t &settings)
+	{
+		if(THREAD_ROLE_MAX <= role)
+		{
+			return;
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&g_mutex));
+		if((settings.policy == g_settings[role].policy) && (settings.priority == g_settings[role].priority) && (settings.cpu == g_settings[role].cpu))
+		{
+			REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&g_mutex));
+			return;
+		}
+		bool cpu_changed = (settings.cpu != g_settings[role].cpu);
+		g_settings[role] = settings;
+		INFO("%s threads: %s, priority %d, cpu %d.\n", ROLE_INFO[role].name, get_sched_policy_name(settings.policy),
+			settings.priority, settings.cpu);
+		for(thread_role_scope * ptr = g_threads; NULL != ptr; ptr = ptr->m_next)
+		{
+			if(role == ptr->m_role)
+			{
+				int ret = apply_settings(ptr->m_thread, ptr->m_tid, settings);
+				if(0 != ret)
+				{
+					ERROR("Could not apply settings to %s thread %d. Error: 0x%x\n", ROLE_INFO[role].name, ptr->m_tid, ret);
+				}
+				if(cpu_changed)
+				{
+					set_thread_cpu(ptr->m_thread, ptr->get_cpu()); //Affinity errors mean a bad CPU number, not missing privileges.
+				}
+			}
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&g_mutex));
+	}
+
+	void get_thread_settings(thread_role_t role, thread_settings_t &settings)
+	{
+		if(THREAD_ROLE_MAX <= role)
+		{
+			get_default_thread_settings(settings);
+			return;
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&g_mutex));
+		settings = g_settings[role];
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&g_mutex));
+	}
+
+	int check_thread_settings()
+	{
+		int refused = 0;
+		for(int i = 0; i < THREAD_ROLE_MAX; i++)
+		{
+			thread_settings_t settings;
+			get_thread_settings((thread_role_t) i, settings);
+			if(is_default(settings))
+			{
+				continue;
+			}
+			/* Try it out on a thread of its own, so that nothing else picks up the settings.*/
+			int ret = 0;
+			std::thread probe([&settings, &ret]()
+				{
+					ret = apply_settings(pthread_self(), (pid_t) syscall(SYS_gettid), settings);
+					int policy;
+					struct sched_param param;
+					if((0 == ret) && ((0 != pthread_getschedparam(pthread_self(), &policy, &param)) || (policy != settings.policy)))
+					{
+						ret = EPERM;
+					}
+				});
+			probe.join();
+			if(0 == ret)
+			{
+				INFO("%s threads: %s, priority %d granted.\n", ROLE_INFO[i].name, get_sched_policy_name(settings.policy), settings.priority);
+			}
+			else
+			{
+				struct rlimit rtprio, nice;
+				getrlimit(RLIMIT_RTPRIO, &rtprio);
+				getrlimit(RLIMIT_NICE, &nice);
+				ERROR("%s threads: %s, priority %d refused. Error: 0x%x, uid %d, RLIMIT_RTPRIO %ld, RLIMIT_NICE %ld. Running with defaults.\n",
+					ROLE_INFO[i].name, get_sched_policy_name(settings.policy), settings.priority, ret, getuid(),
+					(long) rtprio.rlim_cur, (long) nice.rlim_cur);
+				refused++;
+			}
+		}
+		return refused;
+	}
+
+	bool set_thread_group_cpu(thread_group_t &group, int cpu)
+	{
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&g_mutex));
+		bool changed = (cpu != group.cpu);
+		if(changed)
+		{
+			group.cpu = cpu;
+			for(thread_role_scope * ptr = g_threads; NULL != ptr; ptr = ptr->m_next)
+			{
+				if((&group == ptr->m_group) && (0 > g_settings[ptr->m_role].cpu))
+				{
+					set_thread_cpu(ptr->m_thread, cpu);
+				}
+			}
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&g_mutex));
+		return changed;
+	}
+
+	/* The CPU configured for the role comes first, then the group's. Negative to run anywhere.*/
+	int thread_role_scope::get_cpu() const //needs g_mutex
+	{
+		if(0 <= g_settings[m_role].cpu)
+		{
+			return g_settings[m_role].cpu;
+		}
+		return (NULL == m_group ? -1 : m_group->cpu);
+	}
+
+	thread_role_scope::thread_role_scope(thread_role_t role, const thread_group_t * group) : m_role(role), m_thread(pthread_self()),
+		m_tid((pid_t) syscall(SYS_gettid)), m_group(group)
+	{
+		pthread_setname_np(m_thread, ROLE_INFO[role].thread_name);
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&g_mutex));
+		m_next = g_threads;
+		g_threads = this;
+		if(!is_default(g_settings[role]))
+		{
+			int ret = apply_settings(m_thread, m_tid, g_settings[role]);
+			if(0 != ret)
+			{
+				WARN("Could not apply settings to %s thread %d. Error: 0x%x\n", ROLE_INFO[role].name, m_tid, ret);
+			}
+		}
+		int cpu = get_cpu();
+		if(0 <= cpu)
+		{
+			set_thread_cpu(m_thread, cpu);
+		}
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&g_mutex));
+	}
+
+	thread_role_scope::~thread_role_scope()
+	{
+		REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&g_mutex));
+		thread_role_scope ** ptr = &g_threads;
+		while(this != *ptr)
+		{
+			ptr = &((*ptr)->m_next);
+		}
+		*ptr = m_next;
+		REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&g_mutex));
+	}
+}
@@ -21,24 +21,37 @@
 #include <stdlib.h>
 #include "basic_types.h"
 #include <pthread.h>
+#include <new>
 #include "safec_lib.h"
 
-audio_buffer::audio_buffer(const unsigned char *in_ptr, unsigned int in_size, unsigned int clip_length, unsigned int refcount) : m_size(in_size), m_clip_length(clip_length), m_refcount(refcount)
+audio_buffer::audio_buffer(const unsigned char *in_ptr, unsigned int in_size, unsigned int clip_length, unsigned int refcount) : m_size(in_size), m_clip_length(clip_length), m_refcount(refcount), m_allocator(NULL),
+	m_sequence(0), m_timestamp_us(0), m_sample_index(0)
 {
 	DEBUG("Creating new buffer.\n");
 	errno_t rc = -1;
 	m_start_ptr = (unsigned char *)malloc(in_size);
-	rc = memcpy_s(m_start_ptr, in_size, in_ptr, m_size);
-	if(rc != EOK)
+	if(NULL != in_ptr)
 	{
-		ERR_CHK(rc);
+		rc = memcpy_s(m_start_ptr, in_size, in_ptr, m_size);
+		if(rc != EOK)
+		{
+			ERR_CHK(rc);
+		}
 	}
 }
 
+audio_buffer::audio_buffer(audio_buffer_allocator *allocator, unsigned char *storage) : m_start_ptr(storage), m_size(0), m_clip_length(0), m_refcount(0), m_allocator(allocator),
+	m_sequence(0), m_timestamp_us(0), m_sample_index(0)
+{
+}
+
 audio_buffer::~audio_buffer()
 {
 	DEBUG("Deleting buffer.\n");
-	free(m_start_ptr);
+	if(NULL == m_allocator)
+	{
+		free(m_start_ptr);
+	}
 }
 
 
@@ -47,35 +60,282 @@ audio_buffer * create_new_audio_buffer(const unsigned char *in_ptr, unsigned int
 	return new audio_buffer(in_ptr, in_size, clip_length, refcount);
 }
 
-static pthread_mutex_t g_audio_buffer_mutex = PTHREAD_ERRORCHECK_MUTEX_INITIALIZER_NP;
 void unref_audio_buffer(audio_buffer *ptr)
 {
-	/* Current implementation will go for a simple plan, which is to check the refcount of the buffer while protected by a mutex. This means
-	 * every unref operation involving any buffer at all will be serialized. If this turns out to be a performance bottleneck, plan B is to launch
-	 * a garbage-cleaning thread of sorts that will actually check the refcount and free the buffers. In that implementation, this funciton
-	 * will simply post a message (the address of the buffer to be unreffed) to the GC thread and be done with it.*/
-	REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&g_audio_buffer_mutex));
-	if(1 == ptr->m_refcount)
+	/* Release ordering publishes this client's reads of the payload, and acquire ordering on the final decrement makes
+	 * all of them visible to whichever client frees the buffer, so the storage can't be reused while someone is still reading it.*/
+	if(1 == ptr->m_refcount.fetch_sub(1, std::memory_order_acq_rel))
+	{
+		free_audio_buffer(ptr);
+	}
+}
+
+void free_audio_buffer(audio_buffer *ptr)
+{
+	if(NULL != ptr->m_allocator)
+	{
+		ptr->m_allocator->release(ptr);
+	}
+	else
 	{
 		delete ptr;
 	}
+}
+
+audio_buffer_allocator::audio_buffer_allocator() : m_in_use(0), m_high_water_mark(0), m_hits(0), m_misses(0), m_retired(false)
+{
+	pthread_mutexattr_t mutex_attribute;
+	REPORT_IF_UNEQUAL(0, pthread_mutexattr_init(&mutex_attribute));
+	REPORT_IF_UNEQUAL(0, pthread_mutexattr_settype(&mutex_attribute, PTHREAD_MUTEX_ERRORCHECK));
+	REPORT_IF_UNEQUAL(0, pthread_mutex_init(&m_mutex, &mutex_attribute));
+}
+
+audio_buffer_allocator::~audio_buffer_allocator()
+{
+	INFO("Deleting allocator 0x%p. Hits: %llu, misses: %llu, high-water mark: %u buffers.\n", static_cast <void *>(this),
+		m_hits, m_misses, m_high_water_mark);
+	REPORT_IF_UNEQUAL(0, pthread_mutex_destroy(&m_mutex));
+}
+
+audio_buffer * audio_buffer_allocator::allocate(const unsigned char *in_ptr, unsigned int in_size, unsigned int clip_length, unsigned int refcount)
+{
+	REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+	audio_buffer * slot = take_slot(in_size);
+	if(NULL != slot)
+	{
+		m_hits++;
+		m_in_use++;
+		if(m_high_water_mark < m_in_use)
+		{
+			m_high_water_mark = m_in_use;
+		}
+	}
 	else
 	{
-		ptr->m_refcount--;
+		m_misses++;
 	}
-	REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&g_audio_buffer_mutex));
+	REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+
+	if(NULL == slot)
+	{
+		DEBUG("Allocator miss. Size: %u\n", in_size);
+		return create_new_audio_buffer(in_ptr, in_size, clip_length, refcount);
+	}
+
+	errno_t rc = memcpy_s(slot->m_start_ptr, in_size, in_ptr, in_size);
+	if(rc != EOK)
+	{
+		ERR_CHK(rc);
+	}
+	slot->m_size = in_size;
+	slot->m_clip_length = clip_length;
+	slot->m_refcount.store(refcount, std::memory_order_relaxed);
+	return slot;
 }
 
-void free_audio_buffer(audio_buffer *ptr)
+void audio_buffer_allocator::release(audio_buffer *ptr)
+{
+	REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+	return_slot(ptr);
+	m_in_use--;
+	bool destroy = (m_retired && (0 == m_in_use));
+	REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+	if(destroy)
+	{
+		delete this;
+	}
+}
+
+void audio_buffer_allocator::retire()
 {
-	delete ptr;
+	/* Buffers from this allocator may still be held by clients. The last one to be released will take the allocator down with it.*/
+	REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+	m_retired = true;
+	bool destroy = (0 == m_in_use);
+	REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
+	if(destroy)
+	{
+		delete this;
+	}
 }
-void audio_buffer_get_global_lock()
+
+void audio_buffer_allocator::get_stats(audio_buffer_pool_stats_t &stats)
 {
-	REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&g_audio_buffer_mutex));
+	REPORT_IF_UNEQUAL(0, pthread_mutex_lock(&m_mutex));
+	stats.hits = m_hits;
+	stats.misses = m_misses;
+	stats.in_use = m_in_use;
+	stats.high_water_mark = m_high_water_mark;
+	fill_stats(stats);
+	REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&m_mutex));
 }
-void audio_buffer_release_global_lock()
+
+audio_buffer_pool::audio_buffer_pool(unsigned int slot_size, unsigned int num_slots) : m_slab(NULL), m_slot_size(slot_size), m_num_slots(num_slots)
 {
-	REPORT_IF_UNEQUAL(0, pthread_mutex_unlock(&g_audio_buffer_mutex));
+	m_slab = (unsigned char *)malloc((size_t)m_slot_size * m_num_slots);
+	if(NULL == m_slab)
+	{
+		ERROR("Could not allocate %u slots of %u bytes. Pool will be bypassed.\n", m_num_slots, m_slot_size);
+		m_num_slots = 0;
+	}
+	m_slots.reserve(m_num_slots);
+	m_free_list.reserve(m_num_slots);
+	for(unsigned int i = 0; i < m_num_slots; i++)
+	{
+		audio_buffer * slot = new audio_buffer(this, m_slab + ((size_t)i * m_slot_size));
+		m_slots.push_back(slot);
+		m_free_list.push_back(slot);
+	}
+	INFO("Created pool 0x%p with %u slots of %u bytes.\n", static_cast <void *>(this), m_num_slots, m_slot_size);
 }
 
+audio_buffer_pool::~audio_buffer_pool()
+{
+	std::vector <audio_buffer *>::iterator iter;
+	for(iter = m_slots.begin(); iter != m_slots.end(); iter++)
+	{
+		delete *iter;
+	}
+	free(m_slab);
+}
+
+audio_buffer * audio_buffer_pool::take_slot(unsigned int size)
+{
+	if((size > m_slot_size) || m_free_list.empty())
+	{
+		return NULL;
+	}
+	audio_buffer * slot = m_free_list.back();
+	m_free_list.pop_back();
+	return slot;
+}
+
+void audio_buffer_pool::return_slot(audio_buffer *ptr)
+{
+	m_free_list.push_back(ptr);
+}
+
+void audio_buffer_pool::fill_stats(audio_buffer_pool_stats_t &stats)
+{
+	stats.num_slots = m_num_slots;
+	stats.slot_size = m_slot_size;
+	stats.capacity_bytes = m_num_slots * m_slot_size;
+	stats.high_water_mark_bytes = m_high_water_mark * m_slot_size;
+}
+
+static const unsigned int RING_ALIGNMENT = 16; //Keeps every view suitably aligned for vector loads.
+
+audio_buffer_ring::audio_buffer_ring(unsigned int capacity, unsigned int max_buffers) : m_capacity(capacity), m_num_descriptors(max_buffers),
+	m_desc_head(0), m_desc_tail(0), m_desc_count(0), m_write_offset(0), m_bytes_in_use(0), m_bytes_high_water_mark(0)
+{
+	m_capacity -= (m_capacity % RING_ALIGNMENT);
+	if(0 != posix_memalign((void **)&m_storage, RING_ALIGNMENT, m_capacity))
+	{
+		ERROR("Could not allocate %u byte ring. Ring will be bypassed.\n", m_capacity);
+		m_storage = NULL;
+		m_capacity = 0;
+	}
+	m_offsets.resize(m_num_descriptors, 0);
+	m_footprints.resize(m_num_descriptors, 0);
+	m_released.resize(m_num_descriptors, false);
+
+	/* Descriptors live in one array so that a buffer's index can be worked out from its address on release.*/
+	m_descriptor_storage = static_cast <unsigned char *> (::operator new(sizeof(audio_buffer) * m_num_descriptors));
+	for(unsigned int i = 0; i < m_num_descriptors; i++)
+	{
+		new (get_descriptor(i)) audio_buffer(this, NULL);
+	}
+	INFO("Created ring 0x%p with %u bytes and %u descriptors.\n", static_cast <void *>(this), m_capacity, m_num_descriptors);
+}
+
+audio_buffer_ring::~audio_buffer_ring()
+{
+	for(unsigned int i = 0; i < m_num_descriptors; i++)
+	{
+		get_descriptor(i)->~audio_buffer();
+	}
+	::operator delete(m_descriptor_storage);
+	free(m_storage);
+}
+
+audio_buffer * audio_buffer_ring::get_descriptor(unsigned int index)
+{
+	return reinterpret_cast <audio_buffer *> (m_descriptor_storage + (sizeof(audio_buffer) * index));
+}
+
+audio_buffer * audio_buffer_ring::take_slot(unsigned int size)
+{
+	unsigned int aligned_size = (size + RING_ALIGNMENT - 1) & ~(RING_ALIGNMENT - 1);
+	if((m_num_descriptors == m_desc_count) || (aligned_size > m_capacity) || (0 == aligned_size))
+	{
+		return NULL;
+	}
+
+	unsigned int offset = m_write_offset;
+	unsigned int skipped = 0;
+	if(0 == m_bytes_in_use)
+	{
+		offset = 0; //Nothing outstanding. Start afresh at the beginning.
+	}
+	else
+	{
+		unsigned int read_offset = m_offsets[m_desc_tail];
+		bool wrapped = (m_write_offset < read_offset) || ((m_write_offset == read_offset) && (0 != m_bytes_in_use));
+		if(!wrapped)
+		{
+			if((m_capacity - m_write_offset) < aligned_size)
+			{
+				/* Not enough room at the end. Skip it and continue from the start if there's room there.*/
+				if(read_offset < aligned_size)
+				{
+					return NULL;
+				}
+				skipped = m_capacity - m_write_offset;
+				offset = 0;
+			}
+		}
+		else if((read_offset - m_write_offset) < aligned_size)
+		{
+			return NULL;
+		}
+	}
+
+	unsigned int index = m_desc_head;
+	m_offsets[index] = offset;
+	m_footprints[index] = aligned_size + skipped;
+	m_released[index] = false;
+	m_desc_head = (m_desc_head + 1) % m_num_descriptors;
+	m_desc_count++;
+	m_write_offset = offset + aligned_size;
+	m_bytes_in_use += aligned_size + skipped;
+	if(m_bytes_high_water_mark < m_bytes_in_use)
+	{
+		m_bytes_high_water_mark = m_bytes_in_use;
+	}
+
+	audio_buffer * slot = get_descriptor(index);
+	slot->m_start_ptr = m_storage + offset;
+	return slot;
+}
+
+void audio_buffer_ring::return_slot(audio_buffer *ptr)
+{
+	unsigned int index = (reinterpret_cast <unsigned char *> (ptr) - m_descriptor_storage) / sizeof(audio_buffer);
+	m_released[index] = true;
+
+	/* Reclaim space in allocation order, as far as the oldest buffer that is still in use.*/
+	while((0 != m_desc_count) && m_released[m_desc_tail])
+	{
+		m_bytes_in_use -= m_footprints[m_desc_tail];
+		m_desc_tail = (m_desc_tail + 1) % m_num_descriptors;
+		m_desc_count--;
+	}
+}
+
+void audio_buffer_ring::fill_stats(audio_buffer_pool_stats_t &stats)
+{
+	stats.num_slots = m_num_descriptors;
+	stats.slot_size = 0;
+	stats.capacity_bytes = m_capacity;
+	stats.high_water_mark_bytes = m_bytes_high_water_mark;
+}
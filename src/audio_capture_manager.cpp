@@ -23,15 +23,32 @@
 #include <algorithm>
 #include <chrono>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <sched.h>
 #include "rmfAudioCapture.h"
+#include "capture_backend.h"
+#include "acm_thread.h"
 
 using namespace audiocapturemgr;
 
-const unsigned int QUEUE_CHECK_LOOP_TIME_US = 1000 * 50; //50ms
+static const unsigned int QUEUE_CAPACITY = 8192; //Upper bound on buffers in flight between the driver callback and the processing thread.
+static const unsigned int DROP_LOG_INTERVAL = 100; //Log only every Nth dropped buffer.
+static const unsigned int DEFAULT_DELIVERY_QUEUE_DEPTH = 256; //Per-client. Roughly 10 seconds of 16-bit 48kHz stereo at the default threshold.
 static const size_t DEFAULT_FIFO_SIZE = 64 * 1024;
 static const size_t	DEFAULT_THRESHOLD = 8 * 1024;
 static const unsigned int DEFAULT_DELAY_COMPENSATION = 0;
 static const unsigned int MAX_QMGR_BUFFER_DURATION_S = 30; //safe maximum, beyond which the queue will be flushed without waiting for buffers to be consumed.
+static const unsigned int BUFFER_POOL_FIFO_MULTIPLIER = 4; //Pool holds this many driver FIFOs' worth of buffers.
+static const unsigned int MIN_BUFFER_POOL_SLOTS = 16;
+static const size_t MAX_BUFFER_POOL_FOOTPRINT = 2 * 1024 * 1024; //2MB
+static const unsigned int INGEST_RING_DURATION_S = 2; //Ring holds at least this much audio.
+static const size_t MAX_INGEST_RING_SIZE = 4 * 1024 * 1024; //4MB
+static const unsigned int MIN_INGEST_RING_DESCRIPTORS = 64;
+static const unsigned int DATA_MONITOR_INTERVAL_S = 5;
+static const unsigned int INGEST_HISTORY_LENGTH = 12; //Intervals of ingest metrics kept. A minute's worth.
 
 static void * q_mgr_thread_launcher(void * data)
 {
@@ -57,24 +74,40 @@ inline void q_mgr::unlock(pthread_mutex_t &mutex)
 }
 inline void q_mgr::notify_data_ready()
 {
-	DEBUG("Enter.\n");
-	if(m_notify_new_data)
+	/* Pairs with the fence in wait_for_data(): either the consumer sees the buffer we just pushed, or we see that it is waiting.*/
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(m_consumer_waiting.load(std::memory_order_relaxed) && m_consumer_waiting.exchange(false))
 	{
-		DEBUG("Posting semaphore.\n");
-		REPORT_IF_UNEQUAL(0, sem_post(&m_sem));
-		m_notify_new_data = false;
+		DEBUG("Waking up processing thread.\n");
+		uint64_t count = 1;
+		REPORT_IF_UNEQUAL(sizeof(count), write(m_event_fd, &count, sizeof(count)));
 	}
 }
-void q_mgr::swap_queues() //caller must lock before invoking this.
+
+void q_mgr::wait_for_data()
 {
-	if(!m_current_outgoing_q->empty())
 	{
-		WARN("Outgoing queue wasn't empty. Flushing it now.\n");
-		flush_queue(m_current_outgoing_q);
+		std::unique_lock<std::mutex> dlock(m_drain_mutex);
+		m_consumer_idle = true;
+	}
+	m_drain_cv.notify_all();
+
+	m_consumer_waiting.store(true, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if(m_queue.empty() && m_processing_thread_alive)
+	{
+		DEBUG("Queue is empty. Waiting until a buffer arrives.\n");
+		uint64_t count = 0;
+		if(sizeof(count) != read(m_event_fd, &count, sizeof(count)))
+		{
+			ERROR("Error reading eventfd. errno: 0x%x\n", errno);
+		}
 	}
-	std::vector <audio_buffer *> * temp = m_current_incoming_q;
-	m_current_incoming_q = m_current_outgoing_q;
-	m_current_outgoing_q = temp;
+	/* If the producer has already consumed the flag, there is a stale wakeup pending in the eventfd. It only costs one extra spin of the loop.*/
+	m_consumer_waiting.store(false, std::memory_order_relaxed);
+
+	std::unique_lock<std::mutex> dlock(m_drain_mutex);
+	m_consumer_idle = false;
 }
 
 void q_mgr::flush_queue(std::vector <audio_buffer *> *q)
@@ -153,6 +186,13 @@ namespace audiocapturemgr
 		INFO("Audio properties: %dkHz, %d bit, %d channel, byte rate: %d\n", sampling_rate, bits_per_sample, num_channels, data_rate);
 		return data_rate;
 	}
+
+	unsigned int get_frame_size(const audio_properties_t &audio_props)
+	{
+		unsigned int bits_per_sample, sampling_rate, num_channels;
+		get_individual_audio_parameters(audio_props, sampling_rate, bits_per_sample, num_channels);
+		return bits_per_sample * num_channels / 8;
+	}
 	
 	std::string get_suffix(unsigned int ticker)
 	{
@@ -161,36 +201,84 @@ namespace audiocapturemgr
 		std::string outstring = stream.str();
 		return outstring;
 	}
+
+	unsigned long long get_monotonic_time_us()
+	{
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+	}
+
+	int set_thread_cpu(pthread_t thread, int cpu)
+	{
+		cpu_set_t cpus;
+		CPU_ZERO(&cpus);
+		if(0 > cpu)
+		{
+			long num_cpus = sysconf(_SC_NPROCESSORS_CONF);
+			for(long i = 0; (i < num_cpus) && (i < CPU_SETSIZE); i++)
+			{
+				CPU_SET(i, &cpus);
+			}
+		}
+		else
+		{
+			CPU_SET(cpu, &cpus);
+		}
+		int ret = pthread_setaffinity_np(thread, sizeof(cpus), &cpus);
+		if(0 != ret)
+		{
+			ERROR("Could not set CPU affinity to %d. Error: 0x%x\n", cpu, ret);
+		}
+		return ret;
+	}
+}
+
+q_mgr::q_mgr(const char * device_type) : q_mgr(create_capture_backend(NULL, device_type))
+{
 }
 
-q_mgr::q_mgr() : m_inflow_byte_counter(0), m_num_clients(0), m_notify_new_data(false), m_started(false), m_device_handle(NULL), m_stop_data_monitor(true)
+q_mgr::q_mgr(capture_backend * backend) : m_queue(QUEUE_CAPACITY), m_inflow_byte_counter(0), m_inflow_buffer_counter(0), m_ingest_sequence(0), m_ingest_sample_index(0), m_num_clients(0), m_consumer_waiting(false), m_queue_high_water_mark(0), m_dropped_buffers(0),
+	m_consumer_idle(false), m_started(false), m_backend(backend), m_allocator(NULL), m_ingest_mode(INGEST_POOL), m_device_type(NULL == backend ? "unknown" : backend->get_name()),
+	m_stop_data_monitor(true)
 {
-	INFO("Creating instance 0x%p.\n", static_cast <void *>(this));
+	m_thread_group.cpu = -1;
+	INFO("Creating instance 0x%p for %s audio.\n", static_cast <void *>(this), m_device_type.c_str());
 	pthread_mutexattr_t mutex_attribute;
 	REPORT_IF_UNEQUAL(0, pthread_mutexattr_init(&mutex_attribute));
 	REPORT_IF_UNEQUAL(0, pthread_mutexattr_settype(&mutex_attribute, PTHREAD_MUTEX_ERRORCHECK));
 	REPORT_IF_UNEQUAL(0, pthread_mutex_init(&m_q_mutex, &mutex_attribute));
 	REPORT_IF_UNEQUAL(0, pthread_mutex_init(&m_client_mutex, &mutex_attribute));
-	REPORT_IF_UNEQUAL(0, sem_init(&m_sem, 0, 0));
-	m_current_incoming_q = new std::vector <audio_buffer *>;
-	m_current_outgoing_q = new std::vector <audio_buffer *>; 
-	m_processing_thread_alive = false; //CID:80565 :  Initialize bool variable
+	m_event_fd = eventfd(0, EFD_CLOEXEC);
+	if(0 > m_event_fd)
+	{
+		ERROR("Could not create eventfd. errno: 0x%x\n", errno);
+	}
+	m_outgoing_batch.reserve(m_queue.capacity());
+	m_processing_thread_alive = true; //Set before launch so that an early destructor call can't be overwritten by the thread.
 
 	REPORT_IF_UNEQUAL(0, pthread_create(&m_thread, NULL, q_mgr_thread_launcher, (void *) this));
 	
-	int ret = RMF_AudioCapture_Open(&m_device_handle);
-	INFO("open() result is 0x%x\n", ret);
-	
-	RMF_AudioCapture_Settings settings;
-	RMF_AudioCapture_GetDefaultSettings(&settings);
-	m_audio_properties.format = settings.format;
-	m_audio_properties.sampling_frequency = settings.samplingFreq;
+	audio_properties_t defaults;
+	if(NULL != m_backend)
+	{
+		m_backend->get_default_properties(defaults);
+	}
+	else
+	{
+		defaults.format = racFormat_e16BitStereo;
+		defaults.sampling_frequency = racFreq_e48000;
+	}
+	m_audio_properties.format = defaults.format;
+	m_audio_properties.sampling_frequency = defaults.sampling_frequency;
 	m_audio_properties.fifo_size = DEFAULT_FIFO_SIZE; 
 	m_audio_properties.threshold = DEFAULT_THRESHOLD;
 	m_audio_properties.delay_compensation_ms = DEFAULT_DELAY_COMPENSATION; 
 	m_bytes_per_second = calculate_data_rate(m_audio_properties);
+	m_bytes_per_frame = get_frame_size(m_audio_properties);
 	m_max_queue_size = (MAX_QMGR_BUFFER_DURATION_S * m_bytes_per_second) / m_audio_properties.threshold;
 	INFO("Max incoming queue size is now %d\n", m_max_queue_size);
+	rebuild_allocator();
 }
 q_mgr::~q_mgr()
 {
@@ -199,26 +287,96 @@ q_mgr::~q_mgr()
 	{
 		stop();
 	}
-    if(NULL != m_device_handle)
-    {
-		int ret = RMF_AudioCapture_Close(m_device_handle);
-		INFO("close() result is 0x%x\n", ret);
-		m_device_handle = NULL;
-    }
-	
+	delete m_backend;
+	m_backend = NULL;
 
 	m_processing_thread_alive = false;
-	REPORT_IF_UNEQUAL(0, sem_post(&m_sem));
+	uint64_t count = 1;
+	REPORT_IF_UNEQUAL(sizeof(count), write(m_event_fd, &count, sizeof(count)));
 	REPORT_IF_UNEQUAL(0, pthread_join(m_thread, NULL));
-	REPORT_IF_UNEQUAL(0, sem_destroy(&m_sem));
+	close(m_event_fd);
 	REPORT_IF_UNEQUAL(0, pthread_mutex_destroy(&m_q_mutex));
 	REPORT_IF_UNEQUAL(0, pthread_mutex_destroy(&m_client_mutex));
-	flush_queue(m_current_incoming_q);
-	flush_queue(m_current_outgoing_q);
-	delete m_current_incoming_q;
-	delete m_current_outgoing_q;
+
+	/* Both ends of the queue are quiet now, so it's safe to drain it from here.*/
+	audio_buffer * buf;
+	while(m_queue.pop(buf))
+	{
+		m_outgoing_batch.push_back(buf);
+	}
+	flush_queue(&m_outgoing_batch);
+	m_allocator->retire();
+}
+
+void q_mgr::rebuild_allocator() //caller must lock m_q_mutex if the driver may be delivering data.
+{
+	audio_buffer_allocator * new_allocator = NULL;
+	if(INGEST_RING == m_ingest_mode)
+	{
+		/* Big enough to absorb a couple of seconds of clients falling behind before spilling over to the heap.*/
+		size_t capacity = BUFFER_POOL_FIFO_MULTIPLIER * m_audio_properties.fifo_size;
+		if(capacity < ((size_t)INGEST_RING_DURATION_S * m_bytes_per_second))
+		{
+			capacity = (size_t)INGEST_RING_DURATION_S * m_bytes_per_second;
+		}
+		if(MAX_INGEST_RING_SIZE < capacity)
+		{
+			capacity = MAX_INGEST_RING_SIZE;
+		}
+		/* Drivers may call back with less than a threshold's worth of data, so allow for more buffers than capacity / threshold.*/
+		unsigned int num_descriptors = 2 * (capacity / m_audio_properties.threshold);
+		if(MIN_INGEST_RING_DESCRIPTORS > num_descriptors)
+		{
+			num_descriptors = MIN_INGEST_RING_DESCRIPTORS;
+		}
+		new_allocator = new audio_buffer_ring(capacity, num_descriptors);
+	}
+	else
+	{
+		/* Slots are sized to hold one driver callback's worth of data. Enough of them are created to cover a few driver FIFOs
+		 * in flight, but the total footprint is capped so that unusually small thresholds don't explode the slot count.*/
+		unsigned int slot_size = m_audio_properties.threshold;
+		unsigned int num_slots = BUFFER_POOL_FIFO_MULTIPLIER * (m_audio_properties.fifo_size / slot_size);
+		if(MIN_BUFFER_POOL_SLOTS > num_slots)
+		{
+			num_slots = MIN_BUFFER_POOL_SLOTS;
+		}
+		if((MAX_BUFFER_POOL_FOOTPRINT / slot_size) < num_slots)
+		{
+			num_slots = MAX_BUFFER_POOL_FOOTPRINT / slot_size;
+		}
+		new_allocator = new audio_buffer_pool(slot_size, num_slots);
+	}
+
+	if(NULL != m_allocator)
+	{
+		m_allocator->retire(); //Outstanding buffers will return to the old allocator, which goes away with the last of them.
+	}
+	m_allocator = new_allocator;
+}
+
+int q_mgr::set_ingest_mode(ingest_mode_t mode)
+{
+	if((INGEST_POOL != mode) && (INGEST_RING != mode))
+	{
+		ERROR("Bad ingest mode 0x%x\n", mode);
+		return -1;
+	}
+	lock(m_q_mutex);
+	if(mode != m_ingest_mode)
+	{
+		INFO("Switching ingest mode to %s.\n", (INGEST_RING == mode ? "ring" : "pool"));
+		m_ingest_mode = mode;
+		rebuild_allocator();
+	}
+	unlock(m_q_mutex);
+	return 0;
 }
 
+ingest_mode_t q_mgr::get_ingest_mode()
+{
+	return m_ingest_mode;
+}
 
 int q_mgr::set_audio_properties(audio_properties_t &in_properties)
 {
@@ -231,9 +389,9 @@ int q_mgr::set_audio_properties(audio_properties_t &in_properties)
 	}
 
 	/* Validate incoming parameters.*/
-	if((racFormat_eMax <= in_properties.format) || (racFreq_eMax <= in_properties.sampling_frequency))
+	if((racFormat_eMax <= in_properties.format) || (racFreq_eMax <= in_properties.sampling_frequency) || (0 == in_properties.threshold))
 	{
-		ERROR("Bad parameters. Format: 0x%x, sampling freq: 0x%x\n", in_properties.format, in_properties.sampling_frequency);
+		ERROR("Bad parameters. Format: 0x%x, sampling freq: 0x%x, threshold: %zu\n", in_properties.format, in_properties.sampling_frequency, in_properties.threshold);
 		unlock(m_q_mutex);
 		return -1;
 	}
@@ -242,8 +400,10 @@ int q_mgr::set_audio_properties(audio_properties_t &in_properties)
 
 	/*Update data rate.*/
 	m_bytes_per_second = calculate_data_rate(m_audio_properties);
+	m_bytes_per_frame = get_frame_size(m_audio_properties);
 	m_max_queue_size = (MAX_QMGR_BUFFER_DURATION_S * m_bytes_per_second) / m_audio_properties.threshold;
 	INFO("Max incoming queue size is now %d\n", m_max_queue_size);
+	rebuild_allocator();
 	unlock(m_q_mutex);
 
 	lock(m_client_mutex);
@@ -272,119 +432,165 @@ void q_mgr::get_audio_properties(audio_properties_t &out_properties)
 	out_properties = m_audio_properties;
 }
 
+bool q_mgr::is_available()
+{
+	return ((NULL != m_backend) && m_backend->is_open());
+}
+
 void q_mgr::get_default_audio_properties(audio_properties_t &out_properties)
 {
-	RMF_AudioCapture_Settings settings;
-	RMF_AudioCapture_GetDefaultSettings(&settings);
-	out_properties.format = settings.format;
-	out_properties.sampling_frequency = settings.samplingFreq;
-	out_properties.fifo_size = settings.fifoSize;
-	out_properties.threshold = settings.threshold;
-	out_properties.delay_compensation_ms = settings.delayCompensation_ms;
+	if(NULL != m_backend)
+	{
+		m_backend->get_default_properties(out_properties);
+	}
 }
 unsigned int q_mgr::get_data_rate()
 {
 	return m_bytes_per_second;
 }
 
+void q_mgr::get_queue_stats(queue_stats_t &stats)
+{
+	stats.occupancy = m_queue.size();
+	stats.high_water_mark = m_queue_high_water_mark.load();
+	stats.capacity = m_queue.capacity();
+	stats.dropped_buffers = m_dropped_buffers.load();
+}
+
+void q_mgr::set_cpu_affinity(int cpu)
+{
+	if(set_thread_group_cpu(m_thread_group, cpu))
+	{
+		INFO("Moving %s audio to CPU %d.\n", m_device_type.c_str(), cpu);
+	}
+}
+
+const thread_group_t * q_mgr::get_thread_group()
+{
+	return &m_thread_group;
+}
+
+void q_mgr::get_ingest_metrics(ingest_metrics_t &metrics)
+{
+	metrics.bytes = m_inflow_byte_counter.load(std::memory_order_relaxed);
+	metrics.buffers = m_inflow_buffer_counter.load(std::memory_order_relaxed);
+	m_queue_depth.snapshot(metrics.queue_depth);
+	std::unique_lock<std::mutex> wlock(m_data_monitor_mutex);
+	metrics.history.assign(m_ingest_history.begin(), m_ingest_history.end());
+}
+
+void q_mgr::get_buffer_pool_stats(audio_buffer_pool_stats_t &stats)
+{
+	lock(m_q_mutex);
+	m_allocator->get_stats(stats);
+	unlock(m_q_mutex);
+}
+
 void q_mgr::add_data(unsigned char *buf, unsigned int size)
 {
 	DEBUG("Adding data.\n");
+	unsigned long long timestamp_us = get_monotonic_time_us();
+
 	lock(m_q_mutex);
-	audio_buffer * temp = create_new_audio_buffer(buf, size, 0, m_num_clients);
-	if(m_max_queue_size < m_current_incoming_q->size())
+	audio_buffer * temp = m_allocator->allocate(buf, size, 0, 0); //Refcount is stamped when the buffer is dispatched to clients.
+	unsigned int max_queue_size = m_max_queue_size;
+	/* The callback arrives once the last byte is in. Backdate to the first one.*/
+	unsigned long long duration_us = (0 != m_bytes_per_second ? (unsigned long long)size * 1000000ULL / m_bytes_per_second : 0);
+	unsigned int bytes_per_frame = m_bytes_per_frame;
+	unlock(m_q_mutex);
+	temp->m_timestamp_us = (timestamp_us > duration_us ? timestamp_us - duration_us : 0);
+	/* Both are consumed even if the buffer is dropped below, so that downstream sees the gap.*/
+	temp->m_sequence = m_ingest_sequence++;
+	temp->m_sample_index = m_ingest_sample_index;
+	m_ingest_sample_index += (0 != bytes_per_frame ? size / bytes_per_frame : 0);
+
+	unsigned int occupancy = m_queue.size();
+	m_queue_depth.record(occupancy);
+	if((max_queue_size <= occupancy) || !m_queue.push(temp))
 	{
-		WARN("Incoming queue size over limit. Flushing.\n");
-		flush_queue(m_current_incoming_q);
+		/* The consumer owns the other end of the queue, so older buffers can't be flushed from here. Lose the newest one instead.*/
+		if(0 == (m_dropped_buffers++ % DROP_LOG_INTERVAL))
+		{
+			WARN("Queue size over limit. Dropping incoming buffers. Total dropped: %llu\n", m_dropped_buffers.load());
+		}
+		free_audio_buffer(temp);
 	}
-	m_current_incoming_q->push_back(temp);
-	//TODO: guard against accumulating audio_buffers if there is no consumption.
-	notify_data_ready();
-	unlock(m_q_mutex);
-	m_inflow_byte_counter += size;
+	else
+	{
+		occupancy++;
+		if(m_queue_high_water_mark.load(std::memory_order_relaxed) < occupancy)
+		{
+			m_queue_high_water_mark.store(occupancy, std::memory_order_relaxed);
+		}
+		notify_data_ready();
+	}
+	/* Nobody else writes these, so there's no need for a locked read-modify-write.*/
+	m_inflow_byte_counter.store(m_inflow_byte_counter.load(std::memory_order_relaxed) + size, std::memory_order_relaxed);
+	m_inflow_buffer_counter.store(m_inflow_buffer_counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
 }
 void q_mgr::data_processor_thread()
 {
+	thread_role_scope role(THREAD_ROLE_PROCESSING, &m_thread_group);
 	DEBUG("Launching.\n");
-	m_processing_thread_alive = true;
 	while(m_processing_thread_alive)
 	{
 		/*
-		 * 1. If there are audio_buffers remaining in outbound queue, process them.
-		 * 2. If no audio_buffers remain in outbound queue, wait for semaphore.
-		 * 3. When semaphore is posted, if data is available in the other queue, swap queues.
+		 * 1. Drain whatever is available in the queue into the outgoing batch and process it.
+		 * 2. If the queue is empty, block on the eventfd until the producer signals new data.
 		 * */
 		DEBUG("Enter processing loop.\n");
-		while(!m_current_outgoing_q->empty())
+		audio_buffer * buf;
+		while(m_queue.pop(buf))
 		{
-			process_data();	
+			m_outgoing_batch.push_back(buf);
 		}
-		DEBUG("No data in outgoing queue.\n");
-		/* No more data to be consumed. Gotta check the other queue */
-		lock(m_q_mutex);
-		if(!m_current_incoming_q->empty())
-		{	
-			DEBUG("Incoming queue has buffers. Swapping them.\n");
-			swap_queues();
-			unlock(m_q_mutex);
+
+		if(!m_outgoing_batch.empty())
+		{
+			process_data();
 		}
 		else
 		{
-			/*Block until data is available.*/
-			m_notify_new_data = true;
-			unlock(m_q_mutex);
-			DEBUG("Incoming queue is empty as well. Waiting until a buffer arrives.\n");
-			if(0 != sem_wait(&m_sem))
-			{
-				ERROR("Critical semaphore error. Exiting\n");
-				return;
-			}
-			/* Just in case the semaphore was posted to shut down this thred... */
-			if(!m_processing_thread_alive)
-			{
-				break;
-			}
-
-			lock(m_q_mutex);
-			DEBUG("New data available in incoming queue. Swapping them.\n");
-			swap_queues();
-			unlock(m_q_mutex);
+			wait_for_data();
 		}
-
 	}
 	DEBUG("Exiting.\n");
 }
 
 void q_mgr::update_buffer_references()
 {
+	/* No client has seen these buffers yet, so plain atomic stores will do.*/
 	std::vector <audio_buffer *>::iterator buffer_iter;
-	audio_buffer_get_global_lock();
-	for(buffer_iter = m_current_outgoing_q->begin(); buffer_iter != m_current_outgoing_q->end(); buffer_iter++)
+	for(buffer_iter = m_outgoing_batch.begin(); buffer_iter != m_outgoing_batch.end(); buffer_iter++)
 	{
 		set_ref_audio_buffer(*buffer_iter, m_num_clients);	
 	}
-	audio_buffer_release_global_lock();
 }
 
 void q_mgr::process_data()
 {
-	DEBUG("Processing %d buffers of data.\n", m_current_outgoing_q->size());
+	DEBUG("Processing %d buffers of data.\n", m_outgoing_batch.size());
 
 	lock(m_client_mutex);
 	
 	update_buffer_references();
 	
 	std::vector <audio_buffer *>::iterator buffer_iter;
-	for(buffer_iter = m_current_outgoing_q->begin(); buffer_iter != m_current_outgoing_q->end(); buffer_iter++)
+	for(buffer_iter = m_outgoing_batch.begin(); buffer_iter != m_outgoing_batch.end(); buffer_iter++)
 	{
+		if(0 == m_num_clients)
+		{
+			free_audio_buffer(*buffer_iter); //Nobody to deliver to.
+			continue;
+		}
 		std::vector <audio_capture_client *>::iterator client_iter;
 		for(client_iter = m_clients.begin(); client_iter != m_clients.end(); client_iter++)
 		{
-			(*client_iter)->data_callback(*buffer_iter);	
+			(*client_iter)->enqueue_buffer(*buffer_iter);	
 		}
 	}
 	unlock(m_client_mutex);
-	m_current_outgoing_q->clear();
+	m_outgoing_batch.clear();
 }
 
 int q_mgr::register_client(audio_capture_client * client)
@@ -395,6 +601,7 @@ int q_mgr::register_client(audio_capture_client * client)
 	{
 		m_clients.push_back(client);
 		m_num_clients = m_clients.size();
+		client->start_delivery();
 		if(1 == m_num_clients)
 		{
 			start();
@@ -412,13 +619,21 @@ int q_mgr::unregister_client(audio_capture_client * client)
 {
 	DEBUG("Enter.\n");
 	lock(m_client_mutex);
-	m_clients.erase(std::remove(m_clients.begin(), m_clients.end(), client), m_clients.end());
+	std::vector<audio_capture_client *>::iterator iter = std::remove(m_clients.begin(), m_clients.end(), client);
+	bool was_registered = (iter != m_clients.end());
+	m_clients.erase(iter, m_clients.end());
 	m_num_clients = m_clients.size();
 	if(0 == m_num_clients)
 	{
 		stop();
 	}
 	unlock(m_client_mutex);
+	if(was_registered)
+	{
+		/* No new buffers can reach the client now. Wind down its delivery thread outside the client lock
+		 * so that a slow data_callback doesn't hold up the processing thread.*/
+		client->stop_delivery();
+	}
 	INFO("Total clients: %d.\n", m_num_clients);
 	return 0;
 }
@@ -426,40 +641,59 @@ int q_mgr::unregister_client(audio_capture_client * client)
 void q_mgr::flush_system()
 {
 	/*
-	 * Flush everything in incoming queue.
-	 * Wait until outbound queue is exhausted.
-	 * Return.
+	 * Only the processing thread may remove buffers from the queue, so
+	 * wait until it has drained everything and gone idle.
 	 * */
-	flush_queue(m_current_incoming_q);
-	while(!m_current_outgoing_q->empty())
-	{
-		usleep(QUEUE_CHECK_LOOP_TIME_US);
-	}
+	std::unique_lock<std::mutex> dlock(m_drain_mutex);
+	m_drain_cv.wait(dlock, [this](){return (m_consumer_idle && m_queue.empty()) || !m_processing_thread_alive;});
 	INFO("Exit.\n");
 }
 
-static void log_settings(RMF_AudioCapture_Settings &settings)
-{
-	INFO("Format 0x%x, sampling freq: 0x%x, FIFO size: %d, threshold: %d, delay compensation: %d\n",
-		settings.format, settings.samplingFreq, settings.fifoSize, settings.threshold, settings.delayCompensation_ms);
-}
-
 void q_mgr::data_monitor()
 {
+	thread_role_scope role(THREAD_ROLE_MONITOR);
 	INFO("data_monitor thread has launched.\n");
-	unsigned int saved_byte_counter = 0;
+	unsigned long long saved_byte_counter = m_inflow_byte_counter.load(std::memory_order_relaxed);
+	unsigned long long saved_buffer_counter = m_inflow_buffer_counter.load(std::memory_order_relaxed);
+	unsigned long long saved_dropped_buffers = m_dropped_buffers.load();
+	acm_histogram_snapshot saved_queue_depth;
+	m_queue_depth.snapshot(saved_queue_depth);
 	bool is_stalled = false;
 	std::unique_lock<std::mutex> wlock(m_data_monitor_mutex);
 	while(false == m_stop_data_monitor)
 	{
-		auto ret = m_data_monitor_cv.wait_for(wlock, std::chrono::seconds(5), [this](){return m_stop_data_monitor;});
+		auto ret = m_data_monitor_cv.wait_for(wlock, std::chrono::seconds(DATA_MONITOR_INTERVAL_S), [this](){return m_stop_data_monitor;});
 		if(false == ret)
 		{ //This indicates a timeout or spurious wake.
-			if(saved_byte_counter == m_inflow_byte_counter)
+			unsigned long long byte_counter = m_inflow_byte_counter.load(std::memory_order_relaxed);
+			unsigned long long buffer_counter = m_inflow_buffer_counter.load(std::memory_order_relaxed);
+			unsigned long long dropped_buffers = m_dropped_buffers.load();
+			acm_histogram_snapshot queue_depth;
+			m_queue_depth.snapshot(queue_depth);
+
+			acm_histogram_snapshot interval_queue_depth = queue_depth;
+			interval_queue_depth.subtract(saved_queue_depth);
+			ingest_interval_t interval;
+			interval.timestamp_us = get_monotonic_time_us();
+			interval.bytes_per_second = (byte_counter - saved_byte_counter) / DATA_MONITOR_INTERVAL_S;
+			interval.buffers = buffer_counter - saved_buffer_counter;
+			interval.dropped_buffers = dropped_buffers - saved_dropped_buffers;
+			interval.mean_queue_depth = interval_queue_depth.get_mean();
+			interval.peak_queue_depth = interval_queue_depth.get_percentile(1.0);
+			m_ingest_history.push_back(interval);
+			if(INGEST_HISTORY_LENGTH < m_ingest_history.size())
+			{
+				m_ingest_history.pop_front();
+			}
+			saved_buffer_counter = buffer_counter;
+			saved_dropped_buffers = dropped_buffers;
+			saved_queue_depth = queue_depth;
+
+			if(saved_byte_counter == byte_counter)
 			{
 				if(false == is_stalled)
 				{
-					WARN("Data inflow has stalled at %u bytes for instance 0x%p.\n", saved_byte_counter, static_cast <void *>(this));
+					WARN("Data inflow has stalled at %llu bytes for instance 0x%p.\n", saved_byte_counter, static_cast <void *>(this));
 					is_stalled = true;
 				}
 				else
@@ -467,7 +701,7 @@ void q_mgr::data_monitor()
 			}
 			else
 			{
-				saved_byte_counter = m_inflow_byte_counter;
+				saved_byte_counter = byte_counter;
 				if(true == is_stalled)
 				{
 					INFO("Data inflow has resumed for instance 0x%p.\n", static_cast <void *>(this));
@@ -487,22 +721,11 @@ int q_mgr::start()
 		return 0;
 	}
 	
-	m_inflow_byte_counter = 0;
-	RMF_AudioCapture_Settings settings;
-	memset (&settings, 0, sizeof(RMF_AudioCapture_Settings));
-	RMF_AudioCapture_GetDefaultSettings(&settings);
-	
-	settings.cbBufferReady = &q_mgr::data_callback;
-	settings.cbBufferReadyParm = (void *)this;
-	settings.fifoSize = m_audio_properties.fifo_size; 
-	settings.threshold = m_audio_properties.threshold;
-	settings.delayCompensation_ms = m_audio_properties.delay_compensation_ms;
-	settings.format = m_audio_properties.format;
-	settings.samplingFreq = m_audio_properties.sampling_frequency;
-
-	log_settings(settings);
-	
-	int ret = RMF_AudioCapture_Start(m_device_handle, &settings);
+	int ret = -1;
+	if(NULL != m_backend)
+	{
+		ret = m_backend->start(m_audio_properties, &q_mgr::data_callback, (void *)this);
+	}
 	INFO("start() result is 0x%x\n", ret);
 	m_started = true;
 
@@ -527,9 +750,19 @@ int q_mgr::stop()
 	m_data_monitor_cv.notify_all();
 	m_data_monitor_thread.join();
 
-	int ret = RMF_AudioCapture_Stop(m_device_handle);
+	int ret = -1;
+	if(NULL != m_backend)
+	{
+		ret = m_backend->stop();
+	}
 	INFO("stop() result is 0x%x\n", ret);
 	m_started = false;
+
+	audio_buffer_pool_stats_t stats;
+	get_buffer_pool_stats(stats);
+	INFO("Buffer %s stats: hits %llu, misses %llu, in use %u, high-water mark %u of %u slots, %u of %u bytes.\n",
+		(INGEST_RING == m_ingest_mode ? "ring" : "pool"), stats.hits, stats.misses, stats.in_use, stats.high_water_mark,
+		stats.num_slots, stats.high_water_mark_bytes, stats.capacity_bytes);
 	return ret;
 }
 
@@ -543,18 +776,168 @@ int audio_capture_client::data_callback(audio_buffer *buf)
 	release_buffer(buf);
 	return 0;
 } 
-audio_capture_client::audio_capture_client(q_mgr * manager): m_priority(0), m_manager(manager)
+audio_capture_client::audio_capture_client(q_mgr * manager): m_priority(0), m_delivery_thread_alive(false), m_overflow_pending(false),
+	m_overflow_policy(DROP_OLDEST), m_max_queue_depth(DEFAULT_DELIVERY_QUEUE_DEPTH), m_manager(manager)
 { 
 	pthread_mutexattr_t mutex_attribute;
 	REPORT_IF_UNEQUAL(0, pthread_mutexattr_init(&mutex_attribute));
 	REPORT_IF_UNEQUAL(0, pthread_mutexattr_settype(&mutex_attribute, PTHREAD_MUTEX_ERRORCHECK));
 	REPORT_IF_UNEQUAL(0, pthread_mutex_init(&m_mutex, &mutex_attribute));
+	memset(&m_delivery_stats, 0, sizeof(m_delivery_stats));
 } 
 audio_capture_client::~audio_capture_client()
 {	
+	stop_delivery();
 	REPORT_IF_UNEQUAL(0, pthread_mutex_destroy(&m_mutex));
 } 
 
+void audio_capture_client::enqueue_buffer(audio_buffer *buf)
+{
+	bool notify = false;
+	{
+		std::unique_lock<std::mutex> dlock(m_delivery_mutex);
+		if(!m_delivery_thread_alive)
+		{
+			m_delivery_stats.dropped++;
+			dlock.unlock();
+			release_buffer(buf);
+			return;
+		}
+
+		if(m_max_queue_depth <= m_delivery_queue.size())
+		{
+			switch(m_overflow_policy)
+			{
+				case DROP_OLDEST:
+					release_buffer(m_delivery_queue.front());
+					m_delivery_queue.pop_front();
+					m_delivery_stats.dropped++;
+					break;
+
+				case DROP_NEWEST:
+					m_delivery_stats.dropped++;
+					dlock.unlock();
+					release_buffer(buf);
+					return;
+
+				case DISCONNECT:
+					WARN("Delivery queue of client 0x%p is full. Disconnecting.\n", static_cast <void *>(this));
+					m_delivery_stats.dropped += m_delivery_queue.size();
+					m_delivery_stats.disconnects++;
+					flush_delivery_queue();
+					m_overflow_pending = true;
+					break;
+			}
+		}
+		m_delivery_queue.push_back(buf);
+		notify = (1 == m_delivery_queue.size()) || m_overflow_pending;
+		if(m_delivery_stats.high_water_mark < m_delivery_queue.size())
+		{
+			m_delivery_stats.high_water_mark = m_delivery_queue.size();
+		}
+	}
+	if(notify)
+	{
+		m_delivery_cv.notify_one();
+	}
+}
+
+void audio_capture_client::flush_delivery_queue() //caller must hold m_delivery_mutex.
+{
+	std::deque <audio_buffer *>::iterator iter;
+	for(iter = m_delivery_queue.begin(); iter != m_delivery_queue.end(); iter++)
+	{
+		release_buffer(*iter);
+	}
+	m_delivery_queue.clear();
+}
+
+void audio_capture_client::delivery_thread()
+{
+	thread_role_scope role(THREAD_ROLE_DELIVERY, m_manager->get_thread_group());
+	DEBUG("Enter.\n");
+	std::unique_lock<std::mutex> dlock(m_delivery_mutex);
+	while(true)
+	{
+		m_delivery_cv.wait(dlock, [this](){return !m_delivery_thread_alive || m_overflow_pending || !m_delivery_queue.empty();});
+		if(!m_delivery_thread_alive)
+		{
+			break;
+		}
+		if(m_overflow_pending)
+		{
+			m_overflow_pending = false;
+			dlock.unlock();
+			notify_event(AUDIO_DELIVERY_OVERFLOW_EVENT);
+			dlock.lock();
+			continue;
+		}
+		audio_buffer * buf = m_delivery_queue.front();
+		m_delivery_queue.pop_front();
+		m_delivery_stats.delivered++;
+		dlock.unlock();
+		unsigned long long timestamp_us = buf->m_timestamp_us; //buf may be gone once data_callback() returns.
+		unsigned long long start_us = get_monotonic_time_us();
+		data_callback(buf);
+		m_callback_duration.record(get_monotonic_time_us() - start_us);
+		if(0 != timestamp_us)
+		{
+			m_delivery_latency.record(start_us > timestamp_us ? start_us - timestamp_us : 0);
+		}
+		dlock.lock();
+	}
+	DEBUG("Exit.\n");
+}
+
+void audio_capture_client::start_delivery()
+{
+	std::unique_lock<std::mutex> dlock(m_delivery_mutex);
+	if(m_delivery_thread_alive)
+	{
+		return;
+	}
+	m_delivery_thread_alive = true;
+	m_overflow_pending = false;
+	m_delivery_thread = std::thread(&audio_capture_client::delivery_thread, this);
+}
+
+void audio_capture_client::stop_delivery()
+{
+	{
+		std::unique_lock<std::mutex> dlock(m_delivery_mutex);
+		m_delivery_thread_alive = false;
+	}
+	m_delivery_cv.notify_all();
+	if(m_delivery_thread.joinable())
+	{
+		m_delivery_thread.join();
+	}
+	std::unique_lock<std::mutex> dlock(m_delivery_mutex);
+	flush_delivery_queue();
+}
+
+void audio_capture_client::set_delivery_policy(overflow_policy_t policy, unsigned int max_queue_depth)
+{
+	std::unique_lock<std::mutex> dlock(m_delivery_mutex);
+	m_overflow_policy = policy;
+	m_max_queue_depth = (0 == max_queue_depth ? 1 : max_queue_depth);
+	INFO("Client 0x%p: overflow policy %d, max queue depth %u.\n", static_cast <void *>(this), m_overflow_policy, m_max_queue_depth);
+}
+
+void audio_capture_client::get_delivery_stats(delivery_stats_t &stats)
+{
+	std::unique_lock<std::mutex> dlock(m_delivery_mutex);
+	stats = m_delivery_stats;
+	stats.queue_depth = m_delivery_queue.size();
+}
+
+void audio_capture_client::get_delivery_metrics(delivery_metrics_t &metrics)
+{
+	m_delivery_latency.snapshot(metrics.latency_us);
+	m_callback_duration.snapshot(metrics.callback_us);
+	m_conversion_cost.snapshot(metrics.conversion_us);
+}
+
 void audio_capture_client::set_manager(q_mgr *mgr)
 {
 	m_manager = mgr;
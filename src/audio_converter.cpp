@@ -18,13 +18,18 @@
 */
 #include <string.h>
 #include "audio_converter.h"
+#include "resampler.h"
 #include <stdint.h>
-const unsigned int TEMPORARY_BUFFER_SIZE = 100 * 1024; //100kB
+#include <math.h>
+const unsigned int MAX_SPAN_FRAMES = 4096; //Output frames requested from the sink at a time.
 
-audio_converter::audio_converter(const audiocapturemgr::audio_properties_t &in_props, const audiocapturemgr::audio_properties_t &out_props, audio_converter_sink &sink) : m_in_props(in_props), m_out_props(out_props), m_sink(sink)
+audio_converter::audio_converter(const audiocapturemgr::audio_properties_t &in_props, const audiocapturemgr::audio_properties_t &out_props, audio_converter_sink &sink) : m_in_props(in_props), m_out_props(out_props), m_sink(sink),
+	m_kernels(get_audio_kernels()), m_in_channels(0), m_out_channels(0), m_in_frame_size(0), m_out_frame_size(0), m_in_rate(0), m_out_rate(0),
+	m_input_frames(0), m_output_frames(0), m_resampler(NULL), m_carry_size(0)
 {
 	m_downsample = false; //CID:88634 - Intialize bool variables
 	m_downmix = false;
+	m_narrow = false;
 	process_conversion_params();
 }
 
@@ -36,6 +41,7 @@ int audio_converter::process_conversion_params()
 	bool sample_rate_ok = false;
 	bool downmix = false;
 	bool downsample = false;
+	bool narrow = false;
 
 	m_op = UNSUPPORTED_CONVERSION;
 
@@ -64,6 +70,25 @@ int audio_converter::process_conversion_params()
 			format_ok = true;
 			break;
 		}
+
+		if((racFormat_e16BitMono == m_out_props.format) && (
+			(racFormat_e24BitStereo == m_in_props.format) ||
+			(racFormat_e24Bit5_1 == m_in_props.format)))
+		{
+			INFO("Convert 24-bit multichannel to 16-bit mono.\n");
+			format_ok = true;
+			downmix = true;
+			narrow = true;
+			break;
+		}
+
+		if((racFormat_e16BitStereo == m_out_props.format) && (racFormat_e24BitStereo == m_in_props.format))
+		{
+			INFO("Convert 24-bit stereo to 16-bit stereo.\n");
+			format_ok = true;
+			narrow = true;
+			break;
+		}
 		ERROR("Unsupported format conversion: 0x%x to 0x%x.\n", m_in_props.format, m_out_props.format);
 	
 	} while(false);
@@ -75,27 +100,37 @@ int audio_converter::process_conversion_params()
 		audiocapturemgr::get_individual_audio_parameters(m_in_props, in_sampling_rate, in_bits_per_sample, in_num_channels);
 		audiocapturemgr::get_individual_audio_parameters(m_out_props, out_sampling_rate, out_bits_per_sample, out_num_channels);
 
-		if(out_sampling_rate > in_sampling_rate)
+		if((0 == in_sampling_rate) || (0 == out_sampling_rate))
 		{
-			ERROR("Cannot up-sample. %d to %d.\n", in_sampling_rate,  out_sampling_rate);
+			ERROR("Bad sampling rates: %d to %d.\n", in_sampling_rate,  out_sampling_rate);
 		}
-		else if(0 != (in_sampling_rate % out_sampling_rate))
+		else if((out_sampling_rate != in_sampling_rate) && (16 != in_bits_per_sample) && !narrow)
 		{
-			ERROR("Incompatible sampling rates: %d to %d.\n", in_sampling_rate,  out_sampling_rate);
+			ERROR("Resampling is only supported with 16-bit output. %d to %d.\n", in_sampling_rate,  out_sampling_rate);
 		}
 		else
 		{
 			sample_rate_ok = true;
-			if(out_sampling_rate < in_sampling_rate)
+			m_in_channels = in_num_channels;
+			m_out_channels = (downmix ? 1 : in_num_channels);
+			m_in_frame_size = in_num_channels * in_bits_per_sample / 8;
+			m_out_frame_size = m_out_channels * (narrow ? 16 : in_bits_per_sample) / 8;
+			m_in_rate = in_sampling_rate;
+			m_out_rate = out_sampling_rate;
+			if(out_sampling_rate != in_sampling_rate)
 			{
 				downsample = true;
-				INFO("Downsample from %d to %d\n", in_sampling_rate, out_sampling_rate);
+				INFO("Resample from %d to %d\n", in_sampling_rate, out_sampling_rate);
+				m_resampler = new polyphase_resampler(in_sampling_rate, out_sampling_rate, m_out_channels);
 			}
 		}
 	}
 
 	if(format_ok && sample_rate_ok) 
 	{
+		m_downmix = downmix;
+		m_downsample = downsample;
+		m_narrow = narrow;
 		if (downmix && downsample)
 		{
 			m_op = DOWNMIX_AND_DOWNSAMPLE;
@@ -108,6 +143,10 @@ int audio_converter::process_conversion_params()
 		{
 			m_op = DOWNSAMPLE;
 		}
+		else if (narrow)
+		{
+			m_op = CHANGE_SAMPLE_SIZE;
+		}
 		else
 		{
 			m_op = NO_CONVERSION;
@@ -117,181 +156,165 @@ int audio_converter::process_conversion_params()
 	return ret;
 }
 
-int audio_converter::downsample_and_downmix(const std::list<audio_buffer *> &queue, int size)
+audio_converter::~audio_converter()
 {
-	int ret = 0;
-	
-	unsigned int in_sampling_rate, in_bits_per_sample, in_num_channels;
-	audiocapturemgr::get_individual_audio_parameters(m_in_props, in_sampling_rate, in_bits_per_sample, in_num_channels);
-
-	unsigned int out_sampling_rate, out_bits_per_sample, out_num_channels;
-	audiocapturemgr::get_individual_audio_parameters(m_out_props, out_sampling_rate, out_bits_per_sample, out_num_channels);
-
-	unsigned int sample_size = in_bits_per_sample / 8;
-	unsigned int frame_size = in_num_channels * sample_size; 
-	unsigned int leap_value = frame_size * in_sampling_rate / out_sampling_rate;
-	unsigned int write_length = (DOWNMIX_AND_DOWNSAMPLE == m_op ? sample_size : frame_size ); //Write only first sample of a frame if we're downmixing.
-
-	int read_offset = 0;
-	
-	unsigned int temp_buffer_write_offset = 0;
+	delete m_resampler;
+}
 
-	for(auto &entry: queue)
+void audio_converter::convert_format(const unsigned char * src, unsigned int frames, int16_t * dst)
+{
+	if(m_narrow)
 	{
-		char * ptr = (char *)entry->m_start_ptr + read_offset;
-		if(0 != (entry->m_size % frame_size))
+		if(!m_downmix)
 		{
-			WARN("Audio buffer not aligned with frame boundary!\n");
+			m_kernels->s24_to_s16(src, dst, frames * m_in_channels);
 		}
-
-		int buffer_size = entry->m_size;
-		while (buffer_size > 0)
-		{
-			m_sink.write_data(ptr, write_length);
-			buffer_size -= leap_value;
-			ptr += leap_value;
-		}
-
-		/*If the value of buffer_size when exiting the above loop is a negative value (it can only be zero or negative), we need to skip that many bytes
-		 * when processing the next buffer in the list. This is to maintain the continuity of 'frame-skipping' across buffer boundaries. read_offset will 
-		 * now be a positive value that we advance the read pointer of the next buffer by.
-		 * 
-		 * Illustration:
-		 * If we're skipping 3 samples for every 4 samples read (i. e. writing only one sample for every 4 samples read), and we ran out of data in the current
-		 * buffer after skipping just one sample, the remaining 2 samples need to be skipped at the beginning of the next buffer.
-		 * */
-		read_offset = -1 * buffer_size;
-
-		size -= entry->m_size;
-		if(0 >= size)
+		else
 		{
-			break;
+			m_scratch.resize(frames * m_in_channels);
+			m_kernels->s24_to_s16(src, &m_scratch[0], frames * m_in_channels);
+			m_kernels->decimate_s16(&m_scratch[0], dst, frames, m_in_channels, true, 1);
 		}
 	}
-	return ret;
+	else if(m_downmix && (2 == m_in_channels))
+	{
+		m_kernels->stereo_to_mono_s16((const int16_t *)src, dst, frames);
+	}
+	else if(m_downmix)
+	{
+		m_kernels->decimate_s16((const int16_t *)src, dst, frames, m_in_channels, true, 1);
+	}
+	else
+	{
+		memcpy(dst, src, frames * m_in_frame_size);
+	}
 }
 
-
-int audio_converter::downmix(const std::list<audio_buffer *> &queue, int size)
+int audio_converter::transform(const unsigned char * ptr, unsigned int size)
 {
-	int ret = 0;
-	
-	unsigned int in_sampling_rate, in_bits_per_sample, in_num_channels;
-	audiocapturemgr::get_individual_audio_parameters(m_in_props, in_sampling_rate, in_bits_per_sample, in_num_channels);
+	unsigned int frames = size / m_in_frame_size;
+	const unsigned char * src = ptr;
 
-	unsigned int sample_size = in_bits_per_sample / 8;
-	unsigned int frame_size = in_num_channels * sample_size;
-	
-	audio_converter_memory_sink * memsink = dynamic_cast <audio_converter_memory_sink * > (&m_sink);
-
-	/* Targeted optimizations to downmix 16-bit 2 chanel audio to 1-channel. */
-	if(memsink && (16 == in_bits_per_sample) && (2 == in_num_channels))
+	while(0 < frames)
 	{
-		INFO("Running special optimizations for 16-bit stereo to mono conversion.\n");
-		int16_t * dptr = (int16_t *)memsink->get_buffer();
-		unsigned int write_offset = memsink->get_size();
-		for(auto &entry: queue)
+		unsigned int chunk = (frames < MAX_SPAN_FRAMES ? frames : MAX_SPAN_FRAMES);
+		unsigned int out_frames = (m_resampler ? m_resampler->get_output_frames(chunk) : chunk);
+		unsigned int out_bytes = out_frames * m_out_frame_size;
+		int16_t * dst = NULL;
+		if(0 != out_bytes)
 		{
-			int16_t * sptr = (int16_t *)entry->m_start_ptr;
-			unsigned int data_remaining = entry->m_size;
-			while(32 <= data_remaining) 
-			{
-				dptr[0] = sptr[0];
-				dptr[1] = sptr[2];
-				dptr[2] = sptr[4];
-				dptr[3] = sptr[6];
-				dptr[4] = sptr[8];
-				dptr[5] = sptr[10];
-				dptr[6] = sptr[12];
-				dptr[7] = sptr[14];
-				dptr += 8;
-				sptr += 16;
-				data_remaining -= 16 * 2;
-				write_offset += 8 * 2;
-			}
-		
-			/* If there is any remaining data making up less than 32 bytes, process that as well*/
-			while(0 != data_remaining)
+			dst = (int16_t *)m_sink.get_write_span(out_bytes);
+			if(NULL == dst)
 			{
-				*dptr = *sptr;
-				dptr += 1;
-				sptr += 2;
-				data_remaining -= 2 * 2;
-				write_offset += 1 * 2;
+				ERROR("Sink has no room for %d bytes.\n", out_bytes);
+				return -1;
 			}
+		}
 
+		/* Sample format and channels are converted first, so that the resampler has as little to do as possible.*/
+		if(m_resampler)
+		{
+			m_stage.resize(chunk * m_out_channels);
+			convert_format(src, chunk, &m_stage[0]);
+			m_resampler->process(&m_stage[0], chunk, dst);
 		}
-		memsink->m_write_offset = write_offset;
-		INFO("Final write offset is %d. Final value of dptr: %p\n", write_offset, dptr); //CID:128015 - Type cast
-	}
-	else
-	{
-		for(auto &entry: queue)
+		else
 		{
-			char * ptr = (char *)entry->m_start_ptr;
-			if(0 != (entry->m_size % frame_size))
-			{
-				WARN("Audio buffer not aligned with frame boundary!\n");
-			}
-
-			unsigned int buffer_size = entry->m_size;
-			while (buffer_size > 0)
-			{
-				m_sink.write_data(ptr, sample_size);		
-				buffer_size -= frame_size;
-				ptr += frame_size;
-			}
+			convert_format(src, chunk, dst);
+		}
 
-			size -= entry->m_size;
-			if(0 >= size)
-			{
-				break;
-			}
+		if((0 != out_bytes) && (0 > m_sink.commit(out_bytes)))
+		{
+			ERROR("Write error!\n");
+			return -1;
 		}
+		src += chunk * m_in_frame_size;
+		frames -= chunk;
+		m_input_frames += chunk;
+		m_output_frames += out_frames;
 	}
-	return ret;
+	return 0;
 }
-#if 0
-int audio_converter::downsample(std::list<audio_buffer *> &queue, int size)
+
+/* Splits the input at frame boundaries for transform(), holding back any trailing partial frame until the next call
+ * completes it.*/
+int audio_converter::feed(const unsigned char * ptr, unsigned int size)
 {
 	int ret = 0;
-	
-	unsigned int in_sampling_rate, in_bits_per_sample, in_num_channels;
-	audiocapturemgr::get_individual_audio_parameters(m_in_props, in_sampling_rate, in_bits_per_sample, in_num_channels);
-
-	unsigned int out_sampling_rate, out_bits_per_sample, out_num_channels;
-	audiocapturemgr::get_individual_audio_parameters(m_out_props, out_sampling_rate, out_bits_per_sample, out_num_channels);
-
-	unsigned int frame_size = in_num_channels * in_bits_per_sample * 8; 
-	unsigned int leap_value = frame_size * in_sampling_rate / out_sampling_rate;
-	int read_offset = 0;
-
-	for(auto &entry: queue)
+	if(0 != m_carry_size)
 	{
-		char * ptr = (char *)entry->m_start_ptr + read_offset;
-		if(0 != (entry->m_size % frame_size))
+		unsigned int needed = m_in_frame_size - m_carry_size;
+		if(size < needed)
 		{
-			WARN("Audio buffer not aligned with frame boundary!\n");
+			memcpy(&m_carry[m_carry_size], ptr, size);
+			m_carry_size += size;
+			return 0;
 		}
-
-		int buffer_size = entry->m_size;
-		while (buffer_size > 0)
+		memcpy(&m_carry[m_carry_size], ptr, needed);
+		m_carry_size = 0;
+		ret = transform(m_carry, m_in_frame_size);
+		if(0 > ret)
 		{
-			m_sink.write_data(ptr, frame_size); //TODO Check for errors
-			buffer_size -= leap_value;
-			ptr += leap_value;
+			return ret;
 		}
-		read_offset = -1 * buffer_size;
+		ptr += needed;
+		size -= needed;
+	}
 
-		size -= entry->m_size;
-		if(0 >= size)
-		{
-			break;
-		}
+	unsigned int tail = size % m_in_frame_size;
+	if(0 != ((uintptr_t)ptr % sizeof(int16_t)))
+	{
+		/* Kernels load whole samples, so input that a carried frame has left on an odd address is realigned first.*/
+		m_bounce.assign(ptr, ptr + size - tail);
+		ret = transform(m_bounce.data(), size - tail);
 	}
+	else
+	{
+		ret = transform(ptr, size - tail);
+	}
+	memcpy(m_carry, ptr + size - tail, tail);
+	m_carry_size = tail;
 	return ret;
 }
-#endif 
+
+void audio_converter::reset()
+{
+	if(m_resampler)
+	{
+		m_resampler->reset();
+	}
+	m_carry_size = 0;
+	m_input_frames = 0;
+	m_output_frames = 0;
+}
+
+void audio_converter::get_output_position(const audio_buffer * buffer, unsigned long long &timestamp_us, unsigned long long &sample_index) const
+{
+	timestamp_us = buffer->m_timestamp_us;
+	sample_index = buffer->m_sample_index;
+	if((NO_CONVERSION == m_op) || (UNSUPPORTED_CONVERSION == m_op))
+	{
+		return;
+	}
+
+	/* Work out which input frame the next output frame comes from, relative to the start of this buffer. A frame
+	 * carried over from the last buffer began before it.*/
+	double source = (double)m_input_frames;
+	if(m_resampler)
+	{
+		source = (double)m_output_frames * m_in_rate / m_out_rate - m_resampler->get_delay_frames();
+	}
+	double offset = source - ((double)m_input_frames + (double)m_carry_size / m_in_frame_size);
+
+	long long offset_us = llround(offset * 1000000.0 / m_in_rate);
+	if(0 != timestamp_us)
+	{
+		timestamp_us = ((long long)timestamp_us + offset_us > 0 ? timestamp_us + offset_us : 0);
+	}
+	double input_index = (double)buffer->m_sample_index + offset;
+	sample_index = (0.0 < input_index ? (unsigned long long)llround(input_index * m_out_rate / m_in_rate) : 0);
+}
+
 int audio_converter::passthrough(const std::list<audio_buffer *> &queue, int size)
 {
 	int ret = -1;
@@ -319,15 +342,26 @@ int audio_converter::convert(const std::list<audio_buffer *> &queue, unsigned in
 	switch(m_op)
 	{
 		case DOWNMIX_AND_DOWNSAMPLE:
-			ret = downsample_and_downmix(queue, size);
-			break;
-		
 		case DOWNMIX:
-			ret = downmix(queue, size);
-			break;
-
 		case DOWNSAMPLE:
-			ret = downsample_and_downmix(queue, size);
+		case CHANGE_SAMPLE_SIZE:
+			reset(); //Each call converts a clip of its own.
+			ret = 0;
+			for(auto &entry: queue)
+			{
+				unsigned int length = (entry->m_size < size ? entry->m_size : size);
+				ret = feed(entry->m_start_ptr, length);
+				size -= length;
+				if((0 > ret) || (0 == size))
+				{
+					break;
+				}
+			}
+			if(0 != m_carry_size)
+			{
+				WARN("Audio buffer not aligned with frame boundary!\n");
+				m_carry_size = 0;
+			}
 			break;
 
 		case NO_CONVERSION:
@@ -342,6 +376,43 @@ int audio_converter::convert(const std::list<audio_buffer *> &queue, unsigned in
 	return ret;
 }
 
+int audio_converter::convert(const audio_buffer * buffer)
+{
+	int ret = -1;
+	switch(m_op)
+	{
+		case DOWNMIX_AND_DOWNSAMPLE:
+		case DOWNMIX:
+		case DOWNSAMPLE:
+		case CHANGE_SAMPLE_SIZE:
+			ret = feed(buffer->m_start_ptr, buffer->m_size);
+			break;
+
+		case NO_CONVERSION:
+			ret = m_sink.write_data((const char *)buffer->m_start_ptr, buffer->m_size);
+			break;
+
+		default:
+			ERROR("Unsupported conversion.\n");
+			ret = -1;
+	}
+	return ret;
+}
+
+char * audio_converter_sink::get_write_span(unsigned int size)
+{
+	if(m_staging.size() < size)
+	{
+		m_staging.resize(size);
+	}
+	return &m_staging[0];
+}
+
+int audio_converter_sink::commit(unsigned int size)
+{
+	return write_data(&m_staging[0], size);
+}
+
 int audio_converter_file_sink::write_data(const char * ptr, unsigned int size)
 {
 	int ret = 0;
@@ -349,8 +420,7 @@ int audio_converter_file_sink::write_data(const char * ptr, unsigned int size)
 	return ret;
 }
 
-
-audio_converter_memory_sink::audio_converter_memory_sink(unsigned int max_size) : m_write_offset(0)
+audio_converter_memory_sink::audio_converter_memory_sink(unsigned int max_size) : m_write_offset(0), m_max_size(max_size)
 {
 	m_buffer = new char[max_size];
 	INFO("Created with size %d. ptr: %p, this: %p\n", max_size, m_buffer, this); //CID:127553 and CID:127680 - Type cast
@@ -365,7 +435,28 @@ audio_converter_memory_sink::~audio_converter_memory_sink()
 int audio_converter_memory_sink::write_data(const char * ptr, unsigned int size)
 {
 	int ret = 0;
+	if((m_max_size - m_write_offset) < size)
+	{
+		ERROR("Memory sink overflow. Size %d, offset %d, write %d.\n", m_max_size, m_write_offset, size);
+		return -1;
+	}
 	memcpy(&m_buffer[m_write_offset], ptr, size);
 	m_write_offset += size;
 	return ret;
 }
+
+char * audio_converter_memory_sink::get_write_span(unsigned int size)
+{
+	if((m_max_size - m_write_offset) < size)
+	{
+		ERROR("Memory sink overflow. Size %d, offset %d, span %d.\n", m_max_size, m_write_offset, size);
+		return NULL;
+	}
+	return &m_buffer[m_write_offset];
+}
+
+int audio_converter_memory_sink::commit(unsigned int size)
+{
+	m_write_offset += size;
+	return 0;
+}
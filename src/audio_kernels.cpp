@@ -0,0 +1,621 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "audio_kernels.h"
+#include "basic_types.h"
+#include <string.h>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ACM_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define ACM_KERNELS_NEON
+#include <arm_neon.h>
+#endif
+
+/* Every implementation below handles the bulk of the data with its own instructions and leaves the tail, and any stride
+ * it has no fast path for, to these. Strided kernels only read up to src[(count - 1) * stride], so vector loops stop one
+ * output short of where a full-width load would run past it.*/
+static void copy_strided_s16_scalar(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride)
+{
+	for(unsigned int i = 0; i < count; i++)
+	{
+		dst[i] = src[i * stride];
+	}
+}
+
+static void copy_strided_s32_scalar(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride)
+{
+	for(unsigned int i = 0; i < count; i++)
+	{
+		memcpy(&dst[2 * i], &src[2 * i * stride], 4);
+	}
+}
+
+static void stereo_to_mono_s16_scalar(const int16_t * src, int16_t * dst, unsigned int frames)
+{
+	copy_strided_s16_scalar(src, dst, frames, 2);
+}
+
+static void s24_to_s16_scalar(const uint8_t * src, int16_t * dst, unsigned int samples)
+{
+	for(unsigned int i = 0; i < samples; i++)
+	{
+		dst[i] = (int16_t)(src[3 * i + 1] | (src[3 * i + 2] << 8));
+	}
+}
+
+typedef void (*copy_strided_t)(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride);
+
+static inline void decimate_s16_common(const int16_t * src, int16_t * dst, unsigned int out_frames, unsigned int channels, bool first_channel_only, unsigned int ratio,
+		copy_strided_t copy_s16, copy_strided_t copy_s32)
+{
+	if(first_channel_only || (1 == channels))
+	{
+		copy_s16(src, dst, out_frames, channels * ratio);
+	}
+	else if(2 == channels)
+	{
+		copy_s32(src, dst, out_frames, ratio);
+	}
+	else
+	{
+		for(unsigned int i = 0; i < out_frames; i++)
+		{
+			memcpy(&dst[i * channels], &src[i * channels * ratio], channels * sizeof(int16_t));
+		}
+	}
+}
+
+static void decimate_s16_scalar(const int16_t * src, int16_t * dst, unsigned int out_frames, unsigned int channels, bool first_channel_only, unsigned int ratio)
+{
+	decimate_s16_common(src, dst, out_frames, channels, first_channel_only, ratio, copy_strided_s16_scalar, copy_strided_s32_scalar);
+}
+
+static void energy_s16_scalar(const int16_t * src, unsigned int samples, uint64_t * sum_squares, unsigned int * peak)
+{
+	uint64_t sum = 0;
+	unsigned int max = *peak;
+	for(unsigned int i = 0; i < samples; i++)
+	{
+		int value = src[i];
+		sum += (uint64_t)(value * value);
+		unsigned int magnitude = (unsigned int)(0 > value ? -value : value);
+		if(max < magnitude)
+		{
+			max = magnitude;
+		}
+	}
+	*sum_squares += sum;
+	*peak = max;
+}
+
+/* Folds the extremes found by a vector loop into peak. The magnitude of -32768 doesn't fit in 16 bits, so the vector
+ * loops keep the minimum and maximum rather than absolute values.*/
+static inline void update_peak(int min, int max, unsigned int * peak)
+{
+	unsigned int magnitude = (unsigned int)(-min > max ? -min : max);
+	if(*peak < magnitude)
+	{
+		*peak = magnitude;
+	}
+}
+
+static void window_s16_scalar(const int16_t * src, const float * window, float * dst, unsigned int samples)
+{
+	for(unsigned int i = 0; i < samples; i++)
+	{
+		dst[i] = src[i] * window[i];
+	}
+}
+
+static void butterfly_f32_scalar(float * a_re, float * a_im, float * b_re, float * b_im, const float * w_re, const float * w_im, unsigned int count)
+{
+	for(unsigned int i = 0; i < count; i++)
+	{
+		float t_re = b_re[i] * w_re[i] - b_im[i] * w_im[i];
+		float t_im = b_re[i] * w_im[i] + b_im[i] * w_re[i];
+		b_re[i] = a_re[i] - t_re;
+		b_im[i] = a_im[i] - t_im;
+		a_re[i] += t_re;
+		a_im[i] += t_im;
+	}
+}
+
+static void power_f32_scalar(const float * re, const float * im, float * dst, unsigned int count)
+{
+	for(unsigned int i = 0; i < count; i++)
+	{
+		dst[i] = re[i] * re[i] + im[i] * im[i];
+	}
+}
+
+static const audio_kernels_t g_scalar_kernels = {KERNEL_ISA_SCALAR, "scalar", stereo_to_mono_s16_scalar, s24_to_s16_scalar, decimate_s16_scalar, energy_s16_scalar,
+	window_s16_scalar, butterfly_f32_scalar, power_f32_scalar};
+
+
+#ifdef ACM_KERNELS_X86
+/* Keeps the low 16 bits of each 32-bit lane of a and b, in order. The shifts sign-extend them so that the saturating pack is exact.*/
+__attribute__((target("sse2"))) static inline __m128i pack_low_halves_sse2(__m128i a, __m128i b)
+{
+	a = _mm_srai_epi32(_mm_slli_epi32(a, 16), 16);
+	b = _mm_srai_epi32(_mm_slli_epi32(b, 16), 16);
+	return _mm_packs_epi32(a, b);
+}
+
+__attribute__((target("sse2"))) static void copy_strided_s16_sse2(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride)
+{
+	unsigned int i = 0;
+	if(2 == stride)
+	{
+		for(; (i + 8) < count; i += 8)
+		{
+			__m128i a = _mm_loadu_si128((const __m128i *)&src[2 * i]);
+			__m128i b = _mm_loadu_si128((const __m128i *)&src[2 * i + 8]);
+			_mm_storeu_si128((__m128i *)&dst[i], pack_low_halves_sse2(a, b));
+		}
+	}
+	else if(4 == stride)
+	{
+		for(; (i + 8) < count; i += 8)
+		{
+			/* Gather 32-bit lanes 0 and 2 of each vector into its low half, then pair the vectors up.*/
+			__m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&src[4 * i]), _MM_SHUFFLE(3, 1, 2, 0));
+			__m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&src[4 * i + 8]), _MM_SHUFFLE(3, 1, 2, 0));
+			__m128i c = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&src[4 * i + 16]), _MM_SHUFFLE(3, 1, 2, 0));
+			__m128i d = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&src[4 * i + 24]), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storeu_si128((__m128i *)&dst[i], pack_low_halves_sse2(_mm_unpacklo_epi64(a, b), _mm_unpacklo_epi64(c, d)));
+		}
+	}
+	copy_strided_s16_scalar(&src[i * stride], &dst[i], count - i, stride);
+}
+
+__attribute__((target("sse2"))) static void copy_strided_s32_sse2(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride)
+{
+	unsigned int i = 0;
+	if(2 == stride)
+	{
+		for(; (i + 4) < count; i += 4)
+		{
+			__m128i a = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&src[4 * i]), _MM_SHUFFLE(3, 1, 2, 0));
+			__m128i b = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&src[4 * i + 8]), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm_storeu_si128((__m128i *)&dst[2 * i], _mm_unpacklo_epi64(a, b));
+		}
+	}
+	copy_strided_s32_scalar(&src[2 * i * stride], &dst[2 * i], count - i, stride);
+}
+
+static void stereo_to_mono_s16_sse2(const int16_t * src, int16_t * dst, unsigned int frames)
+{
+	copy_strided_s16_sse2(src, dst, frames, 2);
+}
+
+static void decimate_s16_sse2(const int16_t * src, int16_t * dst, unsigned int out_frames, unsigned int channels, bool first_channel_only, unsigned int ratio)
+{
+	decimate_s16_common(src, dst, out_frames, channels, first_channel_only, ratio, copy_strided_s16_sse2, copy_strided_s32_sse2);
+}
+
+/* A sum of two squares can reach 2^31, so the 32-bit results of madd are treated as unsigned when widened to 64 bits.*/
+__attribute__((target("sse2"))) static void energy_s16_sse2(const int16_t * src, unsigned int samples, uint64_t * sum_squares, unsigned int * peak)
+{
+	const __m128i zero = _mm_setzero_si128();
+	__m128i sum = zero;
+	__m128i min = _mm_set1_epi16(INT16_MAX);
+	__m128i max = _mm_set1_epi16(INT16_MIN);
+	unsigned int i = 0;
+	for(; (i + 8) <= samples; i += 8)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i squares = _mm_madd_epi16(in, in);
+		sum = _mm_add_epi64(sum, _mm_add_epi64(_mm_unpacklo_epi32(squares, zero), _mm_unpackhi_epi32(squares, zero)));
+		min = _mm_min_epi16(min, in);
+		max = _mm_max_epi16(max, in);
+	}
+	uint64_t sums[2];
+	int16_t mins[8], maxs[8];
+	_mm_storeu_si128((__m128i *)sums, sum);
+	_mm_storeu_si128((__m128i *)mins, min);
+	_mm_storeu_si128((__m128i *)maxs, max);
+	*sum_squares += sums[0] + sums[1];
+	if(0 != i)
+	{
+		update_peak(*std::min_element(mins, mins + 8), *std::max_element(maxs, maxs + 8), peak);
+	}
+	energy_s16_scalar(&src[i], samples - i, sum_squares, peak);
+}
+
+__attribute__((target("sse2"))) static void window_s16_sse2(const int16_t * src, const float * window, float * dst, unsigned int samples)
+{
+	unsigned int i = 0;
+	for(; (i + 8) <= samples; i += 8)
+	{
+		__m128i in = _mm_loadu_si128((const __m128i *)&src[i]);
+		/* Sign-extends by putting each sample in the upper half of a 32-bit lane, then shifting it back down.*/
+		__m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(in, in), 16));
+		__m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(in, in), 16));
+		_mm_storeu_ps(&dst[i], _mm_mul_ps(lo, _mm_loadu_ps(&window[i])));
+		_mm_storeu_ps(&dst[i + 4], _mm_mul_ps(hi, _mm_loadu_ps(&window[i + 4])));
+	}
+	window_s16_scalar(&src[i], &window[i], &dst[i], samples - i);
+}
+
+__attribute__((target("sse2"))) static void butterfly_f32_sse2(float * a_re, float * a_im, float * b_re, float * b_im, const float * w_re, const float * w_im, unsigned int count)
+{
+	unsigned int i = 0;
+	for(; (i + 4) <= count; i += 4)
+	{
+		__m128 br = _mm_loadu_ps(&b_re[i]);
+		__m128 bi = _mm_loadu_ps(&b_im[i]);
+		__m128 wr = _mm_loadu_ps(&w_re[i]);
+		__m128 wi = _mm_loadu_ps(&w_im[i]);
+		__m128 tr = _mm_sub_ps(_mm_mul_ps(br, wr), _mm_mul_ps(bi, wi));
+		__m128 ti = _mm_add_ps(_mm_mul_ps(br, wi), _mm_mul_ps(bi, wr));
+		__m128 ar = _mm_loadu_ps(&a_re[i]);
+		__m128 ai = _mm_loadu_ps(&a_im[i]);
+		_mm_storeu_ps(&b_re[i], _mm_sub_ps(ar, tr));
+		_mm_storeu_ps(&b_im[i], _mm_sub_ps(ai, ti));
+		_mm_storeu_ps(&a_re[i], _mm_add_ps(ar, tr));
+		_mm_storeu_ps(&a_im[i], _mm_add_ps(ai, ti));
+	}
+	butterfly_f32_scalar(&a_re[i], &a_im[i], &b_re[i], &b_im[i], &w_re[i], &w_im[i], count - i);
+}
+
+__attribute__((target("sse2"))) static void power_f32_sse2(const float * re, const float * im, float * dst, unsigned int count)
+{
+	unsigned int i = 0;
+	for(; (i + 4) <= count; i += 4)
+	{
+		__m128 r = _mm_loadu_ps(&re[i]);
+		__m128 m = _mm_loadu_ps(&im[i]);
+		_mm_storeu_ps(&dst[i], _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m)));
+	}
+	power_f32_scalar(&re[i], &im[i], &dst[i], count - i);
+}
+
+/* SSE2 has no byte shuffle, so 24-bit samples are left to the scalar loop.*/
+static const audio_kernels_t g_sse2_kernels = {KERNEL_ISA_SSE2, "sse2", stereo_to_mono_s16_sse2, s24_to_s16_scalar, decimate_s16_sse2, energy_s16_sse2,
+	window_s16_sse2, butterfly_f32_sse2, power_f32_sse2};
+
+
+__attribute__((target("avx2"))) static void copy_strided_s16_avx2(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride)
+{
+	unsigned int i = 0;
+	if(2 == stride)
+	{
+		for(; (i + 16) < count; i += 16)
+		{
+			__m256i a = _mm256_loadu_si256((const __m256i *)&src[2 * i]);
+			__m256i b = _mm256_loadu_si256((const __m256i *)&src[2 * i + 16]);
+			a = _mm256_srai_epi32(_mm256_slli_epi32(a, 16), 16);
+			b = _mm256_srai_epi32(_mm256_slli_epi32(b, 16), 16);
+			/* The pack works within 128-bit lanes, so the 64-bit quarters come out as a0 b0 a1 b1.*/
+			__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+			_mm256_storeu_si256((__m256i *)&dst[i], packed);
+		}
+	}
+	copy_strided_s16_sse2(&src[i * stride], &dst[i], count - i, stride);
+}
+
+__attribute__((target("avx2"))) static void copy_strided_s32_avx2(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride)
+{
+	unsigned int i = 0;
+	if(2 == stride)
+	{
+		const __m256i even_lanes = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+		for(; (i + 8) < count; i += 8)
+		{
+			__m256i a = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)&src[4 * i]), even_lanes);
+			__m256i b = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)&src[4 * i + 16]), even_lanes);
+			_mm256_storeu_si256((__m256i *)&dst[2 * i], _mm256_permute2x128_si256(a, b, 0x20));
+		}
+	}
+	copy_strided_s32_sse2(&src[2 * i * stride], &dst[2 * i], count - i, stride);
+}
+
+__attribute__((target("avx2"))) static void s24_to_s16_avx2(const uint8_t * src, int16_t * dst, unsigned int samples)
+{
+	/* A 32-byte load is spread so that each 128-bit lane holds 4 whole samples: bytes 0-15 and 12-27. The byte shuffle then keeps the
+	 * upper two bytes of each, into the low half of each lane for the first 8 samples and the high half for the next 8.*/
+	const __m256i spread = _mm256_setr_epi32(0, 1, 2, 3, 3, 4, 5, 6);
+	const __m256i upper_bytes_lo = _mm256_setr_epi8(1, 2, 4, 5, 7, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1,
+			1, 2, 4, 5, 7, 8, 10, 11, -1, -1, -1, -1, -1, -1, -1, -1);
+	const __m256i upper_bytes_hi = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1, 1, 2, 4, 5, 7, 8, 10, 11,
+			-1, -1, -1, -1, -1, -1, -1, -1, 1, 2, 4, 5, 7, 8, 10, 11);
+	unsigned int i = 0;
+	for(; (i + 19) <= samples; i += 16) //The second load reads 8 bytes past the 16 samples being converted.
+	{
+		__m256i a = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)&src[3 * i]), spread);
+		__m256i b = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *)&src[3 * i + 24]), spread);
+		__m256i out = _mm256_or_si256(_mm256_shuffle_epi8(a, upper_bytes_lo), _mm256_shuffle_epi8(b, upper_bytes_hi));
+		/* Quarters are now samples 0-3, 8-11, 4-7, 12-15.*/
+		_mm256_storeu_si256((__m256i *)&dst[i], _mm256_permute4x64_epi64(out, _MM_SHUFFLE(3, 1, 2, 0)));
+	}
+	s24_to_s16_scalar(&src[3 * i], &dst[i], samples - i);
+}
+
+static void stereo_to_mono_s16_avx2(const int16_t * src, int16_t * dst, unsigned int frames)
+{
+	copy_strided_s16_avx2(src, dst, frames, 2);
+}
+
+static void decimate_s16_avx2(const int16_t * src, int16_t * dst, unsigned int out_frames, unsigned int channels, bool first_channel_only, unsigned int ratio)
+{
+	decimate_s16_common(src, dst, out_frames, channels, first_channel_only, ratio, copy_strided_s16_avx2, copy_strided_s32_avx2);
+}
+
+__attribute__((target("avx2"))) static void energy_s16_avx2(const int16_t * src, unsigned int samples, uint64_t * sum_squares, unsigned int * peak)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i sum = zero;
+	__m256i min = _mm256_set1_epi16(INT16_MAX);
+	__m256i max = _mm256_set1_epi16(INT16_MIN);
+	unsigned int i = 0;
+	for(; (i + 16) <= samples; i += 16)
+	{
+		__m256i in = _mm256_loadu_si256((const __m256i *)&src[i]);
+		__m256i squares = _mm256_madd_epi16(in, in); //As in energy_s16_sse2, unsigned.
+		sum = _mm256_add_epi64(sum, _mm256_add_epi64(_mm256_unpacklo_epi32(squares, zero), _mm256_unpackhi_epi32(squares, zero)));
+		min = _mm256_min_epi16(min, in);
+		max = _mm256_max_epi16(max, in);
+	}
+	uint64_t sums[4];
+	int16_t mins[16], maxs[16];
+	_mm256_storeu_si256((__m256i *)sums, sum);
+	_mm256_storeu_si256((__m256i *)mins, min);
+	_mm256_storeu_si256((__m256i *)maxs, max);
+	*sum_squares += sums[0] + sums[1] + sums[2] + sums[3];
+	if(0 != i)
+	{
+		update_peak(*std::min_element(mins, mins + 16), *std::max_element(maxs, maxs + 16), peak);
+	}
+	energy_s16_sse2(&src[i], samples - i, sum_squares, peak);
+}
+
+__attribute__((target("avx2"))) static void window_s16_avx2(const int16_t * src, const float * window, float * dst, unsigned int samples)
+{
+	unsigned int i = 0;
+	for(; (i + 8) <= samples; i += 8)
+	{
+		__m256 in = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)&src[i])));
+		_mm256_storeu_ps(&dst[i], _mm256_mul_ps(in, _mm256_loadu_ps(&window[i])));
+	}
+	window_s16_scalar(&src[i], &window[i], &dst[i], samples - i);
+}
+
+/* No FMA, so that every ISA rounds the same way and gives the same fingerprints.*/
+__attribute__((target("avx2"))) static void butterfly_f32_avx2(float * a_re, float * a_im, float * b_re, float * b_im, const float * w_re, const float * w_im, unsigned int count)
+{
+	unsigned int i = 0;
+	for(; (i + 8) <= count; i += 8)
+	{
+		__m256 br = _mm256_loadu_ps(&b_re[i]);
+		__m256 bi = _mm256_loadu_ps(&b_im[i]);
+		__m256 wr = _mm256_loadu_ps(&w_re[i]);
+		__m256 wi = _mm256_loadu_ps(&w_im[i]);
+		__m256 tr = _mm256_sub_ps(_mm256_mul_ps(br, wr), _mm256_mul_ps(bi, wi));
+		__m256 ti = _mm256_add_ps(_mm256_mul_ps(br, wi), _mm256_mul_ps(bi, wr));
+		__m256 ar = _mm256_loadu_ps(&a_re[i]);
+		__m256 ai = _mm256_loadu_ps(&a_im[i]);
+		_mm256_storeu_ps(&b_re[i], _mm256_sub_ps(ar, tr));
+		_mm256_storeu_ps(&b_im[i], _mm256_sub_ps(ai, ti));
+		_mm256_storeu_ps(&a_re[i], _mm256_add_ps(ar, tr));
+		_mm256_storeu_ps(&a_im[i], _mm256_add_ps(ai, ti));
+	}
+	butterfly_f32_sse2(&a_re[i], &a_im[i], &b_re[i], &b_im[i], &w_re[i], &w_im[i], count - i);
+}
+
+__attribute__((target("avx2"))) static void power_f32_avx2(const float * re, const float * im, float * dst, unsigned int count)
+{
+	unsigned int i = 0;
+	for(; (i + 8) <= count; i += 8)
+	{
+		__m256 r = _mm256_loadu_ps(&re[i]);
+		__m256 m = _mm256_loadu_ps(&im[i]);
+		_mm256_storeu_ps(&dst[i], _mm256_add_ps(_mm256_mul_ps(r, r), _mm256_mul_ps(m, m)));
+	}
+	power_f32_sse2(&re[i], &im[i], &dst[i], count - i);
+}
+
+static const audio_kernels_t g_avx2_kernels = {KERNEL_ISA_AVX2, "avx2", stereo_to_mono_s16_avx2, s24_to_s16_avx2, decimate_s16_avx2, energy_s16_avx2,
+	window_s16_avx2, butterfly_f32_avx2, power_f32_avx2};
+#endif //ACM_KERNELS_X86
+
+
+#ifdef ACM_KERNELS_NEON
+static void copy_strided_s16_neon(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride)
+{
+	unsigned int i = 0;
+	if(2 == stride)
+	{
+		for(; (i + 8) < count; i += 8)
+		{
+			int16x8x2_t in = vld2q_s16(&src[2 * i]);
+			vst1q_s16(&dst[i], in.val[0]);
+		}
+	}
+	else if(4 == stride)
+	{
+		for(; (i + 8) < count; i += 8)
+		{
+			int16x8x4_t in = vld4q_s16(&src[4 * i]);
+			vst1q_s16(&dst[i], in.val[0]);
+		}
+	}
+	copy_strided_s16_scalar(&src[i * stride], &dst[i], count - i, stride);
+}
+
+static void copy_strided_s32_neon(const int16_t * src, int16_t * dst, unsigned int count, unsigned int stride)
+{
+	unsigned int i = 0;
+	if(2 == stride)
+	{
+		for(; (i + 4) < count; i += 4)
+		{
+			int32x4x2_t in = vld2q_s32((const int32_t *)&src[4 * i]);
+			vst1q_s32((int32_t *)&dst[2 * i], in.val[0]);
+		}
+	}
+	copy_strided_s32_scalar(&src[2 * i * stride], &dst[2 * i], count - i, stride);
+}
+
+static void s24_to_s16_neon(const uint8_t * src, int16_t * dst, unsigned int samples)
+{
+	unsigned int i = 0;
+	for(; (i + 16) <= samples; i += 16)
+	{
+		/* De-interleaves bytes 0, 1 and 2 of 16 samples. Zipping bytes 1 and 2 back together makes 16 little-endian 16-bit samples.*/
+		uint8x16x3_t in = vld3q_u8(&src[3 * i]);
+		uint8x16x2_t out = vzipq_u8(in.val[1], in.val[2]);
+		vst1q_u8((uint8_t *)&dst[i], out.val[0]);
+		vst1q_u8((uint8_t *)&dst[i + 8], out.val[1]);
+	}
+	s24_to_s16_scalar(&src[3 * i], &dst[i], samples - i);
+}
+
+static void stereo_to_mono_s16_neon(const int16_t * src, int16_t * dst, unsigned int frames)
+{
+	copy_strided_s16_neon(src, dst, frames, 2);
+}
+
+static void decimate_s16_neon(const int16_t * src, int16_t * dst, unsigned int out_frames, unsigned int channels, bool first_channel_only, unsigned int ratio)
+{
+	decimate_s16_common(src, dst, out_frames, channels, first_channel_only, ratio, copy_strided_s16_neon, copy_strided_s32_neon);
+}
+
+static void energy_s16_neon(const int16_t * src, unsigned int samples, uint64_t * sum_squares, unsigned int * peak)
+{
+	int64x2_t sum = vdupq_n_s64(0);
+	int16x8_t min = vdupq_n_s16(INT16_MAX);
+	int16x8_t max = vdupq_n_s16(INT16_MIN);
+	unsigned int i = 0;
+	for(; (i + 8) <= samples; i += 8)
+	{
+		int16x8_t in = vld1q_s16(&src[i]);
+		/* Each square is at most 2^30, so pairs of them can be added into 64-bit lanes without overflow.*/
+		sum = vpadalq_s32(sum, vmull_s16(vget_low_s16(in), vget_low_s16(in)));
+		sum = vpadalq_s32(sum, vmull_s16(vget_high_s16(in), vget_high_s16(in)));
+		min = vminq_s16(min, in);
+		max = vmaxq_s16(max, in);
+	}
+	int64_t sums[2];
+	int16_t mins[8], maxs[8];
+	vst1q_s64(sums, sum);
+	vst1q_s16(mins, min);
+	vst1q_s16(maxs, max);
+	*sum_squares += (uint64_t)(sums[0] + sums[1]);
+	if(0 != i)
+	{
+		update_peak(*std::min_element(mins, mins + 8), *std::max_element(maxs, maxs + 8), peak);
+	}
+	energy_s16_scalar(&src[i], samples - i, sum_squares, peak);
+}
+
+static void window_s16_neon(const int16_t * src, const float * window, float * dst, unsigned int samples)
+{
+	unsigned int i = 0;
+	for(; (i + 8) <= samples; i += 8)
+	{
+		int16x8_t in = vld1q_s16(&src[i]);
+		float32x4_t lo = vcvtq_f32_s32(vmovl_s16(vget_low_s16(in)));
+		float32x4_t hi = vcvtq_f32_s32(vmovl_s16(vget_high_s16(in)));
+		vst1q_f32(&dst[i], vmulq_f32(lo, vld1q_f32(&window[i])));
+		vst1q_f32(&dst[i + 4], vmulq_f32(hi, vld1q_f32(&window[i + 4])));
+	}
+	window_s16_scalar(&src[i], &window[i], &dst[i], samples - i);
+}
+
+/* Separate multiplies and adds rather than vmla, which rounds differently on some cores, as in butterfly_f32_avx2.*/
+static void butterfly_f32_neon(float * a_re, float * a_im, float * b_re, float * b_im, const float * w_re, const float * w_im, unsigned int count)
+{
+	unsigned int i = 0;
+	for(; (i + 4) <= count; i += 4)
+	{
+		float32x4_t br = vld1q_f32(&b_re[i]);
+		float32x4_t bi = vld1q_f32(&b_im[i]);
+		float32x4_t wr = vld1q_f32(&w_re[i]);
+		float32x4_t wi = vld1q_f32(&w_im[i]);
+		float32x4_t tr = vsubq_f32(vmulq_f32(br, wr), vmulq_f32(bi, wi));
+		float32x4_t ti = vaddq_f32(vmulq_f32(br, wi), vmulq_f32(bi, wr));
+		float32x4_t ar = vld1q_f32(&a_re[i]);
+		float32x4_t ai = vld1q_f32(&a_im[i]);
+		vst1q_f32(&b_re[i], vsubq_f32(ar, tr));
+		vst1q_f32(&b_im[i], vsubq_f32(ai, ti));
+		vst1q_f32(&a_re[i], vaddq_f32(ar, tr));
+		vst1q_f32(&a_im[i], vaddq_f32(ai, ti));
+	}
+	butterfly_f32_scalar(&a_re[i], &a_im[i], &b_re[i], &b_im[i], &w_re[i], &w_im[i], count - i);
+}
+
+static void power_f32_neon(const float * re, const float * im, float * dst, unsigned int count)
+{
+	unsigned int i = 0;
+	for(; (i + 4) <= count; i += 4)
+	{
+		float32x4_t r = vld1q_f32(&re[i]);
+		float32x4_t m = vld1q_f32(&im[i]);
+		vst1q_f32(&dst[i], vaddq_f32(vmulq_f32(r, r), vmulq_f32(m, m)));
+	}
+	power_f32_scalar(&re[i], &im[i], &dst[i], count - i);
+}
+
+static const audio_kernels_t g_neon_kernels = {KERNEL_ISA_NEON, "neon", stereo_to_mono_s16_neon, s24_to_s16_neon, decimate_s16_neon, energy_s16_neon,
+	window_s16_neon, butterfly_f32_neon, power_f32_neon};
+#endif //ACM_KERNELS_NEON
+
+
+const audio_kernels_t * get_audio_kernels(kernel_isa_t isa)
+{
+	switch(isa)
+	{
+		case KERNEL_ISA_SCALAR:
+			return &g_scalar_kernels;
+#ifdef ACM_KERNELS_X86
+		case KERNEL_ISA_SSE2:
+			return (__builtin_cpu_supports("sse2") ? &g_sse2_kernels : NULL);
+		case KERNEL_ISA_AVX2:
+			return (__builtin_cpu_supports("avx2") ? &g_avx2_kernels : NULL);
+#endif
+#ifdef ACM_KERNELS_NEON
+		case KERNEL_ISA_NEON:
+			return &g_neon_kernels; //NEON is a build-time choice on ARM; there is no portable way to probe for it at run time.
+#endif
+		default:
+			return NULL;
+	}
+}
+
+static const audio_kernels_t * select_audio_kernels()
+{
+	const kernel_isa_t preference[] = {KERNEL_ISA_AVX2, KERNEL_ISA_NEON, KERNEL_ISA_SSE2, KERNEL_ISA_SCALAR};
+	const audio_kernels_t * kernels = NULL;
+	for(unsigned int i = 0; (i < sizeof(preference) / sizeof(preference[0])) && (NULL == kernels); i++)
+	{
+		kernels = get_audio_kernels(preference[i]);
+	}
+	INFO("Using %s audio kernels.\n", kernels->name);
+	return kernels;
+}
+
+const audio_kernels_t * get_audio_kernels()
+{
+	static const audio_kernels_t * kernels = select_audio_kernels();
+	return kernels;
+}
@@ -0,0 +1,506 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "capture_backend.h"
+#include "acm_thread.h"
+#include <fstream>
+#include <chrono>
+#include <math.h>
+#include <string.h>
+#include <stdlib.h>
+
+using namespace audiocapturemgr;
+
+static const size_t DEFAULT_FIFO_SIZE = 64 * 1024;
+static const size_t DEFAULT_THRESHOLD = 8 * 1024;
+static const int32_t FULL_SCALE = (1 << 23) - 1; //Samples are rendered at 24 bits and cut down to 16 if needed.
+
+static const char * get_signal_name(synthetic_signal_t signal)
+{
+	switch(signal)
+	{
+		case SYNTHETIC_SILENCE: return "silence";
+		case SYNTHETIC_TONE: return "tone";
+		case SYNTHETIC_NOISE: return "noise";
+		case SYNTHETIC_WAV: return "wav";
+		default: return "unknown";
+	}
+}
+
+static bool get_rac_freq(unsigned int sampling_rate, racFreq &freq)
+{
+	switch(sampling_rate)
+	{
+		case 16000: freq = racFreq_e16000; return true;
+		case 22050: freq = racFreq_e22050; return true;
+		case 24000: freq = racFreq_e24000; return true;
+		case 32000: freq = racFreq_e32000; return true;
+		case 44100: freq = racFreq_e44100; return true;
+		case 48000: freq = racFreq_e48000; return true;
+		default: return false;
+	}
+}
+
+static inline void pack_sample(int32_t value, unsigned int bits_per_sample, uint8_t * dst)
+{
+	if(16 == bits_per_sample)
+	{
+		int16_t sample = (int16_t)(value >> 8);
+		memcpy(dst, &sample, sizeof(sample));
+	}
+	else
+	{
+		dst[0] = (uint8_t)(value & 0xFF);
+		dst[1] = (uint8_t)((value >> 8) & 0xFF);
+		dst[2] = (uint8_t)((value >> 16) & 0xFF);
+	}
+}
+
+static inline uint32_t xorshift32(uint32_t &state)
+{
+	state ^= state << 13;
+	state ^= state >> 17;
+	state ^= state << 5;
+	return state;
+}
+
+static inline uint32_t read_le(const uint8_t * ptr, unsigned int bytes)
+{
+	uint32_t value = 0;
+	for(unsigned int i = 0; i < bytes; i++)
+	{
+		value |= (uint32_t) ptr[i] << (8 * i);
+	}
+	return value;
+}
+
+synthetic_capture_backend::synthetic_capture_backend(const synthetic_capture_config_t &config) : m_config(config), m_name(get_signal_name(config.signal)),
+	m_wav_rate(0), m_wav_channels(0), m_open(true), m_callback(NULL), m_callback_context(NULL), m_stop(true), m_callbacks(0), m_frames(0),
+	m_dropped_frames(0), m_finished(false)
+{
+	memset(&m_properties, 0, sizeof(m_properties));
+	if(SYNTHETIC_WAV == m_config.signal)
+	{
+		m_open = (0 == load_wav());
+	}
+	INFO("%s backend, %s%s.\n", m_name.c_str(), (m_config.realtime ? "realtime" : "as fast as possible"), (m_open ? "" : ", failed to open"));
+}
+
+synthetic_capture_backend::~synthetic_capture_backend()
+{
+	stop();
+}
+
+int synthetic_capture_backend::load_wav()
+{
+	std::ifstream file(m_config.wav_path.c_str(), std::ios::binary);
+	if(!file.is_open())
+	{
+		ERROR("Could not open %s.\n", m_config.wav_path.c_str());
+		return -1;
+	}
+	std::vector <uint8_t> contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	if((12 > contents.size()) || (0 != memcmp(&contents[0], "RIFF", 4)) || (0 != memcmp(&contents[8], "WAVE", 4)))
+	{
+		ERROR("%s is not a WAV file.\n", m_config.wav_path.c_str());
+		return -1;
+	}
+
+	unsigned int format_tag = 0;
+	unsigned int bits_per_sample = 0;
+	const uint8_t * data = NULL;
+	size_t data_size = 0;
+	for(size_t offset = 12; offset + 8 <= contents.size(); )
+	{
+		const uint8_t * chunk = &contents[offset];
+		size_t chunk_size = read_le(chunk + 4, 4);
+		size_t available = std::min(chunk_size, contents.size() - offset - 8);
+		if((0 == memcmp(chunk, "fmt ", 4)) && (16 <= available))
+		{
+			format_tag = read_le(chunk + 8, 2);
+			m_wav_channels = read_le(chunk + 10, 2);
+			m_wav_rate = read_le(chunk + 12, 4);
+			bits_per_sample = read_le(chunk + 22, 2);
+			if((0xFFFE == format_tag) && (26 <= available))
+			{
+				format_tag = read_le(chunk + 32, 2); //First two bytes of the sub-format GUID.
+			}
+		}
+		else if(0 == memcmp(chunk, "data", 4))
+		{
+			data = chunk + 8;
+			data_size = available; //Recorders that never finished the file leave the size at 0 or too big.
+			if(0 == chunk_size)
+			{
+				data_size = contents.size() - offset - 8;
+			}
+		}
+		offset += 8 + chunk_size + (chunk_size & 1);
+	}
+
+	if((1 != format_tag) || (0 == m_wav_channels) || (0 == m_wav_rate) || ((16 != bits_per_sample) && (24 != bits_per_sample) && (32 != bits_per_sample)))
+	{
+		ERROR("%s: only 16, 24 and 32 bit PCM is supported. Format 0x%x, %u bit, %u channels, %uHz.\n", m_config.wav_path.c_str(),
+			format_tag, bits_per_sample, m_wav_channels, m_wav_rate);
+		return -1;
+	}
+	unsigned int bytes_per_sample = bits_per_sample / 8;
+	size_t frames = (NULL == data ? 0 : data_size / (bytes_per_sample * m_wav_channels));
+	if(0 == frames)
+	{
+		ERROR("%s has no audio.\n", m_config.wav_path.c_str());
+		return -1;
+	}
+	m_wav_samples.resize(frames * m_wav_channels);
+	for(size_t i = 0; i < m_wav_samples.size(); i++)
+	{
+		int32_t value = (int32_t)(read_le(data + i * bytes_per_sample, bytes_per_sample) << (32 - bits_per_sample));
+		m_wav_samples[i] = value >> 8; //Sign-extended, 24 bits.
+	}
+	INFO("Loaded %zu frames of %u bit, %u channel, %uHz audio from %s.\n", frames, bits_per_sample, m_wav_channels, m_wav_rate,
+		m_config.wav_path.c_str());
+	return 0;
+}
+
+void synthetic_capture_backend::get_default_properties(audio_properties_t &properties)
+{
+	properties.format = racFormat_e16BitStereo;
+	properties.sampling_frequency = racFreq_e48000;
+	properties.fifo_size = DEFAULT_FIFO_SIZE;
+	properties.threshold = DEFAULT_THRESHOLD;
+	properties.delay_compensation_ms = 0;
+	if(!m_wav_samples.empty())
+	{
+		/* Closest to the file, so that it plays without conversion where possible.*/
+		get_rac_freq(m_wav_rate, properties.sampling_frequency);
+		if(1 == m_wav_channels)
+		{
+			properties.format = racFormat_e16BitMono;
+		}
+		else if(6 == m_wav_channels)
+		{
+			properties.format = racFormat_e24Bit5_1;
+		}
+	}
+}
+
+void synthetic_capture_backend::render_loop(unsigned int sampling_rate, unsigned int bits_per_sample, unsigned int num_channels)
+{
+	unsigned int bytes_per_sample = bits_per_sample / 8;
+	unsigned int frame_size = bytes_per_sample * num_channels;
+	size_t loop_frames = sampling_rate; //A second, except for WAV files.
+	unsigned int cycles = 0;
+	if(SYNTHETIC_TONE == m_config.signal)
+	{
+		cycles = (unsigned int) lround(m_config.frequency_hz);
+		if((0 == cycles) || ((sampling_rate / 2) <= cycles))
+		{
+			WARN("Tone of %fHz can't be played at %uHz. Using 1000Hz.\n", m_config.frequency_hz, sampling_rate);
+			cycles = 1000;
+		}
+		else if(cycles != m_config.frequency_hz)
+		{
+			INFO("Tone rounded to %uHz.\n", cycles);
+		}
+	}
+	else if(SYNTHETIC_WAV == m_config.signal)
+	{
+		size_t wav_frames = m_wav_samples.size() / m_wav_channels;
+		loop_frames = std::max((size_t) 1, (size_t)((double) wav_frames * sampling_rate / m_wav_rate));
+		if(m_wav_rate != sampling_rate)
+		{
+			INFO("Resampling %s from %uHz to %uHz.\n", m_config.wav_path.c_str(), m_wav_rate, sampling_rate);
+		}
+	}
+
+	m_loop.assign(loop_frames * frame_size, 0);
+	const int32_t peak = (int32_t)(FULL_SCALE * std::min(1.0, std::max(0.0, m_config.level)));
+	uint32_t noise_state = 0x2545F491;
+	for(size_t i = 0; i < loop_frames; i++)
+	{
+		uint8_t * frame = &m_loop[i * frame_size];
+		switch(m_config.signal)
+		{
+			case SYNTHETIC_TONE:
+			{
+				int32_t value = (int32_t) lround(peak * sin(2.0 * M_PI * cycles * (double) i / sampling_rate));
+				for(unsigned int channel = 0; channel < num_channels; channel++)
+				{
+					pack_sample(value, bits_per_sample, frame + channel * bytes_per_sample);
+				}
+				break;
+			}
+			case SYNTHETIC_NOISE:
+				for(unsigned int channel = 0; channel < num_channels; channel++)
+				{
+					int32_t value = (int32_t)(((int64_t) xorshift32(noise_state) * (2 * (int64_t) peak + 1)) >> 32) - peak;
+					pack_sample(value, bits_per_sample, frame + channel * bytes_per_sample);
+				}
+				break;
+			case SYNTHETIC_WAV:
+			{
+				/* Linear interpolation between the two nearest frames of the file. The loop wraps back to the start.*/
+				size_t wav_frames = m_wav_samples.size() / m_wav_channels;
+				double position = (double) i * m_wav_rate / sampling_rate;
+				size_t first = (size_t) position % wav_frames;
+				size_t second = (first + 1) % wav_frames;
+				double fraction = position - floor(position);
+				for(unsigned int channel = 0; channel < num_channels; channel++)
+				{
+					unsigned int source = channel % m_wav_channels;
+					if((1 == num_channels) && (racFormat_e16BitMonoRight == m_properties.format))
+					{
+						source = 1 % m_wav_channels;
+					}
+					double a = m_wav_samples[first * m_wav_channels + source];
+					double b = m_wav_samples[second * m_wav_channels + source];
+					if((1 == num_channels) && (racFormat_e16BitMono == m_properties.format) && (1 < m_wav_channels))
+					{
+						a = b = 0;
+						for(unsigned int j = 0; j < m_wav_channels; j++)
+						{
+							a += m_wav_samples[first * m_wav_channels + j];
+							b += m_wav_samples[second * m_wav_channels + j];
+						}
+						a /= m_wav_channels;
+						b /= m_wav_channels;
+					}
+					pack_sample((int32_t) lround(a + (b - a) * fraction), bits_per_sample, frame + channel * bytes_per_sample);
+				}
+				break;
+			}
+			default:
+				break; //Silence
+		}
+	}
+}
+
+int synthetic_capture_backend::start(const audio_properties_t &properties, data_callback_t callback, void * context)
+{
+	if(!m_open)
+	{
+		return -1;
+	}
+	if(m_thread.joinable())
+	{
+		WARN("Already started.\n");
+		return 0;
+	}
+	unsigned int sampling_rate = 0, bits_per_sample = 0, num_channels = 0;
+	get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
+	if((0 == sampling_rate) || (0 == bits_per_sample) || (0 == num_channels))
+	{
+		ERROR("Unsupported audio properties.\n");
+		return -1;
+	}
+	m_properties = properties;
+	m_callback = callback;
+	m_callback_context = context;
+	render_loop(sampling_rate, bits_per_sample, num_channels);
+
+	unsigned int frame_size = bits_per_sample * num_channels / 8;
+	size_t chunk_frames = std::max((size_t) 1, properties.threshold / frame_size);
+	m_chunk.resize(chunk_frames * frame_size);
+	m_callbacks = 0;
+	m_frames = 0;
+	m_dropped_frames = 0;
+	m_finished = false;
+	m_stop = false;
+	m_thread = std::thread(&synthetic_capture_backend::worker_thread, this);
+	INFO("Started. %zu bytes per callback, %zu byte FIFO.\n", m_chunk.size(), properties.fifo_size);
+	return 0;
+}
+
+int synthetic_capture_backend::stop()
+{
+	if(!m_thread.joinable())
+	{
+		return 0;
+	}
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_cv.notify_all();
+	m_thread.join();
+	INFO("Stopped after %llu callbacks, %llu frames, %llu frames dropped.\n", m_callbacks.load(), m_frames.load(), m_dropped_frames.load());
+	return 0;
+}
+
+void synthetic_capture_backend::get_stats(synthetic_capture_stats_t &stats)
+{
+	stats.callbacks = m_callbacks.load();
+	stats.frames = m_frames.load();
+	stats.dropped_frames = m_dropped_frames.load();
+	stats.finished = m_finished.load();
+}
+
+void synthetic_capture_backend::worker_thread()
+{
+	thread_role_scope role(THREAD_ROLE_CAPTURE);
+	unsigned int sampling_rate = 0, bits_per_sample = 0, num_channels = 0;
+	get_individual_audio_parameters(m_properties, sampling_rate, bits_per_sample, num_channels);
+	const size_t frame_size = bits_per_sample * num_channels / 8;
+	const size_t chunk_frames = m_chunk.size() / frame_size;
+	const size_t loop_frames = m_loop.size() / frame_size;
+	const unsigned long long fifo_frames = std::max(chunk_frames, m_properties.fifo_size / frame_size);
+	size_t loop_position = 0;
+	unsigned long long produced = 0; //Frames the device has captured, delivered or dropped.
+	unsigned long long delivered = 0;
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while(!m_stop)
+	{
+		size_t frames = chunk_frames;
+		if(0 != m_config.max_frames)
+		{
+			if(delivered >= m_config.max_frames)
+			{
+				INFO("Delivered all %llu frames.\n", delivered);
+				m_finished = true;
+				m_cv.wait(lock, [this](){return m_stop;});
+				break;
+			}
+			frames = std::min((unsigned long long) frames, m_config.max_frames - delivered);
+		}
+		if(m_config.realtime)
+		{
+			std::chrono::steady_clock::time_point due = start_time + std::chrono::nanoseconds((produced + frames) * 1000000000ULL / sampling_rate);
+			if(m_cv.wait_until(lock, due, [this](){return m_stop;}))
+			{
+				break;
+			}
+			/* A FIFO only holds so much. Skip whatever it would have lost while the callback was late.*/
+			unsigned long long elapsed_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_time).count();
+			unsigned long long captured = elapsed_ns * sampling_rate / 1000000000ULL;
+			if(captured > produced + fifo_frames)
+			{
+				unsigned long long lost = captured - produced - fifo_frames;
+				produced += lost;
+				loop_position = (loop_position + lost) % loop_frames;
+				m_dropped_frames += lost;
+			}
+		}
+
+		for(size_t copied = 0; copied < frames; )
+		{
+			size_t count = std::min(frames - copied, loop_frames - loop_position);
+			memcpy(&m_chunk[copied * frame_size], &m_loop[loop_position * frame_size], count * frame_size);
+			copied += count;
+			loop_position = (loop_position + count) % loop_frames;
+		}
+		lock.unlock();
+		m_callback(m_callback_context, &m_chunk[0], frames * frame_size);
+		lock.lock();
+		produced += frames;
+		delivered += frames;
+		m_callbacks++;
+		m_frames += frames;
+	}
+}
+
+capture_backend * create_capture_backend(const char * spec, const char * device_type)
+{
+	std::string text = (NULL == spec ? "" : spec);
+	if(text.empty() || ("rmf" == text))
+	{
+#ifdef ACM_RMF_CAPTURE
+		return new rmf_capture_backend(device_type);
+#else
+		(void)device_type;
+		ERROR("This build has no RMF capture. Use a synthetic backend.\n");
+		return NULL;
+#endif
+	}
+
+	synthetic_capture_config_t config;
+	config.signal = SYNTHETIC_TONE;
+	config.frequency_hz = 1000.0;
+	config.level = 0.5;
+	config.realtime = true;
+	config.max_frames = 0;
+
+	size_t comma = text.rfind(',');
+	if(std::string::npos != comma)
+	{
+		if("fast" != text.substr(comma + 1))
+		{
+			ERROR("Unknown option in capture backend %s.\n", spec);
+			return NULL;
+		}
+		config.realtime = false;
+		text = text.substr(0, comma);
+	}
+
+	std::string kind = text.substr(0, text.find(':'));
+	std::string arguments = (std::string::npos == text.find(':') ? "" : text.substr(text.find(':') + 1));
+	if("wav" == kind)
+	{
+		config.signal = SYNTHETIC_WAV;
+		config.wav_path = arguments;
+		if(arguments.empty())
+		{
+			ERROR("wav needs a path.\n");
+			return NULL;
+		}
+	}
+	else if(("tone" == kind) || ("noise" == kind) || ("silence" == kind))
+	{
+		config.signal = ("tone" == kind ? SYNTHETIC_TONE : ("noise" == kind ? SYNTHETIC_NOISE : SYNTHETIC_SILENCE));
+		std::vector <double> values;
+		while(!arguments.empty())
+		{
+			char * end = NULL;
+			values.push_back(strtod(arguments.c_str(), &end));
+			if((end == arguments.c_str()) || ((*end != '\0') && (*end != ':')))
+			{
+				ERROR("Bad number in capture backend %s.\n", spec);
+				return NULL;
+			}
+			arguments = ('\0' == *end ? "" : std::string(end + 1));
+		}
+		size_t expected = (SYNTHETIC_TONE == config.signal ? 2 : (SYNTHETIC_NOISE == config.signal ? 1 : 0));
+		if(values.size() > expected)
+		{
+			ERROR("Too many arguments in capture backend %s.\n", spec);
+			return NULL;
+		}
+		if(SYNTHETIC_TONE == config.signal)
+		{
+			if(0 < values.size())
+			{
+				config.frequency_hz = values[0];
+			}
+			if(1 < values.size())
+			{
+				config.level = values[1];
+			}
+		}
+		else if(0 < values.size())
+		{
+			config.level = values[0];
+		}
+	}
+	else
+	{
+		ERROR("Unknown capture backend %s.\n", spec);
+		return NULL;
+	}
+	return new synthetic_capture_backend(config);
+}
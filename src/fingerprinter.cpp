@@ -0,0 +1,323 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "fingerprinter.h"
+#include <math.h>
+#include <algorithm>
+
+using namespace audiocapturemgr;
+
+/* Band edges, in bins of 15.625Hz: 250, 500, 1000, 2000, 3000, 4000 and 6000Hz. Below 250Hz there is little but bass
+ * and hum, and above 6kHz little survives lossy codecs.*/
+static const unsigned int BAND_EDGES[fingerprinter::FINGERPRINT_BANDS + 1] = {16, 32, 64, 128, 192, 256, 384};
+static const float PEAK_RATIO = 10.0f; //A peak is this much stronger than the mean of its frame's bands (10dB).
+static const float MIN_PEAK_DBFS = -60.0f; //Relative to a full-scale sine.
+static const unsigned int PEAK_NEIGHBOURHOOD_FRAMES = 5; //A peak is the strongest in its band this many frames either way.
+static const unsigned int TARGET_ZONE_FRAMES = 32; //About a second.
+static const unsigned int TARGET_ZONE_BINS = 128;
+static const unsigned int FAN_OUT = 3;
+
+fingerprinter::fingerprinter() : m_converter(NULL), m_kernels(get_audio_kernels()), m_in_frame_size(0), m_in_rate(0), m_history_frames(0),
+	m_min_peak_power(0), m_base_position(0), m_next_position(0), m_frames(0)
+{
+	m_analysis_props = {racFormat_e16BitMono, racFreq_e16000, 0, 0, 0};
+	const unsigned int size = FINGERPRINT_FFT_SIZE;
+	m_window.resize(size);
+	for(unsigned int i = 0; i < size; i++)
+	{
+		m_window[i] = (float)(0.5 - 0.5 * cos(2 * M_PI * i / size));
+	}
+
+	unsigned int bits = 0;
+	while((1u << bits) < size)
+	{
+		bits++;
+	}
+	m_bit_reverse.resize(size);
+	for(unsigned int i = 0; i < size; i++)
+	{
+		unsigned int reversed = 0;
+		for(unsigned int bit = 0; bit < bits; bit++)
+		{
+			reversed |= ((i >> bit) & 1) << (bits - 1 - bit);
+		}
+		m_bit_reverse[i] = (unsigned short)reversed;
+	}
+
+	/* Stage s pairs up points half = 2^s apart, with twiddles e^(-i * pi * k / half) for k below half.*/
+	for(unsigned int half = 1; half < size; half <<= 1)
+	{
+		for(unsigned int k = 0; k < half; k++)
+		{
+			m_twiddle_re.push_back((float)cos(M_PI * k / half));
+			m_twiddle_im.push_back((float)-sin(M_PI * k / half));
+		}
+	}
+	m_windowed.resize(size);
+	m_re.resize(size);
+	m_im.resize(size);
+	m_power.resize(size / 2 + 1);
+	m_recent.resize(2 * PEAK_NEIGHBOURHOOD_FRAMES + 1);
+
+	/* A full-scale sine peaks at 32768 * size / 4 in a Hann-windowed transform.*/
+	double full_scale = 32768.0 * size / 4;
+	m_min_peak_power = (float)(full_scale * full_scale * pow(10.0, MIN_PEAK_DBFS / 10));
+}
+
+fingerprinter::~fingerprinter()
+{
+	delete m_converter;
+}
+
+bool fingerprinter::configure(const audio_properties_t &properties, unsigned int history_seconds)
+{
+	delete m_converter;
+	m_converter = NULL;
+	m_in_props = properties;
+	unsigned int bits_per_sample = 0, num_channels = 0;
+	get_individual_audio_parameters(m_in_props, m_in_rate, bits_per_sample, num_channels);
+	m_in_frame_size = get_frame_size(m_in_props);
+	m_history_frames = history_seconds * FINGERPRINT_SAMPLING_RATE / FINGERPRINT_HOP_SIZE;
+
+	audio_converter * converter = new audio_converter(m_in_props, m_analysis_props, *this);
+	if(converter->is_supported() && (0 != m_in_frame_size) && (0 != m_in_rate))
+	{
+		m_converter = converter;
+	}
+	else
+	{
+		WARN("Can't fingerprint audio of format 0x%x.\n", m_in_props.format);
+		delete converter;
+	}
+	reset();
+	return (NULL != m_converter);
+}
+
+void fingerprinter::reset()
+{
+	if(m_converter)
+	{
+		m_converter->reset();
+	}
+	m_frames = 0;
+	m_pending.clear();
+	m_peaks.clear();
+}
+
+unsigned long long fingerprinter::position_to_sample(unsigned long long position) const
+{
+	unsigned long long frames = (position > m_base_position ? (position - m_base_position) / m_in_frame_size : 0);
+	return frames * FINGERPRINT_SAMPLING_RATE / m_in_rate;
+}
+
+unsigned long long fingerprinter::sample_to_position(unsigned long long sample) const
+{
+	return m_base_position + (sample * m_in_rate / FINGERPRINT_SAMPLING_RATE) * m_in_frame_size;
+}
+
+void fingerprinter::add(const audio_buffer * buffer, unsigned long long position)
+{
+	if(!m_converter)
+	{
+		return;
+	}
+	if((0 == m_frames) && m_pending.empty())
+	{
+		m_base_position = position;
+	}
+	else if(position != m_next_position)
+	{
+		DEBUG("Discontinuity at %llu. Starting over.\n", position);
+		reset();
+		m_base_position = position;
+	}
+	m_next_position = position + buffer->m_size;
+	m_converter->convert(buffer);
+}
+
+int fingerprinter::write_data(const char * ptr, unsigned int size)
+{
+	const int16_t * samples = (const int16_t *)ptr;
+	m_pending.insert(m_pending.end(), samples, samples + size / sizeof(int16_t));
+
+	unsigned int offset = 0;
+	while((m_pending.size() - offset) >= FINGERPRINT_FFT_SIZE)
+	{
+		analyse_frame(&m_pending[offset]);
+		offset += FINGERPRINT_HOP_SIZE;
+	}
+	m_pending.erase(m_pending.begin(), m_pending.begin() + offset);
+	return 0;
+}
+
+void fingerprinter::analyse_frame(const int16_t * samples)
+{
+	const unsigned int size = FINGERPRINT_FFT_SIZE;
+	m_kernels->window_s16(samples, &m_window[0], &m_windowed[0], size);
+	for(unsigned int i = 0; i < size; i++)
+	{
+		m_re[i] = m_windowed[m_bit_reverse[i]];
+		m_im[i] = 0;
+	}
+
+	const float * twiddle_re = &m_twiddle_re[0];
+	const float * twiddle_im = &m_twiddle_im[0];
+	for(unsigned int half = 1; half < size; half <<= 1)
+	{
+		for(unsigned int start = 0; start < size; start += 2 * half)
+		{
+			m_kernels->butterfly_f32(&m_re[start], &m_im[start], &m_re[start + half], &m_im[start + half], twiddle_re, twiddle_im, half);
+		}
+		twiddle_re += half;
+		twiddle_im += half;
+	}
+	m_kernels->power_f32(&m_re[0], &m_im[0], &m_power[0], size / 2 + 1);
+
+	/* Strongest bin of each band, and whether it stands out from the rest of the frame.*/
+	double sum = 0;
+	for(unsigned int bin = BAND_EDGES[0]; bin < BAND_EDGES[FINGERPRINT_BANDS]; bin++)
+	{
+		sum += m_power[bin];
+	}
+	float threshold = (float)(sum / (BAND_EDGES[FINGERPRINT_BANDS] - BAND_EDGES[0])) * PEAK_RATIO;
+	if(threshold < m_min_peak_power)
+	{
+		threshold = m_min_peak_power;
+	}
+	frame_bands_t &bands = m_recent[m_frames % m_recent.size()];
+	for(unsigned int band = 0; band < FINGERPRINT_BANDS; band++)
+	{
+		unsigned int best = BAND_EDGES[band];
+		for(unsigned int bin = best + 1; bin < BAND_EDGES[band + 1]; bin++)
+		{
+			if(m_power[bin] > m_power[best])
+			{
+				best = bin;
+			}
+		}
+		bands.power[band] = m_power[best];
+		bands.bin[band] = best;
+		bands.candidate[band] = (m_power[best] > threshold);
+	}
+
+	if(m_frames >= PEAK_NEIGHBOURHOOD_FRAMES)
+	{
+		pick_peaks(m_frames - PEAK_NEIGHBOURHOOD_FRAMES);
+	}
+	m_frames++;
+
+	while(!m_peaks.empty() && ((m_peaks.front().frame + m_history_frames) < m_frames))
+	{
+		m_peaks.pop_front();
+	}
+}
+
+/* Keeps the candidates of a frame that are the strongest in their band among the frames around it. The later frames
+ * have been analysed, and the earlier ones are still in m_recent. Ties go to the earliest frame.*/
+void fingerprinter::pick_peaks(unsigned long long frame)
+{
+	const unsigned long long first = (frame > PEAK_NEIGHBOURHOOD_FRAMES ? frame - PEAK_NEIGHBOURHOOD_FRAMES : 0);
+	const unsigned long long last = frame + PEAK_NEIGHBOURHOOD_FRAMES;
+	const frame_bands_t &bands = m_recent[frame % m_recent.size()];
+	for(unsigned int band = 0; band < FINGERPRINT_BANDS; band++)
+	{
+		if(!bands.candidate[band])
+		{
+			continue;
+		}
+		bool peak = true;
+		for(unsigned long long other = first; peak && (other <= last); other++)
+		{
+			const frame_bands_t &other_bands = m_recent[other % m_recent.size()];
+			if(other < frame)
+			{
+				peak = (bands.power[band] > other_bands.power[band]);
+			}
+			else if(other > frame)
+			{
+				peak = (bands.power[band] >= other_bands.power[band]);
+			}
+		}
+		if(peak)
+		{
+			peak_t entry = {frame, bands.bin[band]};
+			m_peaks.push_back(entry);
+		}
+	}
+}
+
+bool fingerprinter::get_fingerprint(unsigned long long start, unsigned long long end, acm_fingerprint_header_t &header,
+		std::vector <acm_fingerprint_hash_t> &hashes, unsigned long long &first_position) const
+{
+	hashes.clear();
+	if(!m_converter || (m_frames <= PEAK_NEIGHBOURHOOD_FRAMES) || (end <= start))
+	{
+		return false;
+	}
+
+	/* Frames whose peaks are known: not yet dropped, and with all their neighbours analysed.*/
+	unsigned long long oldest_frame = (m_frames > m_history_frames ? m_frames - m_history_frames : 0);
+	unsigned long long settled_frames = m_frames - PEAK_NEIGHBOURHOOD_FRAMES;
+
+	unsigned long long start_sample = position_to_sample(start);
+	unsigned long long end_sample = position_to_sample(end);
+	unsigned long long first_frame = (start_sample + FINGERPRINT_HOP_SIZE - 1) / FINGERPRINT_HOP_SIZE;
+	unsigned long long end_frame = (end_sample >= FINGERPRINT_FFT_SIZE ? (end_sample - FINGERPRINT_FFT_SIZE) / FINGERPRINT_HOP_SIZE + 1 : 0);
+	first_frame = std::max(first_frame, oldest_frame);
+	end_frame = std::min(end_frame, settled_frames);
+	if(end_frame <= first_frame)
+	{
+		return false;
+	}
+
+	auto anchor = std::lower_bound(m_peaks.begin(), m_peaks.end(), first_frame,
+			[](const peak_t &peak, unsigned long long value){return peak.frame < value;});
+	for(; (anchor != m_peaks.end()) && (anchor->frame < end_frame); ++anchor)
+	{
+		unsigned int paired = 0;
+		for(auto target = anchor + 1; (target != m_peaks.end()) && (paired < FAN_OUT); ++target)
+		{
+			if((target->frame >= end_frame) || (target->frame > (anchor->frame + TARGET_ZONE_FRAMES)))
+			{
+				break;
+			}
+			unsigned int distance = (target->bin > anchor->bin ? target->bin - anchor->bin : anchor->bin - target->bin);
+			if((target->frame == anchor->frame) || (distance > TARGET_ZONE_BINS))
+			{
+				continue;
+			}
+			acm_fingerprint_hash_t hash;
+			hash.hash = ACM_FINGERPRINT_HASH(anchor->bin, target->bin, target->frame - anchor->frame);
+			hash.frame = (uint32_t)(anchor->frame - first_frame);
+			hashes.push_back(hash);
+			paired++;
+		}
+	}
+
+	header.magic = ACM_FINGERPRINT_MAGIC;
+	header.version = ACM_FINGERPRINT_VERSION;
+	header.header_size = sizeof(acm_fingerprint_header_t);
+	header.timestamp_us = 0;
+	header.sampling_rate = FINGERPRINT_SAMPLING_RATE;
+	header.fft_size = FINGERPRINT_FFT_SIZE;
+	header.hop_size = FINGERPRINT_HOP_SIZE;
+	header.frames = (uint32_t)(end_frame - first_frame);
+	header.hash_count = (uint32_t)hashes.size();
+	first_position = sample_to_position(first_frame * FINGERPRINT_HOP_SIZE);
+	return true;
+}
@@ -21,20 +21,33 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
 #include <stdio.h>
+#include <string.h>
 #include <errno.h>
 
 #define _GNU_SOURCE
 #include <fcntl.h>
 #include <unistd.h>
 #include "safec_lib.h"
+#include "acm_thread.h"
 
 using namespace audiocapturemgr;
 std::string SOCKNAME_PREFIX = "/tmp/acm_ip_out_";
 static unsigned int ticker;
 static const int PIPE_READ_FD = 0;
 static const int PIPE_WRITE_FD = 1;
-static const unsigned int MAX_CONNECTIONS = 1;
+static const unsigned int MAX_CONNECTIONS = 8;
+static const unsigned int IP_OUT_DELIVERY_QUEUE_DEPTH = 128;
+static const unsigned int SEND_QUEUE_SIZE = 256 * 1024; //Per reader. About 1.3s of 48kHz 16-bit stereo.
+static const unsigned int STALL_TIMEOUT_MS = 2000; //A reader that takes nothing for this long while losing data is disconnected.
+static const unsigned int MAX_EPOLL_EVENTS = 16;
+static const unsigned int DEFAULT_LATENCY_BUDGET_MS = 10;
+static const unsigned int SOCKET_BUFFER_DURATION_MS = 100; //Enough to ride out reader scheduling jitter. Any more backlog shows up in our own queue.
+static const int MIN_SOCKET_BUFFER_SIZE = 16 * 1024;
+static const unsigned int MAX_FRAMES_PER_SEND = 16;
 
 static bool g_one_time_init_complete = false;
 
@@ -51,7 +64,9 @@ static void * ip_out_thread_launcher(void * data)
     return NULL;
 }
 
-ip_out_client::ip_out_client(q_mgr *mgr) : audio_capture_client(mgr), m_listen_fd(-1), m_write_fd(-1), m_num_connections(0)
+ip_out_client::ip_out_client(q_mgr *mgr) : audio_capture_client(mgr), m_listen_fd(-1), m_epoll_fd(-1), m_timer_fd(-1), m_connection_counter(0),
+	m_latency_budget_ms(DEFAULT_LATENCY_BUDGET_MS), m_batch_pending(false), m_stream_data_rate(0), m_framed(false), m_largest_frame(0),
+	m_convert_output(false), m_sink(*this), m_converter(NULL)
 {
 	INFO("Enter\n")
 	if(!g_one_time_init_complete)
@@ -66,7 +81,18 @@ ip_out_client::ip_out_client(q_mgr *mgr) : audio_capture_client(mgr), m_listen_f
         m_control_pipe[PIPE_WRITE_FD] = 0;
 		g_one_time_init_complete = true;
 	}
+	m_stats = {0, 0, 0, 0};
+	m_input_properties = {racFormat_eMax, racFreq_eMax, 0, 0, 0};
+	m_output_properties = {racFormat_e16BitMono, racFreq_e16000, 0, 0, 0}; /*Only format and sampling rate matter for conversion*/
+	memset(&m_frame_header, 0, sizeof(m_frame_header));
+	m_frame_header.magic = ACM_STREAM_FRAME_MAGIC;
+	m_frame_header.version = ACM_STREAM_FRAME_VERSION;
+	m_frame_header.header_size = sizeof(m_frame_header);
+	m_frame_header.sequence = (unsigned long long)-1; //So that the first buffer, number 0, follows on.
 	REPORT_IF_UNEQUAL(0, pipe2(m_control_pipe, O_NONBLOCK));
+	/* Readers never block delivery, so this only overflows if the client itself is starved. Every reader then has a hole
+	 * in its stream, and gets disconnected rather than fed one.*/
+	set_delivery_policy(DISCONNECT, IP_OUT_DELIVERY_QUEUE_DEPTH);
 	open_output();
 }
 
@@ -76,26 +102,69 @@ ip_out_client::~ip_out_client()
 	close_output();
 	close(m_control_pipe[PIPE_WRITE_FD]);
 	close(m_control_pipe[PIPE_READ_FD]);
+	delete m_converter;
 }
 
 int ip_out_client::data_callback(audio_buffer *buf)
 {
 	lock();
-	if(0 < m_write_fd)
+	audio_properties_t properties;
+	get_audio_properties(properties);
+	if((properties.format != m_input_properties.format) || (properties.sampling_frequency != m_input_properties.sampling_frequency))
 	{
-		int ret = write(m_write_fd, buf->m_start_ptr, buf->m_size);
-		if(0 > ret)
+		if(m_convert_output)
+		{
+			rebuild_converter();
+		}
+		else
+		{
+			m_input_properties = properties;
+			update_stream_data_rate();
+		}
+	}
+
+	if((m_frame_header.sequence + 1) != buf->m_sequence)
+	{
+		m_frame_header.flags |= ACM_STREAM_FRAME_FLAG_DISCONTINUITY; //Audio was lost before it got here.
+	}
+	m_frame_header.sequence = buf->m_sequence;
+	unsigned long long timestamp_us = buf->m_timestamp_us;
+	unsigned long long sample_index = buf->m_sample_index;
+	if(m_convert_output && m_converter->is_supported())
+	{
+		m_converter->get_output_position(buf, timestamp_us, sample_index);
+	}
+	m_frame_header.timestamp_us = timestamp_us;
+	m_frame_header.sample_index = sample_index;
+
+	if(!m_connections.empty())
+	{
+		if(m_convert_output)
 		{
-			WARN("Write error! Closing socket. errno: 0x%x\n", errno);
-			perror("ip_out_client::data_callback() ");
-			close(m_write_fd);
-			m_write_fd = -1;
-			m_num_connections--;
-			//audio_capture_client::stop();
+			unsigned long long start_us = get_monotonic_time_us();
+			if(m_converter->is_supported() && m_framed)
+			{
+				/* The converter hands over its output in pieces. Gather them, so that each buffer still makes one frame.*/
+				m_frame_payload.clear();
+				m_sink.collect(&m_frame_payload);
+				m_converter->convert(buf);
+				m_sink.collect(NULL);
+				if(!m_frame_payload.empty())
+				{
+					m_sink.write_data(&m_frame_payload[0], m_frame_payload.size());
+				}
+			}
+			else if(m_converter->is_supported())
+			{
+				m_converter->convert(buf); //Output goes to fan_out() through m_sink.
+			}
+			unsigned long long elapsed_us = get_monotonic_time_us() - start_us;
+			unsigned long long fan_out_us = m_sink.take_fan_out_time();
+			m_conversion_cost.record(elapsed_us > fan_out_us ? elapsed_us - fan_out_us : 0);
 		}
-		else if(ret != buf->m_size)
+		else
 		{
-			WARN("Incomplete buffer write!\n");
+			fan_out((const char *)buf->m_start_ptr, buf->m_size);
 		}
 	}
 	unlock();
@@ -103,6 +172,434 @@ int ip_out_client::data_callback(audio_buffer *buf)
 	return 0;  //CID:88863 ; Missing Return
 }
 
+void ip_out_client::notify_event(audio_capture_events_t event)
+{
+	if(AUDIO_DELIVERY_OVERFLOW_EVENT == event)
+	{
+		lock();
+		if(!m_connections.empty())
+		{
+			WARN("Delivery is not keeping up. Closing all %d sockets.\n", (int)m_connections.size());
+			while(!m_connections.empty())
+			{
+				close_connection(m_connections.begin()->second);
+			}
+		}
+		unlock();
+	}
+}
+
+int ip_out_fanout_sink::write_data(const char * ptr, unsigned int size)
+{
+	if(m_collector)
+	{
+		m_collector->insert(m_collector->end(), ptr, ptr + size);
+		return 0;
+	}
+	unsigned long long start_us = get_monotonic_time_us();
+	int ret = m_client.fan_out(ptr, size);
+	m_fan_out_us += get_monotonic_time_us() - start_us;
+	return ret;
+}
+
+int ip_out_client::fan_out(const char * ptr, unsigned int size)
+{
+	auto now = std::chrono::steady_clock::now();
+	bool batching = (0 != m_latency_budget_ms);
+
+	acm_stream_frame_header_t header;
+	struct iovec iov[2];
+	int iov_count = 0;
+	if(m_framed)
+	{
+		header = m_frame_header;
+		header.payload_size = size;
+		iov[iov_count].iov_base = &header;
+		iov[iov_count++].iov_len = sizeof(header);
+	}
+	iov[iov_count].iov_base = (void *)ptr;
+	iov[iov_count++].iov_len = size;
+	unsigned int total = size + (m_framed ? sizeof(header) : 0);
+
+	if(m_framed && (m_largest_frame < total))
+	{
+		m_largest_frame = total; //Socket buffers have to take at least a whole frame.
+		for(auto &entry : m_connections)
+		{
+			size_socket_buffer(entry.first);
+		}
+	}
+
+	auto iter = m_connections.begin();
+	while(iter != m_connections.end())
+	{
+		connection_t * connection = (iter++)->second; //Advance first, as the connection may be closed below.
+		header.flags = m_frame_header.flags | (connection->discontinuity ? ACM_STREAM_FRAME_FLAG_DISCONTINUITY : 0);
+		unsigned int sent = 0;
+		if(!batching && (0 == connection->queue_fill))
+		{
+			/* A frame goes out whole or not at all, as SOCK_SEQPACKET doesn't do partial writes.*/
+			ssize_t ret = writev(connection->fd, iov, iov_count);
+			if(0 > ret)
+			{
+				if((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+				{
+					WARN("Write error! Closing socket %d. errno: 0x%x\n", connection->stats.id, errno);
+					close_connection(connection);
+					continue;
+				}
+				ret = 0;
+			}
+			else
+			{
+				connection->last_progress = now;
+				connection->stats.writes++;
+				record_latency(connection, m_frame_header.timestamp_us);
+			}
+			sent = ret;
+			connection->stats.bytes_sent += ret;
+		}
+
+		unsigned int remaining = total - sent;
+		if(0 == remaining)
+		{
+			connection->discontinuity = false;
+			continue;
+		}
+		unsigned int needed = remaining + (m_framed ? sizeof(uint32_t) : 0); //Queued frames are prefixed with their length.
+		if(needed <= (connection->queue.size() - connection->queue_fill))
+		{
+			if(0 == sent)
+			{
+				connection->queued_chunks.push_back(std::make_pair(connection->dequeued + connection->queue_fill, m_frame_header.timestamp_us));
+			}
+			if(m_framed)
+			{
+				uint32_t length = total;
+				enqueue(connection, (const char *)&length, sizeof(length));
+				enqueue(connection, (const char *)&header, sizeof(header));
+				enqueue(connection, ptr, size);
+			}
+			else
+			{
+				enqueue(connection, ptr + sent, remaining);
+			}
+			connection->discontinuity = false;
+			if(!batching)
+			{
+				set_waiting_for_output(connection, true);
+			}
+		}
+		else
+		{
+			/* Whole chunks are dropped so that what the reader does get stays frame-aligned.*/
+			connection->stats.bytes_dropped += remaining;
+			connection->stats.chunks_dropped++;
+			connection->discontinuity = true;
+			if(std::chrono::milliseconds(STALL_TIMEOUT_MS) < (now - connection->last_progress))
+			{
+				WARN("Reader %d has taken nothing for over %dms. Closing socket.\n", connection->stats.id, STALL_TIMEOUT_MS);
+				m_stats.stalled++;
+				close_connection(connection);
+			}
+		}
+	}
+
+	/* Batches go out when they are as old as the latency budget allows, or when the timer says so if no more audio
+	 * arrives in the meantime.*/
+	if(batching && !m_connections.empty())
+	{
+		if(!m_batch_pending)
+		{
+			m_batch_pending = true;
+			m_batch_start = now;
+			arm_batch_timer(m_latency_budget_ms);
+		}
+		else if(std::chrono::milliseconds(m_latency_budget_ms) <= (now - m_batch_start))
+		{
+			flush_all();
+		}
+	}
+	m_frame_header.flags &= ~ACM_STREAM_FRAME_FLAG_DISCONTINUITY;
+	return 0;
+}
+
+/* Must be called with the client lock held.*/
+void ip_out_client::flush_all()
+{
+	m_batch_pending = false;
+	arm_batch_timer(0);
+	auto iter = m_connections.begin();
+	while(iter != m_connections.end())
+	{
+		connection_t * connection = (iter++)->second;
+		if(0 > flush(connection))
+		{
+			WARN("Write error! Closing socket %d. errno: 0x%x\n", connection->stats.id, errno);
+			close_connection(connection);
+			continue;
+		}
+		set_waiting_for_output(connection, (0 != connection->queue_fill)); //Socket is full. Carry on when it drains.
+	}
+}
+
+void ip_out_client::arm_batch_timer(unsigned int delay_ms)
+{
+	if(0 > m_timer_fd)
+	{
+		return;
+	}
+	struct itimerspec timeout;
+	memset(&timeout, 0, sizeof(timeout));
+	timeout.it_value.tv_sec = delay_ms / 1000;
+	timeout.it_value.tv_nsec = (delay_ms % 1000) * 1000000; //All zeroes disarms the timer.
+	REPORT_IF_UNEQUAL(0, timerfd_settime(m_timer_fd, 0, &timeout, NULL));
+}
+
+/* The kernel buffer is kept just large enough for a short stretch of audio, so that backlog beyond that shows up in
+ * the send queue, where it is counted and bounded.*/
+void ip_out_client::size_socket_buffer(int fd)
+{
+	int size = (int)(((unsigned long long)m_stream_data_rate * (SOCKET_BUFFER_DURATION_MS + m_latency_budget_ms)) / 1000);
+	if(MIN_SOCKET_BUFFER_SIZE > size)
+	{
+		size = MIN_SOCKET_BUFFER_SIZE;
+	}
+	if(size < (int)(2 * m_largest_frame))
+	{
+		size = 2 * m_largest_frame;
+	}
+	if(0 != setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)))
+	{
+		WARN("Could not set send buffer size to %d. errno: 0x%x\n", size, errno);
+	}
+}
+
+/* Must be called with the client lock held, whenever the format sent to readers may have changed.*/
+void ip_out_client::update_stream_data_rate()
+{
+	bool converting = (m_convert_output && m_converter && m_converter->is_supported());
+	if(!converting && (racFormat_eMax == m_input_properties.format))
+	{
+		return; //No audio seen yet.
+	}
+	const audio_properties_t &properties = (converting ? m_output_properties : m_input_properties);
+	unsigned int sampling_rate, bits_per_sample, num_channels;
+	get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
+	if((sampling_rate != m_frame_header.sampling_rate) || (bits_per_sample != m_frame_header.bits_per_sample) || (num_channels != m_frame_header.channels))
+	{
+		m_frame_header.sampling_rate = sampling_rate;
+		m_frame_header.bits_per_sample = bits_per_sample;
+		m_frame_header.channels = num_channels;
+		m_frame_header.flags |= ACM_STREAM_FRAME_FLAG_DISCONTINUITY;
+	}
+
+	unsigned int data_rate = calculate_data_rate(properties);
+	if(data_rate != m_stream_data_rate)
+	{
+		m_stream_data_rate = data_rate;
+		for(auto &entry : m_connections)
+		{
+			size_socket_buffer(entry.first);
+		}
+	}
+}
+
+void ip_out_client::set_latency_budget(unsigned int budget_ms)
+{
+	lock();
+	m_latency_budget_ms = budget_ms;
+	if(m_batch_pending)
+	{
+		flush_all();
+	}
+	for(auto &entry : m_connections)
+	{
+		size_socket_buffer(entry.first);
+	}
+	unlock();
+	INFO("Latency budget is now %dms.\n", budget_ms);
+}
+
+void ip_out_client::enqueue(connection_t * connection, const char * ptr, unsigned int size)
+{
+	unsigned int capacity = connection->queue.size();
+	unsigned int tail = (connection->queue_head + connection->queue_fill) % capacity;
+	unsigned int first = (size < (capacity - tail) ? size : (capacity - tail));
+	memcpy(&connection->queue[tail], ptr, first);
+	memcpy(&connection->queue[0], ptr + first, size - first);
+	connection->queue_fill += size;
+	if(connection->stats.queue_high_water_mark < connection->queue_fill)
+	{
+		connection->stats.queue_high_water_mark = connection->queue_fill;
+	}
+}
+
+void ip_out_client::dequeue(connection_t * connection, unsigned int size)
+{
+	connection->queue_head = (connection->queue_head + size) % connection->queue.size();
+	connection->queue_fill -= size;
+	connection->dequeued += size;
+	while(!connection->queued_chunks.empty() && (connection->queued_chunks.front().first < connection->dequeued))
+	{
+		record_latency(connection, connection->queued_chunks.front().second); //The start of the chunk has just left.
+		connection->queued_chunks.pop_front();
+	}
+}
+
+void ip_out_client::record_latency(connection_t * connection, unsigned long long timestamp_us)
+{
+	if(0 == timestamp_us)
+	{
+		return;
+	}
+	unsigned long long now = get_monotonic_time_us();
+	connection->stats.latency_us = (now > timestamp_us ? (unsigned int)(now - timestamp_us) : 0);
+	if(connection->stats.max_latency_us < connection->stats.latency_us)
+	{
+		connection->stats.max_latency_us = connection->stats.latency_us;
+	}
+}
+
+/* Sends as much of the queue as the socket takes. Returns -1 if the connection is broken.*/
+int ip_out_client::flush(connection_t * connection)
+{
+	if(m_framed)
+	{
+		return flush_frames(connection);
+	}
+	unsigned int capacity = connection->queue.size();
+	while(0 < connection->queue_fill)
+	{
+		unsigned int first = capacity - connection->queue_head;
+		struct iovec iov[2];
+		iov[0].iov_base = &connection->queue[connection->queue_head];
+		iov[0].iov_len = (connection->queue_fill < first ? connection->queue_fill : first);
+		iov[1].iov_base = &connection->queue[0];
+		iov[1].iov_len = connection->queue_fill - iov[0].iov_len;
+
+		ssize_t ret = writev(connection->fd, iov, (0 == iov[1].iov_len ? 1 : 2));
+		if(0 > ret)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			return (((EAGAIN == errno) || (EWOULDBLOCK == errno)) ? 0 : -1);
+		}
+		dequeue(connection, ret);
+		connection->stats.bytes_sent += ret;
+		connection->stats.writes++;
+		connection->last_progress = std::chrono::steady_clock::now();
+	}
+	return 0;
+}
+
+/* Maps size bytes of a circular queue, starting at offset, to one or two iovecs. Returns how many were used.*/
+static int map_queue(std::vector <char> &queue, unsigned int offset, unsigned int size, struct iovec * iov)
+{
+	unsigned int first = queue.size() - offset;
+	iov[0].iov_base = &queue[offset];
+	iov[0].iov_len = (size < first ? size : first);
+	iov[1].iov_base = &queue[0];
+	iov[1].iov_len = size - iov[0].iov_len;
+	return (0 == iov[1].iov_len ? 1 : 2);
+}
+
+/* Framed counterpart of flush(). Frames are queued behind their length, and sent up to MAX_FRAMES_PER_SEND at a time.*/
+int ip_out_client::flush_frames(connection_t * connection)
+{
+	unsigned int capacity = connection->queue.size();
+	while(0 < connection->queue_fill)
+	{
+		struct mmsghdr messages[MAX_FRAMES_PER_SEND];
+		struct iovec iov[MAX_FRAMES_PER_SEND][2];
+		uint32_t lengths[MAX_FRAMES_PER_SEND];
+		unsigned int count = 0;
+		unsigned int offset = connection->queue_head;
+		unsigned int fill = connection->queue_fill;
+		memset(messages, 0, sizeof(messages));
+		while((MAX_FRAMES_PER_SEND > count) && (0 < fill))
+		{
+			struct iovec length_iov[2];
+			int segments = map_queue(connection->queue, offset, sizeof(uint32_t), length_iov);
+			memcpy(&lengths[count], length_iov[0].iov_base, length_iov[0].iov_len);
+			if(2 == segments)
+			{
+				memcpy((char *)&lengths[count] + length_iov[0].iov_len, length_iov[1].iov_base, length_iov[1].iov_len);
+			}
+			offset = (offset + sizeof(uint32_t)) % capacity;
+
+			messages[count].msg_hdr.msg_iov = iov[count];
+			messages[count].msg_hdr.msg_iovlen = map_queue(connection->queue, offset, lengths[count], iov[count]);
+			offset = (offset + lengths[count]) % capacity;
+			fill -= sizeof(uint32_t) + lengths[count];
+			count++;
+		}
+
+		int ret = sendmmsg(connection->fd, messages, count, 0);
+		if(0 > ret)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			return (((EAGAIN == errno) || (EWOULDBLOCK == errno)) ? 0 : -1);
+		}
+		for(int i = 0; i < ret; i++)
+		{
+			dequeue(connection, sizeof(uint32_t) + lengths[i]);
+			connection->stats.bytes_sent += lengths[i];
+		}
+		connection->stats.writes++;
+		connection->last_progress = std::chrono::steady_clock::now();
+		if(ret < (int)count)
+		{
+			break; //Socket is full.
+		}
+	}
+	return 0;
+}
+
+void ip_out_client::set_waiting_for_output(connection_t * connection, bool waiting)
+{
+	if(waiting == connection->waiting_for_output)
+	{
+		return;
+	}
+	struct epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLIN | EPOLLRDHUP | (waiting ? (uint32_t)EPOLLOUT : 0u);
+	event.data.fd = connection->fd;
+	REPORT_IF_UNEQUAL(0, epoll_ctl(m_epoll_fd, EPOLL_CTL_MOD, connection->fd, &event));
+	connection->waiting_for_output = waiting;
+}
+
+void ip_out_client::close_connection(connection_t * connection)
+{
+	INFO("Closing reader %d. Sent %llu bytes in %llu writes, dropped %llu bytes in %llu chunks, queue high-water mark %d bytes, latency up to %dus.\n",
+			connection->stats.id, connection->stats.bytes_sent, connection->stats.writes, connection->stats.bytes_dropped,
+			connection->stats.chunks_dropped, connection->stats.queue_high_water_mark, connection->stats.max_latency_us);
+	epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+	close(connection->fd);
+	m_connections.erase(connection->fd);
+	delete connection;
+}
+
+void ip_out_client::get_stats(ip_out_stats_t &totals, std::vector <ip_out_connection_stats_t> &connections)
+{
+	lock();
+	totals = m_stats;
+	totals.active_connections = m_connections.size();
+	connections.clear();
+	for(auto &entry : m_connections)
+	{
+		connections.push_back(entry.second->stats);
+		connections.back().queued_bytes = entry.second->queue_fill;
+	}
+	unlock();
+}
+
 std::string ip_out_client::get_data_path()
 {
 	return m_data_path;
@@ -119,7 +616,7 @@ std::string ip_out_client::open_output()
 	}
 
 	/*Open new UNIX socket to transfer data*/
-	m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0); //TODO: Does it really need to be non-blocking?
+	m_listen_fd = socket(AF_UNIX, (m_framed ? SOCK_SEQPACKET : SOCK_STREAM) | SOCK_NONBLOCK, 0); //TODO: Does it really need to be non-blocking?
 	if (m_listen_fd < 0) {
 		ERROR("Could not open socket.\n");
 		unlock();
@@ -161,7 +658,19 @@ std::string ip_out_client::open_output()
 		{
 			INFO("Bound successfully to path.\n");
 			m_data_path = sockpath;
-			REPORT_IF_UNEQUAL(0, listen(m_listen_fd, 3));
+			REPORT_IF_UNEQUAL(0, listen(m_listen_fd, MAX_CONNECTIONS));
+
+			m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+			struct epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN;
+			event.data.fd = m_listen_fd;
+			REPORT_IF_UNEQUAL(0, epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &event));
+			event.data.fd = m_control_pipe[PIPE_READ_FD];
+			REPORT_IF_UNEQUAL(0, epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_control_pipe[PIPE_READ_FD], &event));
+			m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+			event.data.fd = m_timer_fd;
+			REPORT_IF_UNEQUAL(0, epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_timer_fd, &event));
 			REPORT_IF_UNEQUAL(0, pthread_create(&m_thread, NULL, ip_out_thread_launcher, (void *) this));
 			break;
 		}
@@ -175,9 +684,19 @@ std::string ip_out_client::open_output()
 void ip_out_client::close_output()
 {
 	INFO("Enter\n");
-	lock();
+	if(m_data_path.empty())
+	{
+		if(0 <= m_listen_fd)
+		{
+			close(m_listen_fd); //Socket was created, but never bound.
+			m_listen_fd = -1;
+		}
+		INFO("Exit\n");
+		return;
+	}
 
-	/*Shut down worker thread that listens to incoming connections.*/
+	/*Shut down worker thread that listens to incoming connections. It takes the client lock, so it must be joined
+	 * before the lock is taken here.*/
 	int message = MSG_EXIT;
 	int ret = write(m_control_pipe[PIPE_WRITE_FD], &message, sizeof(message));
 	if(ret != sizeof(message))
@@ -190,102 +709,249 @@ void ip_out_client::close_output()
 		REPORT_IF_UNEQUAL(0, pthread_join(m_thread, NULL));
 		INFO("Worker thread has joined.\n");
 	}
-	if(!m_data_path.empty())
+
+	lock();
+	while(!m_connections.empty())
 	{
-		if(0 < m_write_fd)
-		{
-			close(m_write_fd);
-			m_write_fd = -1;
-			m_num_connections--;
-			INFO("Closed write fd. Total active connections now is %d\n", m_num_connections);
-		}
-		INFO("Removing named socket %s.\n", m_data_path.c_str());
-		unlink(m_data_path.c_str());
-		m_data_path.clear();
+		close_connection(m_connections.begin()->second);
 	}
+	m_batch_pending = false;
+	close(m_timer_fd);
+	m_timer_fd = -1;
+	close(m_epoll_fd);
+	m_epoll_fd = -1;
+	close(m_listen_fd);
+	m_listen_fd = -1;
+	INFO("Removing named socket %s.\n", m_data_path.c_str());
+	unlink(m_data_path.c_str());
+	m_data_path.clear();
 	unlock();
 	INFO("Exit\n");
 }
 
-void ip_out_client::process_new_connection()
+void ip_out_client::process_new_connections()
 {
 	INFO("Enter\n");
+	while(true)
+	{
+		int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(0 > fd)
+		{
+			if((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+			{
+				ERROR("Error accepting connection. errno: 0x%x\n", errno);
+			}
+			break;
+		}
+
+		lock();
+		if(MAX_CONNECTIONS <= m_connections.size())
+		{
+			WARN("Already serving %d readers. Turning away the new one.\n", MAX_CONNECTIONS);
+			close(fd);
+			m_stats.rejected++;
+			unlock();
+			continue;
+		}
+
+		connection_t * connection = new connection_t;
+		connection->fd = fd;
+		connection->queue.resize(SEND_QUEUE_SIZE);
+		connection->queue_head = 0;
+		connection->queue_fill = 0;
+		connection->waiting_for_output = false;
+		connection->discontinuity = true;
+		connection->dequeued = 0;
+		connection->last_progress = std::chrono::steady_clock::now();
+		connection->stats = {m_connection_counter++, 0, 0, 0, 0, 0, 0, 0, 0};
+		size_socket_buffer(fd);
+
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.fd = fd;
+		REPORT_IF_UNEQUAL(0, epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event));
+
+		if(m_connections.empty() && m_converter)
+		{
+			m_converter->reset(); //Conversion pauses while nobody is reading, so the old history is stale.
+		}
+		m_connections[fd] = connection;
+		m_stats.accepted++;
+		INFO("Connected to new reader %d. Total active connections now is %d\n", connection->stats.id, (int)m_connections.size());
+		unlock();
+	}
+	INFO("Exit\n");
+}
+
+void ip_out_client::process_connection_event(int fd, unsigned int events)
+{
 	lock();
-	if(0 < m_write_fd)
+	auto iter = m_connections.find(fd);
+	if(m_connections.end() == iter)
 	{
-		WARN("Trashing old write socket in favour of new one.\n");
-		close(m_write_fd);
-		m_write_fd = -1;
-		m_num_connections--;
-	}	
-	
-	DEBUG("Setting up a new connection.\n");
-	struct sockaddr_un incoming_addr;
-	int addrlen = sizeof(incoming_addr);
-	m_write_fd = accept(m_listen_fd, (sockaddr *) &incoming_addr, (socklen_t *)&addrlen);
+		unlock();
+		return; //Already closed by the delivery thread.
+	}
+	connection_t * connection = iter->second;
 
-	if(0 > m_write_fd)
+	bool broken = (0 != (events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)));
+	if(!broken && (0 != (events & EPOLLIN)))
 	{
-		ERROR("Error accepting connection.\n");
+		/* Readers aren't expected to send anything. Discard it, and look out for the end of the stream.*/
+		char discard[256];
+		ssize_t ret = read(fd, discard, sizeof(discard));
+		broken = ((0 == ret) || ((0 > ret) && (EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno)));
 	}
-	else
+	if(!broken && (0 != (events & EPOLLOUT)))
 	{
-		m_num_connections++;
-		INFO("Connected to new client.\n");
-#if 0		
-		if(!m_is_enabled)
+		broken = (0 > flush(connection));
+		if(!broken)
 		{
-			INFO("Starting data delivery.\n");
-			audio_capture_client::start();
+			set_waiting_for_output(connection, (0 != connection->queue_fill));
 		}
-#endif
+	}
+	if(broken)
+	{
+		INFO("Reader %d has gone away.\n", connection->stats.id);
+		close_connection(connection);
 	}
 	unlock();
-	INFO("Exit\n");
-	return;
 }
 
 void ip_out_client::worker_thread()
 {
+	thread_role_scope role(THREAD_ROLE_IP_OUT);
 	INFO("Enter\n");
 	int control_fd = m_control_pipe[PIPE_READ_FD];
-	int max_fd = (m_listen_fd > control_fd ? m_listen_fd : control_fd);
-
-
+	struct epoll_event events[MAX_EPOLL_EVENTS];
 	bool check_fds = true;
 
 	while(check_fds)
 	{
-		fd_set poll_fd_set;
-		FD_ZERO(&poll_fd_set);
-		FD_SET(m_listen_fd, &poll_fd_set);
-		FD_SET(control_fd, &poll_fd_set);
-
-		int ret = select((max_fd + 1), &poll_fd_set, NULL, NULL, NULL);
+		int ret = epoll_wait(m_epoll_fd, events, MAX_EPOLL_EVENTS, -1);
 		DEBUG("Unblocking now. ret is 0x%x\n", ret);
-		if(0 == ret)
+		if(0 > ret)
 		{
-			ERROR("select() returned 0.\n");
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			ERROR("Error polling monitor FD!\n");
+			break;
 		}
-		else if(0 < ret)
+
+		for(int i = 0; i < ret; i++)
 		{
-			//Some activity was detected. Process event further.
-			if(0 != FD_ISSET(control_fd, &poll_fd_set))
+			int fd = events[i].data.fd;
+			if(control_fd == fd)
 			{
+				int message;
+				REPORT_IF_UNEQUAL(sizeof(message), read(control_fd, &message, sizeof(message))); //Consumed, or the output couldn't be reopened.
 				INFO("Exiting monitor thread.\n");
+				check_fds = false;
 				break;
 			}
-			if(0 != FD_ISSET(m_listen_fd, &poll_fd_set))
+			else if(m_listen_fd == fd)
 			{
-				process_new_connection();
+				process_new_connections();
 			}
+			else if(m_timer_fd == fd)
+			{
+				uint64_t expirations;
+				if(sizeof(expirations) == read(m_timer_fd, &expirations, sizeof(expirations)))
+				{
+					lock();
+					if(m_batch_pending)
+					{
+						flush_all();
+					}
+					unlock();
+				}
+			}
+			else
+			{
+				process_connection_event(fd, events[i].events);
+			}
+		}
+	}
+
+	INFO("Exit\n");
+}
+
+/* Must be called with the client lock held. The converter keeps references to both sets of properties, so it has to be
+ * rebuilt whenever either of them changes.*/
+void ip_out_client::rebuild_converter()
+{
+	delete m_converter;
+	get_audio_properties(m_input_properties);
+	m_converter = new audio_converter(m_input_properties, m_output_properties, m_sink);
+	if(!m_converter->is_supported())
+	{
+		ERROR("Can't convert format 0x%x at 0x%x to the output format.\n", m_input_properties.format, m_input_properties.sampling_frequency);
+	}
+	update_stream_data_rate();
+}
+
+int ip_out_client::set_output_properties(const audio_properties_t &properties)
+{
+	audio_properties_t input_properties;
+	get_audio_properties(input_properties);
+	ip_out_fanout_sink sink(*this); //Never written to.
+	audio_converter trial(input_properties, properties, sink);
+	if(!trial.is_supported())
+	{
+		ERROR("Unsupported output format 0x%x at 0x%x.\n", properties.format, properties.sampling_frequency);
+		return -1;
+	}
+
+	lock();
+	m_output_properties.format = properties.format;
+	m_output_properties.sampling_frequency = properties.sampling_frequency;
+	if(m_convert_output)
+	{
+		rebuild_converter();
+	}
+	unlock();
+	INFO("Output format is now 0x%x at 0x%x.\n", properties.format, properties.sampling_frequency);
+	return 0;
+}
+
+void ip_out_client::enable_output_conversion(bool isEnabled)
+{
+	lock();
+	if(isEnabled != m_convert_output)
+	{
+		m_convert_output = isEnabled;
+		if(m_convert_output)
+		{
+			rebuild_converter();
 		}
 		else
 		{
-			ERROR("Error polling monitor FD!\n");
-			break;
+			delete m_converter;
+			m_converter = NULL;
+			update_stream_data_rate();
 		}
 	}
+	unlock();
+	INFO("Output conversion %s.\n", (isEnabled ? "enabled" : "disabled"));
+}
 
-	INFO("Exit\n");
+void ip_out_client::set_framed_output(bool isEnabled)
+{
+	lock();
+	bool changed = (isEnabled != m_framed);
+	unlock();
+	if(!changed)
+	{
+		return;
+	}
+
+	close_output();
+	lock();
+	m_framed = isEnabled;
+	unlock();
+	open_output();
+	INFO("Output is now %s. Socket path is %s\n", (isEnabled ? "framed" : "a byte stream"), m_data_path.c_str());
 }
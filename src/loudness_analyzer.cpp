@@ -0,0 +1,204 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "loudness_analyzer.h"
+#include <math.h>
+
+using namespace audiocapturemgr;
+
+static const unsigned int SCRATCH_SAMPLES = 1024; //For narrowing 24-bit audio, a slice at a time.
+static const double FULL_SCALE = 32768.0;
+
+static float to_db(double ratio)
+{
+	double db = (0 < ratio ? 10 * log10(ratio) : LOUDNESS_FLOOR_DB);
+	return (LOUDNESS_FLOOR_DB > db ? LOUDNESS_FLOOR_DB : (float)db);
+}
+
+loudness_analyzer::loudness_analyzer() : m_history_start(0), m_history_count(0), m_frame_size(0), m_interval_size(0), m_narrow(false),
+	m_kernels(get_audio_kernels()), m_position(0), m_size(0), m_timestamp_us(0), m_sum_squares(0), m_samples(0), m_peak(0)
+{
+}
+
+void loudness_analyzer::configure(const audio_properties_t &properties, unsigned int history_seconds)
+{
+	unsigned int sampling_rate = 0, bits_per_sample = 0, num_channels = 0;
+	get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
+	m_frame_size = get_frame_size(properties);
+	m_interval_size = sampling_rate * m_frame_size;
+	m_narrow = (24 == bits_per_sample);
+	m_history.resize(history_seconds);
+	reset();
+}
+
+void loudness_analyzer::reset()
+{
+	m_history_start = 0;
+	m_history_count = 0;
+	m_size = 0;
+	m_sum_squares = 0;
+	m_samples = 0;
+	m_peak = 0;
+}
+
+void loudness_analyzer::measure(const unsigned char * ptr, unsigned int size)
+{
+	if(m_narrow)
+	{
+		int16_t scratch[SCRATCH_SAMPLES];
+		unsigned int samples = size / 3;
+		for(unsigned int i = 0; i < samples; i += SCRATCH_SAMPLES)
+		{
+			unsigned int count = (SCRATCH_SAMPLES < (samples - i) ? SCRATCH_SAMPLES : samples - i);
+			m_kernels->s24_to_s16(&ptr[3 * i], scratch, count);
+			m_kernels->energy_s16(scratch, count, &m_sum_squares, &m_peak);
+		}
+		m_samples += samples;
+	}
+	else
+	{
+		m_kernels->energy_s16((const int16_t *)ptr, size / 2, &m_sum_squares, &m_peak);
+		m_samples += size / 2;
+	}
+}
+
+void loudness_analyzer::fill_summary(loudness_summary_t &summary, uint64_t sum_squares, unsigned long long samples, unsigned int peak) const
+{
+	summary.level_db = (0 == samples ? LOUDNESS_FLOOR_DB : to_db(sum_squares / (samples * FULL_SCALE * FULL_SCALE)));
+	summary.peak_db = to_db((peak / FULL_SCALE) * (peak / FULL_SCALE));
+}
+
+void loudness_analyzer::close_interval()
+{
+	if((0 != m_size) && !m_history.empty())
+	{
+		unsigned int index = (m_history_start + m_history_count) % m_history.size();
+		if(m_history.size() == m_history_count)
+		{
+			m_history_start = (m_history_start + 1) % m_history.size(); //Overwrites the oldest.
+		}
+		else
+		{
+			m_history_count++;
+		}
+		loudness_summary_t &summary = m_history[index];
+		summary.position = m_position;
+		summary.size = m_size;
+		summary.timestamp_us = m_timestamp_us;
+		fill_summary(summary, m_sum_squares, m_samples, m_peak);
+	}
+	m_position += m_size;
+	m_size = 0;
+	m_sum_squares = 0;
+	m_samples = 0;
+	m_peak = 0;
+}
+
+void loudness_analyzer::add(const unsigned char * ptr, unsigned int size, unsigned long long position, unsigned long long timestamp_us)
+{
+	if(0 == m_interval_size)
+	{
+		return; //Not configured, or a format without a known rate.
+	}
+	if((0 != m_size) && (position != m_position + m_size))
+	{
+		close_interval();
+	}
+	while(0 != size)
+	{
+		if(0 == m_size)
+		{
+			m_position = position;
+			m_timestamp_us = timestamp_us;
+		}
+		/* Seconds end on frame boundaries, so a buffer is split where one ends.*/
+		unsigned int chunk = m_interval_size - m_size;
+		if(chunk > size)
+		{
+			chunk = size;
+		}
+		measure(ptr, chunk);
+		m_size += chunk;
+		if(m_interval_size == m_size)
+		{
+			close_interval();
+		}
+		unsigned long long chunk_us = (unsigned long long)chunk * 1000000 / m_interval_size;
+		ptr += chunk;
+		size -= chunk;
+		position += chunk;
+		timestamp_us = (0 != timestamp_us ? timestamp_us + chunk_us : 0);
+	}
+}
+
+bool loudness_analyzer::get_window(unsigned long long start, unsigned long long end, float threshold_db, loudness_window_t &window) const
+{
+	std::vector <loudness_summary_t> history;
+	get_history(history);
+	double energy = 0;
+	unsigned long long covered = 0;
+	window.max_level_db = LOUDNESS_FLOOR_DB;
+	window.peak_db = LOUDNESS_FLOOR_DB;
+	window.loud_start = window.loud_end = start;
+	bool loud = false;
+	for(auto &summary : history)
+	{
+		unsigned long long summary_end = summary.position + summary.size;
+		if((summary_end <= start) || (summary.position >= end))
+		{
+			continue;
+		}
+		unsigned long long overlap = (summary_end < end ? summary_end : end) - (summary.position > start ? summary.position : start);
+		energy += pow(10, summary.level_db / 10) * overlap;
+		covered += overlap;
+		if(window.max_level_db < summary.level_db)
+		{
+			window.max_level_db = summary.level_db;
+		}
+		if(window.peak_db < summary.peak_db)
+		{
+			window.peak_db = summary.peak_db;
+		}
+		if(summary.level_db >= threshold_db)
+		{
+			if(!loud)
+			{
+				window.loud_start = (summary.position > start ? summary.position : start);
+				loud = true;
+			}
+			window.loud_end = (summary_end < end ? summary_end : end);
+		}
+	}
+	window.level_db = (0 == covered ? LOUDNESS_FLOOR_DB : to_db(energy / covered));
+	return (0 != covered);
+}
+
+void loudness_analyzer::get_history(std::vector <loudness_summary_t> &history) const
+{
+	history.clear();
+	for(unsigned int i = 0; i < m_history_count; i++)
+	{
+		history.push_back(m_history[(m_history_start + i) % m_history.size()]);
+	}
+	if(0 != m_size)
+	{
+		loudness_summary_t current = {m_position, m_size, m_timestamp_us, 0, 0};
+		fill_summary(current, m_sum_squares, m_samples, m_peak);
+		history.push_back(current);
+	}
+}
@@ -18,13 +18,25 @@
 */
 #include "music_id.h"
 #include "audio_converter.h"
+#include "acm_thread.h"
 #include <unistd.h>
 #include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <climits>
 
 #define SOCKET_PATH "/tmp/acm-songid"
 
 using namespace audiocapturemgr;
 const unsigned int DEFAULT_PRECAPTURE_DURATION_SEC = 6;
+const unsigned int REQUEST_DEADLINE_GRACE_MS = 2000; //How long past its due time a fresh sample request waits for audio that isn't coming.
+static const unsigned int MAX_PRECAPTURE_LENGTH_SEC = 120;
+static const unsigned int MAX_COMPRESSED_PRECAPTURE_LENGTH_SEC = 240; //With precapture compression. Programme material compresses to about half, so this takes about as much memory as the above.
+static const unsigned int ANALYSIS_HISTORY_SECONDS = MAX_COMPRESSED_PRECAPTURE_LENGTH_SEC + 2; //The ring holds a second more than the longest clip.
+static const unsigned int UNCOMPRESSED_SECONDS = 5; //Of the most recent audio, kept as it is in the ring while compression is on.
+static const unsigned int COMPRESSION_BLOCK_FRAMES = 4096;
+static const float DEFAULT_SILENCE_THRESHOLD_DB = -70.0f; //The absolute gate of ITU-R BS.1770. Only a muted or idle source is this quiet.
 static unsigned int ticker = 0;
 static void connected_callback(void * data)
 {
@@ -32,12 +44,19 @@ static void connected_callback(void * data)
 	ptr->send_clip_via_socket();
 }
 
-music_id_client::music_id_client(q_mgr * manager, preferred_delivery_method_t mode) : audio_capture_client(manager), m_worker_thread_alive(true), m_total_size(0), 
-	m_queue_upper_limit_bytes(0), m_request_counter(0), m_enable_wav_header_output(false), m_convert_output(false), m_delivery_method(mode), m_sock_path(SOCKET_PATH + get_suffix(ticker++))
+music_id_client::music_id_client(q_mgr * manager, preferred_delivery_method_t mode) : audio_capture_client(manager), m_precapture_ring(NULL), m_ring_capacity(0), m_ring_fill(0),
+	m_ring_write_position(0), m_oldest_pinned_position(ULLONG_MAX), m_silence_detection(false), m_silence_threshold_db(DEFAULT_SILENCE_THRESHOLD_DB), m_trim_silence(false), m_fingerprint_output(false), m_compress_precapture(false), m_block_size(0),
+	m_compressed_size(0), m_staging_position(0), m_compression_generation(0), m_compressing_backlog(false), m_encoder_generation(0), m_history_size(0), m_next_target_position(ULLONG_MAX), m_worker_thread_alive(true), m_clip_thread_alive(true), m_queue_upper_limit_bytes(0), m_request_counter(0), m_enable_wav_header_output(false), m_convert_output(false), m_delivery_method(mode), m_sock_path(SOCKET_PATH + get_suffix(ticker++))
 {
 	DEBUG("Creating instance.\n");
 	set_precapture_duration(DEFAULT_PRECAPTURE_DURATION_SEC);
 	m_output_properties = {racFormat_e16BitMono, racFreq_e48000, 0, 0, 0}; /*Only format and sampling rate matter for conversion*/
+	m_clip_stats = {0, 0, 0, 0, 0, 0, 0};
+	audio_properties_t properties;
+	audio_capture_client::get_audio_properties(properties);
+	m_loudness.configure(properties, ANALYSIS_HISTORY_SECONDS);
+	configure_compression(properties);
+	m_clip_thread = std::thread(&music_id_client::clip_thread, this);
 	m_worker_thread = std::thread(&music_id_client::worker_thread, this);
 
 	if(SOCKET_OUTPUT == m_delivery_method)
@@ -53,28 +72,37 @@ music_id_client::music_id_client(q_mgr * manager, preferred_delivery_method_t mo
 music_id_client::~music_id_client()
 {
 	DEBUG("Deleting instance.\n");
-	m_worker_thread_alive = false;
+	{
+		std::unique_lock <std::mutex> rlock(m_request_mutex);
+		m_worker_thread_alive = false;
+	}
+	m_request_cv.notify_all();
 	if(m_worker_thread.joinable())
 	{
 		m_worker_thread.join();
 	}
 
+	/* The clip thread finishes whatever jobs are still queued before exiting.*/
+	{
+		std::unique_lock <std::mutex> clock(m_clip_mutex);
+		m_clip_thread_alive = false;
+	}
+	m_clip_cv.notify_all();
+	if(m_clip_thread.joinable())
+	{
+		m_clip_thread.join();
+	}
+
 	/*Flush all queues.*/
 	INFO("Flushing request queue. Size is %d\n", m_requests.size());
-	std::list<request_t *>::iterator req_iter;
-	for(req_iter = m_requests.begin(); req_iter != m_requests.end(); req_iter++)
+	for(auto &request : m_requests)
 	{
-		delete (*req_iter);
+		delete request;
 	}
 	m_requests.clear();
 
-	INFO("Flushing buffers.\n");
-	std::list<audio_buffer *>::iterator buf_iter;
-	for(buf_iter = m_queue.begin(); buf_iter != m_queue.end(); buf_iter++)
-	{
-		release_buffer(*buf_iter);
-	}
-	m_queue.clear();
+	INFO("Freeing precapture ring.\n");
+	delete [] m_precapture_ring;
 
 	if(SOCKET_OUTPUT == m_delivery_method)
 	{
@@ -90,10 +118,36 @@ music_id_client::~music_id_client()
 
 int music_id_client::data_callback(audio_buffer *buf)
 {
+	std::vector <sealed_block_t> sealed;
 	lock();
-	m_queue.push_back(buf);
-	m_total_size += buf->m_size;
+	write_to_precapture_ring(buf);
+	unsigned long long position = m_ring_write_position.load(std::memory_order_relaxed);
+	unsigned int generation = m_compression_generation;
+	if(!m_sealed_blocks.empty())
+	{
+		sealed.swap(m_sealed_blocks);
+		if(generation != m_encoder_generation)
+		{
+			m_encoder = m_codec;
+			m_encoder_generation = generation;
+		}
+	}
 	unlock();
+	release_buffer(buf);
+	if(!sealed.empty())
+	{
+		add_compressed_blocks(sealed, m_encoder, generation);
+	}
+
+	/* Wake the worker once the earliest fresh sample request has all its audio. Either this sees the new target, or
+	 * the worker sees the new write position when it evaluates its wait condition.*/
+	if(position >= m_next_target_position.load())
+	{
+		{
+			std::unique_lock <std::mutex> rlock(m_request_mutex);
+		}
+		m_request_cv.notify_one();
+	}
 	return 0;
 }
 
@@ -107,7 +161,6 @@ int music_id_client::set_precapture_duration(unsigned int seconds)
 		m_queue_upper_limit_bytes = m_precapture_size_bytes;
 	}
     compute_queue_size();
-    trim_queue();
     unlock();
 	return 0;
 }
@@ -118,8 +171,20 @@ int music_id_client::set_audio_properties(audio_properties_t &properties)
 	ret = audio_capture_client::set_audio_properties(properties);
 	if(0 == ret) 
 	{
-		/* Populate bit rate fields.*/
+		/* Populate bit rate fields. Audio already in the ring is in the old format, so it can't be used any more.*/
+		lock();
 		m_precapture_size_bytes = m_precapture_duration_seconds * m_manager->get_data_rate();
+		audio_properties_t applied_properties;
+		audio_capture_client::get_audio_properties(applied_properties);
+		configure_compression(applied_properties);
+		reset_precapture_ring();
+		m_loudness.configure(applied_properties, ANALYSIS_HISTORY_SECONDS);
+		if(m_fingerprint_output)
+		{
+			m_fingerprinter.configure(applied_properties, ANALYSIS_HISTORY_SECONDS);
+		}
+		compute_queue_size();
+		unlock();
 	}
 	return ret;
 }
@@ -127,35 +192,406 @@ int music_id_client::set_audio_properties(audio_properties_t &properties)
 void music_id_client::get_audio_properties(audio_properties_t &properties)
 {
 	audio_capture_client::get_audio_properties(properties);
+	lock();
 	if(m_convert_output)
 	{
 		properties.format = m_output_properties.format;
 		properties.sampling_frequency = m_output_properties.sampling_frequency;
 	}
+	unlock();
+}
+
+void music_id_client::reset_precapture_ring() //needs lock
+{
+	m_ring_fill = 0;
+	m_ring_anchors.clear();
+	m_compressed_blocks.clear();
+	m_compressed_size = 0;
+	m_block_staging.clear();
+	m_staging_position = m_ring_write_position.load(std::memory_order_relaxed);
+	m_sealed_blocks.clear();
+	m_compression_generation++;
+}
+
+bool music_id_client::is_compressing() //needs lock
+{
+	return (m_compress_precapture && m_codec.is_configured());
+}
+
+void music_id_client::configure_compression(const audio_properties_t &properties) //needs lock
+{
+	if(!m_codec.configure(properties))
+	{
+		WARN("Can't compress audio of format 0x%x.\n", properties.format);
+	}
+	m_block_size = COMPRESSION_BLOCK_FRAMES * get_frame_size(properties);
+}
+
+/* Takes audio that follows on from what came before, and seals every block that it completes, for compression outside
+ * the lock. Drops blocks that no clip can need any more.*/
+void music_id_client::compress_precapture(const unsigned char * ptr, unsigned int size) //needs lock
+{
+	while(0 != size)
+	{
+		unsigned int chunk = m_block_size - m_block_staging.size();
+		if(chunk > size)
+		{
+			chunk = size;
+		}
+		m_block_staging.insert(m_block_staging.end(), ptr, ptr + chunk);
+		ptr += chunk;
+		size -= chunk;
+		if(m_block_staging.size() == m_block_size)
+		{
+			sealed_block_t block;
+			block.position = m_staging_position;
+			block.pcm.swap(m_block_staging);
+			m_sealed_blocks.push_back(std::move(block));
+			m_staging_position += m_block_size;
+			m_block_staging.reserve(m_block_size);
+		}
+	}
+
+	unsigned long long write_position = m_ring_write_position.load(std::memory_order_relaxed);
+	unsigned long long oldest_needed = (write_position > m_history_size ? write_position - m_history_size : 0);
+	while(!m_compressed_blocks.empty() && ((m_compressed_blocks.front()->position + m_compressed_blocks.front()->size) <= oldest_needed))
+	{
+		m_compressed_size -= m_compressed_blocks.front()->data.size();
+		m_compressed_blocks.pop_front();
+	}
 }
 
-void music_id_client::trim_queue() //Recommend using lock.
+/* Compresses sealed blocks without the lock, then adds them to the compressed blocks, unless those have been thrown away
+ * meanwhile. Blocks come either right after the newest compressed block or, for the backlog compressed when compression
+ * is enabled, right before the oldest.*/
+void music_id_client::add_compressed_blocks(std::vector <sealed_block_t> &sealed, pcm_codec &codec, unsigned int generation)
 {
-	int excess_bytes = m_total_size - m_queue_upper_limit_bytes;
-	DEBUG("excess_bytes = %d\n", excess_bytes);
-	while(0 < excess_bytes)
+	std::vector <std::shared_ptr <const compressed_block_t> > blocks;
+	std::vector <unsigned char> scratch;
+	for(auto &pcm : sealed)
 	{
-		/* Lose buffers until losing any more would take us below the precapture threshold.*/
-		unsigned int current_buffer_size = m_queue.front()->m_size;
-		if((unsigned int)excess_bytes >= current_buffer_size)
+		std::shared_ptr <compressed_block_t> block = std::make_shared <compressed_block_t> ();
+		block->position = pcm.position;
+		block->size = pcm.pcm.size();
+		codec.encode(&pcm.pcm[0], COMPRESSION_BLOCK_FRAMES, scratch);
+		block->data.assign(scratch.begin(), scratch.end()); //Exactly as large as it needs to be.
+		blocks.push_back(block);
+	}
+
+	lock();
+	if(generation == m_compression_generation)
+	{
+		const compressed_block_t * first = blocks.front().get();
+		const compressed_block_t * last = blocks.back().get();
+		if(m_compressed_blocks.empty() || ((m_compressed_blocks.back()->position + m_compressed_blocks.back()->size) == first->position))
 		{
-			excess_bytes -= current_buffer_size; 
-			m_total_size -= current_buffer_size;
-			release_buffer((m_queue.front()));
-			m_queue.pop_front();
+			m_compressed_blocks.insert(m_compressed_blocks.end(), blocks.begin(), blocks.end());
+		}
+		else if((last->position + last->size) == m_compressed_blocks.front()->position)
+		{
+			m_compressed_blocks.insert(m_compressed_blocks.begin(), blocks.begin(), blocks.end());
 		}
 		else
 		{
+			WARN("Dropping %u compressed blocks that don't follow on.\n", (unsigned int)blocks.size());
+			blocks.clear();
+		}
+		for(auto &block : blocks)
+		{
+			m_compressed_size += block->data.size();
+		}
+	}
+	unlock();
+}
+
+/* Returns the ring position of the oldest audio still available, compressed or not.*/
+unsigned long long music_id_client::get_oldest_position() //needs lock
+{
+	unsigned long long oldest_position = m_ring_write_position.load(std::memory_order_relaxed) - m_ring_fill;
+	if(!m_compressed_blocks.empty() && (m_compressed_blocks.front()->position < oldest_position))
+	{
+		oldest_position = m_compressed_blocks.front()->position;
+	}
+	return oldest_position;
+}
+
+static void copy_into_ring(unsigned char * ring, unsigned int capacity, unsigned long long position, const unsigned char * ptr, unsigned int size)
+{
+	unsigned int offset = position % capacity;
+	unsigned int first_chunk = capacity - offset;
+	if(first_chunk > size)
+	{
+		first_chunk = size;
+	}
+	memcpy(&ring[offset], ptr, first_chunk);
+	memcpy(ring, ptr + first_chunk, size - first_chunk);
+}
+
+static void copy_out_of_ring(const unsigned char * ring, unsigned int capacity, unsigned long long position, unsigned char * ptr, unsigned int size)
+{
+	unsigned int offset = position % capacity;
+	unsigned int first_chunk = capacity - offset;
+	if(first_chunk > size)
+	{
+		first_chunk = size;
+	}
+	memcpy(ptr, &ring[offset], first_chunk);
+	memcpy(ptr + first_chunk, ring, size - first_chunk);
+}
+
+void music_id_client::resize_precapture_ring(unsigned int capacity) //needs lock
+{
+	if(capacity == m_ring_capacity)
+	{
+		return;
+	}
+	DEBUG("Resizing precapture ring from %d to %d bytes.\n", m_ring_capacity, capacity);
+
+	/* Pinned jobs can't copy out of the ring while it moves, so they get the rest of their audio now.*/
+	release_pinned_audio(ULLONG_MAX);
+
+	/* Hang on to as much of the most recent audio as fits. Positions don't change, only where they land in the ring.*/
+	unsigned char * new_ring = (0 == capacity ? NULL : new unsigned char[capacity]);
+	unsigned int retained = (m_ring_fill < capacity ? m_ring_fill : capacity);
+	if(0 != retained)
+	{
+		unsigned long long position = m_ring_write_position - retained;
+		unsigned char * scratch = new unsigned char[retained];
+		copy_out_of_ring(m_precapture_ring, m_ring_capacity, position, scratch, retained);
+		copy_into_ring(new_ring, capacity, position, scratch, retained);
+		delete [] scratch;
+	}
+	delete [] m_precapture_ring;
+	m_precapture_ring = new_ring;
+	m_ring_capacity = capacity;
+	m_ring_fill = retained;
+}
+
+void music_id_client::write_to_precapture_ring(const audio_buffer * buf) //needs lock
+{
+	const unsigned char * ptr = buf->m_start_ptr;
+	unsigned int size = buf->m_size;
+	unsigned long long position = m_ring_write_position.load(std::memory_order_relaxed);
+	if(0 != m_ring_capacity)
+	{
+		/* Audio before overwritten_position is about to go. Jobs that still need some of it copy it first.*/
+		unsigned long long overwritten_position = ((position + size) > m_ring_capacity ? position + size - m_ring_capacity : 0);
+		if(overwritten_position > m_oldest_pinned_position.load())
+		{
+			release_pinned_audio(overwritten_position);
+		}
+		if(size > m_ring_capacity)
+		{
+			/* Only the tail end of this write would survive anyway.*/
+			copy_into_ring(m_precapture_ring, m_ring_capacity, position + (size - m_ring_capacity), ptr + (size - m_ring_capacity), m_ring_capacity);
+		}
+		else
+		{
+			copy_into_ring(m_precapture_ring, m_ring_capacity, position, ptr, size);
+		}
+		m_ring_fill += size;
+		if(m_ring_fill > m_ring_capacity)
+		{
+			m_ring_fill = m_ring_capacity;
+		}
+	}
+	m_ring_write_position.store(position + size);
+	if(is_compressing())
+	{
+		compress_precapture(ptr, size);
+	}
+	m_loudness.add(ptr, size, position, buf->m_timestamp_us);
+	if(m_fingerprint_output)
+	{
+		m_fingerprinter.add(buf, position);
+	}
+
+	/* Keep the anchor that covers the oldest audio in the ring, and every one after it.*/
+	ring_anchor_t anchor = {position, buf->m_timestamp_us, buf->m_sample_index};
+	m_ring_anchors.push_back(anchor);
+	unsigned long long oldest_position = get_oldest_position();
+	while((1 < m_ring_anchors.size()) && (m_ring_anchors[1].position <= oldest_position))
+	{
+		m_ring_anchors.pop_front();
+	}
+}
+
+/* Returns the ring position of the audio captured at timestamp_us, to a frame. Times before the oldest audio in the ring
+ * map to its start, and times in a gap between buffers map to the start of the next one.*/
+unsigned long long music_id_client::time_to_ring_position(unsigned long long timestamp_us) //needs lock
+{
+	unsigned long long write_position = m_ring_write_position.load(std::memory_order_relaxed);
+	auto iter = std::upper_bound(m_ring_anchors.begin(), m_ring_anchors.end(), timestamp_us,
+			[](unsigned long long value, const ring_anchor_t &anchor){return value < anchor.timestamp_us;});
+	if(m_ring_anchors.begin() == iter)
+	{
+		return get_oldest_position();
+	}
+	unsigned long long next_position = (m_ring_anchors.end() == iter ? write_position : iter->position);
+	--iter;
+
+	audio_properties_t properties;
+	audio_capture_client::get_audio_properties(properties);
+	unsigned int sampling_rate, bits_per_sample, num_channels;
+	get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
+	unsigned long long frames = (timestamp_us - iter->timestamp_us) * sampling_rate / 1000000;
+	unsigned long long position = iter->position + frames * get_frame_size(properties);
+	return (position < next_position ? position : next_position);
+}
+
+/* Returns the capture time and sample index of the audio at position. Leaves them alone if the ring has no anchor for it.*/
+void music_id_client::get_ring_position_time(unsigned long long position, unsigned long long &timestamp_us, unsigned long long &sample_index) //needs lock
+{
+	auto iter = std::upper_bound(m_ring_anchors.begin(), m_ring_anchors.end(), position,
+			[](unsigned long long value, const ring_anchor_t &anchor){return value < anchor.position;});
+	if(m_ring_anchors.begin() == iter)
+	{
+		return;
+	}
+	--iter;
+
+	audio_properties_t properties;
+	audio_capture_client::get_audio_properties(properties);
+	unsigned int sampling_rate, bits_per_sample, num_channels;
+	get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
+	unsigned int frame_size = get_frame_size(properties);
+	unsigned long long frames = (0 != frame_size ? (position - iter->position) / frame_size : 0);
+	sample_index = iter->sample_index + frames;
+	timestamp_us = (((0 != iter->timestamp_us) && (0 != sampling_rate)) ? iter->timestamp_us + frames * 1000000 / sampling_rate : 0);
+}
+
+void music_id_client::snapshot_precapture_ring(unsigned long long end_position, unsigned int size, clip_job_t * job) //needs lock
+{
+	/* Takes the bounds of the size bytes of audio ending at end_position, or of as much of it as is still in the ring,
+	 * and pins them, so that the clip thread can copy the audio without the lock. Whatever is only there compressed is
+	 * left for the clip thread to decode.*/
+	unsigned long long write_position = m_ring_write_position.load(std::memory_order_relaxed);
+	unsigned long long oldest_position = get_oldest_position();
+	if(end_position > write_position)
+	{
+		end_position = write_position;
+	}
+	unsigned long long start_position = (end_position > size ? end_position - size : 0);
+	if(start_position < oldest_position)
+	{
+		start_position = oldest_position;
+	}
+	if(end_position <= start_position)
+	{
+		return;
+	}
+	if((end_position - start_position) < size)
+	{
+		WARN("Only %llu of the requested %d bytes are available.\n", (end_position - start_position), size);
+		size = end_position - start_position;
+	}
+
+	/* Request sizes, the data rate, blocks and the ring capacity are whole frames, so this starts exactly on a frame boundary.*/
+	audio_buffer * snapshot = create_new_audio_buffer(NULL, size, 0, 1);
+	unsigned long long ring_start = write_position - m_ring_fill;
+	unsigned int compressed_size = 0;
+	if(start_position < ring_start)
+	{
+		compressed_size = (unsigned int)((end_position < ring_start ? end_position : ring_start) - start_position);
+		auto iter = std::upper_bound(m_compressed_blocks.begin(), m_compressed_blocks.end(), start_position,
+				[](unsigned long long value, const std::shared_ptr <const compressed_block_t> &block){return value < block->position;});
+		for(--iter; (iter != m_compressed_blocks.end()) && ((*iter)->position < (start_position + compressed_size)); ++iter)
+		{
+			job->compressed.push_back(*iter);
+		}
+	}
+	get_ring_position_time(start_position, snapshot->m_timestamp_us, snapshot->m_sample_index);
+	job->snapshot = snapshot;
+	job->snapshot_position = start_position;
+	job->copy_position = start_position + compressed_size;
+	job->compressed_size = compressed_size;
+	if(job->copy_position < end_position)
+	{
+		std::unique_lock <std::mutex> plock(m_pin_mutex);
+		m_pinned_jobs.push_back(job);
+		update_oldest_pinned_position();
+	}
+}
+
+void music_id_client::update_oldest_pinned_position() //needs m_pin_mutex
+{
+	unsigned long long oldest_position = ULLONG_MAX;
+	for(auto &job : m_pinned_jobs)
+	{
+		if((job->copy_position < (job->snapshot_position + job->snapshot->m_size)) && (job->copy_position < oldest_position))
+		{
+			oldest_position = job->copy_position;
+		}
+	}
+	m_oldest_pinned_position.store(oldest_position);
+}
+
+/* Copies the audio before limit_position that pinned jobs still need into their snapshots, so that it can be overwritten.
+ * Only happens if the clip thread falls behind by most of the ring.*/
+void music_id_client::release_pinned_audio(unsigned long long limit_position) //needs lock
+{
+	std::unique_lock <std::mutex> plock(m_pin_mutex);
+	for(auto &job : m_pinned_jobs)
+	{
+		unsigned long long end_position = job->snapshot_position + job->snapshot->m_size;
+		unsigned long long copy_end = (limit_position < end_position ? limit_position : end_position);
+		if(job->copy_position < copy_end)
+		{
+			copy_out_of_ring(m_precapture_ring, m_ring_capacity, job->copy_position, job->snapshot->m_start_ptr + (job->copy_position - job->snapshot_position), copy_end - job->copy_position);
+			job->copy_position = copy_end;
+		}
+	}
+	update_oldest_pinned_position();
+}
+
+/* Copies the rest of a pinned job's audio out of the ring, and unpins it. Runs on the clip thread.*/
+void music_id_client::copy_pinned_audio(clip_job_t * job)
+{
+	std::unique_lock <std::mutex> plock(m_pin_mutex);
+	unsigned long long end_position = job->snapshot_position + job->snapshot->m_size;
+	if(job->copy_position < end_position)
+	{
+		copy_out_of_ring(m_precapture_ring, m_ring_capacity, job->copy_position, job->snapshot->m_start_ptr + (job->copy_position - job->snapshot_position), end_position - job->copy_position);
+		job->copy_position = end_position;
+	}
+	m_pinned_jobs.remove(job);
+	update_oldest_pinned_position();
+}
+
+/* Decodes the start of a snapshot that was only there compressed. Runs on the clip thread.*/
+int music_id_client::decompress_snapshot(clip_job_t * job)
+{
+	int ret = 0;
+	pcm_codec codec;
+	codec.configure(job->properties);
+	unsigned int frame_size = get_frame_size(job->properties);
+	unsigned long long end_position = job->snapshot_position + job->compressed_size;
+	std::vector <unsigned char> pcm;
+	for(auto &block : job->compressed)
+	{
+		pcm.resize(block->size);
+		if(!codec.decode(block->data.data(), block->data.size(), block->size / frame_size, &pcm[0]))
+		{
+			ret = -1;
 			break;
 		}
+		unsigned long long start = (block->position > job->snapshot_position ? block->position : job->snapshot_position);
+		unsigned long long end = ((block->position + block->size) < end_position ? block->position + block->size : end_position);
+		memcpy(job->snapshot->m_start_ptr + (start - job->snapshot_position), &pcm[start - block->position], end - start);
 	}
+	job->compressed.clear();
+	return ret;
 }
 
+unsigned int music_id_client::duration_to_bytes(float seconds)
+{
+	audio_properties_t properties;
+	audio_capture_client::get_audio_properties(properties);
+	unsigned int sampling_rate, bits_per_sample, num_channels;
+	get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
+	unsigned long long frames = (unsigned long long)(seconds * sampling_rate + 0.5f);
+	return (unsigned int)(frames * num_channels * (bits_per_sample / 8));
+}
 
 void music_id_client::send_clip_via_socket()
 {
@@ -184,181 +620,470 @@ void music_id_client::send_clip_via_socket()
 
 int music_id_client::grab_precaptured_sample(const std::string &filename)
 {
-	int ret;
 	lock();
-	if(SOCKET_OUTPUT == m_delivery_method)
-	{
-		ret = grab_last_n_seconds(m_precapture_duration_seconds);
-	}
-	else
+	auto lock_time = std::chrono::steady_clock::now();
+	clip_job_t * job = create_clip_job(m_ring_write_position.load(std::memory_order_relaxed), m_precapture_size_bytes, filename);
+	unlock();
+	job->lock_hold_us = std::chrono::duration_cast <std::chrono::microseconds> (std::chrono::steady_clock::now() - lock_time).count();
+	return wait_for_clip_job(job);
+}
+
+int music_id_client::grab_clip(unsigned long long start_us, unsigned long long end_us, const std::string &filename)
+{
+	if(end_us <= start_us)
 	{
-		ret = grab_last_n_seconds(filename, m_precapture_duration_seconds);
+		ERROR("Bad time range %llu to %llu.\n", start_us, end_us);
+		return -1;
 	}
+	lock();
+	auto lock_time = std::chrono::steady_clock::now();
+	unsigned long long start_position = time_to_ring_position(start_us);
+	unsigned long long end_position = time_to_ring_position(end_us);
+	unsigned int size = (end_position > start_position ? (unsigned int)(end_position - start_position) : 0);
+	clip_job_t * job = create_clip_job(end_position, size, filename);
 	unlock();
+	job->lock_hold_us = std::chrono::duration_cast <std::chrono::microseconds> (std::chrono::steady_clock::now() - lock_time).count();
+	INFO("Clip from %lluus to %lluus is %d bytes.\n", start_us, end_us, size);
+	return wait_for_clip_job(job);
+}
+
+/* Hands a job to the clip thread and waits for it to finish. Takes ownership of the job.*/
+int music_id_client::wait_for_clip_job(clip_job_t * job)
+{
+	job->detached = false;
+	submit_clip_job(job);
+
+	std::unique_lock <std::mutex> clock(m_clip_mutex);
+	m_clip_done_cv.wait(clock, [job](){return job->done;});
+	int ret = job->result;
+	clock.unlock();
+	delete job;
 	return ret;
 }
 
-int music_id_client::grab_last_n_seconds(unsigned int seconds) //for socket mode output
+music_id_client::clip_job_t * music_id_client::create_clip_job(unsigned long long end_position, unsigned int size, const std::string &filename) //needs lock
 {
-	
-	int ret = 0;
-	int data_dump_size = seconds * m_manager->get_data_rate();
+	clip_job_t * job = new clip_job_t;
+	job->snapshot = NULL;
+	job->snapshot_position = 0;
+	job->copy_position = 0;
+	job->compressed_size = 0;
+	job->silent = false;
+	job->trimmed_bytes = 0;
+	job->fingerprinted = false;
 
-	if(0 != m_queue.size())
+	/* Judged from the loudness already measured, so that silence costs neither a copy nor a conversion.*/
+	loudness_window_t window;
+	unsigned long long start_position = (end_position > size ? end_position - size : 0);
+	if(m_silence_detection && m_loudness.get_window(start_position, end_position, m_silence_threshold_db, window))
+	{
+		if(window.max_level_db < m_silence_threshold_db)
+		{
+			INFO("Clip is silent. Loudest second is %.1fdB, peak %.1fdB.\n", window.max_level_db, window.peak_db);
+			job->silent = true;
+		}
+		else if(m_trim_silence && ((window.loud_start > start_position) || (window.loud_end < end_position)))
+		{
+			unsigned int trimmed_size = (unsigned int)(window.loud_end - window.loud_start);
+			INFO("Trimming %u bytes of silence from the clip.\n", size - trimmed_size);
+			job->trimmed_bytes = size - trimmed_size;
+			end_position = window.loud_end;
+			size = trimmed_size;
+		}
+	}
+	if(!job->silent && m_fingerprint_output)
 	{
-		audio_properties_t in_properties;
-		audio_capture_client::get_audio_properties(in_properties);
-		audio_converter_memory_sink *sink;
-		if(m_convert_output)
+		/* The peaks are already there, so this is cheap enough to do under the lock, and no audio needs copying.*/
+		unsigned long long first_position = 0;
+		start_position = (end_position > size ? end_position - size : 0);
+		job->fingerprinted = m_fingerprinter.get_fingerprint(start_position, end_position, job->fingerprint_header, job->fingerprint, first_position);
+		if(job->fingerprinted)
 		{
-			sink = new audio_converter_memory_sink(audiocapturemgr::calculate_data_rate(m_output_properties) * (seconds + 1)); //an extra second to account for the imprecise way in which ACM cuts clips
-			audio_converter converter(in_properties, m_output_properties, *sink);
-			converter.convert(m_queue, data_dump_size);
+			unsigned long long timestamp_us = 0, sample_index = 0;
+			get_ring_position_time(first_position, timestamp_us, sample_index);
+			job->fingerprint_header.timestamp_us = timestamp_us;
 		}
 		else
 		{
-			sink = new audio_converter_memory_sink(audiocapturemgr::calculate_data_rate(in_properties) * (seconds + 1));
-			audio_converter converter(in_properties, in_properties, *sink);
-			converter.convert(m_queue, data_dump_size);
+			ERROR("No fingerprint for bytes %llu to %llu.\n", start_position, end_position);
 		}
-		m_outbox.push_back(sink);
-		INFO("Precaptured sample placed in outbox.\n");
 	}
-	else
+	else if(!job->silent)
 	{
-		ERROR("Error! Precaptured queue is empty.\n");
-		ret = -1;
+		snapshot_precapture_ring(end_position, size, job);
 	}
-	return ret;
+	audio_capture_client::get_audio_properties(job->properties);
+	job->convert_output = m_convert_output;
+	job->output_properties = m_output_properties;
+	job->wav_header = m_enable_wav_header_output;
+	job->filename = filename;
+	job->callback = nullptr;
+	job->callback_data = nullptr;
+	job->lock_hold_us = 0;
+	job->detached = true;
+	job->done = false;
+	job->result = -1;
+	return job;
 }
 
-int music_id_client::grab_last_n_seconds(const std::string &filename, unsigned int seconds) //for file mode output
+void music_id_client::submit_clip_job(clip_job_t * job)
 {
-	int ret = 0;
-	int data_dump_size = seconds * m_manager->get_data_rate();
+	{
+		std::unique_lock <std::mutex> clock(m_clip_mutex);
+		m_clip_jobs.push_back(job);
+	}
+	m_clip_cv.notify_one();
+}
 
-	if(0 != m_queue.size())
+void music_id_client::clip_thread()
+{
+	thread_role_scope role(THREAD_ROLE_CLIP);
+	INFO("Enter.\n");
+	std::unique_lock <std::mutex> clock(m_clip_mutex);
+	while(true)
 	{
-		std::ofstream file(filename.c_str(), std::ios::binary);
-		if(file.is_open())
+		m_clip_cv.wait(clock, [this](){return (!m_clip_jobs.empty() || !m_clip_thread_alive);});
+		if(m_clip_jobs.empty())
 		{
-			if(m_enable_wav_header_output)
-			{
-				write_default_file_header(file);
-			}
-			
-			audio_properties_t in_properties;
-			audio_capture_client::get_audio_properties(in_properties);
-			audio_converter_file_sink sink(file);
-			if(m_convert_output)
+			break; //Asked to exit, and nothing left to do.
+		}
+		clip_job_t * job = m_clip_jobs.front();
+		m_clip_jobs.pop_front();
+		clock.unlock();
+
+		auto start_time = std::chrono::steady_clock::now();
+		int ret = -1;
+		if(job->snapshot)
+		{
+			copy_pinned_audio(job);
+		}
+		if(job->fingerprinted)
+		{
+			ret = write_fingerprint(job);
+		}
+		else if(job->snapshot && (0 != job->compressed_size) && (0 != decompress_snapshot(job)))
+		{
+			ERROR("Could not decompress the start of the clip.\n");
+			unref_audio_buffer(job->snapshot);
+			job->snapshot = NULL;
+		}
+		else if(job->snapshot)
+		{
+			if(SOCKET_OUTPUT == m_delivery_method)
 			{
-				audio_converter converter(in_properties, m_output_properties, sink);
-				converter.convert(m_queue, data_dump_size);
+				ret = write_clip(job);
 			}
 			else
 			{
-				audio_converter converter(in_properties, in_properties, sink);
-				converter.convert(m_queue, data_dump_size);
+				ret = write_clip(job, job->filename);
 			}
-			
-			if(m_enable_wav_header_output)
-			{
-				unsigned int payload_size = static_cast<unsigned int>(file.tellp()) - 44;
-				update_file_header_size(file, payload_size);
-			}
-			INFO("Precaptured sample written to %s. File size: %lld bytes\n", filename.c_str(), (long long)file.tellp());//CID:127488 - Type cast
+			unref_audio_buffer(job->snapshot);
+			job->snapshot = NULL;
+		}
+		else if(job->silent)
+		{
+			ret = CLIP_SILENT;
 		}
 		else
 		{
-			ERROR("Could not open file %s.\n", filename.c_str());
-			ret = -1;
+			ERROR("Error! Precaptured queue is empty.\n");
+		}
+		unsigned long long conversion_us = std::chrono::duration_cast <std::chrono::microseconds> (std::chrono::steady_clock::now() - start_time).count();
+		INFO("Clip done with result %d. Lock held for %lluus, conversion took %lluus.\n", ret, job->lock_hold_us, conversion_us);
+
+		if(job->detached && job->callback)
+		{
+			(job->callback)(job->callback_data, job->filename, ret);
+		}
+
+		clock.lock();
+		m_clip_stats.clips++;
+		m_clip_stats.silent_clips += (job->silent ? 1 : 0);
+		m_clip_stats.trimmed_bytes += job->trimmed_bytes;
+		m_clip_stats.lock_hold_us_total += job->lock_hold_us;
+		if(m_clip_stats.lock_hold_us_max < job->lock_hold_us)
+		{
+			m_clip_stats.lock_hold_us_max = job->lock_hold_us;
+		}
+		m_clip_stats.conversion_us_total += conversion_us;
+		if(m_clip_stats.conversion_us_max < conversion_us)
+		{
+			m_clip_stats.conversion_us_max = conversion_us;
+		}
+
+		if(job->detached)
+		{
+			delete job;
+		}
+		else
+		{
+			job->result = ret;
+			job->done = true;
+			m_clip_done_cv.notify_all();
+		}
+	}
+	INFO("Exit.\n");
+}
+
+void music_id_client::get_clip_stats(clip_stats_t &stats)
+{
+	std::unique_lock <std::mutex> clock(m_clip_mutex);
+	stats = m_clip_stats;
+}
+
+int music_id_client::write_clip(const clip_job_t * job) //for socket mode output
+{
+	audio_buffer * snapshot = job->snapshot;
+	std::list <audio_buffer *> clip(1, snapshot);
+	audio_properties_t in_properties = job->properties;
+	audio_converter_memory_sink *sink;
+	if(job->convert_output)
+	{
+		/* Conversion never produces more output per input frame than the ratio of data rates. Round up by a frame's worth.*/
+		unsigned long long out_size = (unsigned long long)snapshot->m_size * audiocapturemgr::calculate_data_rate(job->output_properties) / audiocapturemgr::calculate_data_rate(in_properties);
+		sink = new audio_converter_memory_sink(out_size + 32);
+		audio_converter converter(in_properties, job->output_properties, *sink);
+		converter.convert(clip, snapshot->m_size);
+	}
+	else
+	{
+		sink = new audio_converter_memory_sink(snapshot->m_size);
+		audio_converter converter(in_properties, in_properties, *sink);
+		converter.convert(clip, snapshot->m_size);
+	}
+	lock();
+	m_outbox.push_back(sink);
+	unlock();
+	INFO("Precaptured sample placed in outbox.\n");
+	return 0;
+}
+
+int music_id_client::write_fingerprint(const clip_job_t * job)
+{
+	unsigned int hashes_size = job->fingerprint.size() * sizeof(acm_fingerprint_hash_t);
+	const char * hashes = (const char *)job->fingerprint.data();
+	if(SOCKET_OUTPUT == m_delivery_method)
+	{
+		audio_converter_memory_sink * sink = new audio_converter_memory_sink(sizeof(job->fingerprint_header) + hashes_size);
+		sink->write_data((const char *)&job->fingerprint_header, sizeof(job->fingerprint_header));
+		sink->write_data(hashes, hashes_size);
+		lock();
+		m_outbox.push_back(sink);
+		unlock();
+		INFO("Fingerprint of %u hashes placed in outbox.\n", job->fingerprint_header.hash_count);
+		return 0;
+	}
+
+	std::ofstream file(job->filename.c_str(), std::ios::binary);
+	if(!file.is_open())
+	{
+		ERROR("Could not open file %s.\n", job->filename.c_str());
+		return -1;
+	}
+	file.write((const char *)&job->fingerprint_header, sizeof(job->fingerprint_header));
+	file.write(hashes, hashes_size);
+	INFO("Fingerprint of %u hashes written to %s.\n", job->fingerprint_header.hash_count, job->filename.c_str());
+	return 0;
+}
+
+int music_id_client::write_clip(const clip_job_t * job, const std::string &filename) //for file mode output
+{
+	int ret = 0;
+	audio_buffer * snapshot = job->snapshot;
+	std::list <audio_buffer *> clip(1, snapshot);
+	std::ofstream file(filename.c_str(), std::ios::binary);
+	if(file.is_open())
+	{
+		if(job->wav_header)
+		{
+			write_default_file_header(file, job);
+		}
+
+		audio_properties_t in_properties = job->properties;
+		audio_converter_file_sink sink(file);
+		if(job->convert_output)
+		{
+			audio_converter converter(in_properties, job->output_properties, sink);
+			converter.convert(clip, snapshot->m_size);
 		}
+		else
+		{
+			audio_converter converter(in_properties, in_properties, sink);
+			converter.convert(clip, snapshot->m_size);
+		}
+
+		if(job->wav_header)
+		{
+			unsigned int payload_size = static_cast<unsigned int>(file.tellp()) - 44;
+			update_file_header_size(file, payload_size);
+		}
+		INFO("Precaptured sample written to %s. File size: %lld bytes\n", filename.c_str(), (long long)file.tellp());//CID:127488 - Type cast
 	}
 	else
 	{
-		ERROR("Error! Precaptured queue is empty.\n");
+		ERROR("Could not open file %s.\n", filename.c_str());
 		ret = -1;
 	}
 	return ret;
 }
 
-music_id_client::request_id_t music_id_client::grab_fresh_sample(unsigned int seconds, const std::string &filename, request_complete_callback_t cb , void * cb_data)
+music_id_client::request_id_t music_id_client::grab_fresh_sample(float seconds, const std::string &filename, request_complete_callback_t cb , void * cb_data)
 {
-	request_id_t id = -1;
-	lock();
+	if(0 >= seconds)
+	{
+		ERROR("Bad duration %f\n", seconds);
+		return -1;
+	}
 	request_t *req = new request_t;
-	req->id = m_request_counter++;
 	req->filename = filename;
 	req->length = seconds;
-	req->time_remaining = seconds;
+	unsigned int duration_bytes = duration_to_bytes(seconds);
+	req->length_bytes = duration_bytes;
+	req->deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds((long long)(seconds * 1000) + REQUEST_DEADLINE_GRACE_MS);
 	req->callback = cb;
 	req->callback_data = cb_data;
-	m_requests.push_back(req);
-	compute_queue_size();
+
+	lock();
+	req->target_position = m_ring_write_position.load(std::memory_order_relaxed) + req->length_bytes;
+	{
+		std::unique_lock <std::mutex> rlock(m_request_mutex);
+		req->id = m_request_counter++;
+		m_requests.push_back(req);
+		std::push_heap(m_requests.begin(), m_requests.end(), later_target);
+		m_next_target_position.store(m_requests.front()->target_position);
+		INFO("Request %d for %fs queued. Due at byte position %llu.\n", req->id, seconds, req->target_position);
+	}
+	if(duration_bytes > m_queue_upper_limit_bytes)
+	{
+		compute_queue_size();
+	}
 	unlock();
-	return id;
+	m_request_cv.notify_one(); //Deadlines may have changed.
+	return 0;
+}
+
+bool music_id_client::later_target(const request_t * a, const request_t * b)
+{
+	return (a->target_position > b->target_position);
 }
 
 void music_id_client::compute_queue_size() //needs lock
 {
-	std::list<request_t *>::iterator iter;
-	unsigned int max_length = m_precapture_duration_seconds;
-	for(iter = m_requests.begin(); iter != m_requests.end(); iter++)
+	unsigned int max_length = m_precapture_size_bytes;
 	{
-		if(max_length < (*iter)->length)
+		std::unique_lock <std::mutex> rlock(m_request_mutex);
+		for(auto &request : m_requests)
 		{
-			max_length = (*iter)->length;
+			if(max_length < request->length_bytes)
+			{
+				max_length = request->length_bytes;
+			}
 		}
 	}
-    INFO("New max length for queue: %d\n", max_length);
-	m_queue_upper_limit_bytes = max_length * m_manager->get_data_rate();
+    INFO("New max length for queue: %d bytes\n", max_length);
+	m_queue_upper_limit_bytes = max_length;
+	/* A second of slack, so that the audio a request needs is still there when the worker gets around to it.*/
+	m_history_size = m_queue_upper_limit_bytes + m_manager->get_data_rate();
+	unsigned int capacity = m_history_size;
+	if(is_compressing() && !m_compressing_backlog && (capacity > (UNCOMPRESSED_SECONDS * m_manager->get_data_rate())))
+	{
+		capacity = UNCOMPRESSED_SECONDS * m_manager->get_data_rate();
+	}
+	resize_precapture_ring(capacity);
 }
 
 void music_id_client::worker_thread()
 {
+	thread_role_scope role(THREAD_ROLE_MUSIC_ID);
 	INFO("Enter.\n");
+	std::vector <request_t *> due_requests;
+	std::unique_lock <std::mutex> rlock(m_request_mutex);
 	while(m_worker_thread_alive)
 	{
-		DEBUG("Tick.\n");
-		lock();
-		std::list<request_t *>::iterator iter = m_requests.begin();
+		/* Pull out everything that has all its audio.*/
+		unsigned long long write_position = m_ring_write_position.load();
+		while(!m_requests.empty() && (m_requests.front()->target_position <= write_position))
+		{
+			std::pop_heap(m_requests.begin(), m_requests.end(), later_target);
+			due_requests.push_back(m_requests.back());
+			m_requests.pop_back();
+		}
+
+		/* If audio has stopped flowing, requests that are past their deadline get whatever there is.*/
+		auto now = std::chrono::steady_clock::now();
+		auto earliest_deadline = std::chrono::steady_clock::time_point::max();
+		bool expired = false;
+		std::vector <request_t *>::iterator iter = m_requests.begin();
 		while(iter != m_requests.end())
 		{
-			request_t *request = *iter;
-			if(0 == request->time_remaining--)
+			if((*iter)->deadline <= now)
 			{
-				INFO("Request %d is up.\n", request->id);
-				
-				int ret;
-				if(SOCKET_OUTPUT == m_delivery_method)
-				{
-					ret = grab_last_n_seconds(request->length);
-				}
-				else
-				{
-					ret = grab_last_n_seconds(request->filename, request->length);
-				}
-				if(0 != ret) 
+				WARN("Request %d timed out waiting for audio.\n", (*iter)->id);
+				due_requests.push_back(*iter);
+				iter = m_requests.erase(iter);
+				expired = true;
+			}
+			else
+			{
+				if((*iter)->deadline < earliest_deadline)
 				{
-					ERROR("Failed to fulfil request %d.\n", (*iter)->id);
+					earliest_deadline = (*iter)->deadline;
 				}
+				iter++;
+			}
+		}
+		if(expired)
+		{
+			std::make_heap(m_requests.begin(), m_requests.end(), later_target);
+		}
+		m_next_target_position.store(m_requests.empty() ? ULLONG_MAX : m_requests.front()->target_position);
 
-				if(request->callback)
-				{
-					(request->callback)(request->callback_data, request->filename, ret);
-				}
-				delete request;
-				iter = m_requests.erase(iter);
-                compute_queue_size();
+		if(due_requests.empty())
+		{
+			if(m_requests.empty())
+			{
+				m_request_cv.wait(rlock);
 			}
 			else
 			{
-				iter++;
+				m_request_cv.wait_until(rlock, earliest_deadline);
 			}
+			continue;
+		}
+		rlock.unlock();
+
+		/* Only the snapshots are taken here. Conversion and the callbacks happen on the clip thread.*/
+		std::list <clip_job_t *> jobs;
+		lock();
+		auto lock_time = std::chrono::steady_clock::now();
+		bool resize_needed = false;
+		for(auto &request : due_requests)
+		{
+			INFO("Request %d is up.\n", request->id);
+			clip_job_t * job = create_clip_job(request->target_position, request->length_bytes, request->filename);
+			job->callback = request->callback;
+			job->callback_data = request->callback_data;
+			jobs.push_back(job);
+			if(request->length_bytes >= m_queue_upper_limit_bytes)
+			{
+				resize_needed = true; //Only the longest request determines the size of the ring.
+			}
+			delete request;
+		}
+		due_requests.clear();
+		if(resize_needed)
+		{
+			compute_queue_size();
 		}
-        trim_queue();
 		unlock();
-		sleep(1);
+
+		unsigned long long lock_hold_us = std::chrono::duration_cast <std::chrono::microseconds> (std::chrono::steady_clock::now() - lock_time).count();
+		for(auto &job : jobs)
+		{
+			job->lock_hold_us = lock_hold_us;
+			submit_clip_job(job);
+		}
+		rlock.lock();
 	}
 	INFO("Exit.\n");
 }
@@ -425,7 +1150,7 @@ int music_id_client::write_queue_to_file(const std::string &filename) // needs l
 }
 #endif
 
-int music_id_client::write_default_file_header(std::ofstream &file)
+int music_id_client::write_default_file_header(std::ofstream &file, const clip_job_t * job)
 {
 	/* Write file header chunk.*/
 	file.write("RIFF", 4);
@@ -443,19 +1168,8 @@ int music_id_client::write_default_file_header(std::ofstream &file)
 	unsigned int bits_per_sample = 0;
 	unsigned int sampling_rate= 0;
 	unsigned int num_channels = 0;
-	unsigned int data_rate = 0;
-	if(m_convert_output)
-	{
-		get_individual_audio_parameters(m_output_properties, sampling_rate, bits_per_sample, num_channels);
-		data_rate = sampling_rate * num_channels * bits_per_sample / 8;
-	}
-	else
-	{
-		audio_properties_t properties;
-		get_audio_properties(properties);
-		get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
-		data_rate = m_manager->get_data_rate();
-	}
+	get_individual_audio_parameters((job->convert_output ? job->output_properties : job->properties), sampling_rate, bits_per_sample, num_channels);
+	unsigned int data_rate = sampling_rate * num_channels * bits_per_sample / 8;
 	INFO("Header information: %d channel, %dHz, %d bits per sample audio.\n",
 		num_channels, sampling_rate, bits_per_sample);
 	write_16byte_little_endian((uint16_t)num_channels, file);
@@ -486,15 +1200,129 @@ int music_id_client::update_file_header_size(std::ofstream &file, unsigned int d
 	return 0;
 }
 
-static const unsigned int MAX_PRECAPTURE_LENGTH_SEC = 120;
+void music_id_client::set_silence_detection(bool enable, float threshold_db, bool trim)
+{
+	lock();
+	if((enable != m_silence_detection) || (threshold_db != m_silence_threshold_db) || (trim != m_trim_silence))
+	{
+		INFO("Silence detection %s, threshold %.1fdB, trimming %s.\n", (enable ? "on" : "off"), threshold_db, (trim ? "on" : "off"));
+	}
+	m_silence_detection = enable;
+	m_silence_threshold_db = threshold_db;
+	m_trim_silence = trim;
+	unlock();
+}
+
+void music_id_client::enable_fingerprint_output(bool isEnabled)
+{
+	lock();
+	if(isEnabled && !m_fingerprint_output)
+	{
+		audio_properties_t properties;
+		audio_capture_client::get_audio_properties(properties);
+		m_fingerprinter.configure(properties, ANALYSIS_HISTORY_SECONDS);
+	}
+	if(isEnabled != m_fingerprint_output)
+	{
+		INFO("Fingerprint output %s.\n", (isEnabled ? "on" : "off"));
+	}
+	m_fingerprint_output = isEnabled;
+	unlock();
+}
+
+void music_id_client::get_loudness_history(std::vector <loudness_summary_t> &history)
+{
+	lock();
+	m_loudness.get_history(history);
+	unlock();
+}
+
+void music_id_client::enable_precapture_compression(bool isEnabled)
+{
+	std::vector <sealed_block_t> backlog;
+	pcm_codec codec;
+	unsigned int generation = 0;
+	lock();
+	if(isEnabled != m_compress_precapture)
+	{
+		INFO("Precapture compression %s.\n", (isEnabled ? "on" : "off"));
+		m_compress_precapture = isEnabled;
+		m_compressed_blocks.clear();
+		m_compressed_size = 0;
+		m_block_staging.clear();
+		m_sealed_blocks.clear();
+		m_compression_generation++;
+		m_compressing_backlog = false;
+		unsigned long long oldest_position = m_ring_write_position.load(std::memory_order_relaxed) - m_ring_fill;
+		m_staging_position = oldest_position;
+		if(is_compressing())
+		{
+			/* Seal what the ring already holds, so that none of it is lost when the ring shrinks. It is compressed below,
+			 * without the lock, and the ring is only cut down after that.*/
+			std::vector <unsigned char> chunk(m_block_size);
+			for(unsigned int offset = 0; offset < m_ring_fill; offset += m_block_size)
+			{
+				unsigned int size = ((m_ring_fill - offset) < m_block_size ? m_ring_fill - offset : m_block_size);
+				copy_out_of_ring(m_precapture_ring, m_ring_capacity, oldest_position + offset, &chunk[0], size);
+				compress_precapture(&chunk[0], size);
+			}
+			backlog.swap(m_sealed_blocks);
+			codec = m_codec;
+			generation = m_compression_generation;
+			m_compressing_backlog = !backlog.empty();
+		}
+		else if(m_precapture_duration_seconds > MAX_PRECAPTURE_LENGTH_SEC)
+		{
+			WARN("Cutting precapture duration back to %us.\n", MAX_PRECAPTURE_LENGTH_SEC);
+			m_precapture_duration_seconds = MAX_PRECAPTURE_LENGTH_SEC;
+			m_precapture_size_bytes = m_precapture_duration_seconds * m_manager->get_data_rate();
+		}
+		compute_queue_size();
+	}
+	unlock();
+
+	if(!backlog.empty())
+	{
+		add_compressed_blocks(backlog, codec, generation);
+		lock();
+		if(m_compressing_backlog && (generation == m_compression_generation))
+		{
+			m_compressing_backlog = false;
+			compute_queue_size();
+		}
+		unlock();
+	}
+}
+
+void music_id_client::get_precapture_usage(unsigned int &pcm_bytes, unsigned long long &compressed_bytes, unsigned long long &compressed_audio)
+{
+	lock();
+	pcm_bytes = m_ring_capacity;
+	compressed_bytes = m_compressed_size;
+	compressed_audio = m_compressed_blocks.size() * (unsigned long long)m_block_size;
+	unlock();
+}
+
 unsigned int music_id_client::get_max_supported_duration()
 {
 	//TODO: If necessary, make this a run-time decision based on the current data rate of audio.
-	return MAX_PRECAPTURE_LENGTH_SEC;
+	lock();
+	unsigned int max_duration = (is_compressing() ? MAX_COMPRESSED_PRECAPTURE_LENGTH_SEC : MAX_PRECAPTURE_LENGTH_SEC);
+	unlock();
+	return max_duration;
 }
 
 unsigned int music_id_client::enable_wav_header(bool isEnabled)
 {
+	lock();
 	m_enable_wav_header_output = isEnabled;
+	unlock();
 	return 0;
 }
+
+void music_id_client::enable_output_conversion(bool isEnabled)
+{
+	lock();
+	m_convert_output = isEnabled;
+	unlock();
+}
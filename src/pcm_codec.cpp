@@ -0,0 +1,484 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "pcm_codec.h"
+#include <string.h>
+
+using namespace audiocapturemgr;
+
+static const unsigned int MAX_ORDER = 3;
+static const unsigned int ORDER_BITS = 2;
+static const unsigned int PARAMETER_BITS = 5;
+static const unsigned int ESCAPE = 31; //Rice parameter that marks a partition stored verbatim, with its width.
+static const unsigned int MAX_RICE_PARAMETER = ESCAPE - 1;
+
+class bit_writer
+{
+	private:
+	std::vector <unsigned char> &m_out;
+	uint64_t m_accumulator;
+	unsigned int m_bits;
+
+	public:
+	bit_writer(std::vector <unsigned char> &out) : m_out(out), m_accumulator(0), m_bits(0) {}
+
+	/* count is at most 32.*/
+	inline void put(uint32_t value, unsigned int count)
+	{
+		m_accumulator = (m_accumulator << count) | (value & (uint32_t)((1ull << count) - 1));
+		m_bits += count;
+		while(8 <= m_bits)
+		{
+			m_bits -= 8;
+			m_out.push_back((unsigned char)(m_accumulator >> m_bits));
+		}
+	}
+
+	/* count zeros, then a one.*/
+	inline void put_unary(uint32_t count)
+	{
+		while(32 <= count)
+		{
+			put(0, 32);
+			count -= 32;
+		}
+		put(1, count + 1);
+	}
+
+	inline void flush()
+	{
+		if(0 != m_bits)
+		{
+			put(0, 8 - m_bits);
+		}
+	}
+};
+
+class bit_reader
+{
+	private:
+	const unsigned char * m_data;
+	unsigned int m_size;
+	unsigned int m_offset;
+	uint64_t m_accumulator;
+	unsigned int m_bits;
+	bool m_overrun;
+
+	inline void refill()
+	{
+		while(48 >= m_bits) //Leaves m_bits at most 56, so that a mask of m_bits bits never needs a shift by 64.
+		{
+			m_accumulator <<= 8;
+			if(m_offset < m_size)
+			{
+				m_accumulator |= m_data[m_offset++];
+			}
+			else if(m_offset++ > m_size + 8)
+			{
+				m_overrun = true; //Well past the end. Corrupt data mustn't keep this going.
+				break;
+			}
+			m_bits += 8;
+		}
+	}
+
+	public:
+	bit_reader(const unsigned char * data, unsigned int size) : m_data(data), m_size(size), m_offset(0), m_accumulator(0), m_bits(0), m_overrun(false) {}
+
+	/* count is at most 32.*/
+	inline uint32_t get(unsigned int count)
+	{
+		if(m_bits < count)
+		{
+			refill();
+			if(m_bits < count)
+			{
+				return 0;
+			}
+		}
+		m_bits -= count;
+		return (uint32_t)(m_accumulator >> m_bits) & (uint32_t)((1ull << count) - 1);
+	}
+
+	inline uint32_t get_unary(uint32_t limit)
+	{
+		uint32_t count = 0;
+		while(!m_overrun)
+		{
+			if(0 == m_bits)
+			{
+				refill();
+				continue;
+			}
+			uint64_t window = m_accumulator & ((1ull << m_bits) - 1);
+			if(0 == window)
+			{
+				count += m_bits;
+				m_bits = 0;
+				if(count > limit)
+				{
+					m_overrun = true;
+				}
+				continue;
+			}
+			unsigned int top = 63 - __builtin_clzll(window);
+			count += m_bits - 1 - top;
+			m_bits = top;
+			break;
+		}
+		return count;
+	}
+
+	/* True if more was read than there is data. Refills read ahead, so this counts the bits handed out.*/
+	inline bool overrun() const { return (m_overrun || (((uint64_t)m_offset * 8 - m_bits) > ((uint64_t)m_size * 8))); }
+};
+
+static inline uint32_t zigzag(int32_t value)
+{
+	return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t value)
+{
+	return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static inline unsigned int bit_width(uint32_t value)
+{
+	return (0 == value ? 0 : 32 - __builtin_clz(value));
+}
+
+/* Sum of absolute residuals of each fixed predictor, as a cheap stand-in for coded size.*/
+static unsigned int choose_order(const int32_t * x, unsigned int count)
+{
+	if(count <= MAX_ORDER)
+	{
+		return 0;
+	}
+	uint64_t error[MAX_ORDER + 1] = {0, 0, 0, 0};
+	for(unsigned int n = MAX_ORDER; n < count; n++)
+	{
+		int64_t e0 = x[n];
+		int64_t e1 = e0 - x[n - 1];
+		int64_t e2 = e1 - ((int64_t)x[n - 1] - x[n - 2]);
+		int64_t e3 = e2 - ((int64_t)x[n - 1] - 2 * (int64_t)x[n - 2] + x[n - 3]);
+		error[0] += (e0 < 0 ? -e0 : e0);
+		error[1] += (e1 < 0 ? -e1 : e1);
+		error[2] += (e2 < 0 ? -e2 : e2);
+		error[3] += (e3 < 0 ? -e3 : e3);
+	}
+	unsigned int best = 0;
+	for(unsigned int order = 1; order <= MAX_ORDER; order++)
+	{
+		if(error[order] < error[best])
+		{
+			best = order;
+		}
+	}
+	return best;
+}
+
+/* In 64 bits, as corrupt data can make for any samples at all.*/
+static inline int64_t predict(const int32_t * x, unsigned int n, unsigned int order)
+{
+	switch(order)
+	{
+		case 1: return x[n - 1];
+		case 2: return 2 * (int64_t)x[n - 1] - x[n - 2];
+		case 3: return 3 * ((int64_t)x[n - 1] - x[n - 2]) + x[n - 3];
+		default: return 0;
+	}
+}
+
+/* Picks the cheapest of the Rice parameters around the one the mean suggests, or ESCAPE. Returns the width of the
+ * verbatim samples in width.*/
+static unsigned int choose_parameter(const uint32_t * u, unsigned int count, unsigned int &width)
+{
+	uint64_t sum = 0;
+	uint32_t largest = 0;
+	for(unsigned int i = 0; i < count; i++)
+	{
+		sum += u[i];
+		largest |= u[i];
+	}
+	width = bit_width(largest);
+	uint64_t best_cost = (uint64_t)PARAMETER_BITS + (uint64_t)count * width;
+	unsigned int best = ESCAPE;
+
+	uint64_t mean = sum / (count ? count : 1);
+	unsigned int guess = (0 == mean ? 0 : bit_width((uint32_t)(mean > 0xffffffffull ? 0xffffffffull : mean)) - 1);
+	unsigned int first = (0 == guess ? 0 : guess - 1);
+	for(unsigned int k = first; (k <= guess + 1) && (k <= MAX_RICE_PARAMETER); k++)
+	{
+		uint64_t cost = 0;
+		for(unsigned int i = 0; i < count; i++)
+		{
+			cost += (u[i] >> k);
+		}
+		cost += (uint64_t)count * (k + 1);
+		if(cost < best_cost)
+		{
+			best_cost = cost;
+			best = k;
+		}
+	}
+	return best;
+}
+
+pcm_codec::pcm_codec() : m_channels(0), m_bytes_per_sample(0)
+{
+}
+
+bool pcm_codec::configure(const audio_properties_t &properties)
+{
+	unsigned int sampling_rate = 0, bits_per_sample = 0, num_channels = 0;
+	get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
+	if(((16 != bits_per_sample) && (24 != bits_per_sample)) || (0 == num_channels) || (MAX_CHANNELS < num_channels))
+	{
+		m_channels = 0;
+		m_bytes_per_sample = 0;
+		return false;
+	}
+	m_channels = num_channels;
+	m_bytes_per_sample = bits_per_sample / 8;
+	return true;
+}
+
+void pcm_codec::deinterleave(const unsigned char * pcm, unsigned int frames, unsigned int channel, int32_t * dst) const
+{
+	const unsigned int stride = m_channels * m_bytes_per_sample;
+	const unsigned char * ptr = pcm + channel * m_bytes_per_sample;
+	if(2 == m_bytes_per_sample)
+	{
+		for(unsigned int i = 0; i < frames; i++, ptr += stride)
+		{
+			dst[i] = (int16_t)(ptr[0] | (ptr[1] << 8));
+		}
+	}
+	else
+	{
+		for(unsigned int i = 0; i < frames; i++, ptr += stride)
+		{
+			dst[i] = ((int32_t)(ptr[0] << 8 | ptr[1] << 16 | (uint32_t)ptr[2] << 24)) >> 8;
+		}
+	}
+}
+
+void pcm_codec::interleave(const int32_t * src, unsigned int frames, unsigned int channel, unsigned char * pcm) const
+{
+	const unsigned int stride = m_channels * m_bytes_per_sample;
+	unsigned char * ptr = pcm + channel * m_bytes_per_sample;
+	for(unsigned int i = 0; i < frames; i++, ptr += stride)
+	{
+		ptr[0] = (unsigned char)src[i];
+		ptr[1] = (unsigned char)(src[i] >> 8);
+		if(3 == m_bytes_per_sample)
+		{
+			ptr[2] = (unsigned char)(src[i] >> 16);
+		}
+	}
+}
+
+void pcm_codec::encode(const unsigned char * pcm, unsigned int frames, std::vector <unsigned char> &out)
+{
+	out.clear();
+	if(!is_configured())
+	{
+		return;
+	}
+	const unsigned int bits = m_bytes_per_sample * 8;
+	m_samples.resize(frames * 2);
+	m_side.resize(frames);
+	m_residual.resize(frames);
+	bit_writer writer(out);
+
+	/* Left and side beats left and right when the channels are much alike, which they mostly are.*/
+	bool side = false;
+	if(2 == m_channels)
+	{
+		int32_t * left = &m_samples[0];
+		int32_t * right = &m_samples[frames];
+		deinterleave(pcm, frames, 0, left);
+		deinterleave(pcm, frames, 1, right);
+		uint64_t right_sum = 0, side_sum = 0;
+		for(unsigned int i = 1; i < frames; i++)
+		{
+			int32_t right_delta = right[i] - right[i - 1];
+			int32_t side_delta = (left[i] - right[i]) - (left[i - 1] - right[i - 1]);
+			right_sum += (right_delta < 0 ? -(int64_t)right_delta : right_delta);
+			side_sum += (side_delta < 0 ? -(int64_t)side_delta : side_delta);
+		}
+		side = (side_sum < right_sum);
+		if(side)
+		{
+			for(unsigned int i = 0; i < frames; i++)
+			{
+				m_side[i] = left[i] - right[i];
+			}
+		}
+	}
+	writer.put(side ? 1 : 0, 1);
+
+	for(unsigned int channel = 0; channel < m_channels; channel++)
+	{
+		const int32_t * x = NULL;
+		unsigned int width = bits;
+		if(2 == m_channels)
+		{
+			x = &m_samples[channel * frames];
+			if(side && (1 == channel))
+			{
+				x = &m_side[0];
+				width = bits + 1;
+			}
+		}
+		else
+		{
+			deinterleave(pcm, frames, channel, &m_samples[0]);
+			x = &m_samples[0];
+		}
+
+		unsigned int order = choose_order(x, frames);
+		writer.put(order, ORDER_BITS);
+		for(unsigned int n = 0; n < order; n++)
+		{
+			writer.put((uint32_t)x[n], width);
+		}
+		uint32_t * u = (uint32_t *)&m_residual[0];
+		for(unsigned int n = order; n < frames; n++)
+		{
+			u[n] = zigzag((int32_t)(x[n] - predict(x, n, order)));
+		}
+
+		for(unsigned int start = order; start < frames; )
+		{
+			unsigned int end = ((start / PARTITION_SIZE) + 1) * PARTITION_SIZE;
+			if(end > frames)
+			{
+				end = frames;
+			}
+			unsigned int verbatim_width = 0;
+			unsigned int k = choose_parameter(&u[start], end - start, verbatim_width);
+			writer.put(k, PARAMETER_BITS);
+			if(ESCAPE == k)
+			{
+				writer.put(verbatim_width, PARAMETER_BITS);
+				for(unsigned int n = start; n < end; n++)
+				{
+					writer.put(u[n], verbatim_width);
+				}
+			}
+			else
+			{
+				for(unsigned int n = start; n < end; n++)
+				{
+					writer.put_unary(u[n] >> k);
+					writer.put(u[n], k);
+				}
+			}
+			start = end;
+		}
+	}
+	writer.flush();
+}
+
+bool pcm_codec::decode(const unsigned char * data, unsigned int size, unsigned int frames, unsigned char * pcm)
+{
+	if(!is_configured())
+	{
+		return false;
+	}
+	const unsigned int bits = m_bytes_per_sample * 8;
+	m_samples.resize(frames * 2);
+	bit_reader reader(data, size);
+	bool side = (1 == reader.get(1));
+	bool ok = (!side || (2 == m_channels));
+
+	for(unsigned int channel = 0; ok && (channel < m_channels); channel++)
+	{
+		int32_t * x = &m_samples[(2 == m_channels ? channel : 0) * frames];
+		unsigned int width = ((side && (1 == channel)) ? bits + 1 : bits);
+		unsigned int order = reader.get(ORDER_BITS);
+		if(order > frames)
+		{
+			ok = false;
+			break;
+		}
+		for(unsigned int n = 0; n < order; n++)
+		{
+			x[n] = ((int32_t)(reader.get(width) << (32 - width))) >> (32 - width);
+		}
+		for(unsigned int start = order; start < frames; )
+		{
+			unsigned int end = ((start / PARTITION_SIZE) + 1) * PARTITION_SIZE;
+			if(end > frames)
+			{
+				end = frames;
+			}
+			unsigned int k = reader.get(PARAMETER_BITS);
+			if(ESCAPE == k)
+			{
+				unsigned int verbatim_width = reader.get(PARAMETER_BITS);
+				for(unsigned int n = start; n < end; n++)
+				{
+					x[n] = (int32_t)(unzigzag(reader.get(verbatim_width)) + predict(x, n, order));
+				}
+			}
+			else
+			{
+				for(unsigned int n = start; n < end; n++)
+				{
+					uint32_t u = (reader.get_unary(0xffffffffu >> k) << k) | reader.get(k);
+					x[n] = (int32_t)(unzigzag(u) + predict(x, n, order));
+				}
+			}
+			if(reader.overrun())
+			{
+				ok = false;
+				break;
+			}
+			start = end;
+		}
+		if(ok && (2 != m_channels))
+		{
+			interleave(x, frames, channel, pcm);
+		}
+	}
+
+	if(!ok)
+	{
+		ERROR("Corrupt block of %u bytes.\n", size);
+		memset(pcm, 0, frames * m_channels * m_bytes_per_sample);
+		return false;
+	}
+	if(2 == m_channels)
+	{
+		int32_t * left = &m_samples[0];
+		int32_t * right = &m_samples[frames];
+		if(side)
+		{
+			for(unsigned int i = 0; i < frames; i++)
+			{
+				right[i] = (int32_t)((int64_t)left[i] - right[i]);
+			}
+		}
+		interleave(left, frames, 0, pcm);
+		interleave(right, frames, 1, pcm);
+	}
+	return true;
+}
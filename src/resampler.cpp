@@ -0,0 +1,234 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "resampler.h"
+#include "basic_types.h"
+#include <math.h>
+#include <string.h>
+#include <map>
+#include <mutex>
+
+static const unsigned int ZERO_CROSSINGS = 16; //Per side of the sinc. Sets steepness of the transition band.
+static const double ROLLOFF = 0.92; //Cutoff as a fraction of the lower of the two Nyquist frequencies.
+static const double KAISER_BETA = 8.6; //About 90dB of stopband attenuation.
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while(0 != b)
+	{
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+static double bessel_i0(double x)
+{
+	double sum = 1.0;
+	double term = 1.0;
+	for(unsigned int k = 1; k < 50; k++)
+	{
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+		if(term < (sum * 1e-12))
+		{
+			break;
+		}
+	}
+	return sum;
+}
+
+static polyphase_filter_bank_t * design_filter_bank(unsigned int up, unsigned int down)
+{
+	polyphase_filter_bank_t * bank = new polyphase_filter_bank_t;
+	bank->up = up;
+	bank->down = down;
+
+	/* The prototype runs at up times the input rate. Its cutoff, in cycles per sample at that rate, has to be below the
+	 * Nyquist frequency of both the input and the output.*/
+	unsigned int factor = (up > down ? up : down);
+	double cutoff = 0.5 * ROLLOFF / factor;
+	bank->taps = (unsigned int)ceil(2.0 * ZERO_CROSSINGS * factor / ROLLOFF / up);
+	unsigned int length = bank->taps * up;
+	double centre = (length - 1) / 2.0;
+	double window_scale = bessel_i0(KAISER_BETA);
+
+	std::vector <double> prototype(length);
+	for(unsigned int n = 0; n < length; n++)
+	{
+		double t = n - centre;
+		double sinc = (0.0 == t ? 1.0 : sin(2.0 * M_PI * cutoff * t) / (2.0 * M_PI * cutoff * t));
+		double r = t / (centre + 1.0);
+		double window = bessel_i0(KAISER_BETA * sqrt(1.0 - r * r)) / window_scale;
+		prototype[n] = 2.0 * cutoff * sinc * window * up; //Scaled by up to make up for the zeros that upsampling stuffs in.
+	}
+
+	/* Phase p uses prototype taps p, p + up, p + 2up... against the newest input frame first. Stored oldest first, so
+	 * that the inner loop walks input and coefficients in the same direction.*/
+	bank->coefficients.resize(length);
+	for(unsigned int p = 0; p < up; p++)
+	{
+		for(unsigned int k = 0; k < bank->taps; k++)
+		{
+			bank->coefficients[p * bank->taps + (bank->taps - 1 - k)] = (float)prototype[p + k * up];
+		}
+	}
+	INFO("Designed %d/%d filter bank with %d taps per phase.\n", up, down, bank->taps);
+	return bank;
+}
+
+std::shared_ptr <const polyphase_filter_bank_t> get_polyphase_filter_bank(unsigned int in_rate, unsigned int out_rate)
+{
+	static std::mutex cache_mutex;
+	static std::map <std::pair <unsigned int, unsigned int>, std::shared_ptr <const polyphase_filter_bank_t> > cache;
+
+	unsigned int divisor = gcd(in_rate, out_rate);
+	std::pair <unsigned int, unsigned int> key(out_rate / divisor, in_rate / divisor);
+
+	std::unique_lock <std::mutex> lock(cache_mutex);
+	auto iter = cache.find(key);
+	if(cache.end() != iter)
+	{
+		return iter->second;
+	}
+	std::shared_ptr <const polyphase_filter_bank_t> bank(design_filter_bank(key.first, key.second));
+	cache[key] = bank;
+	return bank;
+}
+
+
+polyphase_resampler::polyphase_resampler(unsigned int in_rate, unsigned int out_rate, unsigned int channels) : m_bank(get_polyphase_filter_bank(in_rate, out_rate)),
+	m_channels(channels)
+{
+	reset();
+}
+
+void polyphase_resampler::reset()
+{
+	/* Start from silence, so the first output is aligned with the first input frame.*/
+	m_history_frames = m_bank->taps - 1;
+	m_history.assign(m_history_frames * m_channels, 0.0f);
+	m_index = m_history_frames;
+	m_phase = 0;
+}
+
+unsigned int polyphase_resampler::get_output_frames(unsigned int in_frames) const
+{
+	/* Output k needs input frame m_index + (m_phase + k * down) / up, which has to exist.*/
+	unsigned long long available = (unsigned long long)(m_history_frames + in_frames) * m_bank->up;
+	unsigned long long position = (unsigned long long)m_index * m_bank->up + m_phase;
+	if(available <= position)
+	{
+		return 0;
+	}
+	return (unsigned int)((available - position + m_bank->down - 1) / m_bank->down);
+}
+
+double polyphase_resampler::get_delay_frames() const
+{
+	/* The filter is symmetric, so its group delay is half its length, at the upsampled rate.*/
+	return ((double)m_bank->taps * m_bank->up - 1.0) / (2.0 * m_bank->up);
+}
+
+static inline int16_t to_s16(float value)
+{
+	long sample = lrintf(value);
+	if(sample > 32767)
+	{
+		sample = 32767;
+	}
+	else if(sample < -32768)
+	{
+		sample = -32768;
+	}
+	return (int16_t)sample;
+}
+
+unsigned int polyphase_resampler::process(const int16_t * src, unsigned int in_frames, int16_t * dst)
+{
+	unsigned int out_frames = get_output_frames(in_frames);
+
+	unsigned int base = m_history_frames * m_channels;
+	m_history.resize(base + in_frames * m_channels);
+	for(unsigned int i = 0; i < in_frames * m_channels; i++)
+	{
+		m_history[base + i] = src[i];
+	}
+	m_history_frames += in_frames;
+
+	const unsigned int taps = m_bank->taps;
+	const unsigned int up = m_bank->up;
+	const unsigned int down = m_bank->down;
+	for(unsigned int n = 0; n < out_frames; n++)
+	{
+		const float * h = &m_bank->coefficients[m_phase * taps];
+		const float * x = &m_history[(m_index + 1 - taps) * m_channels];
+		if(1 == m_channels)
+		{
+			float acc = 0.0f;
+			for(unsigned int k = 0; k < taps; k++)
+			{
+				acc += h[k] * x[k];
+			}
+			dst[n] = to_s16(acc);
+		}
+		else if(2 == m_channels)
+		{
+			float acc_left = 0.0f;
+			float acc_right = 0.0f;
+			for(unsigned int k = 0; k < taps; k++)
+			{
+				acc_left += h[k] * x[2 * k];
+				acc_right += h[k] * x[2 * k + 1];
+			}
+			dst[2 * n] = to_s16(acc_left);
+			dst[2 * n + 1] = to_s16(acc_right);
+		}
+		else
+		{
+			for(unsigned int c = 0; c < m_channels; c++)
+			{
+				float acc = 0.0f;
+				for(unsigned int k = 0; k < taps; k++)
+				{
+					acc += h[k] * x[k * m_channels + c];
+				}
+				dst[n * m_channels + c] = to_s16(acc);
+			}
+		}
+
+		m_phase += down;
+		m_index += m_phase / up;
+		m_phase %= up;
+	}
+
+	/* Keep only the history the next output needs.*/
+	unsigned int keep_from = m_index + 1 - taps;
+	if(keep_from > m_history_frames)
+	{
+		keep_from = m_history_frames; //Next output is past the end of what we have; nothing before it matters.
+	}
+	if(0 != keep_from)
+	{
+		m_history.erase(m_history.begin(), m_history.begin() + keep_from * m_channels);
+		m_history_frames -= keep_from;
+		m_index -= keep_from;
+	}
+	return out_frames;
+}
@@ -0,0 +1,97 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "capture_backend.h"
+#include <string.h>
+#include "rmfAudioCapture.h"
+
+using namespace audiocapturemgr;
+
+static void log_settings(RMF_AudioCapture_Settings &settings)
+{
+	INFO("Format 0x%x, sampling freq: 0x%x, FIFO size: %d, threshold: %d, delay compensation: %d\n",
+		settings.format, settings.samplingFreq, settings.fifoSize, settings.threshold, settings.delayCompensation_ms);
+}
+
+rmf_capture_backend::rmf_capture_backend(const char * device_type) : m_device_handle(NULL), m_name(NULL == device_type ? "primary" : device_type)
+{
+	int ret;
+	if(NULL == device_type)
+	{
+		ret = RMF_AudioCapture_Open(&m_device_handle);
+	}
+	else
+	{
+#ifdef RMF_AC_TYPE_AUXILIARY
+		ret = RMF_AudioCapture_Open_Type(&m_device_handle, const_cast <char *> (device_type));
+#else
+		ERROR("This platform can only capture primary audio.\n");
+		ret = -1;
+#endif
+	}
+	INFO("open() result is 0x%x\n", ret);
+	if(RMF_SUCCESS != ret)
+	{
+		m_device_handle = NULL;
+	}
+}
+
+rmf_capture_backend::~rmf_capture_backend()
+{
+	if(NULL != m_device_handle)
+	{
+		int ret = RMF_AudioCapture_Close(m_device_handle);
+		INFO("close() result is 0x%x\n", ret);
+		m_device_handle = NULL;
+	}
+}
+
+void rmf_capture_backend::get_default_properties(audio_properties_t &properties)
+{
+	RMF_AudioCapture_Settings settings;
+	RMF_AudioCapture_GetDefaultSettings(&settings);
+	properties.format = settings.format;
+	properties.sampling_frequency = settings.samplingFreq;
+	properties.fifo_size = settings.fifoSize;
+	properties.threshold = settings.threshold;
+	properties.delay_compensation_ms = settings.delayCompensation_ms;
+}
+
+int rmf_capture_backend::start(const audio_properties_t &properties, data_callback_t callback, void * context)
+{
+	RMF_AudioCapture_Settings settings;
+	memset (&settings, 0, sizeof(RMF_AudioCapture_Settings));
+	RMF_AudioCapture_GetDefaultSettings(&settings);
+
+	settings.cbBufferReady = callback;
+	settings.cbBufferReadyParm = context;
+	settings.fifoSize = properties.fifo_size;
+	settings.threshold = properties.threshold;
+	settings.delayCompensation_ms = properties.delay_compensation_ms;
+	settings.format = properties.format;
+	settings.samplingFreq = properties.sampling_frequency;
+
+	log_settings(settings);
+
+	return RMF_AudioCapture_Start(m_device_handle, &settings);
+}
+
+int rmf_capture_backend::stop()
+{
+	return RMF_AudioCapture_Stop(m_device_handle);
+}
@@ -0,0 +1,512 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include "shm_out.h"
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "safec_lib.h"
+#include "acm_thread.h"
+
+using namespace audiocapturemgr;
+static const char * SHM_SOCKNAME_PREFIX = "/tmp/acm_shm_out_";
+static unsigned int ticker;
+static const int PIPE_READ_FD = 0;
+static const int PIPE_WRITE_FD = 1;
+static const unsigned int MAX_READERS = 8;
+static const unsigned int SHM_OUT_DELIVERY_QUEUE_DEPTH = 128;
+static const unsigned int RING_CAPACITY = 1024 * 1024; //About 5s of 48kHz 16-bit stereo. Must be a power of 2.
+static const unsigned int RING_HEADER_SIZE = 4096; //Keeps the audio page-aligned.
+static const unsigned int MAX_EPOLL_EVENTS = 16;
+
+static void * shm_out_thread_launcher(void * data)
+{
+	shm_out_client * ptr = (shm_out_client *) data;
+	ptr->worker_thread();
+	return NULL;
+}
+
+shm_out_client::shm_out_client(q_mgr *mgr) : audio_capture_client(mgr), m_listen_fd(-1), m_epoll_fd(-1), m_memfd(-1), m_map_size(0),
+	m_header(NULL), m_data(NULL)
+{
+	INFO("Enter\n");
+	/*SIGPIPE must be ignored or process will exit when a consumer closes its connection during the handshake.*/
+	struct sigaction sig_settings;
+	sig_settings.sa_handler = SIG_IGN;
+	sigemptyset(&sig_settings.sa_mask);
+	sig_settings.sa_flags = 0;
+	sigaction(SIGPIPE, &sig_settings, NULL);
+
+	m_stats = {0, 0, 0, 0, 0, 0};
+	m_published_properties = {racFormat_eMax, racFreq_eMax, 0, 0, 0};
+	REPORT_IF_UNEQUAL(0, pipe2(m_control_pipe, O_NONBLOCK | O_CLOEXEC));
+	/* Publishing never blocks on consumers, so this only overflows if the client itself is starved.*/
+	set_delivery_policy(DROP_OLDEST, SHM_OUT_DELIVERY_QUEUE_DEPTH);
+	if(0 == create_ring())
+	{
+		open_output();
+	}
+}
+
+shm_out_client::~shm_out_client()
+{
+	INFO("Enter\n");
+	close_output();
+	destroy_ring();
+	close(m_control_pipe[PIPE_WRITE_FD]);
+	close(m_control_pipe[PIPE_READ_FD]);
+}
+
+int shm_out_client::create_ring()
+{
+	m_map_size = RING_HEADER_SIZE + RING_CAPACITY;
+	m_memfd = memfd_create("acm_shm_out", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(0 > m_memfd)
+	{
+		ERROR("Could not create memfd. errno: 0x%x\n", errno);
+		return -1;
+	}
+	if(0 != ftruncate(m_memfd, m_map_size))
+	{
+		ERROR("Could not size memfd. errno: 0x%x\n", errno);
+		close(m_memfd);
+		m_memfd = -1;
+		return -1;
+	}
+	void * mapping = mmap(NULL, m_map_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+	if(MAP_FAILED == mapping)
+	{
+		ERROR("Could not map memfd. errno: 0x%x\n", errno);
+		close(m_memfd);
+		m_memfd = -1;
+		return -1;
+	}
+
+	/* Consumers must not be able to resize the ring out from under the writer, or write to it.*/
+	int seals = F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL;
+#ifdef F_SEAL_FUTURE_WRITE
+	seals |= F_SEAL_FUTURE_WRITE;
+#endif
+	REPORT_IF_UNEQUAL(0, fcntl(m_memfd, F_ADD_SEALS, seals));
+
+	m_header = (acm_shm_ring_header_t *)mapping;
+	m_data = (unsigned char *)mapping + RING_HEADER_SIZE;
+	memset(m_header, 0, sizeof(acm_shm_ring_header_t));
+	m_header->magic = ACM_SHM_RING_MAGIC;
+	m_header->version = ACM_SHM_RING_VERSION;
+	m_header->data_offset = RING_HEADER_SIZE;
+	m_header->capacity = RING_CAPACITY;
+
+	audio_properties_t properties;
+	get_audio_properties(properties);
+	publish_format(properties);
+	INFO("Created %d byte ring.\n", RING_CAPACITY);
+	return 0;
+}
+
+void shm_out_client::destroy_ring()
+{
+	if(m_header)
+	{
+		munmap(m_header, m_map_size);
+		m_header = NULL;
+		m_data = NULL;
+	}
+	if(0 <= m_memfd)
+	{
+		close(m_memfd); //Consumers keep their own mappings.
+		m_memfd = -1;
+	}
+}
+
+/* Must be called with the client lock held, or before the ring is shared.*/
+void shm_out_client::publish_format(const audio_properties_t &properties)
+{
+	unsigned int sampling_rate, bits_per_sample, num_channels;
+	get_individual_audio_parameters(properties, sampling_rate, bits_per_sample, num_channels);
+
+	uint64_t sequence = m_header->format_sequence;
+	__atomic_store_n(&m_header->format_sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	m_header->format_position = m_header->write_position;
+	m_header->sampling_rate = sampling_rate;
+	m_header->channels = num_channels;
+	m_header->bits_per_sample = bits_per_sample;
+	__atomic_store_n(&m_header->format_sequence, sequence + 2, __ATOMIC_RELEASE);
+	m_published_properties = properties;
+	INFO("Publishing %dHz, %d bit, %d channel audio from position %llu.\n", sampling_rate, bits_per_sample, num_channels,
+			(unsigned long long)m_header->format_position);
+}
+
+/* Must be called with the client lock held.*/
+void shm_out_client::publish(const audio_buffer * buf)
+{
+	const unsigned char * ptr = buf->m_start_ptr;
+	unsigned int size = buf->m_size;
+	unsigned long long timestamp_us = buf->m_timestamp_us;
+	unsigned long long sample_index = buf->m_sample_index;
+	if(RING_CAPACITY < size)
+	{
+		/* Only the newest audio would survive anyway.*/
+		unsigned int frame_size = m_header->channels * m_header->bits_per_sample / 8;
+		unsigned int skipped_frames = (0 != frame_size ? (size - RING_CAPACITY) / frame_size : 0);
+		sample_index += skipped_frames;
+		timestamp_us += (0 != m_header->sampling_rate ? (unsigned long long)skipped_frames * 1000000 / m_header->sampling_rate : 0);
+		ptr += size - RING_CAPACITY;
+		size = RING_CAPACITY;
+	}
+	uint64_t position = m_header->write_position;
+	uint64_t end = position + size;
+
+	uint64_t sequence = m_header->timing_sequence;
+	__atomic_store_n(&m_header->timing_sequence, sequence + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	m_header->timing_position = position;
+	m_header->timestamp_us = timestamp_us;
+	m_header->sample_index = sample_index;
+	__atomic_store_n(&m_header->timing_sequence, sequence + 2, __ATOMIC_RELEASE);
+
+	/* Readers check reserve_position after copying, so it has to move before any of their audio is overwritten.*/
+	__atomic_store_n(&m_header->reserve_position, end, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	unsigned int offset = position & (RING_CAPACITY - 1);
+	unsigned int first = ((RING_CAPACITY - offset) < size ? (RING_CAPACITY - offset) : size);
+	memcpy(&m_data[offset], ptr, first);
+	memcpy(&m_data[0], ptr + first, size - first);
+
+	__atomic_store_n(&m_header->chunks_written, m_header->chunks_written + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&m_header->write_position, end, __ATOMIC_RELEASE);
+	m_stats.bytes_published += size;
+	if(0 != buf->m_timestamp_us)
+	{
+		unsigned long long now = get_monotonic_time_us();
+		m_stats.latency_us = (now > buf->m_timestamp_us ? (unsigned int)(now - buf->m_timestamp_us) : 0);
+		if(m_stats.max_latency_us < m_stats.latency_us)
+		{
+			m_stats.max_latency_us = m_stats.latency_us;
+		}
+	}
+}
+
+int shm_out_client::data_callback(audio_buffer *buf)
+{
+	lock();
+	if(m_header)
+	{
+		audio_properties_t properties;
+		get_audio_properties(properties);
+		if((properties.format != m_published_properties.format) || (properties.sampling_frequency != m_published_properties.sampling_frequency))
+		{
+			publish_format(properties);
+		}
+		publish(buf);
+
+		uint64_t signal = 1;
+		for(auto &reader : m_readers)
+		{
+			/* EAGAIN only means the counter is saturated, which wakes the reader just the same.*/
+			if((sizeof(signal) != write(reader.second, &signal, sizeof(signal))) && (EAGAIN != errno))
+			{
+				WARN("Could not signal reader eventfd. errno: 0x%x\n", errno);
+			}
+		}
+	}
+	unlock();
+	release_buffer(buf);
+	return 0;
+}
+
+std::string shm_out_client::get_data_path()
+{
+	return m_data_path;
+}
+
+std::string shm_out_client::open_output()
+{
+	lock();
+	if(!m_data_path.empty())
+	{
+		WARN("Already open.\n");
+		unlock();
+		return m_data_path;
+	}
+
+	m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_listen_fd < 0) {
+		ERROR("Could not open socket.\n");
+		unlock();
+		return m_data_path;
+	}
+
+	unsigned int num_retries = 6;
+	errno_t rc = -1;
+	while(num_retries)
+	{
+		num_retries--;
+		std::string sockpath = SHM_SOCKNAME_PREFIX + get_suffix(ticker++);
+
+		struct sockaddr_un bind_path;
+		bind_path.sun_family = AF_UNIX;
+		rc = strcpy_s(bind_path.sun_path, sizeof(bind_path.sun_path), sockpath.c_str());
+		if(rc != EOK)
+		{
+			ERR_CHK(rc);
+		}
+
+		INFO("Binding to path %s\n", bind_path.sun_path);
+		int ret = bind(m_listen_fd, (const struct sockaddr *) &bind_path, sizeof(bind_path));
+		if(-1 == ret)
+		{
+			if(EADDRINUSE == errno)
+			{
+				WARN("Retrying as the path is already in use.\n");
+				continue;
+			}
+			ERROR("Failed to bind to path. Error is %d\n", errno);
+			close(m_listen_fd);
+			m_listen_fd = -1;
+			break;
+		}
+		else
+		{
+			INFO("Bound successfully to path.\n");
+			m_data_path = sockpath;
+			REPORT_IF_UNEQUAL(0, listen(m_listen_fd, MAX_READERS));
+
+			m_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+			struct epoll_event event;
+			memset(&event, 0, sizeof(event));
+			event.events = EPOLLIN;
+			event.data.fd = m_listen_fd;
+			REPORT_IF_UNEQUAL(0, epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_listen_fd, &event));
+			event.data.fd = m_control_pipe[PIPE_READ_FD];
+			REPORT_IF_UNEQUAL(0, epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, m_control_pipe[PIPE_READ_FD], &event));
+			REPORT_IF_UNEQUAL(0, pthread_create(&m_thread, NULL, shm_out_thread_launcher, (void *) this));
+			break;
+		}
+	}
+
+	unlock();
+	return m_data_path;
+}
+
+void shm_out_client::close_output()
+{
+	INFO("Enter\n");
+	if(m_data_path.empty())
+	{
+		if(0 <= m_listen_fd)
+		{
+			close(m_listen_fd); //Socket was created, but never bound.
+			m_listen_fd = -1;
+		}
+		return;
+	}
+
+	/* The worker takes the client lock, so it must be joined before the lock is taken here.*/
+	int message = 0;
+	if(sizeof(message) != write(m_control_pipe[PIPE_WRITE_FD], &message, sizeof(message)))
+	{
+		ERROR("Couldn't trigger worker thread shutdown.\n");
+	}
+	else
+	{
+		REPORT_IF_UNEQUAL(0, pthread_join(m_thread, NULL));
+	}
+
+	lock();
+	while(!m_readers.empty())
+	{
+		close_reader(m_readers.begin()->first);
+	}
+	close(m_epoll_fd);
+	m_epoll_fd = -1;
+	close(m_listen_fd);
+	m_listen_fd = -1;
+	INFO("Removing named socket %s.\n", m_data_path.c_str());
+	unlink(m_data_path.c_str());
+	m_data_path.clear();
+	unlock();
+	INFO("Exit\n");
+}
+
+/* Must be called with the client lock held.*/
+void shm_out_client::close_reader(int fd)
+{
+	auto iter = m_readers.find(fd);
+	if(m_readers.end() == iter)
+	{
+		return;
+	}
+	epoll_ctl(m_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+	close(iter->second);
+	close(fd);
+	m_readers.erase(iter);
+	INFO("Reader on socket %d has gone. Total active readers now is %d\n", fd, (int)m_readers.size());
+}
+
+void shm_out_client::process_new_connections()
+{
+	while(true)
+	{
+		int fd = accept4(m_listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if(0 > fd)
+		{
+			if((EAGAIN != errno) && (EWOULDBLOCK != errno) && (EINTR != errno))
+			{
+				ERROR("Error accepting connection. errno: 0x%x\n", errno);
+			}
+			break;
+		}
+
+		lock();
+		if(MAX_READERS <= m_readers.size())
+		{
+			WARN("Already serving %d readers. Turning away the new one.\n", MAX_READERS);
+			close(fd);
+			m_stats.rejected++;
+			unlock();
+			continue;
+		}
+
+		int event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if(0 > event_fd)
+		{
+			ERROR("Could not create eventfd. errno: 0x%x\n", errno);
+			close(fd);
+			unlock();
+			continue;
+		}
+
+		/* Hand over the ring and the reader's own eventfd.*/
+		acm_shm_handshake_t handshake = {ACM_SHM_RING_MAGIC, ACM_SHM_RING_VERSION, m_map_size};
+		int fds[2] = {m_memfd, event_fd};
+		char control[CMSG_SPACE(sizeof(fds))];
+		memset(control, 0, sizeof(control));
+		struct iovec iov;
+		iov.iov_base = &handshake;
+		iov.iov_len = sizeof(handshake);
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		struct cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+		if(sizeof(handshake) != sendmsg(fd, &message, MSG_NOSIGNAL))
+		{
+			ERROR("Handshake failed. errno: 0x%x\n", errno);
+			close(event_fd);
+			close(fd);
+			unlock();
+			continue;
+		}
+
+		/* Nothing more is sent on the socket. It is only watched for the reader going away.*/
+		struct epoll_event event;
+		memset(&event, 0, sizeof(event));
+		event.events = EPOLLIN | EPOLLRDHUP;
+		event.data.fd = fd;
+		REPORT_IF_UNEQUAL(0, epoll_ctl(m_epoll_fd, EPOLL_CTL_ADD, fd, &event));
+		m_readers[fd] = event_fd;
+		m_stats.accepted++;
+		INFO("Connected to new reader on socket %d. Total active readers now is %d\n", fd, (int)m_readers.size());
+		unlock();
+	}
+}
+
+void shm_out_client::worker_thread()
+{
+	thread_role_scope role(THREAD_ROLE_SHM_OUT);
+	INFO("Enter\n");
+	int control_fd = m_control_pipe[PIPE_READ_FD];
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	bool check_fds = true;
+
+	while(check_fds)
+	{
+		int ret = epoll_wait(m_epoll_fd, events, MAX_EPOLL_EVENTS, -1);
+		if(0 > ret)
+		{
+			if(EINTR == errno)
+			{
+				continue;
+			}
+			ERROR("Error polling monitor FD!\n");
+			break;
+		}
+
+		for(int i = 0; i < ret; i++)
+		{
+			int fd = events[i].data.fd;
+			if(control_fd == fd)
+			{
+				int message;
+				REPORT_IF_UNEQUAL(sizeof(message), read(control_fd, &message, sizeof(message))); //Consumed, or the output couldn't be reopened.
+				INFO("Exiting monitor thread.\n");
+				check_fds = false;
+				break;
+			}
+			else if(m_listen_fd == fd)
+			{
+				process_new_connections();
+			}
+			else
+			{
+				/* Readers aren't expected to send anything. Discard it, and look out for the end of the stream.*/
+				bool gone = (0 != (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)));
+				if(!gone)
+				{
+					char discard[256];
+					ssize_t count = read(fd, discard, sizeof(discard));
+					gone = ((0 == count) || ((0 > count) && (EAGAIN != errno) && (EINTR != errno)));
+				}
+				if(gone)
+				{
+					lock();
+					close_reader(fd);
+					unlock();
+				}
+			}
+		}
+	}
+	INFO("Exit\n");
+}
+
+void shm_out_client::get_stats(shm_out_stats_t &stats)
+{
+	lock();
+	stats = m_stats;
+	stats.active_readers = m_readers.size();
+	unlock();
+}
@@ -25,6 +25,7 @@
 #include <stdio.h>
 #include <errno.h>
 #include "safec_lib.h"
+#include "acm_thread.h"
 
 #define _GNU_SOURCE
 #include <fcntl.h>
@@ -222,6 +223,7 @@ void socket_adaptor::process_new_connection()
 
 void socket_adaptor::worker_thread()
 {
+	audiocapturemgr::thread_role_scope role(audiocapturemgr::THREAD_ROLE_SOCKET_ADAPTOR);
 	INFO("Enter\n");
 	int control_fd = m_control_pipe[PIPE_READ_FD];
 	int max_fd = (m_listen_fd > control_fd ? m_listen_fd : control_fd);
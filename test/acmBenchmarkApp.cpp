@@ -0,0 +1,948 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <string>
+#include <functional>
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#include <stdlib.h>
+#include <time.h>
+#include <math.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "audio_buffer.h"
+#include "audio_kernels.h"
+#include "audio_converter.h"
+#include "audio_capture_manager.h"
+#include "capture_backend.h"
+#include "ip_out.h"
+#include "pcm_codec.h"
+
+using namespace audiocapturemgr;
+
+static const unsigned int DEFAULT_NUM_BUFFERS = 200000;
+static const unsigned int DEFAULT_REPEAT = 5;
+static const unsigned int BUFFER_SIZE = 64; //Payload size doesn't matter for refcounting.
+static const unsigned int AUDIO_BUFFER_SIZE = 8 * 1024; //The default threshold, so the size of a driver callback.
+static const unsigned int POOL_SLOTS = 256;
+static const unsigned int KERNEL_INPUT_SIZE = 960 * 1024; //Divisible by every frame size used below.
+static const unsigned int KERNEL_ITERATIONS = 200;
+static const unsigned int STFT_SIZE = 1024; //As in fingerprinter. KERNEL_INPUT_SIZE holds a whole number of them.
+static const unsigned int PIPELINE_BUFFERS = 100000;
+static const unsigned int PIPELINE_FRAME_SIZE = 4; //16-bit stereo
+static const unsigned int MAX_PIPELINE_CLIENTS = 8;
+static const unsigned int CONVERTER_INPUT_SECONDS = 2;
+static const unsigned int CODEC_BLOCK_FRAMES = 4096; //As music_id compresses precaptured audio.
+static const unsigned int IP_OUT_BUFFERS = 20000;
+static const unsigned int IP_OUT_BACKLOG_LIMIT = 64 * 1024; //Well short of ip_out's per-reader send queue, so nothing is dropped.
+static const unsigned int DRAIN_TIMEOUT_MS = 5000;
+
+typedef std::vector <std::pair <std::string, std::string> > params_t;
+typedef std::vector <std::pair <std::string, double> > metrics_t;
+
+typedef struct
+{
+	std::string name;
+	params_t params;
+	metrics_t metrics;
+} result_t;
+
+static struct
+{
+	std::string filter;
+	std::string json_path;
+	std::string label;
+	unsigned int repeat;
+	unsigned int num_buffers;
+	unsigned int max_threads;
+} g_options;
+
+static std::vector <result_t> g_results;
+static bool g_failed = false; //A benchmark found wrong output. Its numbers are still reported, but the run fails.
+
+static bool is_selected(const std::string &name)
+{
+	return (0 == name.compare(0, g_options.filter.size(), g_options.filter));
+}
+
+/* A group of benchmarks is worth setting up if any of them could be selected, as with --filter kernel/s24_to_s16.*/
+static bool is_group_selected(const std::string &prefix)
+{
+	return (is_selected(prefix) || (0 == g_options.filter.compare(0, prefix.size(), prefix)));
+}
+
+static double get_metric(const metrics_t &metrics, const std::string &key)
+{
+	for(auto &metric : metrics)
+	{
+		if(key == metric.first)
+		{
+			return metric.second;
+		}
+	}
+	return 0;
+}
+
+static double seconds_since(std::chrono::steady_clock::time_point start_time)
+{
+	std::chrono::duration <double> elapsed = std::chrono::steady_clock::now() - start_time;
+	return elapsed.count();
+}
+
+/* Runs a trial g_options.repeat times and keeps the one with the median value of key, along with the spread of key.*/
+static metrics_t run_trials(std::function <metrics_t ()> trial, const std::string &key)
+{
+	std::vector <metrics_t> runs;
+	for(unsigned int i = 0; i < g_options.repeat; i++)
+	{
+		runs.push_back(trial());
+	}
+	std::sort(runs.begin(), runs.end(), [&key](const metrics_t &a, const metrics_t &b){return get_metric(a, key) < get_metric(b, key);});
+	metrics_t median = runs[runs.size() / 2];
+	median.push_back(std::make_pair(key + "_min", get_metric(runs.front(), key)));
+	median.push_back(std::make_pair(key + "_max", get_metric(runs.back(), key)));
+	return median;
+}
+
+static void report(const std::string &name, const params_t &params, const metrics_t &metrics)
+{
+	std::cout<<name;
+	for(auto &param : params)
+	{
+		std::cout<<" "<<param.first<<"="<<param.second;
+	}
+	for(auto &metric : metrics)
+	{
+		std::cout<<" "<<metric.first<<"="<<metric.second;
+	}
+	std::cout<<std::endl;
+	result_t result = {name, params, metrics};
+	g_results.push_back(result);
+}
+
+static std::string json_string(const std::string &text)
+{
+	std::string out = "\"";
+	for(char c : text)
+	{
+		if(('"' == c) || ('\\' == c))
+		{
+			out += '\\';
+			out += c;
+		}
+		else if(0x20 > (unsigned char)c)
+		{
+			char escaped[8];
+			snprintf(escaped, sizeof(escaped), "\\u%04x", (unsigned char)c);
+			out += escaped;
+		}
+		else
+		{
+			out += c;
+		}
+	}
+	return out + "\"";
+}
+
+static void write_json(std::ostream &os)
+{
+	const audio_kernels_t * kernels = get_audio_kernels();
+	os<<"{\"format\":\"acm_benchmark\",\"version\":1,\"label\":"<<json_string(g_options.label)<<",\"timestamp\":"<<time(NULL)
+		<<",\"host\":{\"cpus\":"<<std::thread::hardware_concurrency()<<",\"kernels\":"<<json_string(kernels->name)<<"}"
+		<<",\"repeat\":"<<g_options.repeat<<",\"results\":[";
+	for(size_t i = 0; i < g_results.size(); i++)
+	{
+		const result_t &result = g_results[i];
+		os<<(0 == i ? "" : ",")<<"\n{\"name\":"<<json_string(result.name)<<",\"params\":{";
+		for(size_t j = 0; j < result.params.size(); j++)
+		{
+			os<<(0 == j ? "" : ",")<<json_string(result.params[j].first)<<":"<<json_string(result.params[j].second);
+		}
+		os<<"},\"metrics\":{";
+		for(size_t j = 0; j < result.metrics.size(); j++)
+		{
+			os<<(0 == j ? "" : ",")<<json_string(result.metrics[j].first)<<":"<<result.metrics[j].second;
+		}
+		os<<"}}";
+	}
+	os<<"\n]}\n";
+}
+
+/*------------------------------------------------- audio_buffer -------------------------------------------------*/
+
+typedef void (*unref_function_t)(audio_buffer *ptr);
+
+/* The scheme audio_buffer used before refcounts became atomic: every unref of any buffer serialized on one global mutex.*/
+static pthread_mutex_t g_legacy_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void legacy_unref(audio_buffer *ptr)
+{
+	pthread_mutex_lock(&g_legacy_mutex);
+	unsigned int refcount = ptr->m_refcount.load(std::memory_order_relaxed);
+	if(1 == refcount)
+	{
+		free_audio_buffer(ptr);
+	}
+	else
+	{
+		ptr->m_refcount.store(refcount - 1, std::memory_order_relaxed);
+	}
+	pthread_mutex_unlock(&g_legacy_mutex);
+}
+
+static void run_threads(unsigned int num_threads, std::function <void (unsigned int)> body)
+{
+	std::vector <std::thread> threads;
+	for(unsigned int t = 0; t < num_threads; t++)
+	{
+		threads.push_back(std::thread(body, t));
+	}
+	for(auto &thread : threads)
+	{
+		thread.join();
+	}
+}
+
+/* Every buffer is shared by all threads, the way a buffer is shared by all clients of q_mgr. Each thread drops its
+ * reference to every buffer; whoever drops the last one frees it.*/
+static metrics_t bench_unref(unref_function_t unref, unsigned int num_threads, unsigned int num_buffers)
+{
+	unsigned char payload[BUFFER_SIZE];
+	memset(payload, 0, sizeof(payload));
+	std::vector <audio_buffer *> buffers(num_buffers);
+	for(unsigned int i = 0; i < num_buffers; i++)
+	{
+		buffers[i] = create_new_audio_buffer(payload, sizeof(payload), 0, num_threads);
+	}
+
+	auto start_time = std::chrono::steady_clock::now();
+	run_threads(num_threads, [&buffers, unref](unsigned int t)
+		{
+			/* Start at different offsets so that threads don't move in lockstep on the same buffer.*/
+			size_t count = buffers.size();
+			for(size_t i = 0; i < count; i++)
+			{
+				unref(buffers[(i + t * (count / 8)) % count]);
+			}
+		});
+	double seconds = seconds_since(start_time);
+	unsigned long long ops = (unsigned long long)num_threads * num_buffers;
+	return {{"ns_per_op", seconds * 1e9 / ops}, {"mops_per_s", ops / seconds / 1e6}};
+}
+
+/* Every thread creates buffers of driver callback size and drops them again, from the heap or from one shared pool.*/
+static metrics_t bench_create_unref(bool use_pool, unsigned int num_threads, unsigned int num_buffers)
+{
+	std::vector <unsigned char> payload(AUDIO_BUFFER_SIZE, 0);
+	audio_buffer_pool * pool = (use_pool ? new audio_buffer_pool(AUDIO_BUFFER_SIZE, POOL_SLOTS) : NULL);
+	unsigned int per_thread = num_buffers / num_threads;
+
+	auto start_time = std::chrono::steady_clock::now();
+	run_threads(num_threads, [&payload, pool, per_thread](unsigned int)
+		{
+			for(unsigned int i = 0; i < per_thread; i++)
+			{
+				audio_buffer * buf = (pool ? pool->allocate(&payload[0], payload.size(), 0, 1) : create_new_audio_buffer(&payload[0], payload.size(), 0, 1));
+				unref_audio_buffer(buf);
+			}
+		});
+	double seconds = seconds_since(start_time);
+	unsigned long long ops = (unsigned long long)per_thread * num_threads;
+	metrics_t metrics = {{"ns_per_op", seconds * 1e9 / ops}, {"mops_per_s", ops / seconds / 1e6}};
+	if(pool)
+	{
+		audio_buffer_pool_stats_t stats;
+		pool->get_stats(stats);
+		metrics.push_back(std::make_pair("pool_misses", (double)stats.misses));
+		pool->retire();
+	}
+	return metrics;
+}
+
+static void run_buffer_benchmarks()
+{
+	for(unsigned int threads = 1; threads <= g_options.max_threads; threads *= 2)
+	{
+		unsigned int num_buffers = g_options.num_buffers;
+		if(is_selected("buffer/unref"))
+		{
+			report("buffer/unref", {{"scheme", "global_mutex"}, {"threads", std::to_string(threads)}},
+				run_trials([=](){return bench_unref(legacy_unref, threads, num_buffers);}, "ns_per_op"));
+			report("buffer/unref", {{"scheme", "atomic"}, {"threads", std::to_string(threads)}},
+				run_trials([=](){return bench_unref(unref_audio_buffer, threads, num_buffers);}, "ns_per_op"));
+		}
+		if(is_selected("buffer/create_unref"))
+		{
+			report("buffer/create_unref", {{"allocator", "heap"}, {"threads", std::to_string(threads)}},
+				run_trials([=](){return bench_create_unref(false, threads, num_buffers);}, "ns_per_op"));
+			report("buffer/create_unref", {{"allocator", "pool"}, {"threads", std::to_string(threads)}},
+				run_trials([=](){return bench_create_unref(true, threads, num_buffers);}, "ns_per_op"));
+		}
+	}
+}
+
+/*------------------------------------------------- kernels -------------------------------------------------*/
+
+/* How audio_converter used to downmix and downsample: one virtual write_data() call, and a memcpy, per output sample.*/
+static void legacy_decimate(audio_converter_sink &sink, const unsigned char * src, unsigned int size, unsigned int leap, unsigned int write_length)
+{
+	int remaining = size;
+	const char * ptr = (const char *)src;
+	while(remaining > 0)
+	{
+		sink.write_data(ptr, write_length);
+		remaining -= leap;
+		ptr += leap;
+	}
+}
+
+/* One transform as fingerprinter does it, bar the bit-reversed reordering. Starts from the audio each time, so that
+ * repeated runs don't overflow.*/
+static void stft_block(const audio_kernels_t * kernels, const int16_t * src, const float * window, float * re, float * im, float * power,
+		const float * twiddle_re, const float * twiddle_im)
+{
+	kernels->window_s16(src, window, re, STFT_SIZE);
+	memset(im, 0, STFT_SIZE * sizeof(float));
+	for(unsigned int half = 1; half < STFT_SIZE; half <<= 1)
+	{
+		for(unsigned int start = 0; start < STFT_SIZE; start += 2 * half)
+		{
+			kernels->butterfly_f32(&re[start], &im[start], &re[start + half], &im[start + half], twiddle_re, twiddle_im, half);
+		}
+		twiddle_re += half;
+		twiddle_im += half;
+	}
+	kernels->power_f32(re, im, power, STFT_SIZE / 2 + 1);
+}
+
+/* Throughput is measured in input bytes consumed per second.*/
+static metrics_t time_kernel(std::function <void ()> body)
+{
+	auto start_time = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < KERNEL_ITERATIONS; i++)
+	{
+		body();
+	}
+	double seconds = seconds_since(start_time);
+	return {{"mb_per_s", (double)KERNEL_INPUT_SIZE * KERNEL_ITERATIONS / seconds / 1e6}};
+}
+
+static void run_kernel_benchmarks()
+{
+	if(!is_group_selected("kernel/"))
+	{
+		return;
+	}
+	std::vector <unsigned char> input(KERNEL_INPUT_SIZE);
+	for(unsigned int i = 0; i < input.size(); i++)
+	{
+		input[i] = (unsigned char)rand();
+	}
+	std::vector <int16_t> output(KERNEL_INPUT_SIZE / 2);
+	const int16_t * src16 = (const int16_t *)&input[0];
+	int16_t * dst16 = &output[0];
+	const unsigned char * src = &input[0];
+	std::vector <float> window(KERNEL_INPUT_SIZE / 2, 0.5f);
+	std::vector <float> spectrum(KERNEL_INPUT_SIZE / 2);
+	std::vector <float> imaginary(KERNEL_INPUT_SIZE / 2);
+	std::vector <float> power(STFT_SIZE / 2 + 1);
+	std::vector <float> twiddle_re, twiddle_im;
+	for(unsigned int half = 1; half < STFT_SIZE; half <<= 1)
+	{
+		for(unsigned int k = 0; k < half; k++)
+		{
+			twiddle_re.push_back((float)cos(M_PI * k / half));
+			twiddle_im.push_back((float)-sin(M_PI * k / half));
+		}
+	}
+	auto run = [](const std::string &name, const params_t &params, std::function <void ()> body)
+		{
+			if(is_selected(name))
+			{
+				report(name, params, run_trials([body](){return time_kernel(body);}, "mb_per_s"));
+			}
+		};
+
+	run("kernel/stereo_to_mono_decimate3", {{"isa", "legacy_write_data"}}, [src]()
+		{
+			audio_converter_memory_sink sink(KERNEL_INPUT_SIZE);
+			legacy_decimate(sink, src, KERNEL_INPUT_SIZE, 4 * 3, 2);
+		});
+
+	for(unsigned int isa = KERNEL_ISA_SCALAR; isa < KERNEL_ISA_MAX; isa++)
+	{
+		const audio_kernels_t * kernels = get_audio_kernels((kernel_isa_t)isa);
+		if(NULL == kernels)
+		{
+			continue;
+		}
+		params_t params = {{"isa", kernels->name}};
+		run("kernel/stereo_to_mono", params, [=](){kernels->stereo_to_mono_s16(src16, dst16, KERNEL_INPUT_SIZE / 4);});
+		run("kernel/s24_to_s16", params, [=](){kernels->s24_to_s16(src, dst16, KERNEL_INPUT_SIZE / 3);});
+		run("kernel/stereo_to_mono_decimate3", params, [=](){kernels->decimate_s16(src16, dst16, KERNEL_INPUT_SIZE / 4 / 3, 2, true, 3);});
+		run("kernel/stereo_decimate2", params, [=](){kernels->decimate_s16(src16, dst16, KERNEL_INPUT_SIZE / 4 / 2, 2, false, 2);});
+		run("kernel/energy", params, [=]()
+			{
+				uint64_t sum_squares = 0;
+				unsigned int peak = 0;
+				kernels->energy_s16(src16, KERNEL_INPUT_SIZE / 2, &sum_squares, &peak);
+				asm volatile("" : : "r"(sum_squares), "r"(peak)); //Keeps the result from being optimized away.
+			});
+		run("kernel/window", params, [=, &spectrum](){kernels->window_s16(src16, &window[0], &spectrum[0], KERNEL_INPUT_SIZE / 2);});
+		run("kernel/power", params, [=, &spectrum, &imaginary](){kernels->power_f32(&spectrum[0], &spectrum[KERNEL_INPUT_SIZE / 4], &imaginary[0], KERNEL_INPUT_SIZE / 4);});
+		run("kernel/stft", params, [=, &spectrum, &imaginary, &power]()
+			{
+				for(unsigned int block = 0; block < (KERNEL_INPUT_SIZE / 2); block += STFT_SIZE)
+				{
+					stft_block(kernels, &src16[block], &window[block], &spectrum[block], &imaginary[block], &power[0], &twiddle_re[0], &twiddle_im[0]);
+				}
+			});
+	}
+}
+
+/*------------------------------------------------- audio_converter -------------------------------------------------*/
+
+static const char * get_format_name(racFormat format)
+{
+	switch(format)
+	{
+		case racFormat_e16BitStereo: return "s16_stereo";
+		case racFormat_e24BitStereo: return "s24_stereo";
+		case racFormat_e16BitMonoLeft: return "s16_mono_left";
+		case racFormat_e16BitMonoRight: return "s16_mono_right";
+		case racFormat_e16BitMono: return "s16_mono";
+		case racFormat_e24Bit5_1: return "s24_5_1";
+		default: return "unknown";
+	}
+}
+
+/* Counts output without keeping it, so that only the converter is measured.*/
+class null_sink : public audio_converter_sink
+{
+	private:
+	std::vector <char> m_span;
+
+	public:
+	unsigned long long m_bytes;
+
+	null_sink() : m_bytes(0) {}
+	virtual int write_data(const char *, unsigned int size)
+	{
+		m_bytes += size;
+		return 0;
+	}
+	virtual char * get_write_span(unsigned int size)
+	{
+		if(m_span.size() < size)
+		{
+			m_span.resize(size);
+		}
+		return &m_span[0];
+	}
+	virtual int commit(unsigned int size)
+	{
+		m_bytes += size;
+		return 0;
+	}
+};
+
+static metrics_t bench_converter(const audio_properties_t &in_props, const audio_properties_t &out_props, const std::vector <audio_buffer *> &buffers, double audio_seconds)
+{
+	null_sink sink;
+	audio_converter converter(in_props, out_props, sink);
+	unsigned long long input_bytes = 0;
+	auto start_time = std::chrono::steady_clock::now();
+	for(auto buf : buffers)
+	{
+		converter.convert(buf);
+		input_bytes += buf->m_size;
+	}
+	double seconds = seconds_since(start_time);
+	return {{"mb_per_s", input_bytes / seconds / 1e6}, {"realtime_factor", audio_seconds / seconds}, {"output_bytes", (double)sink.m_bytes}};
+}
+
+static void run_converter_benchmarks()
+{
+	if(!is_group_selected("converter/"))
+	{
+		return;
+	}
+	for(int in_format = 0; in_format < racFormat_eMax; in_format++)
+	{
+		for(int in_rate = 0; in_rate < racFreq_eMax; in_rate++)
+		{
+			audio_properties_t in_props = {(racFormat)in_format, (racFreq)in_rate, 0, 0, 0};
+			unsigned int sampling_rate = 0, bits_per_sample = 0, num_channels = 0;
+			get_individual_audio_parameters(in_props, sampling_rate, bits_per_sample, num_channels);
+			if((0 == sampling_rate) || (0 == bits_per_sample) || (0 == num_channels))
+			{
+				continue;
+			}
+
+			/* Noise cut into driver-sized buffers. These don't always end on a frame boundary, just like the real thing.*/
+			std::vector <unsigned char> input((size_t)CONVERTER_INPUT_SECONDS * sampling_rate * bits_per_sample / 8 * num_channels);
+			for(size_t i = 0; i < input.size(); i++)
+			{
+				input[i] = (unsigned char)rand();
+			}
+			std::vector <audio_buffer *> buffers;
+			for(size_t offset = 0; offset < input.size(); offset += AUDIO_BUFFER_SIZE)
+			{
+				unsigned int size = std::min((size_t)AUDIO_BUFFER_SIZE, input.size() - offset);
+				buffers.push_back(create_new_audio_buffer(&input[offset], size, 0, 1));
+			}
+
+			for(int out_format = 0; out_format < racFormat_eMax; out_format++)
+			{
+				for(int out_rate = 0; out_rate < racFreq_eMax; out_rate++)
+				{
+					audio_properties_t out_props = {(racFormat)out_format, (racFreq)out_rate, 0, 0, 0};
+					null_sink probe_sink;
+					if(!audio_converter(in_props, out_props, probe_sink).is_supported())
+					{
+						continue;
+					}
+					unsigned int out_sampling_rate = 0, out_bits = 0, out_channels = 0;
+					get_individual_audio_parameters(out_props, out_sampling_rate, out_bits, out_channels);
+					std::string name = std::string("converter/") + get_format_name((racFormat)in_format) + "_" + std::to_string(sampling_rate) +
+						"-" + get_format_name((racFormat)out_format) + "_" + std::to_string(out_sampling_rate);
+					if(!is_selected(name))
+					{
+						continue;
+					}
+					report(name, {{"in_format", get_format_name((racFormat)in_format)}, {"in_rate", std::to_string(sampling_rate)},
+						{"out_format", get_format_name((racFormat)out_format)}, {"out_rate", std::to_string(out_sampling_rate)}},
+						run_trials([&](){return bench_converter(in_props, out_props, buffers, CONVERTER_INPUT_SECONDS);}, "mb_per_s"));
+				}
+			}
+			for(auto buf : buffers)
+			{
+				unref_audio_buffer(buf);
+			}
+		}
+	}
+}
+
+/*------------------------------------------------- pcm_codec -------------------------------------------------*/
+
+/* Noise would not compress at all, so this is a few tones with a little noise, at around -12dBFS.*/
+static void make_programme(const audio_properties_t &props, unsigned int frames, std::vector <unsigned char> &pcm)
+{
+	unsigned int sampling_rate = 0, bits_per_sample = 0, num_channels = 0;
+	get_individual_audio_parameters(props, sampling_rate, bits_per_sample, num_channels);
+	unsigned int bytes_per_sample = bits_per_sample / 8;
+	pcm.resize((size_t)frames * num_channels * bytes_per_sample);
+	unsigned char * ptr = &pcm[0];
+	for(unsigned int i = 0; i < frames; i++)
+	{
+		for(unsigned int channel = 0; channel < num_channels; channel++)
+		{
+			double t = (double)i / sampling_rate;
+			double x = 0.15 * sin(2 * M_PI * 220 * t + channel) + 0.07 * sin(2 * M_PI * 1375 * t) + 0.03 * sin(2 * M_PI * 4410 * t * (1 + channel)) +
+				0.002 * ((double)rand() / RAND_MAX - 0.5);
+			int32_t sample = (int32_t)(x * (1 << (bits_per_sample - 1)));
+			for(unsigned int byte = 0; byte < bytes_per_sample; byte++)
+			{
+				*ptr++ = (unsigned char)(sample >> (8 * byte));
+			}
+		}
+	}
+}
+
+/* Throughput is in bytes of audio, either way. Every run also checks that decoding gives back the input exactly, outside the timed part.*/
+static metrics_t bench_codec(const audio_properties_t &props, const std::vector <unsigned char> &pcm, bool decode)
+{
+	pcm_codec codec;
+	codec.configure(props);
+	unsigned int block_size = CODEC_BLOCK_FRAMES * get_frame_size(props);
+	unsigned int blocks = pcm.size() / block_size;
+	std::vector <std::vector <unsigned char> > encoded(blocks);
+	std::vector <unsigned char> decoded((size_t)blocks * block_size);
+	unsigned long long encoded_bytes = 0;
+	bool decoded_ok = true;
+
+	auto start_time = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < blocks; i++)
+	{
+		codec.encode(&pcm[i * block_size], CODEC_BLOCK_FRAMES, encoded[i]);
+		encoded_bytes += encoded[i].size();
+	}
+	double seconds = seconds_since(start_time);
+
+	start_time = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < blocks; i++)
+	{
+		decoded_ok = codec.decode(encoded[i].data(), encoded[i].size(), CODEC_BLOCK_FRAMES, &decoded[(size_t)i * block_size]) && decoded_ok;
+	}
+	if(decode)
+	{
+		seconds = seconds_since(start_time);
+	}
+	if(!decoded_ok || (0 != memcmp(&decoded[0], &pcm[0], decoded.size())))
+	{
+		std::cout<<"codec round trip mismatch for "<<get_format_name(props.format)<<std::endl;
+		g_failed = true;
+	}
+	return {{"mb_per_s", (double)blocks * block_size / seconds / 1e6}, {"compressed_ratio", (double)encoded_bytes / ((double)blocks * block_size)}};
+}
+
+static void run_codec_benchmarks()
+{
+	if(!is_group_selected("codec/"))
+	{
+		return;
+	}
+	for(int format = 0; format < racFormat_eMax; format++)
+	{
+		audio_properties_t props = {(racFormat)format, racFreq_e48000, 0, 0, 0};
+		pcm_codec probe;
+		if(!probe.configure(props))
+		{
+			continue;
+		}
+		std::vector <unsigned char> pcm;
+		make_programme(props, CONVERTER_INPUT_SECONDS * 48000, pcm);
+		params_t params = {{"format", get_format_name((racFormat)format)}};
+		if(is_selected("codec/encode"))
+		{
+			report("codec/encode", params, run_trials([&](){return bench_codec(props, pcm, false);}, "mb_per_s"));
+		}
+		if(is_selected("codec/decode"))
+		{
+			report("codec/decode", params, run_trials([&](){return bench_codec(props, pcm, true);}, "mb_per_s"));
+		}
+	}
+}
+
+/*------------------------------------------------- q_mgr -------------------------------------------------*/
+
+/* Takes each buffer and lets it go, like a client whose own work costs nothing.*/
+class counting_client : public audio_capture_client
+{
+	public:
+	counting_client(q_mgr * manager) : audio_capture_client(manager) {}
+	virtual int data_callback(audio_buffer *buf)
+	{
+		release_buffer(buf);
+		return 0;
+	}
+};
+
+static bool wait_for(std::function <bool ()> condition, unsigned int timeout_ms)
+{
+	auto start_time = std::chrono::steady_clock::now();
+	while(!condition())
+	{
+		if(seconds_since(start_time) * 1000 > timeout_ms)
+		{
+			return false;
+		}
+		std::this_thread::sleep_for(std::chrono::microseconds(200));
+	}
+	return true;
+}
+
+/* Synthetic capture as fast as q_mgr takes it, from add_data() through process_data() to every client's data_callback().
+ * The clock starts once every client is registered, as the first registration starts capture.*/
+static metrics_t bench_pipeline(unsigned int num_clients)
+{
+	synthetic_capture_config_t config;
+	config.signal = SYNTHETIC_NOISE;
+	config.frequency_hz = 0;
+	config.level = 0.5;
+	config.realtime = false;
+	config.max_frames = (unsigned long long)PIPELINE_BUFFERS * AUDIO_BUFFER_SIZE / PIPELINE_FRAME_SIZE;
+	synthetic_capture_backend * backend = new synthetic_capture_backend(config);
+	q_mgr manager(backend);
+
+	std::vector <counting_client *> clients;
+	for(unsigned int i = 0; i < num_clients; i++)
+	{
+		clients.push_back(new counting_client(&manager));
+	}
+	audio_properties_t properties;
+	clients[0]->get_audio_properties(properties);
+	properties.format = racFormat_e16BitStereo;
+	properties.sampling_frequency = racFreq_e48000;
+	properties.threshold = AUDIO_BUFFER_SIZE;
+	clients[0]->set_audio_properties(properties);
+	for(auto client : clients)
+	{
+		client->start();
+	}
+
+	auto start_time = std::chrono::steady_clock::now();
+	synthetic_capture_stats_t start_stats, stats;
+	backend->get_stats(start_stats);
+	queue_stats_t start_queue;
+	manager.get_queue_stats(start_queue);
+	std::vector <audio_capture_client::delivery_stats_t> start_delivery(num_clients);
+	for(unsigned int i = 0; i < num_clients; i++)
+	{
+		clients[i]->get_delivery_stats(start_delivery[i]);
+	}
+
+	wait_for([backend, &stats](){backend->get_stats(stats); return stats.finished;}, 60 * 1000);
+	double ingest_seconds = seconds_since(start_time);
+	/* Done once every buffer that got into the queue has been delivered or dropped by every client.*/
+	queue_stats_t queue;
+	wait_for([&]()
+		{
+			manager.get_queue_stats(queue);
+			unsigned long long accepted = (stats.callbacks - start_stats.callbacks) - (queue.dropped_buffers - start_queue.dropped_buffers);
+			for(unsigned int i = 0; i < num_clients; i++)
+			{
+				audio_capture_client::delivery_stats_t delivery;
+				clients[i]->get_delivery_stats(delivery);
+				if((delivery.delivered - start_delivery[i].delivered) + (delivery.dropped - start_delivery[i].dropped) < accepted)
+				{
+					return false;
+				}
+			}
+			return true;
+		}, DRAIN_TIMEOUT_MS);
+	double seconds = seconds_since(start_time);
+
+	unsigned long long offered = stats.callbacks - start_stats.callbacks;
+	unsigned long long delivered = 0, dropped = 0;
+	for(unsigned int i = 0; i < num_clients; i++)
+	{
+		audio_capture_client::delivery_stats_t delivery;
+		clients[i]->get_delivery_stats(delivery);
+		delivered += delivery.delivered - start_delivery[i].delivered;
+		dropped += delivery.dropped - start_delivery[i].dropped;
+	}
+	audio_capture_client::delivery_metrics_t delivery_metrics;
+	clients[0]->get_delivery_metrics(delivery_metrics);
+	for(auto client : clients)
+	{
+		client->stop();
+		delete client;
+	}
+	return {{"buffers_per_s", offered / ingest_seconds}, {"deliveries_per_s", delivered / seconds},
+		{"ns_per_buffer", ingest_seconds * 1e9 / offered}, {"queue_dropped", (double)(queue.dropped_buffers - start_queue.dropped_buffers)},
+		{"client_dropped", (double)dropped}, {"latency_p50_us", (double)delivery_metrics.latency_us.get_percentile(0.5)},
+		{"latency_p99_us", (double)delivery_metrics.latency_us.get_percentile(0.99)}};
+}
+
+static void run_pipeline_benchmarks()
+{
+	if(!is_group_selected("pipeline/"))
+	{
+		return;
+	}
+	for(unsigned int clients = 1; clients <= MAX_PIPELINE_CLIENTS; clients *= 2)
+	{
+		report("pipeline/fan_out", {{"clients", std::to_string(clients)}}, run_trials([clients](){return bench_pipeline(clients);}, "buffers_per_s"));
+	}
+}
+
+/*------------------------------------------------- ip_out -------------------------------------------------*/
+
+/* Feeds ip_out_client::data_callback() directly, with one reader draining the socket. The feeder holds off while the
+ * send queue is backed up, so this measures what the socket path sustains rather than how fast audio can be dropped.*/
+static metrics_t bench_ip_out(bool framed, unsigned int latency_budget_ms)
+{
+	/* Batched output is paced by the batch timer, so fewer buffers are enough there.*/
+	unsigned int num_buffers = (0 == latency_budget_ms ? IP_OUT_BUFFERS : IP_OUT_BUFFERS / 20);
+	synthetic_capture_config_t config;
+	config.signal = SYNTHETIC_SILENCE;
+	config.frequency_hz = 0;
+	config.level = 0;
+	config.realtime = false;
+	config.max_frames = 0;
+	q_mgr manager(new synthetic_capture_backend(config));
+	ip_out_client client(&manager);
+	client.set_framed_output(framed);
+	client.set_latency_budget(latency_budget_ms);
+
+	int fd = socket(AF_UNIX, (framed ? SOCK_SEQPACKET : SOCK_STREAM), 0);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, client.get_data_path().c_str(), sizeof(addr.sun_path) - 1);
+	if((0 > fd) || (0 != connect(fd, (const struct sockaddr *)&addr, sizeof(addr))))
+	{
+		std::cout<<"Could not connect to "<<addr.sun_path<<". errno "<<errno<<std::endl;
+		if(0 <= fd)
+		{
+			close(fd);
+		}
+		return {};
+	}
+	ip_out_stats_t totals;
+	std::vector <ip_out_connection_stats_t> connections;
+	wait_for([&](){client.get_stats(totals, connections); return (1 == totals.active_connections);}, DRAIN_TIMEOUT_MS);
+
+	std::atomic <unsigned long long> received(0);
+	std::thread reader([fd, &received]()
+		{
+			std::vector <char> buffer(256 * 1024);
+			ssize_t ret;
+			while(0 < (ret = read(fd, &buffer[0], buffer.size())))
+			{
+				received += ret;
+			}
+		});
+
+	std::vector <unsigned char> payload(AUDIO_BUFFER_SIZE, 0);
+	audio_buffer * buf = create_new_audio_buffer(&payload[0], payload.size(), 0, num_buffers + 1); //Each data_callback() drops one reference.
+	auto start_time = std::chrono::steady_clock::now();
+	for(unsigned int i = 0; i < num_buffers; i++)
+	{
+		buf->m_sequence = i;
+		buf->m_sample_index = (unsigned long long)i * AUDIO_BUFFER_SIZE / PIPELINE_FRAME_SIZE;
+		buf->m_timestamp_us = get_monotonic_time_us();
+		client.data_callback(buf);
+		while(client.get_stats(totals, connections), (!connections.empty() && (IP_OUT_BACKLOG_LIMIT < connections[0].queued_bytes)))
+		{
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+	double write_seconds = seconds_since(start_time);
+	/* Sent is final once the send queue has emptied into the socket, and received catches up with it.*/
+	wait_for([&]()
+		{
+			client.get_stats(totals, connections);
+			return (!connections.empty() && (0 == connections[0].queued_bytes) && (received.load() >= connections[0].bytes_sent));
+		}, DRAIN_TIMEOUT_MS);
+	double seconds = seconds_since(start_time);
+	client.get_stats(totals, connections);
+	shutdown(fd, SHUT_RDWR);
+	reader.join();
+	close(fd);
+	unref_audio_buffer(buf);
+
+	double bytes = (double)received.load();
+	metrics_t metrics = {{"mb_per_s", bytes / seconds / 1e6}, {"ns_per_buffer", write_seconds * 1e9 / num_buffers}};
+	if(!connections.empty())
+	{
+		metrics.push_back(std::make_pair("bytes_dropped", (double)connections[0].bytes_dropped));
+		metrics.push_back(std::make_pair("writes_per_buffer", (double)connections[0].writes / num_buffers));
+	}
+	return metrics;
+}
+
+static void run_ip_out_benchmarks()
+{
+	const unsigned int budgets[] = {0, 10}; //Unbatched, and ip_out's default batching.
+	for(unsigned int budget : budgets)
+	{
+		params_t params = {{"readers", "1"}, {"latency_budget_ms", std::to_string(budget)}};
+		if(is_selected("ip_out/stream"))
+		{
+			report("ip_out/stream", params, run_trials([budget](){return bench_ip_out(false, budget);}, "mb_per_s"));
+		}
+		if(is_selected("ip_out/framed"))
+		{
+			report("ip_out/framed", params, run_trials([budget](){return bench_ip_out(true, budget);}, "mb_per_s"));
+		}
+	}
+}
+
+static void print_usage(const char * name)
+{
+	std::cout<<"Usage: "<<name<<" [--json <file>] [--label <text>] [--filter <prefix>] [--repeat <n>] [--buffers <n>] [--threads <n>]\n"
+		<<"  --json     Also write results to file as JSON.\n"
+		<<"  --label    Stored in the JSON, such as the commit being measured.\n"
+		<<"  --filter   Only run benchmarks whose name starts with prefix: buffer/, kernel/, converter/, codec/,\n"
+		<<"             pipeline/ or ip_out/.\n"
+		<<"  --repeat   Runs of each benchmark. The median is reported. Default "<<DEFAULT_REPEAT<<".\n"
+		<<"  --buffers  Buffers per thread in buffer/ benchmarks. Default "<<DEFAULT_NUM_BUFFERS<<".\n"
+		<<"  --threads  Most threads in buffer/ benchmarks. Default: number of CPUs.\n";
+}
+
+int main(int argc, char *argv[])
+{
+	g_options.repeat = DEFAULT_REPEAT;
+	g_options.num_buffers = DEFAULT_NUM_BUFFERS;
+	g_options.max_threads = std::max(1U, std::thread::hardware_concurrency());
+	for(int i = 1; i < argc; i++)
+	{
+		std::string option = argv[i];
+		if((i + 1) >= argc)
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+		std::string value = argv[++i];
+		if("--json" == option)
+		{
+			g_options.json_path = value;
+		}
+		else if("--label" == option)
+		{
+			g_options.label = value;
+		}
+		else if("--filter" == option)
+		{
+			g_options.filter = value;
+		}
+		else if("--repeat" == option)
+		{
+			g_options.repeat = strtoul(value.c_str(), NULL, 10);
+		}
+		else if("--buffers" == option)
+		{
+			g_options.num_buffers = strtoul(value.c_str(), NULL, 10);
+		}
+		else if("--threads" == option)
+		{
+			g_options.max_threads = strtoul(value.c_str(), NULL, 10);
+		}
+		else
+		{
+			print_usage(argv[0]);
+			return 1;
+		}
+	}
+	if((0 == g_options.repeat) || (0 == g_options.num_buffers) || (0 == g_options.max_threads))
+	{
+		print_usage(argv[0]);
+		return 1;
+	}
+	srand(1); //Same input on every run.
+
+	run_buffer_benchmarks();
+	run_kernel_benchmarks();
+	run_converter_benchmarks();
+	run_codec_benchmarks();
+	run_pipeline_benchmarks();
+	run_ip_out_benchmarks();
+
+	if(!g_options.json_path.empty())
+	{
+		std::ofstream file(g_options.json_path.c_str());
+		write_json(file);
+		if(!file.good())
+		{
+			std::cout<<"Could not write "<<g_options.json_path<<std::endl;
+			return 1;
+		}
+	}
+	return (g_failed ? 1 : 0);
+}
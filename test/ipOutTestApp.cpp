@@ -18,6 +18,7 @@
 */
 #include <iostream>
 #include "audiocapturemgr_iarm.h"
+#include "acm_stream_frame.h"
 #include "libIBus.h"
 #include <pthread.h>
 #include <fstream>
@@ -26,11 +27,13 @@
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <errno.h>
+#include <string.h>
 #include <unistd.h>
 #include "safec_lib.h"
 
 using namespace audiocapturemgr;
 static const char * instance_name = NULL;
+static bool framed_output = false;
 void print_menu(void)
 {
 	std::cout<<"\n--- audio capture test application menu ---\n";
@@ -45,6 +48,10 @@ void print_menu(void)
 	std::cout<<"9. reconnect to known socket.\n";
 	std::cout<<"10. get audio props.\n";
 	std::cout<<"11. quit.\n";
+	std::cout<<"12. convert output to 16kHz mono.\n";
+	std::cout<<"13. send output unconverted.\n";
+	std::cout<<"14. toggle framed output (get output props again afterwards).\n";
+	std::cout<<"15. get metrics.\n";
 }
 
 static bool verify_result(IARM_Result_t ret, iarmbus_acm_arg_t &param)
@@ -76,7 +83,8 @@ void * read_thread(void * data)
 	addr.sun_family = AF_UNIX;
 	strncpy(addr.sun_path, socket_path.c_str(), (socket_path.size() + 1));
 
-	int read_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	bool framed = framed_output;
+	int read_fd = socket(AF_UNIX, (framed ? SOCK_SEQPACKET : SOCK_STREAM), 0);
 	if(0 > read_fd)
 	{
 		std::cout<<"Couldn't create read socket. Exiting.\n";
@@ -93,13 +101,17 @@ void * read_thread(void * data)
 
 	std::cout<<"Connection established.\n";
 	unsigned int recvd_bytes = 0;
-	char buffer[1024];
+	unsigned int frames = 0;
+	unsigned int discontinuities = 0;
+	unsigned long long lost_frames = 0;
+	unsigned long long last_sequence = 0;
+	static char buffer[64 * 1024]; //Large enough for a whole frame.
 	std::string filename = "/opt/acm_ipout_dump_";
 	filename += instance_name;
 	std::ofstream file_dump(filename.c_str(), std::ios::binary);
 	while(true)
 	{
-		int ret = read(read_fd, buffer, 1024);
+		int ret = read(read_fd, buffer, (framed ? sizeof(buffer) : 1024));
 		if(0 == ret)
 		{
 			std::cout<<"Zero bytes read. Exiting.\n";
@@ -111,15 +123,44 @@ void * read_thread(void * data)
 			perror("read error");
 			break;
 		}
+		char * payload = buffer;
+		if(framed)
+		{
+			acm_stream_frame_header_t header;
+			memcpy(&header, buffer, sizeof(header));
+			if((sizeof(header) > (unsigned int)ret) || (ACM_STREAM_FRAME_MAGIC != header.magic) || ((header.header_size + header.payload_size) != (unsigned int)ret))
+			{
+				std::cout<<"Malformed frame of "<<ret<<" bytes. Exiting.\n";
+				break;
+			}
+			if(0 != (header.flags & ACM_STREAM_FRAME_FLAG_DISCONTINUITY))
+			{
+				discontinuities++;
+				std::cout<<"Discontinuity at frame "<<header.sequence<<": "<<header.sampling_rate<<"Hz, "<<header.bits_per_sample<<" bit, "
+					<<header.channels<<" channels, captured at "<<header.timestamp_us<<"us.\n";
+			}
+			if((0 != frames) && (header.sequence > (last_sequence + 1)))
+			{
+				lost_frames += header.sequence - last_sequence - 1;
+			}
+			last_sequence = header.sequence;
+			frames++;
+			payload += header.header_size;
+			ret = header.payload_size;
+		}
 		if((1024*1024*2) > recvd_bytes) //Write up to 2 MB to a file
 		{
-			file_dump.write(buffer, ret);	
+			file_dump.write(payload, ret);
 		}
 		recvd_bytes += ret;
 	}
 	
 	close(read_fd);
 	std::cout<<"Number of bytes read: "<<recvd_bytes<<std::endl;
+	if(framed)
+	{
+		std::cout<<frames<<" frames, "<<lost_frames<<" lost, "<<discontinuities<<" discontinuities.\n";
+	}
 	file_dump.seekp(0, std::ios_base::end);
 	std::cout<<file_dump.tellp()<<" bytes written to file.\n";
 	std::cout<<"Exiting read thread.\n";
@@ -288,6 +329,47 @@ void launcher()
 				keep_running = false;
 				break;
 
+			case 12:
+			case 13:
+				param.session_id = session;
+				param.details.arg_output_props.output.stream_format.format = (12 == choice ? acmFormate16BitMono : acmFormateMax);
+				param.details.arg_output_props.output.stream_format.sampling_frequency = acmFreqe16000;
+				param.details.arg_output_props.output.stream_format.flags = ACM_STREAM_FLAG_SET_FORMAT;
+				ret = IARM_Bus_Call(IARMBUS_AUDIOCAPTUREMGR_NAME, IARMBUS_AUDIOCAPTUREMGR_SET_OUTPUT_PROPERTIES, (void *) &param, sizeof(param));
+				if(!verify_result(ret, param))
+				{
+					break;
+				}
+				std::cout<<"Output format updated.\n";
+				break;
+
+			case 14:
+				param.session_id = session;
+				param.details.arg_output_props.output.stream_format.format = acmFormateMax;
+				param.details.arg_output_props.output.stream_format.sampling_frequency = acmFreqe16000;
+				param.details.arg_output_props.output.stream_format.flags = ACM_STREAM_FLAG_SET_FRAMING | (framed_output ? 0 : ACM_STREAM_FLAG_FRAMED);
+				ret = IARM_Bus_Call(IARMBUS_AUDIOCAPTUREMGR_NAME, IARMBUS_AUDIOCAPTUREMGR_SET_OUTPUT_PROPERTIES, (void *) &param, sizeof(param));
+				if(!verify_result(ret, param))
+				{
+					break;
+				}
+				framed_output = !framed_output;
+				socket_path.clear();
+				std::cout<<"Output is now "<<(framed_output ? "framed" : "a byte stream")<<". Get output props for the new socket path.\n";
+				break;
+
+			case 15:
+				ret = IARM_Bus_Call(IARMBUS_AUDIOCAPTUREMGR_NAME, IARMBUS_AUDIOCAPTUREMGR_GET_METRICS, (void *) &param, sizeof(param));
+				if(!verify_result(ret, param))
+				{
+					break;
+				}
+				{
+					std::ifstream metrics(param.details.arg_output_props.output.file_path);
+					std::cout<<metrics.rdbuf()<<std::endl;
+				}
+				break;
+
 			default:
 				std::cout<<"Unknown input!\n";
 		}
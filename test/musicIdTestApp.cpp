@@ -61,6 +61,12 @@ static bool verify_result(IARM_Result_t ret, iarmbus_acm_arg_t &param)
 void iarmEventHandler(const char *owner, IARM_EventId_t eventId, void *data, size_t len)
 {
 	std::cout<<"Received IARM event.\n";
+	if(DATA_CAPTURE_IARM_EVENT_AUDIO_CLIP_FAILED == eventId)
+	{
+		iarmbus_clip_failed_payload_t * param = static_cast <iarmbus_clip_failed_payload_t *> (data);
+		std::cout<<"Sample request failed with result "<<param->result<<(ACM_RESULT_CLIP_SILENT == param->result ? " (silent).\n" : ".\n");
+		return;
+	}
 	iarmbus_notification_payload_t * param = static_cast <iarmbus_notification_payload_t *> (data);
 	std::string filename = param->dataLocator;
 	std::cout<<"Sample "<<filename<<" is ready.\n";
@@ -264,10 +270,12 @@ int main(int argc, char *argv[])
 	}
 	
 	IARM_Bus_RegisterEventHandler(IARMBUS_AUDIOCAPTUREMGR_NAME, DATA_CAPTURE_IARM_EVENT_AUDIO_CLIP_READY, iarmEventHandler);
+	IARM_Bus_RegisterEventHandler(IARMBUS_AUDIOCAPTUREMGR_NAME, DATA_CAPTURE_IARM_EVENT_AUDIO_CLIP_FAILED, iarmEventHandler);
 
 	launcher();
 
 	IARM_Bus_RemoveEventHandler(IARMBUS_AUDIOCAPTUREMGR_NAME, DATA_CAPTURE_IARM_EVENT_AUDIO_CLIP_READY, iarmEventHandler);
+	IARM_Bus_RemoveEventHandler(IARMBUS_AUDIOCAPTUREMGR_NAME, DATA_CAPTURE_IARM_EVENT_AUDIO_CLIP_FAILED, iarmEventHandler);
 	IARM_Bus_Disconnect();
 	IARM_Bus_Term();
     return 0;
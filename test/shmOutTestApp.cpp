@@ -0,0 +1,276 @@
+/*
+ * If not stated otherwise in this file or this component's Licenses.txt file the
+ * following copyright and licenses apply:
+ *
+ * Copyright 2016 RDK Management
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+*/
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/mman.h>
+#include <time.h>
+#include "audiocapturemgr_iarm.h"
+#include "acm_shm_ring.h"
+#include "libIBus.h"
+#include "safec_lib.h"
+
+using namespace audiocapturemgr;
+static const unsigned int DEFAULT_READ_DURATION_S = 10;
+static const unsigned int MAX_DUMP_SIZE = 1024 * 1024 * 2; //Write up to 2 MB to a file
+
+static bool verify_result(IARM_Result_t ret, iarmbus_acm_arg_t &param)
+{
+	if(IARM_RESULT_SUCCESS != ret)
+	{
+		std::cout<<"Bus call failed.\n";
+		return false;
+	}
+	if(0 != param.result)
+	{
+		std::cout<<"ACM implementation of bus call failed.\n";
+		return false;
+	}
+	return true;
+}
+
+/* Connects to the session socket and receives the ring and an eventfd. Returns the socket, which has to stay open for
+ * as long as the ring is in use.*/
+static int connect_to_ring(const std::string &socket_path, acm_shm_handshake_t &handshake, int &memfd, int &event_fd)
+{
+	struct sockaddr_un addr;
+	addr.sun_family = AF_UNIX;
+	strncpy(addr.sun_path, socket_path.c_str(), sizeof(addr.sun_path) - 1);
+	addr.sun_path[sizeof(addr.sun_path) - 1] = '\0';
+
+	int sock_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(0 > sock_fd)
+	{
+		std::cout<<"Couldn't create socket.\n";
+		return -1;
+	}
+	if(0 != connect(sock_fd, (const struct sockaddr *) &addr, sizeof(addr)))
+	{
+		perror("connect");
+		close(sock_fd);
+		return -1;
+	}
+
+	int fds[2];
+	char control[CMSG_SPACE(sizeof(fds))];
+	struct iovec iov;
+	iov.iov_base = &handshake;
+	iov.iov_len = sizeof(handshake);
+	struct msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	ssize_t ret = recvmsg(sock_fd, &message, MSG_CMSG_CLOEXEC);
+	struct cmsghdr * cmsg = CMSG_FIRSTHDR(&message);
+	if((sizeof(handshake) != ret) || (NULL == cmsg) || (SCM_RIGHTS != cmsg->cmsg_type) || (CMSG_LEN(sizeof(fds)) != cmsg->cmsg_len))
+	{
+		std::cout<<"Bad handshake.\n";
+		close(sock_fd);
+		return -1;
+	}
+	memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+	memfd = fds[0];
+	event_fd = fds[1];
+	if((ACM_SHM_RING_MAGIC != handshake.magic) || (ACM_SHM_RING_VERSION != handshake.version))
+	{
+		std::cout<<"Unsupported ring version "<<handshake.version<<std::endl;
+		close(memfd);
+		close(event_fd);
+		close(sock_fd);
+		return -1;
+	}
+	return sock_fd;
+}
+
+static void read_ring(const std::string &socket_path, unsigned int duration_s, const char * instance_name)
+{
+	acm_shm_handshake_t handshake;
+	int memfd = -1;
+	int event_fd = -1;
+	int sock_fd = connect_to_ring(socket_path, handshake, memfd, event_fd);
+	if(0 > sock_fd)
+	{
+		return;
+	}
+
+	void * mapping = mmap(NULL, handshake.map_size, PROT_READ, MAP_SHARED, memfd, 0);
+	close(memfd);
+	if(MAP_FAILED == mapping)
+	{
+		perror("mmap");
+		close(event_fd);
+		close(sock_fd);
+		return;
+	}
+	const acm_shm_ring_header_t * header = (const acm_shm_ring_header_t *) mapping;
+
+	uint32_t sampling_rate;
+	uint16_t channels, bits_per_sample;
+	uint64_t format_position;
+	acm_shm_ring_get_format(header, &sampling_rate, &channels, &bits_per_sample, &format_position);
+	std::cout<<"Ring of "<<header->capacity<<" bytes. "<<sampling_rate<<"Hz, "<<bits_per_sample<<" bit, "<<channels<<" channels.\n";
+
+	std::string filename = "/opt/acm_shmout_dump_";
+	filename += instance_name;
+	std::ofstream file_dump(filename.c_str(), std::ios::binary);
+
+	uint64_t position = acm_shm_ring_get_write_position(header);
+	unsigned long long received = 0;
+	unsigned int overruns = 0;
+	unsigned int wakeups = 0;
+	uint64_t max_latency_us = 0;
+	char buffer[16 * 1024];
+	time_t end_time = time(NULL) + duration_s;
+	while(time(NULL) < end_time)
+	{
+		struct pollfd poll_fd = {event_fd, POLLIN, 0};
+		if(0 >= poll(&poll_fd, 1, 1000))
+		{
+			continue;
+		}
+		uint64_t count;
+		if(sizeof(count) != read(event_fd, &count, sizeof(count)))
+		{
+			continue;
+		}
+		wakeups++;
+
+		/* How long ago the audio this wakeup is for was captured.*/
+		uint64_t timestamp_us, sample_index;
+		acm_shm_ring_get_timing(header, position, &timestamp_us, &sample_index);
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		uint64_t now_us = (uint64_t)now.tv_sec * 1000000 + now.tv_nsec / 1000;
+		if((0 != timestamp_us) && (now_us > timestamp_us) && ((now_us - timestamp_us) > max_latency_us))
+		{
+			max_latency_us = now_us - timestamp_us;
+		}
+
+		int64_t ret;
+		while(0 != (ret = acm_shm_ring_read(header, &position, buffer, sizeof(buffer))))
+		{
+			if(0 > ret)
+			{
+				overruns++;
+				continue;
+			}
+			if(MAX_DUMP_SIZE > received)
+			{
+				file_dump.write(buffer, ret);
+			}
+			received += ret;
+		}
+	}
+
+	std::cout<<"Read "<<received<<" bytes in "<<wakeups<<" wakeups, with "<<overruns<<" overruns. Ring has published "
+		<<header->chunks_written<<" chunks. Audio was up to "<<max_latency_us<<"us old when the reader woke up for it.\n";
+	munmap(mapping, handshake.map_size);
+	close(event_fd);
+	close(sock_fd);
+}
+
+#define ACM_TESTAPP_NAME_PRFIX "acm_testapp_"
+int main(int argc, char *argv[])
+{
+	if(2 > argc)
+	{
+		std::cout<<"Each exec session needs a name. Invoke it as $<exec name> <session-name> [seconds] [source]"<<std::endl;
+		std::cout<<"For instance, $acm_shmout_testapp alpha 10 1 reads auxiliary audio for 10 seconds.\n";
+		return -1;
+	}
+	unsigned int duration_s = (2 < argc ? strtoul(argv[2], NULL, 10) : DEFAULT_READ_DURATION_S);
+	int source = (3 < argc ? atoi(argv[3]) : 0); //primary by default
+
+	errno_t rc = -1;
+	char bus_registration_name[100];
+	rc = sprintf_s(bus_registration_name, sizeof(bus_registration_name), "%s%s", ACM_TESTAPP_NAME_PRFIX, argv[1]);
+	if( rc < EOK )
+	{
+		ERR_CHK(rc);
+		return -1;
+	}
+	if(0 != IARM_Bus_Init(bus_registration_name))
+	{
+		std::cout<<"Unable to init IARMBus. Try another session name.\n";
+		return -1;
+	}
+	if(0 != IARM_Bus_Connect())
+	{
+		std::cout<<"Unable to connect to IARBus\n";
+		return -1;
+	}
+
+	iarmbus_acm_arg_t param;
+	IARM_Result_t ret;
+	session_id_t session = -1;
+	do
+	{
+		param.details.arg_open.source = source;
+		param.details.arg_open.output_type = REALTIME_SHARED_MEMORY;
+		ret = IARM_Bus_Call(IARMBUS_AUDIOCAPTUREMGR_NAME, IARMBUS_AUDIOCAPTUREMGR_OPEN, (void *) &param, sizeof(param));
+		if(!verify_result(ret, param))
+		{
+			break;
+		}
+		session = param.session_id;
+		std::cout<<"Opened new session "<<session<<std::endl;
+
+		param.session_id = session;
+		ret = IARM_Bus_Call(IARMBUS_AUDIOCAPTUREMGR_NAME, IARMBUS_AUDIOCAPTUREMGR_GET_OUTPUT_PROPS, (void *) &param, sizeof(param));
+		if(!verify_result(ret, param))
+		{
+			break;
+		}
+		std::string socket_path(param.details.arg_output_props.output.file_path);
+		std::cout<<"Output path is "<<socket_path<<std::endl;
+
+		param.session_id = session;
+		ret = IARM_Bus_Call(IARMBUS_AUDIOCAPTUREMGR_NAME, IARMBUS_AUDIOCAPTUREMGR_START, (void *) &param, sizeof(param));
+		if(!verify_result(ret, param))
+		{
+			break;
+		}
+		read_ring(socket_path, duration_s, argv[1]);
+
+		param.session_id = session;
+		ret = IARM_Bus_Call(IARMBUS_AUDIOCAPTUREMGR_NAME, IARMBUS_AUDIOCAPTUREMGR_STOP, (void *) &param, sizeof(param));
+		verify_result(ret, param);
+	} while(false);
+
+	if(-1 != session)
+	{
+		param.session_id = session;
+		ret = IARM_Bus_Call(IARMBUS_AUDIOCAPTUREMGR_NAME, IARMBUS_AUDIOCAPTUREMGR_CLOSE, (void *) &param, sizeof(param));
+		verify_result(ret, param);
+	}
+	IARM_Bus_Disconnect();
+	IARM_Bus_Term();
+	return 0;
+}